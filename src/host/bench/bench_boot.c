@@ -0,0 +1,281 @@
+// Benchmark: power on to the first route confirmed
+//-----------------------------------
+// Boots the firmware in a forked process against a stand-in Videohub on localhost, and times
+// from power on (the fork) to the router taking the connection and to the panel LED lighting
+// from the router's status dump - the first route confirmed.
+// The shim is given stand-in delays for the parts of a box's boot that a host doesn't have:
+// the PHY negotiating a link, DHCP, and mounting the SD card. They are shorter than a box's to
+// keep the run short - what matters is whether they are waited for one after another or all
+// at once. Boots with the settings read off the card and from the cache are both timed, first
+// with the network waited for before anything else (the serial boot the PHY starting first
+// replaced - see host_set_boot_serial) and then as the firmware boots. In the firmware's boot
+// the first route should follow the address by no more than the connection and dump, as long
+// as the card and the wait to see if a button is held for test mode are over by then.
+
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "host_shim.h"
+#include "pindefs.h"
+
+#define BOOTS 4
+#define LINK_US 500000
+#define DHCP_US 250000
+#define SDCARD_MOUNT_US 200000
+#define TEST_MODE_WAIT_US 100000 // app_main's wait to see if a button is held
+#define BOOT_TIMEOUT_US 5000000
+#define SLACK_US 30000           // Connecting, the dump, and scheduling
+
+#define LED_CONFIRMED 2 // Button lit by the stand-in router's route
+
+// What the box's panel LEDs showed, and when - written down a pipe by the box
+struct Led_Event {
+    int64_t time_us;
+    int code;
+};
+
+static int listener;
+static int router_port;
+static char sdcard_dir[64];
+static char nvs_dir[64];
+
+// In the box's process - reports every change to its panel LEDs
+static int box_report_fd;
+static int box_led_code = 0;
+
+static void box_led_hook(int pin, int level)
+{
+    if (pin != PIN_LED_A && pin != PIN_LED_B && pin != PIN_LED_C)
+    {
+        return;
+    }
+    int code = host_gpio_get_output(PIN_LED_A) | (host_gpio_get_output(PIN_LED_B) << 1) | (host_gpio_get_output(PIN_LED_C) << 2);
+    if (code != box_led_code)
+    {
+        box_led_code = code;
+        struct Led_Event event = {.time_us = host_time_us(), .code = code};
+        if (write(box_report_fd, &event, sizeof(event)) != sizeof(event))
+        {
+            _exit(1);
+        }
+    }
+}
+
+static int write_config(void)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", sdcard_dir);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror("fopen");
+        return 0;
+    }
+    fprintf(f, "routing_sources = 1,2,3,4,5,6\nrouting_destination = 1\nroute_sharing = off\n"
+               "router_ip = 127.0.0.1\nrouter_port = %d\n", router_port);
+    fclose(f);
+    return 1;
+}
+
+// Stored routes would light the LED before the router confirms anything - see bench_route_store
+static void clear_stored_routes(void)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "%s/routes.last", nvs_dir);
+    unlink(path);
+}
+
+static void clear_nvs(void)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "%s/settings.cache", nvs_dir);
+    unlink(path);
+    clear_stored_routes();
+}
+
+// Boots a box, and returns the times from power on to the router taking its connection and to
+// its LED showing the route - 0 if the box didn't get there
+static int boot_box(int serial, int64_t *connect_us, int64_t *confirm_us)
+{
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0)
+    {
+        perror("pipe");
+        return 0;
+    }
+    fflush(stdout);
+    int64_t power_on = host_time_us();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(pipe_fds[0]);
+        close(listener);
+        box_report_fd = pipe_fds[1];
+        esp_log_level_set("*", ESP_LOG_NONE);
+        host_gpio_set_output_hook(box_led_hook);
+        host_set_sdcard_dir(sdcard_dir);
+        host_set_nvs_dir(nvs_dir);
+        host_set_boot_delays(LINK_US, DHCP_US, SDCARD_MOUNT_US);
+        host_set_boot_serial(serial);
+        host_start_app();
+        while (1)
+        {
+            pause();
+        }
+    }
+    close(pipe_fds[1]);
+
+    int sock = -1;
+    *connect_us = 0;
+    *confirm_us = 0;
+    int64_t end = power_on + BOOT_TIMEOUT_US;
+    while (*confirm_us == 0 && host_time_us() < end)
+    {
+        struct pollfd pfds[2] = {{.fd = listener, .events = POLLIN}, {.fd = pipe_fds[0], .events = POLLIN}};
+        if (poll(pfds, 2, (int)((end - host_time_us()) / 1000) + 1) <= 0)
+        {
+            continue;
+        }
+        if ((pfds[0].revents & POLLIN) && sock < 0)
+        {
+            sock = accept(listener, NULL, NULL);
+            *connect_us = host_time_us() - power_on;
+            const char *dump = "PROTOCOL PREAMBLE:\nVersion: 2.8\n\nVIDEO OUTPUT ROUTING:\n0 1\n\nEND PRELUDE:\n\n";
+            send(sock, dump, strlen(dump), MSG_NOSIGNAL);
+        }
+        struct Led_Event event;
+        if ((pfds[1].revents & POLLIN) && read(pipe_fds[0], &event, sizeof(event)) == sizeof(event) && event.code == LED_CONFIRMED)
+        {
+            *confirm_us = event.time_us - power_on;
+        }
+    }
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    close(pipe_fds[0]);
+    if (sock >= 0)
+    {
+        close(sock);
+    }
+    return *confirm_us != 0;
+}
+
+static int compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+int main(void)
+{
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = 0};
+    socklen_t address_length = sizeof(address);
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 1) != 0
+        || getsockname(listener, (struct sockaddr *)&address, &address_length) != 0)
+    {
+        perror("listen");
+        return 1;
+    }
+    router_port = ntohs(address.sin_port);
+
+    snprintf(sdcard_dir, sizeof(sdcard_dir), "/tmp/bench_boot_sd_XXXXXX");
+    snprintf(nvs_dir, sizeof(nvs_dir), "/tmp/bench_boot_nvs_XXXXXX");
+    if (mkdtemp(sdcard_dir) == NULL || mkdtemp(nvs_dir) == NULL || !write_config())
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    printf("Power on to first route confirmed, median of %d boots\n", BOOTS);
+    printf("Stand-ins: link %d ms, DHCP %d ms, SD card mount %d ms\n", LINK_US / 1000, DHCP_US / 1000, SDCARD_MOUNT_US / 1000);
+    printf("%-10s %-10s %12s %12s %12s\n", "boot", "settings", "connect ms", "confirm ms", "bound ms");
+
+    int failures = 0;
+    int64_t serial_confirm_us[2] = {0, 0};
+    int64_t parallel_confirm_us[2] = {0, 0};
+    for (int serial = 1; serial >= 0; serial--)
+    {
+        for (int cached = 0; cached < 2; cached++)
+        {
+            int64_t connects[BOOTS];
+            int64_t confirms[BOOTS];
+            int booted = 0;
+            for (int boot = 0; boot < BOOTS; boot++)
+            {
+                if (!cached)
+                {
+                    clear_nvs();
+                }
+                clear_stored_routes();
+                if (boot_box(serial, &connects[booted], &confirms[booted]))
+                {
+                    booted++;
+                }
+            }
+
+            // Serially, the network then the card and test mode wait; otherwise everything
+            // overlapped - the network, or the card and test mode wait, whichever is longer
+            int64_t network_us = LINK_US + DHCP_US;
+            int64_t local_us = (cached ? 0 : SDCARD_MOUNT_US) + TEST_MODE_WAIT_US;
+            int64_t bound_us = (serial ? network_us + local_us : ((network_us > local_us) ? network_us : local_us)) + SLACK_US;
+
+            const char *boot_name = serial ? "serial" : "firmware";
+            const char *name = cached ? "cache" : "sd card";
+            if (booted == 0)
+            {
+                printf("%-10s %-10s no boot reached a confirm\n", boot_name, name);
+                failures++;
+                continue;
+            }
+            qsort(connects, booted, sizeof(connects[0]), compare_int64);
+            qsort(confirms, booted, sizeof(confirms[0]), compare_int64);
+            printf("%-10s %-10s %12.1f %12.1f %12.1f\n", boot_name, name, connects[booted / 2] / 1000.0, confirms[booted / 2] / 1000.0, bound_us / 1000.0);
+            if (booted != BOOTS || confirms[booted / 2] > bound_us)
+            {
+                printf("  %d of %d boots reached a confirm, median over the bound\n", booted, BOOTS);
+                failures++;
+            }
+            if (serial)
+            {
+                serial_confirm_us[cached] = confirms[booted / 2];
+            }
+            else
+            {
+                parallel_confirm_us[cached] = confirms[booted / 2];
+            }
+        }
+    }
+
+    for (int cached = 0; cached < 2; cached++)
+    {
+        printf("Gain over the serial boot, %s: %.1f ms\n", cached ? "cache" : "sd card", (serial_confirm_us[cached] - parallel_confirm_us[cached]) / 1000.0);
+    }
+
+    clear_nvs();
+    rmdir(nvs_dir);
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", sdcard_dir);
+    unlink(path);
+    rmdir(sdcard_dir);
+
+    if (failures != 0)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
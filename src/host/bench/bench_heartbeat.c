@@ -0,0 +1,255 @@
+// Benchmark: the PING heartbeat - round trip figures, and finding a router that has stopped answering
+//-----------------------------------
+// Boots the whole firmware against a stand-in Videohub on localhost and leaves the panel idle, so
+// pings are all that goes to the router:
+//   answering - router ACKs straight away, then after an added delay as on a congested VLAN;
+//               checks the firmware's rolling round trip follows the delay and nothing is missed
+//   hung      - router keeps the connection open but stops answering, as a Videohub whose
+//               protocol engine has locked up does; times it to the firmware reconnecting
+
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "host_shim.h"
+#include "ethernet.h"
+
+#define ANSWERING_MS 6000
+#define CONGESTED_DELAY_MS 40
+#define HUNG_TRIALS 4
+#define ACCEPT_TIMEOUT_MS 10000
+#define DETECT_SLACK_MS 300
+#define HANDSHAKE_MS 200
+#define PING_MISSED_MAX 3 // Set in the config file, rather than the default
+
+static int listener = -1;
+static int router_port = 0;
+
+static int router_listen(void)
+{
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = 0};
+    socklen_t address_length = sizeof(address);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 1) != 0
+        || getsockname(listener, (struct sockaddr *)&address, &address_length) != 0)
+    {
+        perror("listen");
+        return 0;
+    }
+    router_port = ntohs(address.sin_port);
+    return 1;
+}
+
+// Waits for the firmware to connect and sends the status dump - returns the socket, or -1
+static int router_accept(void)
+{
+    struct pollfd pfd = {.fd = listener, .events = POLLIN};
+    if (poll(&pfd, 1, ACCEPT_TIMEOUT_MS) <= 0)
+    {
+        return -1;
+    }
+    int sock = accept(listener, NULL, NULL);
+    const char *dump = "PROTOCOL PREAMBLE:\nVersion: 2.8\n\nVIDEO OUTPUT ROUTING:\n0 3\n\nEND PRELUDE:\n\n";
+    send(sock, dump, strlen(dump), MSG_NOSIGNAL);
+    return sock;
+}
+
+// Runs the router for duration_ms, answering every block with ACK after delay_ms (or never if
+// delay_ms is negative) - returns 0 if the firmware closed the connection
+static int router_run(int sock, int delay_ms, int duration_ms)
+{
+    static char pending[4096];
+    size_t used = 0;
+    int64_t end = host_time_us() + duration_ms * 1000LL;
+    int64_t now;
+    while ((now = host_time_us()) < end)
+    {
+        struct pollfd pfd = {.fd = sock, .events = POLLIN};
+        if (poll(&pfd, 1, (int)((end - now) / 1000) + 1) <= 0)
+        {
+            continue;
+        }
+        ssize_t length = recv(sock, pending + used, sizeof(pending) - used - 1, 0);
+        if (length <= 0)
+        {
+            return 0;
+        }
+        used += length;
+        pending[used] = '\0';
+
+        char *block;
+        while ((block = strstr(pending, "\n\n")) != NULL)
+        {
+            if (delay_ms >= 0)
+            {
+                usleep(delay_ms * 1000);
+                send(sock, "ACK\n\n", 5, MSG_NOSIGNAL);
+            }
+            used -= (block + 2) - pending;
+            memmove(pending, block + 2, used + 1);
+        }
+    }
+    return 1;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int write_config(char *dir, size_t dir_size)
+{
+    snprintf(dir, dir_size, "/tmp/bench_heartbeat_XXXXXX");
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return 0;
+    }
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", dir);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror("fopen");
+        return 0;
+    }
+    fprintf(f, "routing_sources = 1,2,3,4,5,6\nrouting_destination = 1\nrouter_ip = 127.0.0.1\nrouter_port = %d\nping_missed_max = %d\n",
+            router_port, PING_MISSED_MAX);
+    fclose(f);
+    return 1;
+}
+
+int main(void)
+{
+    char dir[64];
+    if (!router_listen() || !write_config(dir, sizeof(dir)))
+    {
+        return 1;
+    }
+
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    host_set_sdcard_dir(dir);
+    host_start_app();
+
+    int sock = router_accept();
+    if (sock < 0)
+    {
+        printf("FAILED: firmware never connected\n");
+        return 1;
+    }
+
+    int failures = 0;
+    printf("Heartbeat: ping every %d ms, reconnect after %d missed\n", ETH_PING_INTERVAL_MS, PING_MISSED_MAX);
+    printf("%-10s %9s %6s %6s %11s %11s\n", "router", "delay ms", "pings", "missed", "rolling ms", "jitter ms");
+
+    // Answering, then congested
+    const int delays_ms[] = {0, CONGESTED_DELAY_MS};
+    for (size_t d = 0; d < sizeof(delays_ms) / sizeof(delays_ms[0]); d++)
+    {
+        struct Command_Stats_Struct before;
+        struct Command_Stats_Struct after;
+        get_command_stats(0, &before);
+        if (!router_run(sock, delays_ms[d], ANSWERING_MS))
+        {
+            printf("FAILED: firmware dropped a router that was answering\n");
+            return 1;
+        }
+        get_command_stats(0, &after);
+
+        uint32_t pings = after.pings_sent - before.pings_sent;
+        uint32_t missed = after.pings_missed - before.pings_missed;
+        double rolling_ms = after.rtt_rolling_us / 1000.0;
+        printf("%-10s %9d %6"PRIu32" %6"PRIu32" %11.2f %11.2f\n", (d == 0) ? "answering" : "congested", delays_ms[d],
+               pings, missed, rolling_ms, after.rtt_jitter_us / 1000.0);
+
+        // Idle for the whole run, so a ping goes out every interval (give or take a tick)
+        if (pings < (ANSWERING_MS / ETH_PING_INTERVAL_MS) - 1 || missed != 0 || after.ping_resets != 0)
+        {
+            printf("Expected a ping every %d ms and none missed\n", ETH_PING_INTERVAL_MS);
+            failures++;
+        }
+        if (rolling_ms < delays_ms[d] * 0.5 || rolling_ms > delays_ms[d] + 20.0)
+        {
+            printf("Rolling round trip doesn't follow the router's %d ms\n", delays_ms[d]);
+            failures++;
+        }
+    }
+
+    // Hung - each trial answers the status dump request on connecting, so only pings are left to
+    // find the hang, then stops answering
+    double times[HUNG_TRIALS];
+    int count = 0;
+    for (int trial = 0; trial < HUNG_TRIALS; trial++)
+    {
+        router_run(sock, 0, HANDSHAKE_MS);
+        int64_t hung = host_time_us();
+        struct pollfd pfds[2] = {{.fd = listener, .events = POLLIN}, {.fd = sock, .events = POLLIN}};
+        int64_t reconnected = -1;
+        while (reconnected < 0 && poll(pfds, 2, ACCEPT_TIMEOUT_MS) > 0)
+        {
+            if (pfds[0].revents & POLLIN)
+            {
+                reconnected = host_time_us();
+            }
+            else if (!router_run(sock, -1, 10))
+            {
+                pfds[1].fd = -1; // Closed by the firmware - the new connection follows
+            }
+        }
+        close(sock);
+        sock = (reconnected >= 0) ? router_accept() : -1;
+        if (sock < 0)
+        {
+            printf("Firmware didn't reconnect to a hung router\n");
+            failures++;
+            break;
+        }
+        times[count++] = (reconnected - hung) / 1000.0;
+    }
+
+    struct Command_Stats_Struct stats;
+    get_command_stats(0, &stats);
+    if (count > 0)
+    {
+        qsort(times, count, sizeof(double), compare_doubles);
+        printf("hung: router stopped answering to firmware reconnecting, %d trials: min %.1f ms, med %.1f ms, max %.1f ms (%"PRIu32" reconnects for missed pings)\n",
+               count, times[0], times[count / 2], times[count - 1], stats.ping_resets);
+
+        // The first ping is due an interval after the status dump request, and the reset once
+        // PING_MISSED_MAX more intervals have passed - less the handshake before the hang
+        double limit_ms = ETH_PING_INTERVAL_MS * (PING_MISSED_MAX + 1) + DETECT_SLACK_MS;
+        if (times[count - 1] > limit_ms || stats.ping_resets != (uint32_t)count)
+        {
+            printf("Expected each hang found by the heartbeat within %.0f ms\n", limit_ms);
+            failures++;
+        }
+    }
+
+    if (sock >= 0)
+    {
+        close(sock);
+    }
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", dir);
+    unlink(path);
+    rmdir(dir);
+
+    if (failures != 0)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,171 @@
+// Benchmark: cost of the panel IO calls the main logic makes
+//-----------------------------------
+// Times get_button_panel_state and set_button_led_state (with the LED changing every call, so
+// each one drives the pins), first on their own and then with other tasks using the same state:
+// one switching the IR contactor as fast as it can, and one pressing and releasing a panel
+// button so the debounce keeps reading the buttons. Per call figures are p50, p99, p99.9 and
+// the number of calls over 50 us - the host's scheduler preempts now and then, locks or not.
+// Afterwards the pins must show the last LED and contactor states written - an update dropped
+// under contention would leave them wrong. The input event queue is full from the start and
+// nothing takes from it, as in the LED test mode - the debounce must never wait on it, and the
+// last press must still be staged for the main logic.
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "host_shim.h"
+#include "main.h"
+#include "local_io.h"
+#include "pindefs.h"
+#include "storage.h"
+
+#define CALLS 200000
+#define PRESS_PERIOD_MS 25 // Long enough for each press and release to get through the debounce
+#define STALL_NS 50000     // Calls longer than this waited on something
+#define QUEUE_LENGTH 4
+
+static atomic_bool contenders_running = true;
+static atomic_int contenders_stopped = 0;
+static uint8_t last_contactor_state;
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void contactor_task(void *arg)
+{
+    uint8_t state = 0;
+    while (atomic_load(&contenders_running))
+    {
+        state = !state;
+        set_ir_contactor_state(state);
+    }
+    last_contactor_state = state;
+    atomic_fetch_add(&contenders_stopped, 1);
+    vTaskDelete(NULL);
+}
+
+static void button_task(void *arg)
+{
+    uint8_t pressed = 0;
+    while (atomic_load(&contenders_running))
+    {
+        pressed = !pressed;
+        host_gpio_set_input(PIN_BUTTON_3, !pressed); // Buttons pull low when pressed
+        vTaskDelay(pdMS_TO_TICKS(PRESS_PERIOD_MS));
+    }
+    host_gpio_set_input(PIN_BUTTON_3, 1);
+    atomic_fetch_add(&contenders_stopped, 1);
+    vTaskDelete(NULL);
+}
+
+static void print_figures(const char *what, const char *call, int64_t *times)
+{
+    qsort(times, CALLS, sizeof(times[0]), compare_int64);
+    int stalls = 0;
+    while (stalls < CALLS && times[CALLS - 1 - stalls] > STALL_NS)
+    {
+        stalls++;
+    }
+    printf("%-10s %-22s %7lld %7lld %9lld %7d\n", what, call, (long long)times[CALLS / 2], (long long)times[CALLS * 99 / 100],
+           (long long)times[CALLS * 999 / 1000], stalls);
+}
+
+// Times CALLS of each call, and prints the figures
+static void time_calls(const char *what)
+{
+    static int64_t read_ns[CALLS];
+    static int64_t write_ns[CALLS];
+    volatile uint8_t sink = 0;
+
+    for (int call = 0; call < CALLS; call++)
+    {
+        int64_t start = now_ns();
+        sink += get_button_panel_state(0);
+        int64_t middle = now_ns();
+        set_button_led_state(0, 1 + (call % 6));
+        int64_t end = now_ns();
+        read_ns[call] = middle - start;
+        write_ns[call] = end - middle;
+    }
+
+    print_figures(what, "get_button_panel_state", read_ns);
+    print_figures(what, "set_button_led_state", write_ns);
+}
+
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+    host_adopt_current_thread("bench");
+    QueueHandle_t input_event_queue = xQueueCreate(QUEUE_LENGTH, sizeof(struct Queued_Input_Message_Struct));
+    struct Queued_Input_Message_Struct filler = {0};
+    filler.type = IN_MSG_TYP_SETTINGS;
+    while (xQueueSend(input_event_queue, &filler, 0) == pdTRUE)
+    {
+    }
+    setup_local_io(&input_event_queue, ROUTE_TRIGGER_PRESS);
+
+    printf("Panel IO calls from the main logic, %d calls each\n", CALLS);
+    printf("%-10s %-22s %7s %7s %9s %7s\n", "", "", "p50 ns", "p99 ns", "p99.9 ns", ">50 us");
+    time_calls("alone");
+
+    xTaskCreate(contactor_task, "contactor_task", 2048, NULL, 5, NULL);
+    xTaskCreate(button_task, "button_task", 2048, NULL, 5, NULL);
+    time_calls("contended");
+    atomic_store(&contenders_running, false);
+    while (atomic_load(&contenders_stopped) < 2)
+    {
+        vTaskDelay(1);
+    }
+
+    // Whatever was written last must be on the pins
+    set_button_led_state(0, 5);
+    int led_code = host_gpio_get_output(PIN_LED_A) | (host_gpio_get_output(PIN_LED_B) << 1) | (host_gpio_get_output(PIN_LED_C) << 2);
+    int contactor = host_gpio_get_output(PIN_IR_CONTACTOR) == (last_contactor_state ? IR_CONTACTOR_ON_LEVEL : !IR_CONTACTOR_ON_LEVEL);
+    if (led_code != 5 || !contactor)
+    {
+        printf("Pins out of step after contention: LEDs show %d (expected 5), contactor %s\n", led_code, contactor ? "right" : "wrong");
+        printf("FAILED\n");
+        return 1;
+    }
+
+    // With the queue still full, a press must be debounced and staged
+    host_gpio_set_input(PIN_BUTTON_5, 0);
+    vTaskDelay(pdMS_TO_TICKS(PRESS_PERIOD_MS));
+    host_gpio_set_input(PIN_BUTTON_5, 1);
+    vTaskDelay(pdMS_TO_TICKS(PRESS_PERIOD_MS));
+    struct Queued_Input_Message_Struct press = {0};
+    uint8_t last_button = 0;
+    while (take_button_press(&press))
+    {
+        if (press.type == IN_MSG_TYP_ROUTING && press.panel == 0)
+        {
+            last_button = press.panel_button + 1;
+        }
+    }
+    printf("Queue full (%u of %d waiting), last press staged: button %u\n", (unsigned int)uxQueueMessagesWaiting(input_event_queue),
+           QUEUE_LENGTH, last_button);
+    if (last_button != 5)
+    {
+        printf("Press lost with the input event queue full\n");
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
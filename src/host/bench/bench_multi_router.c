@@ -0,0 +1,348 @@
+// Benchmark: cuts on one router while the other is healthy, stalled or down
+//-----------------------------------
+// Boots the whole firmware against two stand-in Videohubs on localhost - router 1 carries the
+// Show Relay, router 2 the routing panel - and times panel presses from the button going down
+// to the route arriving at router 2, with the Main/IR button pressed alongside so router 1 has
+// work queued too. Router 1 is:
+//   healthy  - answers everything straight away
+//   stalled  - takes the connection but never answers, so its commands time out and it resets
+//   down     - not listening, so the firmware keeps retrying the connection
+// Each router has its own connection task, so router 2's figures should not move.
+
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "host_shim.h"
+#include "pindefs.h"
+#include "ethernet.h"
+#include "videohub_protocol.h"
+
+#define TRIALS 40 // Enough presses for the stalled router to time out and reconnect
+#define ROUTE_TIMEOUT_US 2000000
+
+#define MODE_HEALTHY 0
+#define MODE_STALLED 1
+#define MODE_DOWN 2
+
+static const char *const mode_names[] = {"healthy", "stalled", "down"};
+static const int button_pins[] = {PIN_BUTTON_1, PIN_BUTTON_2};
+
+// Stand-in router - answers routes and status requests the way a Videohub does unless stalled
+struct Router_Stub {
+    int listener;
+    int port;
+    int sock;
+    int mode;
+    struct Videohub_Parser_Struct parser;
+    int block_routes;
+    int new_routes;          // Routes to output 0 received since last checked
+    uint16_t last_input;     // Input of the last of them
+    int64_t last_route_time; // When it was received
+    char reply[512];
+    size_t reply_length;
+};
+
+static struct Router_Stub stubs[2];
+
+static void stub_listen(struct Router_Stub *stub)
+{
+    stub->listener = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(stub->listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = htons(stub->port)};
+    socklen_t address_length = sizeof(address);
+    if (bind(stub->listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(stub->listener, 1) != 0
+        || getsockname(stub->listener, (struct sockaddr *)&address, &address_length) != 0)
+    {
+        perror("listen");
+        exit(1);
+    }
+    stub->port = ntohs(address.sin_port);
+}
+
+static void stub_close(struct Router_Stub *stub)
+{
+    if (stub->sock >= 0)
+    {
+        close(stub->sock);
+        stub->sock = -1;
+    }
+}
+
+static void stub_queue_reply(struct Router_Stub *stub, const char *text)
+{
+    size_t length = strlen(text);
+    if (stub->reply_length + length < sizeof(stub->reply))
+    {
+        memcpy(stub->reply + stub->reply_length, text, length);
+        stub->reply_length += length;
+    }
+}
+
+static void router_event(const struct Videohub_Event_Struct *event, void *context)
+{
+    struct Router_Stub *stub = context;
+    char line[32];
+
+    if (event->type == VH_EVT_ROUTE && event->block == VH_BLOCK_OUTPUT_ROUTING)
+    {
+        if (stub->block_routes++ == 0)
+        {
+            stub_queue_reply(stub, "ACK\n\nVIDEO OUTPUT ROUTING:\n");
+        }
+        snprintf(line, sizeof(line), "%u %u\n", event->index, event->value);
+        stub_queue_reply(stub, line);
+        if (event->index == 0)
+        {
+            stub->new_routes++;
+            stub->last_input = event->value;
+            stub->last_route_time = host_time_us();
+        }
+    }
+    else if (event->type == VH_EVT_BLOCK_END && event->block == VH_BLOCK_OUTPUT_ROUTING)
+    {
+        // An empty block is a status request - the stub's routing table is all input 100
+        stub_queue_reply(stub, (stub->block_routes == 0) ? "ACK\n\nVIDEO OUTPUT ROUTING:\n0 99\n\n" : "\n");
+        stub->block_routes = 0;
+    }
+}
+
+// Accepts and reads whatever the firmware sends either router, for up to timeout_us
+static void routers_poll(int64_t timeout_us)
+{
+    struct pollfd pfds[4];
+    struct Router_Stub *owners[4];
+    int count = 0;
+    for (int router = 0; router < 2; router++)
+    {
+        struct Router_Stub *stub = &stubs[router];
+        if (stub->mode == MODE_DOWN)
+        {
+            continue;
+        }
+        pfds[count] = (struct pollfd){.fd = stub->listener, .events = POLLIN};
+        owners[count++] = stub;
+        if (stub->sock >= 0)
+        {
+            pfds[count] = (struct pollfd){.fd = stub->sock, .events = POLLIN};
+            owners[count++] = stub;
+        }
+    }
+
+    if (poll(pfds, count, (int)((timeout_us + 999) / 1000)) <= 0)
+    {
+        return;
+    }
+    for (int index = 0; index < count; index++)
+    {
+        struct Router_Stub *stub = owners[index];
+        if (!(pfds[index].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            continue;
+        }
+        if (pfds[index].fd == stub->listener)
+        {
+            stub_close(stub); // The firmware only reconnects once it has dropped the old one
+            stub->sock = accept(stub->listener, NULL, NULL);
+            videohub_parser_reset(&stub->parser);
+            stub->block_routes = 0;
+            const char *prelude = "PROTOCOL PREAMBLE:\nVersion: 2.8\n\nEND PRELUDE:\n\n";
+            send(stub->sock, prelude, strlen(prelude), 0);
+            continue;
+        }
+
+        uint8_t buffer[1024];
+        ssize_t length = recv(stub->sock, buffer, sizeof(buffer), 0);
+        if (length <= 0)
+        {
+            stub_close(stub);
+            continue;
+        }
+        if (stub->mode == MODE_STALLED)
+        {
+            continue; // Swallowed without an answer
+        }
+        stub->reply_length = 0;
+        videohub_parser_feed(&stub->parser, buffer, length);
+        if (stub->reply_length > 0)
+        {
+            send(stub->sock, stub->reply, stub->reply_length, 0);
+        }
+    }
+}
+
+static void routers_poll_for(int64_t duration_us)
+{
+    int64_t end = host_time_us() + duration_us;
+    int64_t now;
+    while ((now = host_time_us()) < end)
+    {
+        routers_poll(end - now);
+    }
+}
+
+static void set_mode(struct Router_Stub *stub, int mode)
+{
+    if (stub->mode == MODE_DOWN && mode != MODE_DOWN)
+    {
+        stub_listen(stub);
+    }
+    else if (mode == MODE_DOWN && stub->mode != MODE_DOWN)
+    {
+        stub_close(stub);
+        close(stub->listener);
+    }
+    stub->mode = mode;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int write_config(char *dir, size_t dir_size)
+{
+    snprintf(dir, dir_size, "/tmp/bench_multi_router_XXXXXX");
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return 0;
+    }
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", dir);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror("fopen");
+        return 0;
+    }
+    fprintf(f, "routing_sources = 1,2\nrouting_destination = 1\nrouting_router = 2\nroute_trigger = press\n"
+               "show_relay_router = 1\nshow_relay_main = 10\nshow_relay_ir = 11\nshow_relay_outputs = 20,21,22,23\n"
+               "router_ip = 127.0.0.1\nrouter_port = %d\nrouter_ip_2 = 127.0.0.1\nrouter_port_2 = %d\n", stubs[0].port, stubs[1].port);
+    fclose(f);
+    return 1;
+}
+
+int main(void)
+{
+    for (int router = 0; router < 2; router++)
+    {
+        stubs[router].sock = -1;
+        stub_listen(&stubs[router]);
+        videohub_parser_init(&stubs[router].parser, router_event, &stubs[router]);
+    }
+
+    char dir[64];
+    if (!write_config(dir, sizeof(dir)))
+    {
+        return 1;
+    }
+
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    host_set_sdcard_dir(dir);
+    host_start_app();
+    routers_poll_for(500000);
+    if (stubs[0].sock < 0 || stubs[1].sock < 0)
+    {
+        printf("FAILED: firmware didn't connect to both routers\n");
+        return 1;
+    }
+
+    int failures = 0;
+    double median[3];
+    printf("Two routers: %d presses per run, button down to route at router 2, Main/IR pressed alongside for router 1\n", TRIALS);
+    printf("%-9s %8s %8s %8s %8s %8s %12s\n", "router 1", "routes", "min ms", "med ms", "p95 ms", "max ms", "r1 attempts");
+
+    srand(1);
+    for (int mode = MODE_HEALTHY; mode <= MODE_DOWN; mode++)
+    {
+        set_mode(&stubs[0], mode);
+        routers_poll_for(100000);
+
+        struct Reconnect_Stats_Struct before;
+        get_reconnect_stats(0, &before);
+
+        double latencies[TRIALS];
+        int routes = 0;
+        int stray = 0;
+        for (int trial = 0; trial < TRIALS; trial++)
+        {
+            int button = trial % 2; // Alternate, so every press is a real change of route
+            routers_poll_for(20000 + rand() % 60000);
+
+            stubs[1].new_routes = 0;
+            int64_t pressed = host_time_us();
+            host_gpio_set_input(button_pins[button], 0);
+            host_gpio_set_input(PIN_SHOW_RELAY_BUTTON, 0);
+            while (stubs[1].new_routes == 0 && host_time_us() < pressed + ROUTE_TIMEOUT_US)
+            {
+                routers_poll(pressed + ROUTE_TIMEOUT_US - host_time_us());
+            }
+            host_gpio_set_input(button_pins[button], 1);
+            host_gpio_set_input(PIN_SHOW_RELAY_BUTTON, 1);
+
+            if (stubs[1].new_routes == 0)
+            {
+                continue;
+            }
+            if (stubs[1].last_input != button)
+            {
+                stray++;
+            }
+            latencies[routes++] = (stubs[1].last_route_time - pressed) / 1000.0;
+        }
+        routers_poll_for(100000);
+
+        struct Reconnect_Stats_Struct after;
+        get_reconnect_stats(0, &after);
+        if (routes == 0)
+        {
+            printf("%-9s %8d\n", mode_names[mode], 0);
+            failures++;
+            continue;
+        }
+        qsort(latencies, routes, sizeof(double), compare_doubles);
+        median[mode] = latencies[routes / 2];
+        printf("%-9s %8d %8.1f %8.1f %8.1f %8.1f %12"PRIu32"\n", mode_names[mode], routes, latencies[0], median[mode],
+               latencies[(routes * 95) / 100 < routes ? (routes * 95) / 100 : routes - 1], latencies[routes - 1],
+               (after.connects + after.connect_failures) - (before.connects + before.connect_failures));
+        if (routes != TRIALS || stray != 0)
+        {
+            printf("  %d presses without a route, %d to the wrong input\n", TRIALS - routes, stray);
+            failures++;
+        }
+    }
+
+    // Router 1's trouble mustn't reach router 2 - allow a couple of ms of scheduling noise
+    for (int mode = MODE_STALLED; mode <= MODE_DOWN && failures == 0; mode++)
+    {
+        if (median[mode] > median[MODE_HEALTHY] + 2.0)
+        {
+            printf("Router 2 cuts slowed by %.1f ms with router 1 %s\n", median[mode] - median[MODE_HEALTHY], mode_names[mode]);
+            failures++;
+        }
+    }
+
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", dir);
+    unlink(path);
+    rmdir(dir);
+
+    if (failures != 0)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,172 @@
+// Benchmark: routing confirm lookup through the panel map against searching every panel
+//-----------------------------------
+// Sets up 1 to PANELS_MAX panels, each with PANEL_BUTTONS_MAX buttons (two of them sharing a
+// destination), and times finding which panel buttons a routing confirm lights: through the
+// prebuilt reverse index, and by searching each panel's destination and sources the way the
+// main logic used to. Every (output, input) pair on a 288x288 router is checked to give the
+// same answer both ways.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "panel_map.h"
+
+#define LOOKUPS 4000000
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void make_settings(struct Settings_Struct *settings, uint8_t panel_count)
+{
+    memset(settings, 0, sizeof(*settings));
+    settings->panel_count = panel_count;
+    for (uint8_t panel = 0; panel < panel_count; panel++)
+    {
+        // Panels 1 and 2 both show output 5 - the SM desk and a monitor wall on the same feed
+        settings->panels[panel].routing_destination = (panel == 1) ? 5 : 5 + (panel * 40);
+        settings->panels[panel].button_count = PANEL_BUTTONS_MAX;
+        for (uint8_t button = 0; button < PANEL_BUTTONS_MAX; button++)
+        {
+            settings->panels[panel].routing_sources[button] = 1 + ((panel * 7 + button * 31) % ROUTER_INPUTS_MAX);
+        }
+    }
+    settings->panels[0].routing_sources[PANEL_BUTTONS_MAX - 1] = settings->panels[0].routing_sources[0]; // Repeated source
+}
+
+// The search the reverse index replaces - returns a bitmask of panels on the output, with the
+// button each would light in buttons[]
+static uint32_t search_panels(const struct Settings_Struct *settings, uint16_t output, uint16_t input, uint8_t *buttons)
+{
+    uint32_t panels = 0;
+    for (uint8_t panel = 0; panel < settings->panel_count; panel++)
+    {
+        if (settings->panels[panel].routing_destination != output + 1)
+        {
+            continue;
+        }
+        panels |= 1u << panel;
+        buttons[panel] = 0;
+        for (uint8_t button = 0; button < settings->panels[panel].button_count; button++)
+        {
+            if (settings->panels[panel].routing_sources[button] == input + 1)
+            {
+                buttons[panel] = button + 1;
+                break;
+            }
+        }
+    }
+    return panels;
+}
+
+static uint32_t map_panels(const struct Panel_Map_Struct *map, uint16_t output, uint16_t input, uint8_t *buttons)
+{
+    uint32_t panels = 0;
+    for (uint8_t panel = panel_map_first(map, 0, output); panel != PANEL_NONE; panel = panel_map_next(map, panel))
+    {
+        panels |= 1u << panel;
+        buttons[panel] = panel_map_button(map, panel, input);
+    }
+    return panels;
+}
+
+// Folds a lookup's answer into one number - only the buttons of panels on the output are written
+static uint32_t lookup_checksum(uint32_t panels, const uint8_t *buttons)
+{
+    uint32_t sum = panels;
+    for (uint8_t panel = 0; panel < PANELS_MAX; panel++)
+    {
+        if (panels & (1u << panel))
+        {
+            sum += (uint32_t)buttons[panel] << (8 * panel);
+        }
+    }
+    return sum;
+}
+
+int main(void)
+{
+    static struct Panel_Map_Struct map;
+    struct Settings_Struct settings;
+    int failures = 0;
+
+    printf("Routing confirm to panel buttons: %d buttons per panel, %d lookups\n", PANEL_BUTTONS_MAX, LOOKUPS);
+    printf("%-8s %14s %14s\n", "panels", "index ns", "search ns");
+
+    for (uint8_t panel_count = 1; panel_count <= PANELS_MAX; panel_count++)
+    {
+        make_settings(&settings, panel_count);
+        panel_map_build(&map, &settings);
+
+        // Same answer both ways for every crosspoint
+        for (uint16_t output = 0; output < ROUTER_OUTPUTS_MAX; output++)
+        {
+            for (uint16_t input = 0; input < ROUTER_INPUTS_MAX; input++)
+            {
+                uint8_t expected[PANELS_MAX];
+                uint8_t actual[PANELS_MAX];
+                uint32_t expected_panels = search_panels(&settings, output, input, expected);
+                uint32_t actual_panels = map_panels(&map, output, input, actual);
+                int same = expected_panels == actual_panels;
+                for (uint8_t panel = 0; same && panel < panel_count; panel++)
+                {
+                    same = !(expected_panels & (1u << panel)) || expected[panel] == actual[panel];
+                }
+                if (!same)
+                {
+                    if (failures++ == 0)
+                    {
+                        fprintf(stderr, "%u panels: output %u input %u looked up wrong\n", panel_count, output, input);
+                    }
+                }
+            }
+        }
+
+        // Confirms mostly for outputs with panels on them, as during a busy show
+        uint16_t outputs[256];
+        uint16_t inputs[256];
+        srand(panel_count);
+        for (int i = 0; i < 256; i++)
+        {
+            uint8_t panel = rand() % panel_count;
+            outputs[i] = (i % 4 == 0) ? rand() % ROUTER_OUTPUTS_MAX : settings.panels[panel].routing_destination - 1;
+            inputs[i] = rand() % ROUTER_INPUTS_MAX;
+        }
+
+        uint8_t buttons[PANELS_MAX];
+        uint32_t check = 0;
+        double start = now_seconds();
+        for (int i = 0; i < LOOKUPS; i++)
+        {
+            uint32_t panels = map_panels(&map, outputs[i & 255], inputs[i & 255], buttons);
+            check += lookup_checksum(panels, buttons);
+        }
+        double indexed = (now_seconds() - start) / LOOKUPS;
+
+        start = now_seconds();
+        for (int i = 0; i < LOOKUPS; i++)
+        {
+            uint32_t panels = search_panels(&settings, outputs[i & 255], inputs[i & 255], buttons);
+            check -= lookup_checksum(panels, buttons);
+        }
+        double searched = (now_seconds() - start) / LOOKUPS;
+
+        printf("%-8u %14.1f %14.1f%s\n", panel_count, indexed * 1e9, searched * 1e9, (check == 0) ? "" : " (mismatch)");
+        if (check != 0)
+        {
+            failures++;
+        }
+    }
+
+    if (failures != 0)
+    {
+        printf("FAILED: %d lookups gave the wrong panels or buttons\n", failures);
+        return 1;
+    }
+    return 0;
+}
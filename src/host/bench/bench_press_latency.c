@@ -0,0 +1,324 @@
+// Benchmark: press-to-wire latency of a routing button, press and release triggered
+//-----------------------------------
+// Boots the whole firmware against a stand-in Videohub on localhost, holds routing buttons down
+// for a set time and measures from the moment the button goes down to the moment the route
+// command arrives at the router. Each trigger mode runs in its own forked process (the firmware
+// only boots once per process). Presses land at random points in the input poll cycle.
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "host_shim.h"
+#include "pindefs.h"
+#include "storage.h"
+#include "videohub_protocol.h"
+
+#define TRIALS 16
+#define ROUTE_TIMEOUT_US 2000000
+
+static const int button_pins[] = {PIN_BUTTON_1, PIN_BUTTON_2, PIN_BUTTON_3, PIN_BUTTON_4, PIN_BUTTON_5, PIN_BUTTON_6};
+
+struct Run_Result {
+    int routes;       // Route commands seen for the presses made
+    int stray_routes; // Route commands for the wrong input, or more than one per press
+    double min_ms;
+    double median_ms;
+    double p95_ms;
+    double max_ms;
+};
+
+// Stand-in router: confirms routes the way a Videohub does, and answers the status request
+struct Router_Stub {
+    int sock;
+    struct Videohub_Parser_Struct parser;
+    uint16_t route;          // What the stub has on output 0
+    int block_routes;        // Routes in the block being read
+    int new_routes;          // Routes received since last checked
+    uint16_t last_input;     // Input of the last route received
+    int64_t last_route_time; // When it was received
+};
+
+static void send_text(struct Router_Stub *stub, const char *text)
+{
+    if (send(stub->sock, text, strlen(text), 0) < 0)
+    {
+        perror("send");
+    }
+}
+
+static void router_event(const struct Videohub_Event_Struct *event, void *context)
+{
+    struct Router_Stub *stub = context;
+    char reply[96];
+
+    if (event->type == VH_EVT_ROUTE && event->index == 0)
+    {
+        stub->block_routes++;
+        stub->new_routes++;
+        stub->last_input = event->value;
+        stub->last_route_time = host_time_us();
+        stub->route = event->value;
+        snprintf(reply, sizeof(reply), "ACK\n\nVIDEO OUTPUT ROUTING:\n0 %u\n\n", stub->route);
+        send_text(stub, reply);
+    }
+    else if (event->type == VH_EVT_BLOCK_END && event->block == VH_BLOCK_OUTPUT_ROUTING)
+    {
+        if (stub->block_routes == 0)
+        {
+            // Empty block is a status request
+            snprintf(reply, sizeof(reply), "ACK\n\nVIDEO OUTPUT ROUTING:\n0 %u\n\n", stub->route);
+            send_text(stub, reply);
+        }
+        stub->block_routes = 0;
+    }
+}
+
+// Reads whatever the firmware has sent, for up to timeout_us
+static void router_poll(struct Router_Stub *stub, int64_t timeout_us)
+{
+    struct pollfd pfd = {.fd = stub->sock, .events = POLLIN};
+    int timeout_ms = (int)((timeout_us + 999) / 1000);
+    if (poll(&pfd, 1, timeout_ms) > 0)
+    {
+        uint8_t buffer[1024];
+        ssize_t length = recv(stub->sock, buffer, sizeof(buffer), 0);
+        if (length > 0)
+        {
+            videohub_parser_feed(&stub->parser, buffer, length);
+        }
+    }
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int write_config(char *dir, size_t dir_size, int port, const char *trigger)
+{
+    snprintf(dir, dir_size, "/tmp/bench_press_latency_XXXXXX");
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return 0;
+    }
+    char path[256];
+    snprintf(path, sizeof(path), "%s/config.txt", dir);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror("fopen");
+        return 0;
+    }
+    fprintf(f, "routing_sources = 1,2,3,4,5,6\nrouting_destination = 1\nroute_trigger = %s\n"
+               "router_ip = 127.0.0.1\nrouter_port = %d\n", trigger, port);
+    fclose(f);
+    return 1;
+}
+
+// Runs in a child process: boots the firmware and times TRIALS presses
+static int run_mode(const char *trigger, int hold_ms, struct Run_Result *result)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = 0};
+    socklen_t address_length = sizeof(address);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 1) != 0
+        || getsockname(listener, (struct sockaddr *)&address, &address_length) != 0)
+    {
+        perror("listen");
+        return 0;
+    }
+
+    char dir[64];
+    if (!write_config(dir, sizeof(dir), ntohs(address.sin_port), trigger))
+    {
+        return 0;
+    }
+
+    esp_log_level_set("*", ESP_LOG_WARN);
+    host_set_sdcard_dir(dir);
+    host_start_app();
+
+    struct pollfd pfd = {.fd = listener, .events = POLLIN};
+    if (poll(&pfd, 1, 5000) <= 0)
+    {
+        fprintf(stderr, "Firmware never connected\n");
+        return 0;
+    }
+
+    static struct Router_Stub stub;
+    stub.sock = accept(listener, NULL, NULL);
+    stub.route = 100; // Something no button selects
+    videohub_parser_init(&stub.parser, router_event, &stub);
+    send_text(&stub, "PROTOCOL PREAMBLE:\nVersion: 2.8\n\nEND PRELUDE:\n\n");
+
+    // Let the status request and its answer go through before timing anything
+    int64_t settle_end = host_time_us() + 300000;
+    while (host_time_us() < settle_end)
+    {
+        router_poll(&stub, settle_end - host_time_us());
+    }
+    stub.new_routes = 0;
+
+    double latencies[TRIALS];
+    srand(1);
+    for (int trial = 0; trial < TRIALS; trial++)
+    {
+        int button = trial % 2; // Alternate, so every press is a real change of route
+        usleep(rand() % 20000); // Random phase against the input poll loop
+
+        int64_t pressed = host_time_us();
+        int64_t release_at = pressed + hold_ms * 1000LL;
+        int64_t give_up = release_at + ROUTE_TIMEOUT_US;
+        int released = 0;
+        stub.new_routes = 0;
+
+        host_gpio_set_input(button_pins[button], 0);
+        while (host_time_us() < give_up && (stub.new_routes == 0 || !released))
+        {
+            int64_t now = host_time_us();
+            if (!released && now >= release_at)
+            {
+                host_gpio_set_input(button_pins[button], 1);
+                released = 1;
+                continue;
+            }
+            router_poll(&stub, released ? give_up - now : release_at - now);
+        }
+        if (!released)
+        {
+            host_gpio_set_input(button_pins[button], 1);
+        }
+
+        // Catch a second route for the same press, if one is sent
+        int64_t quiet_end = host_time_us() + 80000;
+        while (host_time_us() < quiet_end)
+        {
+            router_poll(&stub, quiet_end - host_time_us());
+        }
+
+        if (stub.new_routes == 0)
+        {
+            fprintf(stderr, "No route sent for press %d\n", trial);
+            continue;
+        }
+        if (stub.new_routes > 1 || stub.last_input != button)
+        {
+            result->stray_routes++;
+        }
+        latencies[result->routes++] = (stub.last_route_time - pressed) / 1000.0;
+    }
+
+    if (result->routes > 0)
+    {
+        qsort(latencies, result->routes, sizeof(double), compare_doubles);
+        result->min_ms = latencies[0];
+        result->median_ms = latencies[result->routes / 2];
+        result->p95_ms = latencies[(result->routes * 95) / 100 < result->routes ? (result->routes * 95) / 100 : result->routes - 1];
+        result->max_ms = latencies[result->routes - 1];
+    }
+
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", dir);
+    unlink(path);
+    rmdir(dir);
+    return 1;
+}
+
+// Forks a process for one trigger mode and hold time, and collects its result
+static int measure(const char *trigger, int hold_ms, struct Run_Result *result)
+{
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0)
+    {
+        perror("pipe");
+        return 0;
+    }
+    fflush(stdout);
+
+    pid_t child = fork();
+    if (child == 0)
+    {
+        close(pipe_fds[0]);
+        struct Run_Result child_result = {0};
+        int ok = run_mode(trigger, hold_ms, &child_result);
+        if (ok && write(pipe_fds[1], &child_result, sizeof(child_result)) != sizeof(child_result))
+        {
+            ok = 0;
+        }
+        _exit(ok ? 0 : 1);
+    }
+
+    close(pipe_fds[1]);
+    ssize_t length = read(pipe_fds[0], result, sizeof(*result));
+    close(pipe_fds[0]);
+    int status = 0;
+    waitpid(child, &status, 0);
+    return length == sizeof(*result) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(void)
+{
+    const struct {
+        const char *trigger;
+        int hold_ms;
+    } runs[] = {{"release", 100}, {"release", 300}, {"press", 100}, {"press", 300}};
+    double median[4];
+    int failures = 0;
+
+    printf("Press-to-wire latency: %d presses per run, from button down to route command at the router\n", TRIALS);
+    printf("%-8s %8s %8s %8s %8s %8s %8s\n", "trigger", "hold ms", "routes", "min ms", "med ms", "p95 ms", "max ms");
+
+    for (size_t r = 0; r < sizeof(runs) / sizeof(runs[0]); r++)
+    {
+        struct Run_Result result = {0};
+        if (!measure(runs[r].trigger, runs[r].hold_ms, &result))
+        {
+            printf("%-8s %8d  run failed\n", runs[r].trigger, runs[r].hold_ms);
+            failures++;
+            continue;
+        }
+        printf("%-8s %8d %8d %8.1f %8.1f %8.1f %8.1f\n", runs[r].trigger, runs[r].hold_ms, result.routes,
+               result.min_ms, result.median_ms, result.p95_ms, result.max_ms);
+        median[r] = result.median_ms;
+        if (result.routes != TRIALS || result.stray_routes != 0)
+        {
+            printf("  %d presses without a route, %d wrong or repeated routes\n", TRIALS - result.routes, result.stray_routes);
+            failures++;
+        }
+    }
+
+    if (failures == 0)
+    {
+        // Press triggered cuts must not depend on how long the button is held
+        if (median[2] >= runs[2].hold_ms || median[3] >= runs[2].hold_ms)
+        {
+            printf("Press trigger waited for the release\n");
+            failures++;
+        }
+        else
+        {
+            printf("Press trigger saves %.1f ms at %d ms hold, %.1f ms at %d ms hold\n", median[0] - median[2], runs[0].hold_ms,
+                   median[1] - median[3], runs[1].hold_ms);
+        }
+    }
+
+    if (failures != 0)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
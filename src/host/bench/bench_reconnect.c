@@ -0,0 +1,222 @@
+// Benchmark: how quickly the firmware gets back to the router after losing it
+//-----------------------------------
+// Boots the whole firmware against a stand-in Videohub on localhost, then repeatedly takes the
+// router away and brings it back:
+//   drop     - router closes the connection but keeps listening (router side reset)
+//   outage   - router stops listening for a while, so connection attempts are refused
+//   link     - Ethernet cable unplugged and replugged
+// and measures from the moment the router (or link) is back to the moment the firmware has
+// reconnected and asked for the routing table.
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "host_shim.h"
+#include "ethernet.h"
+
+#define TRIALS 8
+#define ACCEPT_TIMEOUT_MS 10000
+
+static int listener = -1;
+static int router_port = 0;
+
+static int router_listen(void)
+{
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = htons(router_port)};
+    socklen_t address_length = sizeof(address);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 1) != 0
+        || getsockname(listener, (struct sockaddr *)&address, &address_length) != 0)
+    {
+        perror("listen");
+        return 0;
+    }
+    router_port = ntohs(address.sin_port);
+    return 1;
+}
+
+static void router_stop_listening(void)
+{
+    close(listener);
+    listener = -1;
+}
+
+// Waits for the firmware to connect, sends the status dump and waits for its routing request
+// Returns the connected socket, or -1
+static int router_accept(void)
+{
+    struct pollfd pfd = {.fd = listener, .events = POLLIN};
+    if (poll(&pfd, 1, ACCEPT_TIMEOUT_MS) <= 0)
+    {
+        fprintf(stderr, "Firmware didn't reconnect\n");
+        return -1;
+    }
+    int sock = accept(listener, NULL, NULL);
+    const char *dump = "PROTOCOL PREAMBLE:\nVersion: 2.8\n\nVIDEO OUTPUT ROUTING:\n0 3\n\nEND PRELUDE:\n\n";
+    send(sock, dump, strlen(dump), 0);
+    return sock;
+}
+
+// Reads and answers what the firmware sends until it has asked for the routing table
+static int router_wait_for_request(int sock)
+{
+    char buffer[512];
+    size_t used = 0;
+    struct pollfd pfd = {.fd = sock, .events = POLLIN};
+    while (poll(&pfd, 1, ACCEPT_TIMEOUT_MS) > 0)
+    {
+        ssize_t length = recv(sock, buffer + used, sizeof(buffer) - used - 1, 0);
+        if (length <= 0)
+        {
+            return 0;
+        }
+        used += length;
+        buffer[used] = '\0';
+        if (strstr(buffer, "VIDEO OUTPUT ROUTING:\n\n") != NULL)
+        {
+            const char *reply = "ACK\n\nVIDEO OUTPUT ROUTING:\n0 3\n\n";
+            send(sock, reply, strlen(reply), 0);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_row(const char *name, int outage_ms, double *times, int count, const char *note)
+{
+    if (count == 0)
+    {
+        printf("%-8s %9d %8s\n", name, outage_ms, "failed");
+        return;
+    }
+    qsort(times, count, sizeof(double), compare_doubles);
+    printf("%-8s %9d %8.1f %8.1f %8.1f  %s\n", name, outage_ms, times[0], times[count / 2], times[count - 1], note);
+}
+
+static int write_config(char *dir, size_t dir_size)
+{
+    snprintf(dir, dir_size, "/tmp/bench_reconnect_XXXXXX");
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return 0;
+    }
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", dir);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror("fopen");
+        return 0;
+    }
+    fprintf(f, "routing_sources = 1,2,3,4,5,6\nrouting_destination = 1\nrouter_ip = 127.0.0.1\nrouter_port = %d\n", router_port);
+    fclose(f);
+    return 1;
+}
+
+int main(void)
+{
+    char dir[64];
+    if (!router_listen() || !write_config(dir, sizeof(dir)))
+    {
+        return 1;
+    }
+
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    host_set_sdcard_dir(dir);
+    host_start_app();
+
+    int sock = router_accept();
+    if (sock < 0 || !router_wait_for_request(sock))
+    {
+        printf("FAILED: firmware never connected\n");
+        return 1;
+    }
+
+    int failures = 0;
+    double times[TRIALS];
+    double recovery[TRIALS];
+    const int outages_ms[] = {0, 300, 1500};
+
+    printf("Reconnect: %d trials each, time from router/link back to routing table requested\n", TRIALS);
+    printf("%-8s %9s %8s %8s %8s\n", "event", "outage ms", "min ms", "med ms", "max ms");
+
+    // Router side resets and outages
+    for (size_t o = 0; o < sizeof(outages_ms) / sizeof(outages_ms[0]); o++)
+    {
+        int count = 0;
+        for (int trial = 0; trial < TRIALS; trial++)
+        {
+            close(sock);
+            if (outages_ms[o] > 0)
+            {
+                router_stop_listening();
+                usleep(outages_ms[o] * 1000);
+                router_listen();
+            }
+            int64_t back = host_time_us();
+            sock = router_accept();
+            if (sock < 0 || !router_wait_for_request(sock))
+            {
+                failures++;
+                break;
+            }
+            times[count++] = (host_time_us() - back) / 1000.0;
+        }
+        print_row(outages_ms[o] == 0 ? "drop" : "outage", outages_ms[o], times, count, "");
+    }
+
+    // Cable unplugged and replugged
+    int count = 0;
+    for (int trial = 0; trial < TRIALS; trial++)
+    {
+        host_eth_set_link(0);
+        usleep(200000);
+        int64_t back = host_time_us();
+        host_eth_set_link(1);
+        close(sock);
+        sock = router_accept();
+        if (sock < 0 || !router_wait_for_request(sock))
+        {
+            failures++;
+            break;
+        }
+        times[count] = (host_time_us() - back) / 1000.0;
+        usleep(50000); // Let the confirm through before reading the firmware's own figure
+
+        struct Reconnect_Stats_Struct stats;
+        get_reconnect_stats(0, &stats);
+        recovery[count++] = stats.recovery_to_confirm_us / 1000.0;
+    }
+    print_row("link", 200, times, count, "");
+    print_row("", 200, recovery, count, "(firmware's own link up -> first confirm)");
+
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", dir);
+    unlink(path);
+    rmdir(dir);
+
+    if (failures != 0)
+    {
+        printf("FAILED: %d reconnects didn't happen\n", failures);
+        return 1;
+    }
+    return 0;
+}
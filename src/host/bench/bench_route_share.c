@@ -0,0 +1,510 @@
+// Benchmark: warming a box's routes from other boxes over multicast
+//-----------------------------------
+// Runs several boxes as forked processes on loopback against one stand-in Videohub that only
+// takes a single client, as a full router would. Box A gets the session; the others can only
+// learn the routes from A over the route sharing group. Measures:
+//   warm     - a box booting with no session of its own, to its panel LEDs showing the
+//              router's route taken from A's table - from boot, and from its request for
+//              tables going out on the group
+//   delta    - a route changed at the router, to the LEDs of a box without a session following
+//              it through A's delta
+//   dump     - for comparison, a box with sharing off that does get its own session, to its
+//              LEDs lit by its own status dump - from boot, and from the router accepting it
+// Boot times include the firmware's wait at startup to see if a button is held for test mode.
+// Also checks a box with sharing off and no session stays dark, so the LEDs really came from A.
+
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "host_shim.h"
+#include "pindefs.h"
+#include "router_state.h"
+#include "route_share.h"
+#include "videohub_protocol.h"
+
+#define BOOT_RUNS 8
+#define DELTA_TRIALS 16
+#define SESSIONS_MAX 4
+#define WAIT_TIMEOUT_US 2000000
+#define DARK_CHECK_US 500000
+
+// What a box's panel LEDs showed, and when - written down a pipe by each box
+struct Led_Event {
+    int64_t time_us;
+    int code; // Button lit, 0 for none
+};
+
+// A box running in a child process
+struct Box {
+    pid_t pid;
+    int events; // Read end of its LED pipe
+    int code;   // Last LED code it reported
+    int64_t booted_us;
+};
+
+// Stand-in router - one session at a time unless told otherwise, the rest are turned away
+struct Session {
+    int sock;
+    struct Videohub_Parser_Struct parser;
+    int block_routes;
+};
+
+static int listener;
+static int router_port;
+static int session_limit = 1;
+static struct Session sessions[SESSIONS_MAX];
+static uint16_t router_table[ROUTER_OUTPUTS_MAX];
+static int status_requests = 0;
+static int64_t last_accept_us = -1;  // When the router last took a session
+
+// Listening in on the route sharing group
+static int group_sock;
+static int64_t last_request_us = -1; // When a box last asked for tables
+
+static char config_dir[64];
+
+static void send_text(int sock, const char *text, size_t length)
+{
+    if (send(sock, text, length, MSG_NOSIGNAL) < 0)
+    {
+        perror("send");
+    }
+}
+
+// The whole table, as a Videohub sends it
+static void send_table(int sock)
+{
+    static char text[ROUTER_OUTPUTS_MAX * 9 + 64];
+    size_t length = snprintf(text, sizeof(text), "ACK\n\nVIDEO OUTPUT ROUTING:\n");
+    for (uint16_t output = 0; output < ROUTER_OUTPUTS_MAX; output++)
+    {
+        length += snprintf(text + length, sizeof(text) - length, "%u %u\n", output, router_table[output]);
+    }
+    length += snprintf(text + length, sizeof(text) - length, "\n");
+    send_text(sock, text, length);
+}
+
+static void router_event(const struct Videohub_Event_Struct *event, void *context)
+{
+    struct Session *session = context;
+    if (event->type == VH_EVT_ROUTE && event->block == VH_BLOCK_OUTPUT_ROUTING)
+    {
+        session->block_routes++;
+    }
+    else if (event->type == VH_EVT_BLOCK_END && event->block == VH_BLOCK_OUTPUT_ROUTING)
+    {
+        if (session->block_routes == 0)
+        {
+            status_requests++;
+            send_table(session->sock);
+        }
+        else
+        {
+            send_text(session->sock, "NAK\n\n", 5); // Nothing in this bench routes
+        }
+        session->block_routes = 0;
+    }
+}
+
+// A change made at the router - sent to every session, as a Videohub does
+static void router_change(uint16_t output, uint16_t input)
+{
+    char text[64];
+    router_table[output] = input;
+    int length = snprintf(text, sizeof(text), "VIDEO OUTPUT ROUTING:\n%u %u\n\n", output, input);
+    for (int index = 0; index < SESSIONS_MAX; index++)
+    {
+        if (sessions[index].sock >= 0)
+        {
+            send_text(sessions[index].sock, text, length);
+        }
+    }
+}
+
+static void close_session(struct Session *session)
+{
+    close(session->sock);
+    session->sock = -1;
+}
+
+// Serves the router and reads LED reports from the boxes, for up to timeout_us
+static void poll_all(struct Box *boxes, int box_count, int64_t timeout_us)
+{
+    struct pollfd pfds[2 + SESSIONS_MAX + 4];
+    int count = 0;
+    pfds[count++] = (struct pollfd){.fd = listener, .events = POLLIN};
+    pfds[count++] = (struct pollfd){.fd = group_sock, .events = POLLIN};
+    for (int index = 0; index < SESSIONS_MAX; index++)
+    {
+        pfds[count++] = (struct pollfd){.fd = sessions[index].sock, .events = POLLIN}; // Ignored if -1
+    }
+    for (int box = 0; box < box_count; box++)
+    {
+        pfds[count++] = (struct pollfd){.fd = boxes[box].events, .events = POLLIN};
+    }
+
+    if (poll(pfds, count, (int)((timeout_us + 999) / 1000)) <= 0)
+    {
+        return;
+    }
+
+    if (pfds[0].revents & POLLIN)
+    {
+        int sock = accept(listener, NULL, NULL);
+        int open_sessions = 0;
+        struct Session *free_session = NULL;
+        for (int index = 0; index < SESSIONS_MAX; index++)
+        {
+            if (sessions[index].sock >= 0)
+            {
+                open_sessions++;
+            }
+            else if (free_session == NULL)
+            {
+                free_session = &sessions[index];
+            }
+        }
+        if (open_sessions >= session_limit || free_session == NULL)
+        {
+            close(sock); // Router full
+        }
+        else
+        {
+            last_accept_us = host_time_us();
+            free_session->sock = sock;
+            free_session->block_routes = 0;
+            videohub_parser_reset(&free_session->parser);
+            const char *prelude = "PROTOCOL PREAMBLE:\nVersion: 2.8\n\nEND PRELUDE:\n\n";
+            send_text(sock, prelude, strlen(prelude));
+        }
+    }
+
+    if (pfds[1].revents & POLLIN)
+    {
+        uint8_t datagram[ROUTE_SHARE_DATAGRAM_SIZE];
+        ssize_t length = recv(group_sock, datagram, sizeof(datagram), 0);
+        if (length >= ROUTE_SHARE_HEADER_SIZE && datagram[3] == ROUTE_SHARE_MSG_REQUEST)
+        {
+            last_request_us = host_time_us();
+        }
+    }
+
+    for (int index = 0; index < SESSIONS_MAX; index++)
+    {
+        if (sessions[index].sock >= 0 && (pfds[2 + index].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            uint8_t buffer[1024];
+            ssize_t length = recv(sessions[index].sock, buffer, sizeof(buffer), 0);
+            if (length <= 0)
+            {
+                close_session(&sessions[index]);
+                continue;
+            }
+            videohub_parser_feed(&sessions[index].parser, buffer, length);
+        }
+    }
+
+    for (int box = 0; box < box_count; box++)
+    {
+        if (pfds[2 + SESSIONS_MAX + box].revents & POLLIN)
+        {
+            struct Led_Event event;
+            if (read(boxes[box].events, &event, sizeof(event)) == sizeof(event))
+            {
+                boxes[box].code = event.code;
+            }
+        }
+    }
+}
+
+// Waits for a box's LEDs to show code - returns the time they did, or -1
+static int64_t wait_for_leds(struct Box *boxes, int box_count, struct Box *box, int code, int64_t timeout_us)
+{
+    int64_t give_up = host_time_us() + timeout_us;
+    int64_t now;
+    while (box->code != code && (now = host_time_us()) < give_up)
+    {
+        poll_all(boxes, box_count, give_up - now);
+    }
+    return (box->code == code) ? host_time_us() : -1;
+}
+
+static void poll_for(struct Box *boxes, int box_count, int64_t duration_us)
+{
+    int64_t end = host_time_us() + duration_us;
+    int64_t now;
+    while ((now = host_time_us()) < end)
+    {
+        poll_all(boxes, box_count, end - now);
+    }
+}
+
+// In a box's process - reports every change to its panel LEDs
+static int box_report_fd;
+static int box_led_code = 0;
+
+static void box_led_hook(int pin, int level)
+{
+    if (pin != PIN_LED_A && pin != PIN_LED_B && pin != PIN_LED_C)
+    {
+        return;
+    }
+    int code = host_gpio_get_output(PIN_LED_A) | (host_gpio_get_output(PIN_LED_B) << 1) | (host_gpio_get_output(PIN_LED_C) << 2);
+    if (code != box_led_code)
+    {
+        box_led_code = code;
+        struct Led_Event event = {.time_us = host_time_us(), .code = code};
+        if (write(box_report_fd, &event, sizeof(event)) != sizeof(event))
+        {
+            _exit(1);
+        }
+    }
+}
+
+static int write_config(const char *sharing)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", config_dir);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror("fopen");
+        return 0;
+    }
+    fprintf(f, "routing_sources = 1,2,3,4,5,6\nrouting_destination = 1\nroute_sharing = %s\n"
+               "router_ip = 127.0.0.1\nrouter_port = %d\n", sharing, router_port);
+    fclose(f);
+    return 1;
+}
+
+// Boots a box in a new process - its config is read before this returns
+static int start_box(struct Box *box, const char *sharing)
+{
+    int pipe_fds[2];
+    if (!write_config(sharing) || pipe(pipe_fds) != 0)
+    {
+        return 0;
+    }
+    fflush(stdout);
+    box->code = 0;
+    box->booted_us = host_time_us();
+
+    box->pid = fork();
+    if (box->pid == 0)
+    {
+        close(pipe_fds[0]);
+        close(listener);
+        close(group_sock);
+        box_report_fd = pipe_fds[1];
+        esp_log_level_set("*", ESP_LOG_NONE); // Boxes turned away by the router would fill the screen
+        host_gpio_set_output_hook(box_led_hook);
+        host_set_sdcard_dir(config_dir);
+        host_start_app();
+        while (1)
+        {
+            pause();
+        }
+    }
+    close(pipe_fds[1]);
+    box->events = pipe_fds[0];
+    usleep(50000); // Let it read the config before the next box changes it
+    return box->pid > 0;
+}
+
+static void stop_box(struct Box *box)
+{
+    kill(box->pid, SIGKILL);
+    waitpid(box->pid, NULL, 0);
+    close(box->events);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Prints the spread of values, and the median from boot if there is one
+static int report(const char *name, double *values, double *from_boot, int count, int expected)
+{
+    if (count == 0)
+    {
+        printf("%-7s %8d\n", name, 0);
+        return 1;
+    }
+    qsort(values, count, sizeof(double), compare_doubles);
+    printf("%-7s %8d %8.2f %8.2f %8.2f", name, count, values[0], values[count / 2], values[count - 1]);
+    if (from_boot != NULL)
+    {
+        qsort(from_boot, count, sizeof(double), compare_doubles);
+        printf(" %12.1f", from_boot[count / 2]);
+    }
+    printf("\n");
+    if (count != expected)
+    {
+        printf("  %d runs timed out\n", expected - count);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = 0};
+    socklen_t address_length = sizeof(address);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 4) != 0
+        || getsockname(listener, (struct sockaddr *)&address, &address_length) != 0)
+    {
+        perror("listen");
+        return 1;
+    }
+    router_port = ntohs(address.sin_port);
+
+    group_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    int reuse = 1;
+    setsockopt(group_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in group_address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY), .sin_port = htons(ROUTE_SHARE_PORT)};
+    struct ip_mreq membership = {.imr_multiaddr.s_addr = inet_addr(ROUTE_SHARE_GROUP), .imr_interface.s_addr = htonl(INADDR_LOOPBACK)};
+    if (group_sock < 0 || bind(group_sock, (struct sockaddr *)&group_address, sizeof(group_address)) != 0
+        || setsockopt(group_sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0)
+    {
+        perror("route sharing group");
+        return 1;
+    }
+    for (int index = 0; index < SESSIONS_MAX; index++)
+    {
+        sessions[index].sock = -1;
+        videohub_parser_init(&sessions[index].parser, router_event, &sessions[index]);
+    }
+
+    // A full 288x288 table, with input 3 (button 3) on the panel's destination
+    for (uint16_t output = 0; output < ROUTER_OUTPUTS_MAX; output++)
+    {
+        router_table[output] = (output * 7) % ROUTER_INPUTS_MAX;
+    }
+    router_table[0] = 2;
+
+    snprintf(config_dir, sizeof(config_dir), "/tmp/bench_route_share_XXXXXX");
+    if (mkdtemp(config_dir) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    int failures = 0;
+    struct Box boxes[2];
+
+    // Box A holds the router's only session
+    if (!start_box(&boxes[0], "on") || wait_for_leds(boxes, 1, &boxes[0], 3, WAIT_TIMEOUT_US) < 0 || status_requests == 0)
+    {
+        printf("FAILED: first box didn't get the router's routes\n");
+        stop_box(&boxes[0]);
+        return 1;
+    }
+    poll_for(boxes, 1, 100000);
+
+    printf("Route sharing between boxes on loopback, router takes %d client - warm from the box's request\n", session_limit);
+    printf("going out, delta from the change at the router, dump from the router accepting the box\n");
+    printf("%-7s %8s %8s %8s %8s %12s\n", "", "runs", "min ms", "med ms", "max ms", "boot med ms");
+
+    // Boxes booting without a session, warmed from A's table
+    double times[DELTA_TRIALS];
+    double from_boot[BOOT_RUNS];
+    int count = 0;
+    for (int run = 0; run < BOOT_RUNS; run++)
+    {
+        last_request_us = -1;
+        if (!start_box(&boxes[1], "on"))
+        {
+            break;
+        }
+        int64_t lit = wait_for_leds(boxes, 2, &boxes[1], router_table[0] + 1, WAIT_TIMEOUT_US);
+        if (lit >= 0 && last_request_us >= 0)
+        {
+            times[count] = (lit - last_request_us) / 1000.0;
+            from_boot[count++] = (lit - boxes[1].booted_us) / 1000.0;
+        }
+        if (run < BOOT_RUNS - 1)
+        {
+            stop_box(&boxes[1]);
+        }
+    }
+    failures += report("warm", times, from_boot, count, BOOT_RUNS);
+
+    // Routes changed at the router, followed by the box without a session
+    count = 0;
+    for (int trial = 0; trial < DELTA_TRIALS; trial++)
+    {
+        uint16_t input = (trial % 2 == 0) ? 4 : 2;
+        poll_for(boxes, 2, 20000 + rand() % 30000);
+        int64_t changed = host_time_us();
+        router_change(0, input);
+        int64_t lit = wait_for_leds(boxes, 2, &boxes[1], input + 1, WAIT_TIMEOUT_US);
+        if (lit >= 0)
+        {
+            times[count++] = (lit - changed) / 1000.0;
+        }
+    }
+    failures += report("delta", times, NULL, count, DELTA_TRIALS);
+    stop_box(&boxes[1]);
+
+    // Sharing off and no session - must stay dark
+    if (start_box(&boxes[1], "off"))
+    {
+        poll_for(boxes, 2, DARK_CHECK_US);
+        if (boxes[1].code != 0)
+        {
+            printf("Box with sharing off and no session lit button %d\n", boxes[1].code);
+            failures++;
+        }
+        stop_box(&boxes[1]);
+    }
+
+    // For comparison - sharing off, with a session and status dump of its own
+    session_limit = 2;
+    count = 0;
+    for (int run = 0; run < BOOT_RUNS; run++)
+    {
+        last_accept_us = -1;
+        if (!start_box(&boxes[1], "off"))
+        {
+            break;
+        }
+        int64_t lit = wait_for_leds(boxes, 2, &boxes[1], router_table[0] + 1, WAIT_TIMEOUT_US);
+        if (lit >= 0 && last_accept_us >= 0)
+        {
+            times[count] = (lit - last_accept_us) / 1000.0;
+            from_boot[count++] = (lit - boxes[1].booted_us) / 1000.0;
+        }
+        stop_box(&boxes[1]);
+        poll_for(boxes, 1, 20000); // Router notices the session go
+    }
+    failures += report("dump", times, from_boot, count, BOOT_RUNS);
+
+    stop_box(&boxes[0]);
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", config_dir);
+    unlink(path);
+    rmdir(config_dir);
+
+    if (failures != 0)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
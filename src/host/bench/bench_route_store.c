@@ -0,0 +1,345 @@
+// Benchmark: buttons lit from the stored routes at power on
+//-----------------------------------
+// Boots the firmware in a forked process against a stand-in Videohub on localhost, with the
+// same stand-in link, DHCP and SD card delays as bench_boot:
+//   first boot  - the router dumps a route, and the box stores it once it has settled
+//   second boot - the router doesn't take the connection at first, so the only way to light
+//                 the button is the stored route. Times power on to that, then lets the router
+//                 in with a different route, as if it had been changed while the box was off,
+//                 and times power on to the button following it
+// Then checks the flash wear in process: a route changed and changed back isn't written, and
+// a burst of changes is written once.
+// NVS is kept in a host directory, so the routes survive the power cut as they do on a box.
+
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "host_shim.h"
+#include "pindefs.h"
+#include "route_store.h"
+#include "router_state.h"
+
+#define LINK_US 500000
+#define DHCP_US 250000
+#define SDCARD_MOUNT_US 200000
+#define BOOT_TIMEOUT_US 5000000
+#define STORE_WAIT_US ((ROUTE_STORE_SETTLE_MS + 500) * 1000)
+#define RESTORE_BOUND_US 50000 // Power on to the stored route lit, with the settings cached
+#define BURST_CHANGES 300
+#define BURST_GAP_US 5000
+
+// Buttons for the inputs the stand-in router has on the panel's destination
+#define FIRST_INPUT 2  // Zero based - source 3, button 3
+#define SECOND_INPUT 4 // Source 5, button 5
+#define LED_FIRST 3
+#define LED_SECOND 5
+
+// What the box's panel LEDs showed, and when - written down a pipe by the box
+struct Led_Event {
+    int64_t time_us;
+    int code;
+};
+
+static int listener;
+static int router_port;
+static char sdcard_dir[64];
+static char nvs_dir[64];
+
+// In the box's process - reports every change to its panel LEDs
+static int box_report_fd;
+static int box_led_code = 0;
+
+static void box_led_hook(int pin, int level)
+{
+    if (pin != PIN_LED_A && pin != PIN_LED_B && pin != PIN_LED_C)
+    {
+        return;
+    }
+    int code = host_gpio_get_output(PIN_LED_A) | (host_gpio_get_output(PIN_LED_B) << 1) | (host_gpio_get_output(PIN_LED_C) << 2);
+    if (code != box_led_code)
+    {
+        box_led_code = code;
+        struct Led_Event event = {.time_us = host_time_us(), .code = code};
+        if (write(box_report_fd, &event, sizeof(event)) != sizeof(event))
+        {
+            _exit(1);
+        }
+    }
+}
+
+static int write_config(void)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", sdcard_dir);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror("fopen");
+        return 0;
+    }
+    fprintf(f, "routing_sources = 1,2,3,4,5,6\nrouting_destination = 1\nroute_sharing = off\n"
+               "router_ip = 127.0.0.1\nrouter_port = %d\n", router_port);
+    fclose(f);
+    return 1;
+}
+
+static void remove_nvs_key(const char *name)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%s", nvs_dir, name);
+    unlink(path);
+}
+
+static int routes_stored(void)
+{
+    char path[128];
+    struct stat info;
+    snprintf(path, sizeof(path), "%s/%s.%s", nvs_dir, ROUTE_STORE_NVS_NAMESPACE, ROUTE_STORE_NVS_KEY);
+    return stat(path, &info) == 0;
+}
+
+static pid_t start_box(int *report_fd)
+{
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0)
+    {
+        perror("pipe");
+        return -1;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(pipe_fds[0]);
+        close(listener);
+        box_report_fd = pipe_fds[1];
+        esp_log_level_set("*", ESP_LOG_NONE);
+        host_gpio_set_output_hook(box_led_hook);
+        host_set_sdcard_dir(sdcard_dir);
+        host_set_nvs_dir(nvs_dir);
+        host_set_boot_delays(LINK_US, DHCP_US, SDCARD_MOUNT_US);
+        host_start_app();
+        while (1)
+        {
+            pause();
+        }
+    }
+    close(pipe_fds[1]);
+    *report_fd = pipe_fds[0];
+    return pid;
+}
+
+static void stop_box(pid_t pid, int report_fd)
+{
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    close(report_fd);
+}
+
+// Waits for the box's LED to show a code - time from power on to it, 0 if it didn't
+static int64_t wait_for_led(int report_fd, int code, int64_t power_on)
+{
+    int64_t end = power_on + BOOT_TIMEOUT_US;
+    while (host_time_us() < end)
+    {
+        struct pollfd pfd = {.fd = report_fd, .events = POLLIN};
+        struct Led_Event event;
+        if (poll(&pfd, 1, (int)((end - host_time_us()) / 1000) + 1) > 0 && read(report_fd, &event, sizeof(event)) == sizeof(event)
+            && event.code == code)
+        {
+            return event.time_us - power_on;
+        }
+    }
+    return 0;
+}
+
+// Takes the box's connection and sends a status dump with one route on output 1
+static int accept_router(int input)
+{
+    struct pollfd pfd = {.fd = listener, .events = POLLIN};
+    if (poll(&pfd, 1, BOOT_TIMEOUT_US / 1000) <= 0)
+    {
+        return -1;
+    }
+    int sock = accept(listener, NULL, NULL);
+    char dump[128];
+    snprintf(dump, sizeof(dump), "PROTOCOL PREAMBLE:\nVersion: 2.8\n\nVIDEO OUTPUT ROUTING:\n0 %d\n\nEND PRELUDE:\n\n", input);
+    send(sock, dump, strlen(dump), MSG_NOSIGNAL);
+    return sock;
+}
+
+// Box with an empty store - its route is stored once it settles
+static int first_boot(void)
+{
+    int report_fd;
+    int64_t power_on = host_time_us();
+    pid_t pid = start_box(&report_fd);
+    int sock = accept_router(FIRST_INPUT);
+    int64_t confirm_us = wait_for_led(report_fd, LED_FIRST, power_on);
+    usleep(STORE_WAIT_US);
+    int stored = routes_stored();
+    stop_box(pid, report_fd);
+    if (sock >= 0)
+    {
+        close(sock);
+    }
+    if (confirm_us == 0 || !stored)
+    {
+        printf("First boot: confirm %s, route %s\n", confirm_us ? "seen" : "not seen", stored ? "stored" : "not stored");
+        return 0;
+    }
+    return 1;
+}
+
+// Box with a stored route and a router that isn't there yet - returns the times to the stored
+// route lit and to the router's own route, which it then stores
+static int second_boot(int64_t *restore_us, int64_t *reconcile_us)
+{
+    int report_fd;
+    int64_t power_on = host_time_us();
+    pid_t pid = start_box(&report_fd);
+    *restore_us = wait_for_led(report_fd, LED_FIRST, power_on);
+    int sock = accept_router(SECOND_INPUT);
+    *reconcile_us = wait_for_led(report_fd, LED_SECOND, power_on);
+    usleep(STORE_WAIT_US); // Stores the router's route for the wear checks
+    stop_box(pid, report_fd);
+    if (sock >= 0)
+    {
+        close(sock);
+    }
+    return *restore_us != 0 && *reconcile_us != 0;
+}
+
+// Flash writes for changes made in process - the store here has the second boot's route
+static int check_wear(void)
+{
+    esp_log_level_set("*", ESP_LOG_WARN);
+    host_adopt_current_thread("bench");
+    host_set_nvs_dir(nvs_dir);
+    nvs_flash_init();
+
+    struct Settings_Struct settings;
+    memset(&settings, 0, sizeof(settings));
+    settings.panel_count = 1;
+    settings.panels[0].button_count = 6;
+    settings.panels[0].routing_destination = 1;
+    settings.router_count = 1;
+    settings.routers[0].ip = 0x7F000001;
+    settings.routers[0].port = router_port;
+    setup_route_store(&settings);
+
+    struct Route_Store_Stats_Struct stats;
+    int failures = 0;
+    if (route_store_restored(0) != SECOND_INPUT || !route_store_provisional(0))
+    {
+        printf("Wear: restored input %u, provisional %u\n", route_store_restored(0), route_store_provisional(0));
+        failures++;
+    }
+
+    // Changed and changed back before it settles - flash already holds it
+    route_store_update(0, SECOND_INPUT);
+    route_store_update(0, FIRST_INPUT);
+    route_store_update(0, SECOND_INPUT);
+    usleep(STORE_WAIT_US);
+    route_store_get_stats(&stats);
+    uint32_t changed_back_writes = stats.writes;
+
+    // A burst of changes - written once it settles
+    uint32_t changes_before = stats.changes;
+    for (int change = 0; change < BURST_CHANGES; change++)
+    {
+        route_store_update(0, change % ROUTER_INPUTS_MAX);
+        usleep(BURST_GAP_US);
+    }
+    usleep(STORE_WAIT_US);
+    route_store_get_stats(&stats);
+
+    printf("Flash wear\n");
+    printf("  changed and back  %2"PRIu32" writes\n", changed_back_writes);
+    printf("  burst of %"PRIu32"      %2"PRIu32" writes\n", stats.changes - changes_before, stats.writes - changed_back_writes);
+    if (stats.reconciled != 1 || stats.differed != 0 || changed_back_writes != 0 || stats.writes != 1
+        || stats.changes - changes_before != BURST_CHANGES)
+    {
+        printf("  %u reconciled, %u differed - expected 1 and 0, no write for the change back, and one for the burst\n",
+               stats.reconciled, stats.differed);
+        failures++;
+    }
+    return failures;
+}
+
+int main(void)
+{
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = 0};
+    socklen_t address_length = sizeof(address);
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 1) != 0
+        || getsockname(listener, (struct sockaddr *)&address, &address_length) != 0)
+    {
+        perror("listen");
+        return 1;
+    }
+    router_port = ntohs(address.sin_port);
+
+    snprintf(sdcard_dir, sizeof(sdcard_dir), "/tmp/bench_store_sd_XXXXXX");
+    snprintf(nvs_dir, sizeof(nvs_dir), "/tmp/bench_store_nvs_XXXXXX");
+    if (mkdtemp(sdcard_dir) == NULL || mkdtemp(nvs_dir) == NULL || !write_config())
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    printf("Power on to buttons lit, router away at first\n");
+    printf("Stand-ins: link %d ms, DHCP %d ms, SD card mount %d ms\n", LINK_US / 1000, DHCP_US / 1000, SDCARD_MOUNT_US / 1000);
+
+    int failures = 0;
+    int64_t restore_us = 0;
+    int64_t reconcile_us = 0;
+    if (!first_boot() || !second_boot(&restore_us, &reconcile_us))
+    {
+        failures++;
+    }
+    else
+    {
+        printf("  stored route lit    %8.1f ms (bound %.1f ms)\n", restore_us / 1000.0, RESTORE_BOUND_US / 1000.0);
+        printf("  router's route lit  %8.1f ms\n", reconcile_us / 1000.0);
+        if (restore_us > RESTORE_BOUND_US)
+        {
+            failures++;
+        }
+    }
+
+    if (failures == 0)
+    {
+        failures += check_wear();
+    }
+
+    remove_nvs_key("settings.cache");
+    remove_nvs_key(ROUTE_STORE_NVS_NAMESPACE "." ROUTE_STORE_NVS_KEY);
+    rmdir(nvs_dir);
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", sdcard_dir);
+    unlink(path);
+    rmdir(sdcard_dir);
+
+    if (failures != 0)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,311 @@
+// Benchmark: settings from the NVS cache against reading the SD card
+//-----------------------------------
+// Times get_settings reading the config file off the card (mount, read, parse, cache) against
+// taking the cached copy from NVS, and checks what the card checks after a cached boot do:
+//   unchanged - the cache is kept
+//   no card   - the cache is kept
+//   errors    - a changed file with errors is not used or cached, the cache is kept
+//   changed   - the new file is cached and published for the main logic to take, without a
+//               restart. A change isn't published until the one before has been taken, and
+//               the copy in use is never written (bench_settings_reload covers the restart
+//               for a router change, and a reload on a running box)
+// Also checks a file with errors still sets its good lines when there is no cache, and is read
+// from the card again at the next boot rather than cached.
+// NVS is kept in a host directory here, so the cache survives the restart as it does on a box.
+// The shim mounts the card by mapping a directory, so the card figures leave out the SDMMC
+// init and FAT mount that the cache saves on a box.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "host_shim.h"
+#include "main.h"
+#include "storage.h"
+
+#define RUNS 200
+#define CHECK_TIMEOUT_US 2000000
+
+static const char *good_config =
+    "// Bench config\n"
+    "routing_sources = 33,1,39,relay,5,4\n"
+    "routing_destination = 5\n"
+    "routing_sources_2 = 7, 8\n"
+    "routing_destination_2 = 288\n"
+    "routing_router_2 = 2\n"
+    "route_trigger = press\n"
+    "route_sharing = off\n"
+    "  // Indented comment\n"
+    "show_relay_main = 10\n"
+    "show_relay_ir = 11\n"
+    "show_relay_outputs = 20,21,22,23\n"
+    "router_ip = 192.168.11.41\r\n"
+    "router_port = 9990\n"
+    "router_ip_2 = 10.0.0.2\n";
+
+// Three bad lines among good ones - each is ignored, the good lines still count
+static const char *broken_config =
+    "routing_sources = 1,2,3\n"
+    "routing_destination = 300\n"
+    "route_triger = press\n"
+    "router_ip = 10.0.0.1 x\n"
+    "router_port = 9991\n";
+
+static char sdcard_dir[64];
+static char nvs_dir[64];
+
+static int write_config(const char *text)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", sdcard_dir);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror("fopen");
+        return 0;
+    }
+    fputs(text, f);
+    fclose(f);
+    return 1;
+}
+
+static QueueHandle_t input_event_queue;
+
+// Runs a card check, and waits for it
+static uint8_t wait_for_check(void)
+{
+    struct Settings_Status_Struct status;
+    get_settings_status(&status);
+    uint32_t checks = status.checks;
+    settings_check_start(&input_event_queue);
+    settings_check_now();
+    int64_t end = host_time_us() + CHECK_TIMEOUT_US;
+    do
+    {
+        vTaskDelay(1);
+        get_settings_status(&status);
+    } while (status.checks == checks && host_time_us() < end);
+    return status.check;
+}
+
+// 1 if the card check has published settings for the main logic
+static int settings_message_queued(void)
+{
+    struct Queued_Input_Message_Struct message;
+    return xQueueReceive(input_event_queue, &message, 0) == pdTRUE && message.type == IN_MSG_TYP_SETTINGS;
+}
+
+// Config file with one line swapped for another
+static void change_config(char *changed, size_t size, const char *config, const char *line, const char *replacement)
+{
+    const char *found = strstr(config, line);
+    snprintf(changed, size, "%.*s%s%s", (int)(found - config), config, replacement, found + strlen(line));
+}
+
+static int compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int check_good_settings(const struct Settings_Struct *settings, const char *what)
+{
+    int ok = settings->panel_count == 2 && settings->router_count == 2
+        && settings->panels[0].button_count == 6 && settings->panels[0].routing_sources[0] == 33
+        && settings->panels[0].routing_sources[3] == SOURCE_SHOW_RELAY && settings->panels[0].routing_destination == 5
+        && settings->panels[0].router == 0
+        && settings->panels[1].button_count == 2 && settings->panels[1].routing_sources[1] == 8
+        && settings->panels[1].routing_sources[2] == 0 && settings->panels[1].routing_destination == 288
+        && settings->panels[1].router == 1
+        && settings->route_trigger == ROUTE_TRIGGER_PRESS && settings->route_sharing == 0
+        && settings->show_relay_main_source == 10 && settings->show_relay_ir_source == 11
+        && settings->show_relay_output_count == 4 && settings->show_relay_outputs[3] == 23
+        && settings->routers[0].ip == 0xC0A80B29 && settings->routers[0].port == 9990
+        && settings->routers[1].ip == 0x0A000002 && settings->routers[1].port == 9990;
+    if (!ok)
+    {
+        printf("Settings %s don't match the config file\n", what);
+    }
+    return ok;
+}
+
+// Times get_settings RUNS times, back to back - the card check after a cached one is left to the caller
+static int time_get_settings(uint8_t source, int64_t *median_us, struct Settings_Struct *settings)
+{
+    static int64_t times[RUNS];
+    for (int run = 0; run < RUNS; run++)
+    {
+        if (source == SETTINGS_SOURCE_CARD)
+        {
+            nvs_flash_erase();
+        }
+        int64_t start = host_time_us();
+        *settings = *get_settings();
+        times[run] = host_time_us() - start;
+
+        struct Settings_Status_Struct status;
+        get_settings_status(&status);
+        if (status.source != source || status.errors != 0)
+        {
+            printf("Run %d: settings from source %u with %u errors\n", run, status.source, status.errors);
+            return 0;
+        }
+    }
+    qsort(times, RUNS, sizeof(times[0]), compare_int64);
+    *median_us = times[RUNS / 2];
+    return 1;
+}
+
+int main(void)
+{
+    snprintf(sdcard_dir, sizeof(sdcard_dir), "/tmp/bench_settings_sd_XXXXXX");
+    snprintf(nvs_dir, sizeof(nvs_dir), "/tmp/bench_settings_nvs_XXXXXX");
+    if (mkdtemp(sdcard_dir) == NULL || mkdtemp(nvs_dir) == NULL || !write_config(good_config))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    host_adopt_current_thread("bench");
+    host_set_sdcard_dir(sdcard_dir);
+    host_set_nvs_dir(nvs_dir);
+    nvs_flash_init();
+    input_event_queue = xQueueCreate(4, sizeof(struct Queued_Input_Message_Struct));
+
+    int failures = 0;
+    struct Settings_Struct card_settings;
+    struct Settings_Struct cached_settings;
+    int64_t card_us = 0;
+    int64_t cache_us = 0;
+
+    // Card first - every run starts with NVS erased, so each reads the card and caches it
+    if (!time_get_settings(SETTINGS_SOURCE_CARD, &card_us, &card_settings) || !check_good_settings(&card_settings, "from the card"))
+    {
+        failures++;
+    }
+    if (!time_get_settings(SETTINGS_SOURCE_CACHE, &cache_us, &cached_settings) || !check_good_settings(&cached_settings, "from the cache"))
+    {
+        failures++;
+    }
+    uint8_t check = wait_for_check();
+    if (check != SETTINGS_CHECK_UNCHANGED)
+    {
+        printf("Unchanged card: check %u\n", check);
+        failures++;
+    }
+
+    printf("get_settings, median of %d runs\n", RUNS);
+    printf("  sd card  %8.1f us (mount, read, parse, cache)\n", card_us / 1.0);
+    printf("  cache    %8.1f us (NVS read - card checked after boot)\n", cache_us / 1.0);
+    printf("  saved    %8.1f us, plus the SDMMC init and FAT mount on a box\n", (card_us - cache_us) / 1.0);
+
+    // No card - the cache is used and kept
+    struct Settings_Status_Struct status;
+    host_set_sdcard_dir(NULL);
+    cached_settings = *get_settings();
+    check = wait_for_check();
+    get_settings_status(&status);
+    if (status.source != SETTINGS_SOURCE_CACHE || check != SETTINGS_CHECK_NO_FILE || !check_good_settings(&cached_settings, "with no card"))
+    {
+        printf("No card: source %u, check %u\n", status.source, check);
+        failures++;
+    }
+    host_set_sdcard_dir(sdcard_dir);
+
+    // A changed file with errors doesn't replace the cache
+    printf("Config errors expected below:\n");
+    fflush(stdout);
+    write_config(broken_config);
+    cached_settings = *get_settings();
+    check = wait_for_check();
+    get_settings_status(&status);
+    if (status.source != SETTINGS_SOURCE_CACHE || check != SETTINGS_CHECK_ERRORS || status.errors != 3
+        || !check_good_settings(&cached_settings, "with a broken file on the card"))
+    {
+        printf("Broken file over the cache: source %u, check %u, %u errors\n", status.source, check, status.errors);
+        failures++;
+    }
+
+    // Without a cache it sets its good lines, but isn't cached
+    for (int boot = 0; boot < 2; boot++)
+    {
+        if (boot == 0)
+        {
+            nvs_flash_erase();
+        }
+        struct Settings_Struct settings = *get_settings();
+        get_settings_status(&status);
+        if (status.source != SETTINGS_SOURCE_CARD || status.errors != 3 || settings.panels[0].button_count != 3
+            || settings.panels[0].routing_destination != 5 || settings.routers[0].ip != 3232238377 || settings.routers[0].port != 9991)
+        {
+            printf("Broken file, boot %d: source %u, %u errors\n", boot + 1, status.source, status.errors);
+            failures++;
+        }
+    }
+
+    // A good change is cached and published, without a restart
+    char changed_config[1024];
+    char second_config[1024];
+    nvs_flash_erase();
+    write_config(good_config);
+    get_settings();
+    const struct Settings_Struct *in_use = settings_take();
+    change_config(changed_config, sizeof(changed_config), good_config, "route_trigger = press\n", "route_trigger = release\n");
+    write_config(changed_config);
+    check = wait_for_check();
+    get_settings_status(&status);
+    int published = settings_message_queued();
+    const struct Settings_Struct *reloaded = settings_take();
+    if (check != SETTINGS_CHECK_CHANGED || status.reloads != 1 || !published || reloaded == in_use
+        || reloaded->route_trigger != ROUTE_TRIGGER_RELEASE || in_use->route_trigger != ROUTE_TRIGGER_PRESS)
+    {
+        printf("Changed file: check %u, %"PRIu32" reloads, %s, trigger %u\n", check, status.reloads,
+               published ? "published" : "not published", reloaded->route_trigger);
+        failures++;
+    }
+
+    // Another change is published but not taken - a third then waits, and the copy in use is left alone
+    in_use = reloaded;
+    change_config(second_config, sizeof(second_config), changed_config, "routing_destination = 5\n", "routing_destination = 6\n");
+    write_config(second_config);
+    wait_for_check();
+    int published_second = settings_message_queued();
+    write_config(good_config);
+    wait_for_check();
+    int published_early = settings_message_queued();
+    int in_use_kept = in_use->route_trigger == ROUTE_TRIGGER_RELEASE && in_use->panels[0].routing_destination == 5;
+    reloaded = settings_take();
+    wait_for_check();
+    int published_late = settings_message_queued();
+    const struct Settings_Struct *last = settings_take();
+    get_settings_status(&status);
+    if (!published_second || published_early || !in_use_kept || reloaded->panels[0].routing_destination != 6 || !published_late || last != in_use || last->route_trigger != ROUTE_TRIGGER_PRESS
+        || status.reloads != 3)
+    {
+        printf("Change before the last was taken: published %d %d %d, %"PRIu32" reloads\n", published_second, published_early, published_late, status.reloads);
+        failures++;
+    }
+
+    nvs_flash_erase();
+    rmdir(nvs_dir);
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", sdcard_dir);
+    unlink(path);
+    rmdir(sdcard_dir);
+
+    if (failures != 0)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,328 @@
+// Benchmark: reloading the settings on a running box
+//-----------------------------------
+// Boots the firmware in a forked process against a stand-in Videohub on localhost, with the
+// config file read off the card. Once the router's route is lit, the panel's sources are
+// changed on the card and "reload" is sent to the diagnostics port:
+//   sources - the new file is put in use without a restart. Times the command to the LED
+//             showing the router's route on its new button, and checks the router connection
+//             stayed up - not closed, and no second connection
+//   routers - a file moving the router to another port restarts the box, as the connections
+//             are set up from it. Checks the box restarts, and the next boot takes the new
+//             file from the cache and connects to the new port
+// Run RELOADS times, alternating the two sets of sources, for the median.
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "host_shim.h"
+#include "diagnostics.h"
+#include "pindefs.h"
+
+#define RELOADS 20
+#define TIMEOUT_US 5000000
+#define RELOAD_BOUND_US 50000 // Command to LED - reading the card, the cache write and the logic
+
+#define ROUTE_INPUT 4 // Zero based input the stand-in router has on the panel's destination
+
+// Source 5 is on button 5 in the first set, button 1 in the second
+static const char *const source_sets[2] = {"1,2,3,4,5,6", "5,6,7,8,9,10"};
+static const int route_leds[2] = {5, 1};
+
+// What the box's panel LEDs showed, and when - written down a pipe by the box
+struct Led_Event {
+    int64_t time_us;
+    int code;
+};
+
+static int listeners[2];
+static int router_ports[2];
+static char sdcard_dir[64];
+static char nvs_dir[64];
+
+// In the box's process - reports every change to its panel LEDs
+static int box_report_fd;
+static int box_led_code = 0;
+
+static void box_led_hook(int pin, int level)
+{
+    if (pin != PIN_LED_A && pin != PIN_LED_B && pin != PIN_LED_C)
+    {
+        return;
+    }
+    int code = host_gpio_get_output(PIN_LED_A) | (host_gpio_get_output(PIN_LED_B) << 1) | (host_gpio_get_output(PIN_LED_C) << 2);
+    if (code != box_led_code)
+    {
+        box_led_code = code;
+        struct Led_Event event = {.time_us = host_time_us(), .code = code};
+        if (write(box_report_fd, &event, sizeof(event)) != sizeof(event))
+        {
+            _exit(1);
+        }
+    }
+}
+
+static int open_listener(int *port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = 0};
+    socklen_t address_length = sizeof(address);
+    if (bind(sock, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(sock, 1) != 0
+        || getsockname(sock, (struct sockaddr *)&address, &address_length) != 0)
+    {
+        perror("listen");
+        return -1;
+    }
+    *port = ntohs(address.sin_port);
+    return sock;
+}
+
+static int write_config(int sources, int router)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", sdcard_dir);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror("fopen");
+        return 0;
+    }
+    fprintf(f, "routing_sources = %s\nrouting_destination = 1\nroute_sharing = off\n"
+               "router_ip = 127.0.0.1\nrouter_port = %d\n", source_sets[sources], router_ports[router]);
+    fclose(f);
+    return 1;
+}
+
+static pid_t start_box(int *report_fd)
+{
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0)
+    {
+        perror("pipe");
+        return -1;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(pipe_fds[0]);
+        close(listeners[0]);
+        close(listeners[1]);
+        box_report_fd = pipe_fds[1];
+        esp_log_level_set("*", ESP_LOG_NONE);
+        host_gpio_set_output_hook(box_led_hook);
+        host_set_sdcard_dir(sdcard_dir);
+        host_set_nvs_dir(nvs_dir);
+        host_start_app();
+        while (1)
+        {
+            pause();
+        }
+    }
+    close(pipe_fds[1]);
+    *report_fd = pipe_fds[0];
+    return pid;
+}
+
+// Waits for the box's LED to show a code - the time it did, 0 if it didn't
+static int64_t wait_for_led(int report_fd, int code)
+{
+    int64_t end = host_time_us() + TIMEOUT_US;
+    while (host_time_us() < end)
+    {
+        struct pollfd pfd = {.fd = report_fd, .events = POLLIN};
+        struct Led_Event event;
+        if (poll(&pfd, 1, (int)((end - host_time_us()) / 1000) + 1) > 0 && read(report_fd, &event, sizeof(event)) == sizeof(event)
+            && event.code == code)
+        {
+            return event.time_us;
+        }
+    }
+    return 0;
+}
+
+// Takes the box's connection on a router and sends a status dump
+static int accept_router(int router)
+{
+    struct pollfd pfd = {.fd = listeners[router], .events = POLLIN};
+    if (poll(&pfd, 1, TIMEOUT_US / 1000) <= 0)
+    {
+        return -1;
+    }
+    int sock = accept(listeners[router], NULL, NULL);
+    char dump[128];
+    snprintf(dump, sizeof(dump), "PROTOCOL PREAMBLE:\nVersion: 2.8\n\nVIDEO OUTPUT ROUTING:\n0 %d\n\nEND PRELUDE:\n\n", ROUTE_INPUT);
+    send(sock, dump, strlen(dump), MSG_NOSIGNAL);
+    return sock;
+}
+
+// Sends "reload" to the box's diagnostics port - returns the connection for the answer
+// The port opens last at boot, so may not be open yet when the LED first lights
+static int send_reload(void)
+{
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = htons(DIAG_TCP_PORT)};
+    int64_t end = host_time_us() + TIMEOUT_US;
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    while (connect(sock, (struct sockaddr *)&address, sizeof(address)) != 0 && errno == ECONNREFUSED && host_time_us() < end)
+    {
+        close(sock);
+        usleep(1000);
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+    }
+    if (send(sock, "reload\n", 7, MSG_NOSIGNAL) != 7)
+    {
+        perror("diagnostics port");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static void read_answer(int sock, char *answer, size_t size)
+{
+    struct pollfd pfd = {.fd = sock, .events = POLLIN};
+    answer[0] = '\0';
+    if (poll(&pfd, 1, TIMEOUT_US / 1000) > 0)
+    {
+        ssize_t length = recv(sock, answer, size - 1, 0);
+        answer[(length > 0) ? length : 0] = '\0';
+    }
+    close(sock);
+}
+
+// 1 if the router connection is still up and the box hasn't opened another - whatever the box
+// has sent on it is read and thrown away
+static int router_connection_kept(int sock, int router)
+{
+    char buffer[256];
+    ssize_t length;
+    while ((length = recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+    {
+    }
+    struct pollfd pfd = {.fd = listeners[router], .events = POLLIN};
+    return length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && poll(&pfd, 1, 0) == 0;
+}
+
+static int compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+int main(void)
+{
+    listeners[0] = open_listener(&router_ports[0]);
+    listeners[1] = open_listener(&router_ports[1]);
+    snprintf(sdcard_dir, sizeof(sdcard_dir), "/tmp/bench_reload_sd_XXXXXX");
+    snprintf(nvs_dir, sizeof(nvs_dir), "/tmp/bench_reload_nvs_XXXXXX");
+    if (listeners[0] < 0 || listeners[1] < 0 || mkdtemp(sdcard_dir) == NULL || mkdtemp(nvs_dir) == NULL || !write_config(0, 0))
+    {
+        perror("setup");
+        return 1;
+    }
+
+    int failures = 0;
+    int report_fd;
+    pid_t pid = start_box(&report_fd);
+    int router_sock = accept_router(0);
+    if (router_sock < 0 || wait_for_led(report_fd, route_leds[0]) == 0)
+    {
+        printf("Box didn't light the router's route\n");
+        failures++;
+    }
+
+    // Panel sources changed - in use without a restart
+    static int64_t reload_times[RELOADS];
+    int reloaded = 0;
+    char answer[256];
+    for (int reload = 0; reload < RELOADS && failures == 0; reload++)
+    {
+        int sources = (reload + 1) % 2;
+        write_config(sources, 0);
+        int64_t start = host_time_us();
+        int diag_sock = send_reload();
+        int64_t lit = wait_for_led(report_fd, route_leds[sources]);
+        read_answer(diag_sock, answer, sizeof(answer));
+        if (lit == 0 || strstr(answer, "changed and in use") == NULL || !router_connection_kept(router_sock, 0))
+        {
+            answer[strcspn(answer, "\n")] = '\0';
+            printf("Reload %d: LED %s, answer '%s', router connection %s\n", reload + 1, lit ? "lit" : "not lit",
+                   answer, router_connection_kept(router_sock, 0) ? "kept" : "disturbed");
+            failures++;
+            break;
+        }
+        reload_times[reloaded++] = lit - start;
+    }
+
+    printf("Settings reload on a running box, median of %d\n", RELOADS);
+    if (reloaded > 0)
+    {
+        qsort(reload_times, reloaded, sizeof(reload_times[0]), compare_int64);
+        printf("  command to LED   %8.1f ms (bound %.1f ms), router connection kept\n", reload_times[reloaded / 2] / 1000.0, RELOAD_BOUND_US / 1000.0);
+        if (reload_times[reloaded / 2] > RELOAD_BOUND_US)
+        {
+            failures++;
+        }
+    }
+
+    // Router moved - the box restarts, and comes back up on the new port from the cache
+    int restarted = 0;
+    if (failures == 0)
+    {
+        write_config(0, 1);
+        read_answer(send_reload(), answer, sizeof(answer));
+        int status;
+        restarted = waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 3;
+        close(report_fd);
+        close(router_sock);
+        pid = restarted ? start_box(&report_fd) : pid;
+        router_sock = restarted ? accept_router(1) : -1;
+        if (!restarted || router_sock < 0 || wait_for_led(report_fd, route_leds[0]) == 0)
+        {
+            printf("Router change: box %s, %s\n", restarted ? "restarted" : "didn't restart", (router_sock >= 0) ? "connected to the new port" : "didn't connect");
+            failures++;
+        }
+        else
+        {
+            printf("  router change    box restarted, connected to the new port\n");
+        }
+    }
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    close(report_fd);
+    if (router_sock >= 0)
+    {
+        close(router_sock);
+    }
+
+    char path[128];
+    snprintf(path, sizeof(path), "%s/settings.cache", nvs_dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/routes.last", nvs_dir);
+    unlink(path);
+    rmdir(nvs_dir);
+    snprintf(path, sizeof(path), "%s/config.txt", sdcard_dir);
+    unlink(path);
+    rmdir(sdcard_dir);
+
+    if (failures != 0)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,405 @@
+// Benchmark: Show Relay salvo - one block to the router, contactor in step with its ACK
+//-----------------------------------
+// Boots the whole firmware against a stand-in Videohub on localhost with sixteen show relay
+// outputs and a panel following the relay, then presses the Main/IR button repeatedly. The
+// stand-in holds each salvo back so the firmware can be checked at every step:
+//   - every output arrives in a single routing block, for the right camera
+//   - the IR contactor doesn't move until the router ACKs, and doesn't move at all on a NAK
+// and measures press to salvo at the router, ACK to contactor, and the firmware's own figure
+// for the skew between the first and last output confirm - with the router confirming the
+// whole salvo in one block, and one output at a time 2 ms apart.
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "host_shim.h"
+#include "pindefs.h"
+#include "latency.h"
+#include "videohub_protocol.h"
+
+#define TRIALS 8
+#define MAIN_CAMERA 10 // Labeled 1-288, as in the config file
+#define IR_CAMERA 11
+#define RELAY_FIRST_OUTPUT 20
+#define RELAY_OUTPUTS 16
+#define PANEL_DESTINATION 1
+#define SALVO_OUTPUTS (RELAY_OUTPUTS + 1) // Show relay outputs and the following panel
+#define SALVO_TIMEOUT_US 2000000
+#define SPREAD_GAP_US 2000
+
+// Stand-in router: answers single routes and status requests itself, holds salvos back
+struct Router_Stub {
+    int sock;
+    struct Videohub_Parser_Struct parser;
+    uint16_t routes[300];      // What the stub has on each output (zero based)
+    int block_routes;          // Routes in the block being read
+    uint16_t block_outputs[64];
+    uint16_t block_inputs[64];
+    int salvos;                // Salvo blocks received since last checked
+    int salvo_routes;          // Routes in the last one
+    uint16_t salvo_outputs[64];
+    uint16_t salvo_inputs[64];
+    int64_t salvo_time;
+};
+
+static volatile int64_t contactor_change_time = 0;
+
+static void contactor_hook(int pin, int level)
+{
+    (void)level;
+    if (pin == PIN_IR_CONTACTOR)
+    {
+        contactor_change_time = host_time_us();
+    }
+}
+
+static int contactor_on(void)
+{
+    return host_gpio_get_output(PIN_IR_CONTACTOR) == IR_CONTACTOR_ON_LEVEL;
+}
+
+static void send_text(struct Router_Stub *stub, const char *text)
+{
+    if (send(stub->sock, text, strlen(text), 0) < 0)
+    {
+        perror("send");
+    }
+}
+
+static void router_event(const struct Videohub_Event_Struct *event, void *context)
+{
+    struct Router_Stub *stub = context;
+    char reply[96];
+
+    if (event->type == VH_EVT_ROUTE && event->block == VH_BLOCK_OUTPUT_ROUTING && stub->block_routes < 64)
+    {
+        stub->block_outputs[stub->block_routes] = event->index;
+        stub->block_inputs[stub->block_routes] = event->value;
+        stub->block_routes++;
+    }
+    else if (event->type == VH_EVT_BLOCK_END && event->block == VH_BLOCK_OUTPUT_ROUTING)
+    {
+        if (stub->block_routes == 0)
+        {
+            // Empty block is a status request - only the first relay output matters here
+            snprintf(reply, sizeof(reply), "ACK\n\nVIDEO OUTPUT ROUTING:\n%d %u\n\n", RELAY_FIRST_OUTPUT - 1, stub->routes[RELAY_FIRST_OUTPUT - 1]);
+            send_text(stub, reply);
+        }
+        else if (stub->block_routes == 1)
+        {
+            // A panel button - take it straight away
+            stub->routes[stub->block_outputs[0]] = stub->block_inputs[0];
+            snprintf(reply, sizeof(reply), "ACK\n\nVIDEO OUTPUT ROUTING:\n%u %u\n\n", stub->block_outputs[0], stub->block_inputs[0]);
+            send_text(stub, reply);
+        }
+        else
+        {
+            stub->salvos++;
+            stub->salvo_routes = stub->block_routes;
+            memcpy(stub->salvo_outputs, stub->block_outputs, sizeof(stub->salvo_outputs));
+            memcpy(stub->salvo_inputs, stub->block_inputs, sizeof(stub->salvo_inputs));
+            stub->salvo_time = host_time_us();
+        }
+        stub->block_routes = 0;
+    }
+}
+
+// Reads whatever the firmware has sent, for up to timeout_us
+static void router_poll(struct Router_Stub *stub, int64_t timeout_us)
+{
+    struct pollfd pfd = {.fd = stub->sock, .events = POLLIN};
+    int timeout_ms = (int)((timeout_us + 999) / 1000);
+    if (poll(&pfd, 1, timeout_ms) > 0)
+    {
+        uint8_t buffer[1024];
+        ssize_t length = recv(stub->sock, buffer, sizeof(buffer), 0);
+        if (length > 0)
+        {
+            videohub_parser_feed(&stub->parser, buffer, length);
+        }
+    }
+}
+
+static void router_poll_for(struct Router_Stub *stub, int64_t duration_us)
+{
+    int64_t end = host_time_us() + duration_us;
+    while (host_time_us() < end)
+    {
+        router_poll(stub, end - host_time_us());
+    }
+}
+
+// Confirms the held salvo, in one block or an output at a time
+static void router_confirm_salvo(struct Router_Stub *stub, int spread)
+{
+    char reply[2048];
+    size_t length = snprintf(reply, sizeof(reply), "VIDEO OUTPUT ROUTING:\n");
+    for (int route = 0; route < stub->salvo_routes; route++)
+    {
+        stub->routes[stub->salvo_outputs[route]] = stub->salvo_inputs[route];
+        if (spread)
+        {
+            snprintf(reply, sizeof(reply), "VIDEO OUTPUT ROUTING:\n%u %u\n\n", stub->salvo_outputs[route], stub->salvo_inputs[route]);
+            send_text(stub, reply);
+            usleep(SPREAD_GAP_US);
+            continue;
+        }
+        length += snprintf(reply + length, sizeof(reply) - length, "%u %u\n", stub->salvo_outputs[route], stub->salvo_inputs[route]);
+    }
+    if (!spread)
+    {
+        snprintf(reply + length, sizeof(reply) - length, "\n");
+        send_text(stub, reply);
+    }
+}
+
+// Presses the Main/IR button and waits for the salvo, returns 0 if it never came
+static int press_relay(struct Router_Stub *stub, int64_t *pressed)
+{
+    stub->salvos = 0;
+    *pressed = host_time_us();
+    host_gpio_set_input(PIN_SHOW_RELAY_BUTTON, 0);
+    router_poll_for(stub, 30000);
+    host_gpio_set_input(PIN_SHOW_RELAY_BUTTON, 1);
+
+    int64_t give_up = *pressed + SALVO_TIMEOUT_US;
+    while (stub->salvos == 0 && host_time_us() < give_up)
+    {
+        router_poll(stub, give_up - host_time_us());
+    }
+    router_poll_for(stub, 20000); // Catch a second block, if the salvo was split
+    return stub->salvos != 0;
+}
+
+// Checks the salvo held by the stub is whole and for the right camera
+static int salvo_is_whole(const struct Router_Stub *stub, int ir)
+{
+    if (stub->salvos != 1 || stub->salvo_routes != SALVO_OUTPUTS)
+    {
+        printf("Salvo arrived as %d blocks, last with %d of %d outputs\n", stub->salvos, stub->salvo_routes, SALVO_OUTPUTS);
+        return 0;
+    }
+    for (int route = 0; route < stub->salvo_routes; route++)
+    {
+        if (stub->salvo_inputs[route] != (ir ? IR_CAMERA : MAIN_CAMERA) - 1)
+        {
+            printf("Salvo output %u went to input %u\n", stub->salvo_outputs[route] + 1, stub->salvo_inputs[route] + 1);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// The firmware's own salvo skew, from a latency table holding a single salvo
+static double firmware_skew_ms(void)
+{
+    char table[1024];
+    latency_dump(table, sizeof(table));
+    char *row = strstr(table, "salvo skew");
+    unsigned int count, p50, p99, max;
+    if (row == NULL || sscanf(row + strlen("salvo skew"), "%u %u %u %u", &count, &p50, &p99, &max) != 4 || count != 1)
+    {
+        return -1;
+    }
+    return max / 1000.0;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_row(const char *name, double *times, int count)
+{
+    if (count == 0)
+    {
+        printf("%-28s %8s\n", name, "failed");
+        return;
+    }
+    qsort(times, count, sizeof(double), compare_doubles);
+    printf("%-28s %8.2f %8.2f %8.2f\n", name, times[0], times[count / 2], times[count - 1]);
+}
+
+static int write_config(char *dir, size_t dir_size, int port)
+{
+    snprintf(dir, dir_size, "/tmp/bench_show_relay_XXXXXX");
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return 0;
+    }
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", dir);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror("fopen");
+        return 0;
+    }
+    fprintf(f, "routing_sources = 1,2,relay\nrouting_destination = %d\nroute_trigger = press\n", PANEL_DESTINATION);
+    fprintf(f, "show_relay_main = %d\nshow_relay_ir = %d\nshow_relay_outputs = ", MAIN_CAMERA, IR_CAMERA);
+    for (int output = 0; output < RELAY_OUTPUTS; output++)
+    {
+        fprintf(f, "%s%d", (output == 0) ? "" : ",", RELAY_FIRST_OUTPUT + output);
+    }
+    fprintf(f, "\nrouter_ip = 127.0.0.1\nrouter_port = %d\n", port);
+    fclose(f);
+    return 1;
+}
+
+int main(void)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = 0};
+    socklen_t address_length = sizeof(address);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 1) != 0
+        || getsockname(listener, (struct sockaddr *)&address, &address_length) != 0)
+    {
+        perror("listen");
+        return 1;
+    }
+
+    char dir[64];
+    if (!write_config(dir, sizeof(dir), ntohs(address.sin_port)))
+    {
+        return 1;
+    }
+
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    host_set_sdcard_dir(dir);
+    host_gpio_set_output_hook(contactor_hook);
+    host_start_app();
+
+    struct pollfd pfd = {.fd = listener, .events = POLLIN};
+    if (poll(&pfd, 1, 5000) <= 0)
+    {
+        printf("FAILED: firmware never connected\n");
+        return 1;
+    }
+
+    static struct Router_Stub stub;
+    stub.sock = accept(listener, NULL, NULL);
+    for (int output = 0; output < 300; output++)
+    {
+        stub.routes[output] = MAIN_CAMERA - 1;
+    }
+    videohub_parser_init(&stub.parser, router_event, &stub);
+    send_text(&stub, "PROTOCOL PREAMBLE:\nVersion: 2.8\n\nEND PRELUDE:\n\n");
+    router_poll_for(&stub, 300000);
+
+    // Panel follows the relay from its relay button on
+    host_gpio_set_input(PIN_BUTTON_3, 0);
+    router_poll_for(&stub, 30000);
+    host_gpio_set_input(PIN_BUTTON_3, 1);
+    router_poll_for(&stub, 100000);
+
+    int failures = 0;
+    int ir = 0;
+    double press_to_salvo[2 * TRIALS];
+    double ack_to_contactor[2 * TRIALS];
+    double skew[2][TRIALS];
+    int press_count = 0;
+    int skew_count[2] = {0, 0};
+
+    printf("Show Relay: %d outputs per salvo, %d switches per confirm pattern\n", SALVO_OUTPUTS, TRIALS);
+
+    for (int spread = 0; spread < 2 && failures == 0; spread++)
+    {
+        for (int trial = 0; trial < TRIALS; trial++)
+        {
+            int64_t pressed;
+            if (!press_relay(&stub, &pressed) || !salvo_is_whole(&stub, !ir))
+            {
+                failures++;
+                break;
+            }
+            press_to_salvo[press_count] = (stub.salvo_time - pressed) / 1000.0;
+
+            // Nothing moves until the router has answered
+            router_poll_for(&stub, 20000);
+            if (contactor_on() != ir)
+            {
+                printf("Contactor switched before the router ACKed\n");
+                failures++;
+                break;
+            }
+
+            latency_reset();
+            contactor_change_time = 0;
+            int64_t acked = host_time_us();
+            send_text(&stub, "ACK\n\n");
+            router_confirm_salvo(&stub, spread);
+            ir = !ir;
+            router_poll_for(&stub, 50000);
+            if (contactor_on() != ir || contactor_change_time == 0)
+            {
+                printf("Contactor didn't follow the ACK\n");
+                failures++;
+                break;
+            }
+            ack_to_contactor[press_count++] = (contactor_change_time - acked) / 1000.0;
+
+            double trial_skew = firmware_skew_ms();
+            if (trial_skew < 0)
+            {
+                printf("No salvo skew recorded\n");
+                failures++;
+                break;
+            }
+            skew[spread][skew_count[spread]++] = trial_skew;
+        }
+    }
+
+    // A refused salvo leaves the contactor alone, and the next press asks for the same camera
+    if (failures == 0)
+    {
+        int64_t pressed;
+        if (!press_relay(&stub, &pressed) || !salvo_is_whole(&stub, !ir))
+        {
+            failures++;
+        }
+        else
+        {
+            send_text(&stub, "NAK\n\n");
+            router_poll_for(&stub, 50000);
+            if (contactor_on() != ir)
+            {
+                printf("Contactor switched on a NAK\n");
+                failures++;
+            }
+            else if (!press_relay(&stub, &pressed) || !salvo_is_whole(&stub, !ir))
+            {
+                printf("Salvo after a NAK was for the wrong camera\n");
+                failures++;
+            }
+        }
+    }
+
+    printf("%-28s %8s %8s %8s\n", "", "min ms", "med ms", "max ms");
+    print_row("press to salvo at router", press_to_salvo, press_count);
+    print_row("ACK to contactor", ack_to_contactor, press_count);
+    print_row("skew, one confirm block", skew[0], skew_count[0]);
+    print_row("skew, confirms 2 ms apart", skew[1], skew_count[1]);
+
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", dir);
+    unlink(path);
+    rmdir(dir);
+
+    if (failures != 0)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+// Benchmark: cost of recording an event in the trace ring against logging it as text
+//-----------------------------------
+// Times trace_record() for the events on the packet path, and the ESP_LOGI lines they replaced
+// (with the log sent to /dev/null, so this is only the formatting and write cost - on the box
+// the UART adds the bytes' transmit time on top, shown in the last column). Then fills the
+// ring past its end and checks that reading it back gives every record still held, in order,
+// with the overwritten ones noted.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_log.h"
+#include "trace.h"
+
+#define ITERATIONS 200000
+#define UART_BAUD 115200
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int check_readback(void)
+{
+    const uint32_t extra = 37;
+    uint32_t start = trace_position();
+    for (uint32_t i = 0; i < TRACE_RING_LENGTH + extra; i++)
+    {
+        trace_record(TRACE_EVT_CONFIRM, i & 0xffff, i, 0);
+    }
+
+    static char buffer[64 * 1024];
+    size_t used = 0;
+    uint32_t cursor = start;
+    size_t length;
+    while ((length = trace_format(&cursor, buffer + used, sizeof(buffer) - used)) > 0)
+    {
+        used += length;
+    }
+
+    // Expect the overwritten note, then the last TRACE_RING_LENGTH records in order
+    char expected[64];
+    snprintf(expected, sizeof(expected), "... %u older events overwritten\n", extra);
+    if (strncmp(buffer, expected, strlen(expected)) != 0)
+    {
+        fprintf(stderr, "Overwritten note missing: %.60s\n", buffer);
+        return 0;
+    }
+    uint32_t lines = 0;
+    uint32_t next = extra;
+    for (char *line = strchr(buffer, '\n') + 1; *line != '\0'; line = strchr(line, '\n') + 1)
+    {
+        unsigned output;
+        unsigned input;
+        if (sscanf(line, "%*u route confirm output %u input %u", &output, &input) != 2 || input != next || output != (next & 0xffff))
+        {
+            fprintf(stderr, "Record %u read back wrong: %.60s\n", next, line);
+            return 0;
+        }
+        next++;
+        lines++;
+    }
+    if (lines != TRACE_RING_LENGTH || cursor != trace_position())
+    {
+        fprintf(stderr, "Read back %u records, expected %u\n", lines, TRACE_RING_LENGTH);
+        return 0;
+    }
+    return 1;
+}
+
+int main(void)
+{
+    // A typical chunk of routing status as received from the router
+    char payload[160];
+    int payload_length = 0;
+    payload_length += snprintf(payload, sizeof(payload), "VIDEO OUTPUT ROUTING:\n");
+    for (int output = 0; payload_length < 140; output++)
+    {
+        payload_length += snprintf(payload + payload_length, sizeof(payload) - payload_length, "%d %d\n", output, (output * 37) % 288);
+    }
+
+    if (freopen("/dev/null", "w", stderr) == NULL)
+    {
+        perror("freopen");
+        return 1;
+    }
+    esp_log_level_set("*", ESP_LOG_INFO);
+
+    printf("Trace ring: %d records of %zu bytes, %d iterations\n", TRACE_RING_LENGTH, sizeof(struct Trace_Record_Struct), ITERATIONS);
+    printf("%-34s %10s %14s\n", "event", "ns each", "UART us each");
+
+    // Received data - the old code logged the length, then the whole payload
+    double start = now_seconds();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        ESP_LOGI("ethernet", "Received %d bytes:", payload_length);
+        ESP_LOGI("ethernet", "%.*s", payload_length, payload);
+    }
+    double log_received = (now_seconds() - start) / ITERATIONS;
+    size_t received_bytes = strlen("I (12345) ethernet: Received 144 bytes:\n") + strlen("I (12345) ethernet: \n") + payload_length;
+
+    start = now_seconds();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        trace_record(TRACE_EVT_RECEIVED, payload_length, 0, 0);
+    }
+    double trace_received = (now_seconds() - start) / ITERATIONS;
+
+    // Route confirm - two lines per confirm, so 576 for a 288 output status dump
+    start = now_seconds();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        ESP_LOGI("ethernet", "Route confirm received! Output: %u Input %"PRIu32, i % 288, (uint32_t)(i % 40));
+        ESP_LOGI("ethernet", "Sending message from route confirm %i,%i,%i", 1, i % 288, i % 40);
+    }
+    double log_confirm = (now_seconds() - start) / ITERATIONS;
+    size_t confirm_bytes = strlen("I (12345) ethernet: Route confirm received! Output: 123 Input 12\n")
+                         + strlen("I (12345) ethernet: Sending message from route confirm 1,123,12\n");
+
+    start = now_seconds();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        trace_record(TRACE_EVT_CONFIRM, i % 288, i % 40, 0);
+    }
+    double trace_confirm = (now_seconds() - start) / ITERATIONS;
+
+    double uart_us_per_byte = 10.0 * 1e6 / UART_BAUD;
+    printf("%-34s %10.0f %14.0f\n", "received, ESP_LOGI + payload", log_received * 1e9, received_bytes * uart_us_per_byte);
+    printf("%-34s %10.0f %14s\n", "received, trace_record", trace_received * 1e9, "0");
+    printf("%-34s %10.0f %14.0f\n", "route confirm, 2 x ESP_LOGI", log_confirm * 1e9, confirm_bytes * uart_us_per_byte);
+    printf("%-34s %10.0f %14s\n", "route confirm, trace_record", trace_confirm * 1e9, "0");
+    printf("288 output status dump: %.1f ms of UART time logged, %.3f ms traced\n",
+           288 * confirm_bytes * uart_us_per_byte / 1000.0, 288 * trace_confirm * 1000.0);
+
+    if (!check_readback())
+    {
+        printf("FAILED: trace ring read back wrong\n");
+        return 1;
+    }
+    return 0;
+}
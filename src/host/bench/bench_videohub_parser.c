@@ -0,0 +1,171 @@
+// Benchmark: Videohub protocol parser throughput on a full 288x288 status dump
+//-----------------------------------
+// Builds the dump a Videohub Universal Videohub 288 sends on connect (preamble, device, input and
+// output labels, locks, routing, END PRELUDE) and feeds it through the parser whole, at TCP MSS
+// sized chunks, and at awkward small chunk sizes. Every event is counted and checked, so a
+// parser regression shows up as a failure here rather than just a number.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "videohub_protocol.h"
+
+#define ROUTER_SIZE 288
+
+struct Event_Counts {
+    uint32_t fields;
+    uint32_t input_labels;
+    uint32_t output_labels;
+    uint32_t locks;
+    uint32_t routes;
+    uint32_t route_check; // Sum of output ^ input over all routes, checked against the dump
+    uint32_t end_prelude;
+    uint32_t block_ends;
+};
+
+static void count_event(const struct Videohub_Event_Struct *event, void *context)
+{
+    struct Event_Counts *counts = context;
+    switch (event->type)
+    {
+    case VH_EVT_PREAMBLE_FIELD:
+    case VH_EVT_DEVICE_FIELD:
+        counts->fields++;
+        break;
+    case VH_EVT_INPUT_LABEL:
+        counts->input_labels++;
+        break;
+    case VH_EVT_OUTPUT_LABEL:
+        counts->output_labels++;
+        break;
+    case VH_EVT_OUTPUT_LOCK:
+        counts->locks++;
+        break;
+    case VH_EVT_ROUTE:
+        counts->routes++;
+        counts->route_check += event->index ^ event->value;
+        break;
+    case VH_EVT_END_PRELUDE:
+        counts->end_prelude++;
+        break;
+    case VH_EVT_BLOCK_END:
+        counts->block_ends++;
+        break;
+    default:
+        break;
+    }
+}
+
+static size_t build_dump(char *buffer, size_t size, uint32_t *route_check)
+{
+    size_t n = 0;
+    n += snprintf(buffer + n, size - n, "PROTOCOL PREAMBLE:\nVersion: 2.8\n\n");
+    n += snprintf(buffer + n, size - n, "VIDEOHUB DEVICE:\nDevice present: true\nModel name: Blackmagic Universal Videohub 288\n"
+                  "Friendly name: ADC Main Router\nUnique ID: 7C2E0D0A1B2C\nVideo inputs: %d\nVideo processing units: 0\n"
+                  "Video outputs: %d\nVideo monitoring outputs: 0\nSerial ports: 0\n\n", ROUTER_SIZE, ROUTER_SIZE);
+    n += snprintf(buffer + n, size - n, "INPUT LABELS:\n");
+    for (int i = 0; i < ROUTER_SIZE; i++)
+    {
+        n += snprintf(buffer + n, size - n, "%d Camera %d Stage Left Wide\n", i, i + 1);
+    }
+    n += snprintf(buffer + n, size - n, "\nOUTPUT LABELS:\n");
+    for (int i = 0; i < ROUTER_SIZE; i++)
+    {
+        n += snprintf(buffer + n, size - n, "%d Monitor %d Front of House\n", i, i + 1);
+    }
+    n += snprintf(buffer + n, size - n, "\nVIDEO OUTPUT LOCKS:\n");
+    for (int i = 0; i < ROUTER_SIZE; i++)
+    {
+        n += snprintf(buffer + n, size - n, "%d %c\n", i, (i % 7 == 0) ? 'L' : 'U');
+    }
+    n += snprintf(buffer + n, size - n, "\nVIDEO OUTPUT ROUTING:\n");
+    *route_check = 0;
+    for (int i = 0; i < ROUTER_SIZE; i++)
+    {
+        int input = (i * 37) % ROUTER_SIZE;
+        n += snprintf(buffer + n, size - n, "%d %d\n", i, input);
+        *route_check += i ^ input;
+    }
+    n += snprintf(buffer + n, size - n, "\nEND PRELUDE:\n\n");
+    return n;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int check_counts(const struct Event_Counts *counts, uint32_t route_check, int passes)
+{
+    int ok = counts->fields == (uint32_t)(10 * passes)
+          && counts->input_labels == (uint32_t)(ROUTER_SIZE * passes)
+          && counts->output_labels == (uint32_t)(ROUTER_SIZE * passes)
+          && counts->locks == (uint32_t)(ROUTER_SIZE * passes)
+          && counts->routes == (uint32_t)(ROUTER_SIZE * passes)
+          && counts->route_check == route_check * passes
+          && counts->end_prelude == (uint32_t)passes
+          && counts->block_ends == (uint32_t)(7 * passes);
+    if (!ok)
+    {
+        fprintf(stderr, "Event counts wrong: fields %u in %u out %u locks %u routes %u end %u blocks %u\n",
+                counts->fields, counts->input_labels, counts->output_labels, counts->locks, counts->routes,
+                counts->end_prelude, counts->block_ends);
+    }
+    return ok;
+}
+
+int main(void)
+{
+    static char dump[128 * 1024];
+    uint32_t route_check;
+    size_t dump_length = build_dump(dump, sizeof(dump), &route_check);
+    const size_t chunk_sizes[] = {0, 1440, 536, 64, 7, 1}; // 0 = whole dump in one call
+    const int target_bytes = 256 * 1024 * 1024;
+    int failures = 0;
+
+    printf("Videohub parser: %dx%d dump, %zu bytes, %d events per dump\n", ROUTER_SIZE, ROUTER_SIZE, dump_length, 4 * ROUTER_SIZE + 10 + 8);
+    printf("%-10s %12s %12s %14s\n", "chunk", "MB/s", "dumps/s", "events/s");
+
+    for (size_t c = 0; c < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); c++)
+    {
+        size_t chunk = (chunk_sizes[c] == 0) ? dump_length : chunk_sizes[c];
+        int passes = target_bytes / (int)dump_length / ((chunk < 64) ? 8 : 1);
+
+        struct Event_Counts counts = {0};
+        struct Videohub_Parser_Struct parser;
+        videohub_parser_init(&parser, count_event, &counts);
+
+        double start = now_seconds();
+        for (int pass = 0; pass < passes; pass++)
+        {
+            for (size_t offset = 0; offset < dump_length; offset += chunk)
+            {
+                size_t length = (dump_length - offset < chunk) ? dump_length - offset : chunk;
+                videohub_parser_feed(&parser, (const uint8_t *)dump + offset, length);
+            }
+        }
+        double elapsed = now_seconds() - start;
+
+        if (!check_counts(&counts, route_check, passes) || parser.malformed_lines != 0)
+        {
+            failures++;
+        }
+
+        char label[16];
+        snprintf(label, sizeof(label), chunk_sizes[c] == 0 ? "whole" : "%zu", chunk);
+        double bytes = (double)dump_length * passes;
+        double events = (double)(counts.fields + counts.input_labels + counts.output_labels + counts.locks + counts.routes + counts.end_prelude + counts.block_ends);
+        printf("%-10s %12.1f %12.0f %14.0f\n", label, bytes / elapsed / 1e6, passes / elapsed, events / elapsed);
+    }
+
+    if (failures != 0)
+    {
+        printf("FAILED: %d chunk sizes produced wrong events\n", failures);
+        return 1;
+    }
+    return 0;
+}
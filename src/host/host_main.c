@@ -0,0 +1,133 @@
+// Host build entry point
+//-----------------------------------
+// Boots the firmware as a Linux process and drives the front panel from stdin:
+//   press <1-6>   hold a routing button down
+//   relay         hold the Show Relay Main/IR button down
+//   release       let go of all buttons
+//   link up|down  plug/unplug the Ethernet cable
+//   diag <cmd>    run a diagnostics port command (latency, stats, trace...)
+//   quit
+// LED and IR contactor changes are printed as they happen. The router address comes from the config file in
+// the SD card directory, so point it at a Videohub (or stand-in) on localhost.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host_shim.h"
+#include "pindefs.h"
+#include "diagnostics.h"
+
+static const int button_pins[] = {PIN_BUTTON_1, PIN_BUTTON_2, PIN_BUTTON_3, PIN_BUTTON_4, PIN_BUTTON_5, PIN_BUTTON_6};
+
+static void print_leds(int pin, int level)
+{
+    if (pin == PIN_IR_CONTACTOR)
+    {
+        printf("[%8.3f ms] IR contactor: %s\n", host_time_us() / 1000.0, (level == IR_CONTACTOR_ON_LEVEL) ? "on" : "off");
+        fflush(stdout);
+        return;
+    }
+    int lit = host_gpio_get_output(PIN_LED_A) | (host_gpio_get_output(PIN_LED_B) << 1) | (host_gpio_get_output(PIN_LED_C) << 2);
+    printf("[%8.3f ms] LED panel: %d\n", host_time_us() / 1000.0, lit);
+    fflush(stdout);
+}
+
+static int print_text(const char *text, size_t length, void *context)
+{
+    (void)context;
+    return fwrite(text, 1, length, stdout) == length;
+}
+
+static void release_all(void)
+{
+    for (size_t i = 0; i < sizeof(button_pins) / sizeof(button_pins[0]); i++)
+    {
+        host_gpio_set_input(button_pins[i], 1);
+    }
+    host_gpio_set_input(PIN_SHOW_RELAY_BUTTON, 1);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [--sdcard DIR | --no-sdcard] [--nvs DIR]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    const char *sdcard = getenv("BOXES_SDCARD");
+    if (sdcard == NULL)
+    {
+        sdcard = HOST_DEFAULT_SDCARD_DIR;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--sdcard") == 0 && i + 1 < argc)
+        {
+            sdcard = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-sdcard") == 0)
+        {
+            sdcard = NULL;
+        }
+        else if (strcmp(argv[i], "--nvs") == 0 && i + 1 < argc)
+        {
+            host_set_nvs_dir(argv[++i]);
+        }
+        else
+        {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    host_set_sdcard_dir(sdcard);
+    host_gpio_set_output_hook(print_leds);
+    release_all();
+    host_start_app();
+
+    char line[64];
+    while (fgets(line, sizeof(line), stdin) != NULL)
+    {
+        int button;
+        if (sscanf(line, "press %d", &button) == 1 && button >= 1 && button <= 6)
+        {
+            release_all();
+            host_gpio_set_input(button_pins[button - 1], 0);
+        }
+        else if (strncmp(line, "relay", 5) == 0)
+        {
+            release_all();
+            host_gpio_set_input(PIN_SHOW_RELAY_BUTTON, 0);
+        }
+        else if (strncmp(line, "release", 7) == 0)
+        {
+            release_all();
+        }
+        else if (strncmp(line, "link up", 7) == 0)
+        {
+            host_eth_set_link(1);
+        }
+        else if (strncmp(line, "link down", 9) == 0)
+        {
+            host_eth_set_link(0);
+        }
+        else if (strncmp(line, "diag ", 5) == 0)
+        {
+            diagnostics_command(line + 5, print_text, NULL);
+            fflush(stdout);
+        }
+        else if (strncmp(line, "quit", 4) == 0)
+        {
+            break;
+        }
+        else if (line[0] != '\n')
+        {
+            fprintf(stderr, "Unknown command: %s", line);
+        }
+    }
+    return 0;
+}
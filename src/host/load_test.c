@@ -0,0 +1,231 @@
+// Network load test
+//-----------------------------------
+// Boots the firmware against the Videohub emulator (a 288x288 router) and runs it through a set of
+// loads in turn, pressing a routing button every PRESS_INTERVAL_MS throughout:
+//   quiet        - nothing but the presses
+//   storm        - route changes from other clients all over the router
+//   panel storm  - route changes all on the first few outputs, the panel's destination among them
+//   slow writes  - the router's writes cut into small pieces with a wait between, under a storm
+//   disconnects  - the router dropping the connection every so often, under a storm
+// For each it reports the routing confirms the router sent a second, what the box's queues did
+// with them (messages turned away by the main logic's input event queue and by the router's output
+// queue, sends that had to wait for room in the input event queue, and confirms merged into a later
+// one for the same output before the main logic took them), press to the route command reaching
+// the router, and whether the panel ends up showing what the router has once the load stops. Then
+// the box's queue counters and its own latency figures over all the loads.
+// Fails if a press never reached the router, the input event queue turned anything away, or the
+// panel is left showing the wrong route.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "host_shim.h"
+#include "latency.h"
+#include "main.h"
+#include "pindefs.h"
+#include "queue_stats.h"
+#include "storage.h"
+#include "videohub_emulator.h"
+
+#define LOAD_MS 4000
+#define PRESS_INTERVAL_MS 250
+#define PRESS_MS 60
+#define COMMAND_TIMEOUT_US 2000000
+#define SETTLE_MS 1500 // After a load stops, for the box to catch up (and reconnect)
+#define MAX_PRESSES (LOAD_MS / PRESS_INTERVAL_MS + 1)
+
+static const int button_pins[] = {PIN_BUTTON_1, PIN_BUTTON_2, PIN_BUTTON_3, PIN_BUTTON_4, PIN_BUTTON_5, PIN_BUTTON_6};
+
+struct Load_Struct {
+    const char *name;
+    struct Videohub_Emulator_Config_Struct config;
+};
+
+static const struct Load_Struct loads[] = {
+    {"quiet", {.size = 288}},
+    {"storm", {.size = 288, .storm_interval_ms = 5, .storm_routes = 64}},
+    {"panel storm", {.size = 288, .storm_interval_ms = 5, .storm_routes = 64, .storm_outputs = 4}},
+    {"slow writes", {.size = 288, .storm_interval_ms = 20, .storm_routes = 32, .write_chunk = 7, .write_delay_us = 200}},
+    {"disconnects", {.size = 288, .storm_interval_ms = 10, .storm_routes = 32, .disconnect_ms = 700}},
+};
+
+static char sdcard_dir[64];
+
+static int write_config(int port)
+{
+    snprintf(sdcard_dir, sizeof(sdcard_dir), "/tmp/load_test_XXXXXX");
+    if (mkdtemp(sdcard_dir) == NULL)
+    {
+        perror("mkdtemp");
+        return 0;
+    }
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", sdcard_dir);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror("fopen");
+        return 0;
+    }
+    fprintf(f, "routing_sources = 1,2,3,4,5,6\nrouting_destination = 1\nroute_trigger = press\nrouter_ip = 127.0.0.1\nrouter_port = %d\n", port);
+    fclose(f);
+    return 1;
+}
+
+static int panel_led(void)
+{
+    return host_gpio_get_output(PIN_LED_A) | (host_gpio_get_output(PIN_LED_B) << 1) | (host_gpio_get_output(PIN_LED_C) << 2);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Presses a button and waits for a route command for output 0 - returns the time it took in ms,
+// or a negative number if none came (the route itself may already be stormed over)
+static double press(int button)
+{
+    int64_t pressed = host_time_us();
+    host_gpio_set_input(button_pins[button], 0);
+    usleep(PRESS_MS * 1000);
+    host_gpio_set_input(button_pins[button], 1);
+
+    int64_t command_time;
+    while ((command_time = videohub_emulator_command_time(0)) < pressed)
+    {
+        if (host_time_us() - pressed > COMMAND_TIMEOUT_US)
+        {
+            return -1.0;
+        }
+        usleep(500);
+    }
+    return (command_time - pressed) / 1000.0;
+}
+
+int main(void)
+{
+    struct Videohub_Emulator_Config_Struct quiet = loads[0].config;
+    int port = videohub_emulator_start(0, &quiet);
+    if (port < 0 || !write_config(port))
+    {
+        return 1;
+    }
+
+    esp_log_level_set("*", ESP_LOG_NONE);
+    host_set_sdcard_dir(sdcard_dir);
+    host_start_app();
+    usleep(SETTLE_MS * 1000);
+
+    printf("Load test: 288x288 router, a press every %d ms for %d ms under each load\n", PRESS_INTERVAL_MS, LOAD_MS);
+    printf("%-12s %11s %9s %9s %10s %9s %8s %9s %9s %9s  %s\n", "load", "confirms/s", "in drops", "in waits", "coalesced",
+           "out drops", "presses", "p50 ms", "max ms", "missed", "panel after");
+
+    int failures = 0;
+    int button = 0;
+    for (size_t load = 0; load < sizeof(loads) / sizeof(loads[0]); load++)
+    {
+        if (load == 1)
+        {
+            latency_reset(); // Box's own figures are over the loads only
+        }
+
+        struct Videohub_Emulator_Stats_Struct before;
+        struct Videohub_Emulator_Stats_Struct after;
+        struct Queue_Stats_Struct *input_queue = queue_stats_find_name("input event");
+        struct Queue_Stats_Struct *confirms = queue_stats_find_name("router 1 confirms");
+        struct Queue_Stats_Struct *output_queue = queue_stats_find_name("router 1 output");
+        unsigned int input_drops = atomic_load(&input_queue->dropped);
+        unsigned int input_waits = atomic_load(&input_queue->waited);
+        unsigned int coalesced = atomic_load(&confirms->coalesced);
+        unsigned int output_drops = atomic_load(&output_queue->dropped);
+        videohub_emulator_get_stats(&before);
+
+        videohub_emulator_configure(&loads[load].config);
+        int64_t start = host_time_us();
+        double times[MAX_PRESSES];
+        int presses = 0;
+        int missed = 0;
+        while (host_time_us() - start < LOAD_MS * 1000LL && presses + missed < MAX_PRESSES)
+        {
+            // The box doesn't send a route the router already has, so skip the button for it
+            int64_t press_start = host_time_us();
+            button = (button + 1) % PANEL_BUTTONS_MAX;
+            if (videohub_emulator_route(0) == button)
+            {
+                button = (button + 1) % PANEL_BUTTONS_MAX;
+            }
+            double time_ms = press(button);
+            if (time_ms < 0)
+            {
+                missed++;
+            }
+            else
+            {
+                times[presses++] = time_ms;
+            }
+            int64_t left_us = PRESS_INTERVAL_MS * 1000LL - (host_time_us() - press_start);
+            if (left_us > 0)
+            {
+                usleep(left_us);
+            }
+        }
+        double seconds = (host_time_us() - start) / 1000000.0;
+        videohub_emulator_configure(&quiet);
+        videohub_emulator_get_stats(&after);
+        usleep(SETTLE_MS * 1000);
+
+        input_drops = atomic_load(&input_queue->dropped) - input_drops;
+        input_waits = atomic_load(&input_queue->waited) - input_waits;
+        coalesced = atomic_load(&confirms->coalesced) - coalesced;
+        output_drops = atomic_load(&output_queue->dropped) - output_drops;
+
+        // Panel should show the router's route on its destination, if it is one of its sources
+        uint16_t route = videohub_emulator_route(0);
+        int expected = (route < PANEL_BUTTONS_MAX) ? route + 1 : 0;
+        int shown = panel_led();
+
+        qsort(times, presses, sizeof(double), compare_doubles);
+        printf("%-12s %11.0f %9u %9u %10u %9u %8d %9.2f %9.2f %9d  %s\n", loads[load].name,
+               (after.confirms_sent - before.confirms_sent) / seconds, input_drops, input_waits, coalesced, output_drops,
+               presses, (presses > 0) ? times[presses / 2] : 0.0, (presses > 0) ? times[presses - 1] : 0.0, missed,
+               (shown == expected) ? "right" : "WRONG");
+        if (missed != 0 || input_drops != 0 || shown != expected)
+        {
+            failures++;
+        }
+    }
+
+    struct Videohub_Emulator_Stats_Struct totals;
+    videohub_emulator_get_stats(&totals);
+    printf("Router: %"PRIu32" connections, %"PRIu32" dropped by it, %"PRIu32" dumps, %"PRIu32" commands acked, %"PRIu32" pings\n",
+           totals.connections, totals.disconnects, totals.dumps_sent, totals.commands_acked, totals.pings);
+
+    static char table[4096];
+    printf("Box's queues over the whole run:\n");
+    size_t length = queue_stats_dump(table, sizeof(table));
+    fwrite(table, 1, length, stdout);
+
+    printf("Box's own latency over the loads:\n");
+    length = latency_dump(table, sizeof(table));
+    fwrite(table, 1, length, stdout);
+
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", sdcard_dir);
+    unlink(path);
+    rmdir(sdcard_dir);
+
+    if (failures != 0)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,282 @@
+// RAM budget report
+//-----------------------------------
+// Boots the firmware with two stand-in routers on localhost, route sharing and a Show Relay, and
+// puts it through its paces - a full status dump from each router, every panel button, the Show
+// Relay, a cable pull, a settings reload and the diagnostics commands - so each task has been
+// down its deepest paths. Then prints the "ram" diagnostics answer: every task's stack against
+// the most of it used, and the RAM totals.
+// Stack use is the host's, built for x86-64 against glibc, so it is a guide to which tasks run
+// close to their stacks rather than the esp32's figure - ask a box for "ram" for that. Fails if a
+// task has used all of its stack here.
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "host_shim.h"
+#include "diagnostics.h"
+#include "pindefs.h"
+#include "route_store.h"
+#include "router_state.h"
+
+#define ROUTERS 2
+#define PRESS_MS 60
+#define ANSWER_QUIET_MS 300 // A diagnostics answer is complete once nothing more comes for this long
+
+static const int button_pins[] = {PIN_BUTTON_1, PIN_BUTTON_2, PIN_BUTTON_3, PIN_BUTTON_4, PIN_BUTTON_5, PIN_BUTTON_6};
+
+static int listeners[ROUTERS];
+static int router_ports[ROUTERS];
+static char sdcard_dir[64];
+static char nvs_dir[64];
+
+static int open_listener(int *port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = 0};
+    socklen_t address_length = sizeof(address);
+    if (bind(sock, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(sock, 4) != 0
+        || getsockname(sock, (struct sockaddr *)&address, &address_length) != 0)
+    {
+        perror("listen");
+        return -1;
+    }
+    *port = ntohs(address.sin_port);
+    return sock;
+}
+
+static int write_config(const char *sources)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "%s/config.txt", sdcard_dir);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror("fopen");
+        return 0;
+    }
+    fprintf(f, "routing_sources = %s\nrouting_destination = 1\nrouting_sources_2 = 1,2,3\nrouting_destination_2 = 2\nrouting_router_2 = 2\n"
+               "route_trigger = press\nroute_sharing = on\nshow_relay_main = 7\nshow_relay_ir = 8\nshow_relay_outputs = 10,11,12,13\n"
+               "router_ip = 127.0.0.1\nrouter_port = %d\nrouter_ip_2 = 127.0.0.1\nrouter_port_2 = %d\n",
+            sources, router_ports[0], router_ports[1]);
+    fclose(f);
+    return 1;
+}
+
+// Full 288x288 status dump, as a Videohub sends on connect
+static void send_dump(int sock)
+{
+    static char dump[ROUTER_OUTPUTS_MAX * 12 + 128];
+    size_t length = snprintf(dump, sizeof(dump), "PROTOCOL PREAMBLE:\nVersion: 2.8\n\nVIDEO OUTPUT ROUTING:\n");
+    for (int output = 0; output < ROUTER_OUTPUTS_MAX; output++)
+    {
+        length += snprintf(dump + length, sizeof(dump) - length, "%d %d\n", output, output % ROUTER_INPUTS_MAX);
+    }
+    length += snprintf(dump + length, sizeof(dump) - length, "\nEND PRELUDE:\n\n");
+    send(sock, dump, length, MSG_NOSIGNAL);
+}
+
+// Answers every block with ACK, and confirms the routes in it as a Videohub does
+static void answer_blocks(int sock, char *pending, size_t *used)
+{
+    char *end;
+    while ((end = strstr(pending, "\n\n")) != NULL)
+    {
+        end[1] = '\0';
+        send(sock, "ACK\n\n", 5, MSG_NOSIGNAL);
+        if (strncmp(pending, "VIDEO OUTPUT ROUTING:\n", 22) == 0 && end > pending + 22)
+        {
+            char update[1024];
+            int length = snprintf(update, sizeof(update), "%s\n", pending);
+            send(sock, update, (length < (int)sizeof(update)) ? length : (int)sizeof(update) - 1, MSG_NOSIGNAL);
+        }
+        size_t taken = (end + 2) - pending;
+        *used -= taken;
+        memmove(pending, end + 2, *used + 1);
+    }
+}
+
+// Stand-in routers - take the box's connections as often as it makes them
+static void *routers_thread(void *arg)
+{
+    int socks[ROUTERS] = {-1, -1};
+    static char pending[ROUTERS][4096];
+    size_t used[ROUTERS] = {0, 0};
+    while (1)
+    {
+        struct pollfd pfds[ROUTERS * 2];
+        for (int router = 0; router < ROUTERS; router++)
+        {
+            pfds[router] = (struct pollfd){.fd = listeners[router], .events = POLLIN};
+            pfds[ROUTERS + router] = (struct pollfd){.fd = socks[router], .events = POLLIN};
+        }
+        if (poll(pfds, ROUTERS * 2, -1) <= 0)
+        {
+            continue;
+        }
+        for (int router = 0; router < ROUTERS; router++)
+        {
+            if (pfds[router].revents & POLLIN)
+            {
+                if (socks[router] >= 0)
+                {
+                    close(socks[router]);
+                }
+                socks[router] = accept(listeners[router], NULL, NULL);
+                used[router] = 0;
+                send_dump(socks[router]);
+            }
+            else if (pfds[ROUTERS + router].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                ssize_t length = recv(socks[router], pending[router] + used[router], sizeof(pending[router]) - used[router] - 1, 0);
+                if (length <= 0)
+                {
+                    close(socks[router]);
+                    socks[router] = -1;
+                    continue;
+                }
+                used[router] += length;
+                pending[router][used[router]] = '\0';
+                answer_blocks(socks[router], pending[router], &used[router]);
+                if (used[router] == sizeof(pending[router]) - 1)
+                {
+                    used[router] = 0;
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+static void press(int pin)
+{
+    host_gpio_set_input(pin, 0);
+    usleep(PRESS_MS * 1000);
+    host_gpio_set_input(pin, 1);
+    usleep(PRESS_MS * 1000);
+}
+
+// Sends commands to the diagnostics port over the network, so they run on its own task, and
+// returns everything it answered
+static size_t diagnostics(const char *commands, char *answer, size_t size)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = htons(DIAG_TCP_PORT)};
+    size_t length = 0;
+    if (connect(sock, (struct sockaddr *)&address, sizeof(address)) == 0 && send(sock, commands, strlen(commands), MSG_NOSIGNAL) > 0)
+    {
+        struct pollfd pfd = {.fd = sock, .events = POLLIN};
+        ssize_t got;
+        while (length < size - 1 && poll(&pfd, 1, ANSWER_QUIET_MS) > 0 && (got = recv(sock, answer + length, size - 1 - length, 0)) > 0)
+        {
+            length += got;
+        }
+    }
+    answer[length] = '\0';
+    close(sock);
+    return length;
+}
+
+static void remove_files(void)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "%s/settings.cache", nvs_dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%s.%s", nvs_dir, ROUTE_STORE_NVS_NAMESPACE, ROUTE_STORE_NVS_KEY);
+    unlink(path);
+    rmdir(nvs_dir);
+    snprintf(path, sizeof(path), "%s/config.txt", sdcard_dir);
+    unlink(path);
+    rmdir(sdcard_dir);
+}
+
+int main(void)
+{
+    snprintf(sdcard_dir, sizeof(sdcard_dir), "/tmp/ram_report_sd_XXXXXX");
+    snprintf(nvs_dir, sizeof(nvs_dir), "/tmp/ram_report_nvs_XXXXXX");
+    for (int router = 0; router < ROUTERS; router++)
+    {
+        listeners[router] = open_listener(&router_ports[router]);
+    }
+    if (listeners[0] < 0 || listeners[1] < 0 || mkdtemp(sdcard_dir) == NULL || mkdtemp(nvs_dir) == NULL || !write_config("1,2,3,4,5,relay"))
+    {
+        perror("setup");
+        return 1;
+    }
+
+    pthread_t routers;
+    pthread_create(&routers, NULL, routers_thread, NULL);
+
+    // Logging as on a box, as formatting log lines is a good part of most tasks' stack - written
+    // away, and buffered so glibc doesn't format unbuffered output on the stack
+    if (freopen("/dev/null", "w", stderr) == NULL)
+    {
+        return 1;
+    }
+    setvbuf(stderr, NULL, _IOFBF, BUFSIZ);
+    esp_log_level_set("*", ESP_LOG_INFO);
+    host_set_sdcard_dir(sdcard_dir);
+    host_set_nvs_dir(nvs_dir);
+    host_start_app();
+    usleep(500000);
+
+    for (int button = 0; button < PANEL_BUTTONS_MAX; button++)
+    {
+        press(button_pins[button]);
+    }
+    press(PIN_SHOW_RELAY_BUTTON);
+    press(PIN_SHOW_RELAY_BUTTON);
+
+    host_eth_set_link(0);
+    usleep(200000);
+    host_eth_set_link(1);
+    usleep(500000);
+    for (int button = PANEL_BUTTONS_MAX - 1; button >= 0; button--)
+    {
+        press(button_pins[button]);
+    }
+
+    static char answer[16384];
+    write_config("6,5,4,3,2,1");
+    diagnostics("reload\nstats\nlatency\ntrace\n", answer, sizeof(answer));
+    usleep((ROUTE_STORE_SETTLE_MS + 500) * 1000); // The route store writes the routes
+
+    diagnostics("ram\n", answer, sizeof(answer));
+    printf("RAM budget - stacks as used on the host build, in bytes\n%s", answer);
+
+    // Task lines are "name stack peak free"
+    int failures = 0;
+    int tasks = 0;
+    for (char *line = strtok(answer, "\n"); line != NULL; line = strtok(NULL, "\n"))
+    {
+        char name[32];
+        unsigned int stack, peak, free_bytes;
+        if (sscanf(line, "%31s %u %u %u", name, &stack, &peak, &free_bytes) == 4)
+        {
+            tasks++;
+            if (free_bytes == 0)
+            {
+                printf("%s has used all of its stack\n", name);
+                failures++;
+            }
+        }
+    }
+
+    remove_files();
+    if (tasks == 0 || failures != 0)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
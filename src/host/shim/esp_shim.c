@@ -0,0 +1,1177 @@
+// Host shim: ESP-IDF component stand-ins (timer, log, system, gpio, event loop, netif/eth, SD card)
+//-----------------------------------
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <malloc.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_random.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_eth.h"
+#include "esp_vfs_fat.h"
+#include "esp_vfs_eventfd.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "driver/gpio.h"
+#include "host_shim.h"
+#include "pindefs.h"
+
+void app_main(void);
+
+// Time
+// =============================================================================
+
+static int64_t monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t boot_time_us = 0;
+
+// Power on is process start, so timing from here matches esp_timer on the device
+__attribute__((constructor)) static void record_boot_time(void)
+{
+    boot_time_us = monotonic_us();
+}
+
+int64_t host_boot_time_us(void)
+{
+    return boot_time_us;
+}
+
+int64_t host_time_us(void)
+{
+    return monotonic_us() - boot_time_us;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return host_time_us();
+}
+
+// esp_timer
+// =============================================================================
+
+// Armed timers are kept in a list, and a single "esp_timer" task sleeps until the earliest one is
+// due - callbacks run one at a time in that task, as ESP_TIMER_TASK dispatch does on the device
+
+struct host_esp_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    int64_t alarm_us;  // Time since boot the timer is next due
+    int64_t period_us; // 0 for one-shot
+    uint8_t active;
+    struct host_esp_timer *next; // Next in the list of all timers
+};
+
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_cond;
+static struct host_esp_timer *timer_list = NULL;
+static TaskHandle_t timer_task_handle = NULL;
+
+static void timer_task(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&timer_lock);
+    while (1)
+    {
+        struct host_esp_timer *due = NULL;
+        for (struct host_esp_timer *timer = timer_list; timer != NULL; timer = timer->next)
+        {
+            if (timer->active && (due == NULL || timer->alarm_us < due->alarm_us))
+            {
+                due = timer;
+            }
+        }
+
+        if (due == NULL)
+        {
+            pthread_cond_wait(&timer_cond, &timer_lock);
+            continue;
+        }
+        if (due->alarm_us > host_time_us())
+        {
+            int64_t deadline = host_boot_time_us() + due->alarm_us;
+            struct timespec ts = {.tv_sec = deadline / 1000000, .tv_nsec = (deadline % 1000000) * 1000};
+            pthread_cond_timedwait(&timer_cond, &timer_lock, &ts);
+            continue; // The list may have changed while waiting
+        }
+
+        if (due->period_us != 0)
+        {
+            due->alarm_us += due->period_us;
+        }
+        else
+        {
+            due->active = 0;
+        }
+        esp_timer_cb_t callback = due->callback;
+        void *callback_arg = due->arg;
+        pthread_mutex_unlock(&timer_lock);
+        callback(callback_arg);
+        pthread_mutex_lock(&timer_lock);
+    }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    if (create_args == NULL || create_args->callback == NULL || out_handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct host_esp_timer *timer = calloc(1, sizeof(struct host_esp_timer));
+    if (timer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+
+    pthread_mutex_lock(&timer_lock);
+    if (timer_task_handle == NULL)
+    {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&timer_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        xTaskCreate(timer_task, "esp_timer", 3584, NULL, 22, &timer_task_handle);
+    }
+    timer->next = timer_list;
+    timer_list = timer;
+    pthread_mutex_unlock(&timer_lock);
+
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t timer_start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&timer_lock);
+    if (timer->active)
+    {
+        pthread_mutex_unlock(&timer_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->alarm_us = host_time_us() + (int64_t)timeout_us;
+    timer->period_us = (int64_t)period_us;
+    timer->active = 1;
+    pthread_cond_signal(&timer_cond);
+    pthread_mutex_unlock(&timer_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return timer_start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return timer_start(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&timer_lock);
+    esp_err_t ret = timer->active ? ESP_OK : ESP_ERR_INVALID_STATE;
+    timer->active = 0;
+    pthread_mutex_unlock(&timer_lock);
+    return ret;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&timer_lock);
+    if (timer->active)
+    {
+        pthread_mutex_unlock(&timer_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (struct host_esp_timer **link = &timer_list; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == timer)
+        {
+            *link = timer->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&timer_lock);
+    free(timer);
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    pthread_mutex_lock(&timer_lock);
+    bool active = timer != NULL && timer->active;
+    pthread_mutex_unlock(&timer_lock);
+    return active;
+}
+
+// Errors, logging and system
+// =============================================================================
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+    default: return "UNKNOWN ERROR";
+    }
+}
+
+static esp_log_level_t log_level = (esp_log_level_t)CONFIG_LOG_DEFAULT_LEVEL;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    // Per tag levels are not needed on the host - "*" and any tag set the global level
+    (void)tag;
+    log_level = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    (void)tag;
+    if (level > log_level)
+    {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    pthread_mutex_lock(&log_lock);
+    vfprintf(stderr, format, args);
+    pthread_mutex_unlock(&log_lock);
+    va_end(args);
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return (uint32_t)(host_time_us() / 1000);
+}
+
+void esp_restart(void)
+{
+    fprintf(stderr, "host shim: esp_restart() called, exiting\n");
+    exit(3);
+}
+
+// Every process is its own box, so boxes on one host never pick the same number
+uint32_t esp_random(void)
+{
+    uint32_t value;
+    if (getrandom(&value, sizeof(value), 0) != sizeof(value))
+    {
+        value = (uint32_t)monotonic_us() ^ ((uint32_t)getpid() << 16);
+    }
+    return value;
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return 0;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return 0;
+}
+
+// Heap - what malloc has taken from the system, and how much of that is free. The lowest free
+// figure is only as good as how often it is asked for, unlike the esp32's
+static size_t heap_minimum_free = SIZE_MAX;
+
+size_t heap_caps_get_total_size(uint32_t caps)
+{
+    (void)caps;
+    struct mallinfo2 info = mallinfo2();
+    return info.arena + info.hblkhd;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    (void)caps;
+    size_t free_size = mallinfo2().fordblks;
+    if (free_size < heap_minimum_free)
+    {
+        heap_minimum_free = free_size;
+    }
+    return free_size;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    size_t free_size = heap_caps_get_free_size(caps);
+    return (heap_minimum_free < free_size) ? heap_minimum_free : free_size;
+}
+
+FILE *__real_fopen(const char *path, const char *mode);
+
+// NVS - blobs held in memory (a blank flash every run), or as files "<namespace>.<key>" in a
+// host directory so they survive from one run to the next
+// =============================================================================
+
+#define HOST_NVS_ENTRIES_MAX 32
+#define HOST_NVS_HANDLES_MAX 8
+
+struct host_nvs_entry {
+    char name[2 * NVS_KEY_NAME_MAX_SIZE]; // "<namespace>.<key>", "" if free
+    void *data;
+    size_t length;
+};
+
+static const char *nvs_dir = NULL;
+static int nvs_initialised = 0;
+static struct host_nvs_entry nvs_entries[HOST_NVS_ENTRIES_MAX];
+static char nvs_handles[HOST_NVS_HANDLES_MAX][NVS_KEY_NAME_MAX_SIZE]; // Namespace of each open handle, "" if free
+static pthread_mutex_t nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void host_set_nvs_dir(const char *path)
+{
+    nvs_dir = path;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    nvs_initialised = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    pthread_mutex_lock(&nvs_lock);
+    for (int i = 0; i < HOST_NVS_ENTRIES_MAX; i++)
+    {
+        free(nvs_entries[i].data);
+        memset(&nvs_entries[i], 0, sizeof(nvs_entries[i]));
+    }
+    DIR *dir = (nvs_dir != NULL) ? opendir(nvs_dir) : NULL;
+    struct dirent *file;
+    while (dir != NULL && (file = readdir(dir)) != NULL)
+    {
+        if (file->d_name[0] != '.')
+        {
+            char path[512];
+            snprintf(path, sizeof(path), "%s/%s", nvs_dir, file->d_name);
+            unlink(path);
+        }
+    }
+    if (dir != NULL)
+    {
+        closedir(dir);
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    (void)open_mode;
+    if (!nvs_initialised)
+    {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    if (namespace_name == NULL || namespace_name[0] == '\0' || strlen(namespace_name) >= NVS_KEY_NAME_MAX_SIZE)
+    {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+    pthread_mutex_lock(&nvs_lock);
+    for (int i = 0; i < HOST_NVS_HANDLES_MAX; i++)
+    {
+        if (nvs_handles[i][0] == '\0')
+        {
+            snprintf(nvs_handles[i], sizeof(nvs_handles[i]), "%s", namespace_name);
+            pthread_mutex_unlock(&nvs_lock);
+            *out_handle = i + 1;
+            return ESP_OK;
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return ESP_ERR_NO_MEM;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    if (handle >= 1 && handle <= HOST_NVS_HANDLES_MAX)
+    {
+        pthread_mutex_lock(&nvs_lock);
+        nvs_handles[handle - 1][0] = '\0';
+        pthread_mutex_unlock(&nvs_lock);
+    }
+}
+
+// Entry name for a key - returns 0 for a bad handle or key (call with nvs_lock held)
+static int nvs_entry_name(nvs_handle_t handle, const char *key, char *name)
+{
+    if (handle < 1 || handle > HOST_NVS_HANDLES_MAX || nvs_handles[handle - 1][0] == '\0'
+        || key == NULL || key[0] == '\0' || strlen(key) >= NVS_KEY_NAME_MAX_SIZE)
+    {
+        return 0;
+    }
+    snprintf(name, 2 * NVS_KEY_NAME_MAX_SIZE, "%s.%s", nvs_handles[handle - 1], key);
+    return 1;
+}
+
+static struct host_nvs_entry *nvs_find_entry(const char *name)
+{
+    for (int i = 0; i < HOST_NVS_ENTRIES_MAX; i++)
+    {
+        if (strcmp(nvs_entries[i].name, name) == 0)
+        {
+            return &nvs_entries[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    char name[2 * NVS_KEY_NAME_MAX_SIZE];
+    pthread_mutex_lock(&nvs_lock);
+    if (!nvs_entry_name(handle, key, name))
+    {
+        pthread_mutex_unlock(&nvs_lock);
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    void *data = NULL;
+    size_t stored = 0;
+    int found = 0;
+    if (nvs_dir != NULL)
+    {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", nvs_dir, name);
+        FILE *f = __real_fopen(path, "rb");
+        struct stat st;
+        if (f != NULL && fstat(fileno(f), &st) == 0 && (data = malloc(st.st_size + 1)) != NULL)
+        {
+            stored = fread(data, 1, st.st_size, f);
+            found = (stored == (size_t)st.st_size);
+        }
+        if (f != NULL)
+        {
+            fclose(f);
+        }
+    }
+    else
+    {
+        struct host_nvs_entry *entry = nvs_find_entry(name);
+        if (entry != NULL)
+        {
+            data = entry->data;
+            stored = entry->length;
+            found = 1;
+        }
+    }
+
+    esp_err_t result = ESP_OK;
+    if (!found)
+    {
+        result = ESP_ERR_NVS_NOT_FOUND;
+    }
+    else if (out_value != NULL && *length < stored)
+    {
+        result = ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    else
+    {
+        if (out_value != NULL)
+        {
+            memcpy(out_value, data, stored);
+        }
+        *length = stored;
+    }
+    if (nvs_dir != NULL)
+    {
+        free(data);
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return result;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    char name[2 * NVS_KEY_NAME_MAX_SIZE];
+    pthread_mutex_lock(&nvs_lock);
+    if (!nvs_entry_name(handle, key, name))
+    {
+        pthread_mutex_unlock(&nvs_lock);
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    esp_err_t result = ESP_OK;
+    if (nvs_dir != NULL)
+    {
+        // Written aside and renamed into place, so a crash never leaves half a blob
+        char path[512];
+        char temp_path[520];
+        snprintf(path, sizeof(path), "%s/%s", nvs_dir, name);
+        snprintf(temp_path, sizeof(temp_path), "%s.new", path);
+        FILE *f = __real_fopen(temp_path, "wb");
+        if (f == NULL || fwrite(value, 1, length, f) != length || fclose(f) != 0 || rename(temp_path, path) != 0)
+        {
+            result = ESP_FAIL;
+        }
+    }
+    else
+    {
+        struct host_nvs_entry *entry = nvs_find_entry(name);
+        if (entry == NULL)
+        {
+            entry = nvs_find_entry("");
+        }
+        void *data = malloc(length > 0 ? length : 1);
+        if (entry == NULL || data == NULL)
+        {
+            free(data);
+            result = ESP_ERR_NVS_NO_FREE_PAGES;
+        }
+        else
+        {
+            memcpy(data, value, length);
+            free(entry->data);
+            snprintf(entry->name, sizeof(entry->name), "%s", name);
+            entry->data = data;
+            entry->length = length;
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return result;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    char name[2 * NVS_KEY_NAME_MAX_SIZE];
+    pthread_mutex_lock(&nvs_lock);
+    if (!nvs_entry_name(handle, key, name))
+    {
+        pthread_mutex_unlock(&nvs_lock);
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    esp_err_t result = ESP_OK;
+    if (nvs_dir != NULL)
+    {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", nvs_dir, name);
+        result = (unlink(path) == 0) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+    }
+    else
+    {
+        struct host_nvs_entry *entry = nvs_find_entry(name);
+        if (entry == NULL)
+        {
+            result = ESP_ERR_NVS_NOT_FOUND;
+        }
+        else
+        {
+            free(entry->data);
+            memset(entry, 0, sizeof(*entry));
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return result;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return (handle >= 1 && handle <= HOST_NVS_HANDLES_MAX) ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+// GPIO
+// =============================================================================
+
+static pthread_mutex_t gpio_lock = PTHREAD_MUTEX_INITIALIZER;
+static gpio_mode_t gpio_modes[GPIO_NUM_MAX];
+static uint8_t gpio_input_levels[GPIO_NUM_MAX];
+static uint8_t gpio_input_driven[GPIO_NUM_MAX];
+static uint8_t gpio_output_levels[GPIO_NUM_MAX];
+static host_gpio_output_hook_t gpio_output_hook = NULL;
+static gpio_int_type_t gpio_intr_types[GPIO_NUM_MAX];
+static gpio_isr_t gpio_isr_handlers[GPIO_NUM_MAX];
+static void *gpio_isr_args[GPIO_NUM_MAX];
+static uint8_t gpio_isr_service_installed = 0;
+
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+    pthread_mutex_lock(&gpio_lock);
+    for (int pin = 0; pin < GPIO_NUM_MAX; pin++)
+    {
+        if ((config->pin_bit_mask & (1ULL << pin)) == 0)
+        {
+            continue;
+        }
+        gpio_modes[pin] = config->mode;
+        gpio_intr_types[pin] = config->intr_type;
+        if (!gpio_input_driven[pin])
+        {
+            // Undriven inputs float to their pull
+            gpio_input_levels[pin] = (config->pull_up_en == GPIO_PULLUP_ENABLE);
+        }
+    }
+    pthread_mutex_unlock(&gpio_lock);
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&gpio_lock);
+    uint8_t changed = gpio_output_levels[gpio_num] != (level != 0);
+    gpio_output_levels[gpio_num] = (level != 0);
+    host_gpio_output_hook_t hook = gpio_output_hook;
+    pthread_mutex_unlock(&gpio_lock);
+
+    if (changed && hook != NULL)
+    {
+        hook(gpio_num, level != 0);
+    }
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+    {
+        return 0;
+    }
+    pthread_mutex_lock(&gpio_lock);
+    int level = (gpio_modes[gpio_num] & GPIO_MODE_INPUT) ? gpio_input_levels[gpio_num] : gpio_output_levels[gpio_num];
+    pthread_mutex_unlock(&gpio_lock);
+    return level;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&gpio_lock);
+    gpio_intr_types[gpio_num] = intr_type;
+    pthread_mutex_unlock(&gpio_lock);
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags)
+{
+    (void)intr_alloc_flags;
+    pthread_mutex_lock(&gpio_lock);
+    esp_err_t ret = gpio_isr_service_installed ? ESP_ERR_INVALID_STATE : ESP_OK;
+    gpio_isr_service_installed = 1;
+    pthread_mutex_unlock(&gpio_lock);
+    return ret;
+}
+
+void gpio_uninstall_isr_service(void)
+{
+    pthread_mutex_lock(&gpio_lock);
+    gpio_isr_service_installed = 0;
+    memset(gpio_isr_handlers, 0, sizeof(gpio_isr_handlers));
+    pthread_mutex_unlock(&gpio_lock);
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args)
+{
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&gpio_lock);
+    if (!gpio_isr_service_installed)
+    {
+        pthread_mutex_unlock(&gpio_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    gpio_isr_handlers[gpio_num] = isr_handler;
+    gpio_isr_args[gpio_num] = args;
+    pthread_mutex_unlock(&gpio_lock);
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num)
+{
+    return gpio_isr_handler_add(gpio_num, NULL, NULL);
+}
+
+void host_gpio_set_input(int pin, int level)
+{
+    pthread_mutex_lock(&gpio_lock);
+    uint8_t old_level = gpio_input_levels[pin];
+    gpio_input_driven[pin] = 1;
+    gpio_input_levels[pin] = (level != 0);
+
+    // Edge interrupt for a change of level on an input with a handler
+    gpio_isr_t handler = NULL;
+    void *handler_arg = NULL;
+    gpio_int_type_t type = gpio_intr_types[pin];
+    uint8_t edge = (old_level != gpio_input_levels[pin]) && (gpio_modes[pin] & GPIO_MODE_INPUT);
+    if (edge && (type == GPIO_INTR_ANYEDGE || (type == GPIO_INTR_POSEDGE && level) || (type == GPIO_INTR_NEGEDGE && !level)))
+    {
+        handler = gpio_isr_handlers[pin];
+        handler_arg = gpio_isr_args[pin];
+    }
+    pthread_mutex_unlock(&gpio_lock);
+
+    if (handler != NULL)
+    {
+        handler(handler_arg);
+    }
+}
+
+int host_gpio_get_output(int pin)
+{
+    pthread_mutex_lock(&gpio_lock);
+    int level = gpio_output_levels[pin];
+    pthread_mutex_unlock(&gpio_lock);
+    return level;
+}
+
+void host_gpio_set_output_hook(host_gpio_output_hook_t hook)
+{
+    pthread_mutex_lock(&gpio_lock);
+    gpio_output_hook = hook;
+    pthread_mutex_unlock(&gpio_lock);
+}
+
+// Default event loop
+// =============================================================================
+
+#define HOST_EVENT_HANDLERS_MAX 16
+#define HOST_EVENT_QUEUE_LEN 16
+
+struct host_event_handler {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void *arg;
+};
+
+struct host_event {
+    esp_event_base_t base;
+    int32_t id;
+    void *data;
+};
+
+static struct host_event_handler event_handlers[HOST_EVENT_HANDLERS_MAX];
+static pthread_mutex_t event_handler_lock = PTHREAD_MUTEX_INITIALIZER;
+static QueueHandle_t event_queue = NULL;
+
+const esp_event_base_t ETH_EVENT = "ETH_EVENT";
+const esp_event_base_t IP_EVENT = "IP_EVENT";
+
+static void event_loop_task(void *arg)
+{
+    (void)arg;
+    while (1)
+    {
+        struct host_event event;
+        if (xQueueReceive(event_queue, &event, portMAX_DELAY) != pdTRUE)
+        {
+            continue;
+        }
+
+        for (int i = 0; i < HOST_EVENT_HANDLERS_MAX; i++)
+        {
+            pthread_mutex_lock(&event_handler_lock);
+            struct host_event_handler entry = event_handlers[i];
+            pthread_mutex_unlock(&event_handler_lock);
+
+            if (entry.handler != NULL && entry.base == event.base && (entry.id == ESP_EVENT_ANY_ID || entry.id == event.id))
+            {
+                entry.handler(entry.arg, event.base, event.id, event.data);
+            }
+        }
+        free(event.data);
+    }
+}
+
+esp_err_t esp_event_loop_create_default(void)
+{
+    if (event_queue != NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    event_queue = xQueueCreate(HOST_EVENT_QUEUE_LEN, sizeof(struct host_event));
+    if (event_queue == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskCreate(event_loop_task, "sys_evt", 2304, NULL, 20, NULL);
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register(esp_event_base_t event_base, int32_t event_id, esp_event_handler_t event_handler, void *event_handler_arg)
+{
+    pthread_mutex_lock(&event_handler_lock);
+    for (int i = 0; i < HOST_EVENT_HANDLERS_MAX; i++)
+    {
+        if (event_handlers[i].handler == NULL)
+        {
+            event_handlers[i].base = event_base;
+            event_handlers[i].id = event_id;
+            event_handlers[i].handler = event_handler;
+            event_handlers[i].arg = event_handler_arg;
+            pthread_mutex_unlock(&event_handler_lock);
+            return ESP_OK;
+        }
+    }
+    pthread_mutex_unlock(&event_handler_lock);
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_event_handler_unregister(esp_event_base_t event_base, int32_t event_id, esp_event_handler_t event_handler)
+{
+    pthread_mutex_lock(&event_handler_lock);
+    for (int i = 0; i < HOST_EVENT_HANDLERS_MAX; i++)
+    {
+        if (event_handlers[i].handler == event_handler && event_handlers[i].base == event_base && event_handlers[i].id == event_id)
+        {
+            memset(&event_handlers[i], 0, sizeof(event_handlers[i]));
+        }
+    }
+    pthread_mutex_unlock(&event_handler_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_event_post(esp_event_base_t event_base, int32_t event_id, const void *event_data, size_t event_data_size, TickType_t ticks_to_wait)
+{
+    if (event_queue == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Event data is copied, as the real loop does, so posters can pass stack variables
+    struct host_event event = { .base = event_base, .id = event_id, .data = NULL };
+    if (event_data_size > 0)
+    {
+        event.data = malloc(event_data_size);
+        if (event.data == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        memcpy(event.data, event_data, event_data_size);
+    }
+
+    if (xQueueSend(event_queue, &event, ticks_to_wait) != pdTRUE)
+    {
+        free(event.data);
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+// Network interface and Ethernet driver
+// =============================================================================
+
+struct esp_netif_obj {
+    int unused;
+};
+
+struct host_eth_mac {
+    int unused;
+};
+
+struct host_eth_phy {
+    int unused;
+};
+
+static struct esp_netif_obj host_netif;
+static struct host_eth_mac host_mac;
+static struct host_eth_phy host_phy;
+static esp_eth_handle_t host_eth_handle = NULL;
+static int host_eth_started = 0;
+
+esp_err_t esp_netif_init(void)
+{
+    return ESP_OK;
+}
+
+esp_netif_t *esp_netif_new(const esp_netif_config_t *config)
+{
+    (void)config;
+    return &host_netif;
+}
+
+esp_err_t esp_netif_attach(esp_netif_t *esp_netif, void *driver_handle)
+{
+    (void)esp_netif;
+    (void)driver_handle;
+    return ESP_OK;
+}
+
+esp_eth_mac_t *esp_eth_mac_new_esp32(const eth_esp32_emac_config_t *esp32_config, const eth_mac_config_t *config)
+{
+    (void)esp32_config;
+    (void)config;
+    return &host_mac;
+}
+
+esp_eth_phy_t *esp_eth_phy_new_lan87xx(const eth_phy_config_t *config)
+{
+    (void)config;
+    return &host_phy;
+}
+
+esp_err_t esp_eth_driver_install(const esp_eth_config_t *config, esp_eth_handle_t *out_hdl)
+{
+    if (config == NULL || out_hdl == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    host_eth_handle = (esp_eth_handle_t)&host_mac;
+    *out_hdl = host_eth_handle;
+    return ESP_OK;
+}
+
+void *esp_eth_new_netif_glue(esp_eth_handle_t eth_hdl)
+{
+    return eth_hdl;
+}
+
+// Stand-ins for the time a box takes - 0 unless a benchmark sets them
+static int64_t link_delay_us = 0;
+static int64_t dhcp_delay_us = 0;
+static int64_t sdcard_mount_delay_us = 0;
+static int boot_serial = 0;
+
+void host_set_boot_delays(int64_t link_us, int64_t dhcp_us, int64_t sdcard_mount_us)
+{
+    link_delay_us = link_us;
+    dhcp_delay_us = dhcp_us;
+    sdcard_mount_delay_us = sdcard_mount_us;
+}
+
+void host_set_boot_serial(int serial)
+{
+    boot_serial = serial;
+}
+
+static void sleep_us(int64_t us)
+{
+    if (us > 0)
+    {
+        struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void *link_up_thread(void *arg)
+{
+    (void)arg;
+    sleep_us(link_delay_us); // Autonegotiation
+    esp_event_post(ETH_EVENT, ETHERNET_EVENT_CONNECTED, &host_eth_handle, sizeof(host_eth_handle), portMAX_DELAY);
+    sleep_us(dhcp_delay_us);
+
+    ip_event_got_ip_t got_ip = {0};
+    got_ip.esp_netif = &host_netif;
+    got_ip.ip_info.ip.addr = htonl(INADDR_LOOPBACK);
+    got_ip.ip_info.netmask.addr = htonl(0xff000000);
+    got_ip.ip_info.gw.addr = htonl(INADDR_LOOPBACK);
+    got_ip.ip_changed = true;
+    esp_event_post(IP_EVENT, IP_EVENT_ETH_GOT_IP, &got_ip, sizeof(got_ip), portMAX_DELAY);
+    return NULL;
+}
+
+// Link and address come straight away, or after the stand-in delays without holding up the caller
+// (unless booting serially)
+static void post_link_up(void)
+{
+    pthread_t thread;
+    if ((link_delay_us == 0 && dhcp_delay_us == 0) || boot_serial)
+    {
+        link_up_thread(NULL);
+    }
+    else if (pthread_create(&thread, NULL, link_up_thread, NULL) == 0)
+    {
+        pthread_detach(thread);
+    }
+}
+
+esp_err_t esp_eth_start(esp_eth_handle_t hdl)
+{
+    if (hdl != host_eth_handle)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    host_eth_started = 1;
+    esp_event_post(ETH_EVENT, ETHERNET_EVENT_START, &host_eth_handle, sizeof(host_eth_handle), portMAX_DELAY);
+    post_link_up();
+    return ESP_OK;
+}
+
+esp_err_t esp_eth_stop(esp_eth_handle_t hdl)
+{
+    if (hdl != host_eth_handle)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    host_eth_started = 0;
+    esp_event_post(ETH_EVENT, ETHERNET_EVENT_STOP, &host_eth_handle, sizeof(host_eth_handle), portMAX_DELAY);
+    return ESP_OK;
+}
+
+esp_err_t esp_eth_ioctl(esp_eth_handle_t hdl, esp_eth_io_cmd_t cmd, void *data)
+{
+    (void)hdl;
+    if (cmd == ETH_CMD_G_MAC_ADDR && data != NULL)
+    {
+        static const uint8_t mac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01}; // Locally administered
+        memcpy(data, mac, sizeof(mac));
+        return ESP_OK;
+    }
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void host_eth_set_link(int up)
+{
+    if (!host_eth_started)
+    {
+        return;
+    }
+    if (up)
+    {
+        post_link_up();
+    }
+    else
+    {
+        esp_event_post(ETH_EVENT, ETHERNET_EVENT_DISCONNECTED, &host_eth_handle, sizeof(host_eth_handle), portMAX_DELAY);
+    }
+}
+
+esp_err_t esp_vfs_eventfd_register(const esp_vfs_eventfd_config_t *config)
+{
+    return config != NULL ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+// SD card - mounting maps the VFS prefix onto a host directory, fopen() is wrapped at link time
+// =============================================================================
+
+static const char *sdcard_dir = NULL;
+static char mounted_base[64] = "";
+static sdmmc_card_t host_card = { .name = "HOSTSD", .host_path = NULL };
+
+void host_set_sdcard_dir(const char *path)
+{
+    sdcard_dir = path;
+}
+
+esp_err_t esp_vfs_fat_sdmmc_mount(const char *base_path, const sdmmc_host_t *host_config, const void *slot_config, const esp_vfs_fat_mount_config_t *mount_config, sdmmc_card_t **out_card)
+{
+    (void)host_config;
+    (void)slot_config;
+    (void)mount_config;
+
+    sleep_us(sdcard_mount_delay_us); // Card init and FAT mount - or timing out with no card
+
+    struct stat st;
+    if (sdcard_dir == NULL || stat(sdcard_dir, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        return ESP_ERR_TIMEOUT; // What the SDMMC driver reports with no card in the slot
+    }
+    if (mounted_base[0] != '\0')
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    snprintf(mounted_base, sizeof(mounted_base), "%s", base_path);
+    host_card.host_path = sdcard_dir;
+    *out_card = &host_card;
+    return ESP_OK;
+}
+
+esp_err_t esp_vfs_fat_sdcard_unmount(const char *base_path, sdmmc_card_t *card)
+{
+    if (card != &host_card)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strcmp(base_path, mounted_base) != 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    mounted_base[0] = '\0';
+    return ESP_OK;
+}
+
+void sdmmc_card_print_info(FILE *stream, const sdmmc_card_t *card)
+{
+    if (log_level < ESP_LOG_INFO)
+    {
+        return; // Benchmarks quieten the log, and mount the card over and over
+    }
+    fprintf(stream, "Name: %s\nType: host directory %s\n", card->name, card->host_path);
+}
+
+FILE *__real_fopen(const char *path, const char *mode);
+
+FILE *__wrap_fopen(const char *path, const char *mode)
+{
+    size_t base_len = strlen(mounted_base);
+    if (base_len > 0 && strncmp(path, mounted_base, base_len) == 0 && (path[base_len] == '/' || path[base_len] == '\0'))
+    {
+        char host_path[512];
+        snprintf(host_path, sizeof(host_path), "%s%s", sdcard_dir, path + base_len);
+        return __real_fopen(host_path, mode);
+    }
+    return __real_fopen(path, mode);
+}
+
+// Startup
+// =============================================================================
+
+static void main_task(void *arg)
+{
+    (void)arg;
+    app_main();
+    vTaskDelete(NULL);
+}
+
+void host_start_app(void)
+{
+    // The Show Relay button's pull-up is on the board rather than in the esp32
+    host_gpio_set_input(PIN_SHOW_RELAY_BUTTON, 1);
+    xTaskCreate(main_task, "main", CONFIG_ESP_MAIN_TASK_STACK_SIZE, NULL, 1, NULL);
+}
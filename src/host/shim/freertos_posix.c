@@ -0,0 +1,678 @@
+// Host shim: FreeRTOS kernel subset on POSIX threads
+//-----------------------------------
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+#include "freertos/FreeRTOS.h"
+#include "host_shim.h"
+
+// Host threads need far more stack than the xtensa build (glibc printf alone is several KB),
+// so the requested depth is only used as a lower bound
+#define HOST_MIN_TASK_STACK (256 * 1024)
+
+// Task stacks are filled with this before the task starts, so the deepest the task has reached is
+// where the fill stops - the same trick the kernel uses for uxTaskGetStackHighWaterMark
+#define HOST_STACK_FILL 0xa5
+
+struct host_task {
+    pthread_t thread;
+    TaskFunction_t function;
+    void *parameters;
+    char name[configMAX_TASK_NAME_LEN];
+    uint8_t is_static; // Lives in the caller's StaticTask_t
+
+    // Stack the thread runs on - NULL for adopted threads, which aren't measured
+    uint8_t *stack;
+    size_t stack_size;
+    uint32_t stack_depth;  // What the firmware asked for
+    size_t stack_overhead; // Used before the task function starts (glibc's thread block and TLS)
+
+    pthread_mutex_t notify_lock;
+    pthread_cond_t notify_cond;
+    uint32_t notify_value;
+    uint8_t notify_pending;
+};
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    uint8_t *storage;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    uint8_t is_static; // Lives in the caller's StaticQueue_t, with the caller's storage
+    const char *name;  // Set by vQueueAddToRegistry
+    uint32_t full_count; // Sends refused because the queue was full
+    UBaseType_t peak;    // Most items it has held
+};
+
+_Static_assert(sizeof(struct host_task) <= sizeof(StaticTask_t), "StaticTask_t too small for the host task");
+_Static_assert(sizeof(struct host_queue) <= sizeof(StaticQueue_t), "StaticQueue_t too small for the host queue");
+
+static __thread struct host_task *current_task = NULL;
+static pthread_mutex_t critical_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_condattr_t monotonic_condattr;
+static pthread_once_t shim_once = PTHREAD_ONCE_INIT;
+
+// Time base
+// =============================================================================
+
+static void shim_once_init(void)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&critical_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    pthread_condattr_init(&monotonic_condattr);
+    pthread_condattr_setclock(&monotonic_condattr, CLOCK_MONOTONIC);
+}
+
+static void cond_init(pthread_cond_t *cond)
+{
+    pthread_once(&shim_once, shim_once_init);
+    pthread_cond_init(cond, &monotonic_condattr);
+}
+
+static struct timespec us_to_timespec(int64_t us)
+{
+    struct timespec ts;
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (long)(us % 1000000) * 1000;
+    return ts;
+}
+
+// Absolute monotonic deadline for a wait of 'ticks', rounded to the tick boundary the
+// kernel would wake on
+static struct timespec tick_deadline(TickType_t ticks)
+{
+    int64_t tick_us = 1000000 / configTICK_RATE_HZ;
+    int64_t target_tick = (int64_t)xTaskGetTickCount() + ticks;
+    return us_to_timespec(host_boot_time_us() + target_tick * tick_us);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(host_time_us() / (1000000 / configTICK_RATE_HZ));
+}
+
+// Critical sections
+// =============================================================================
+
+void host_enter_critical(portMUX_TYPE *mux)
+{
+    pthread_once(&shim_once, shim_once_init);
+    pthread_mutex_lock(&critical_lock);
+    mux->count++;
+}
+
+void host_exit_critical(portMUX_TYPE *mux)
+{
+    mux->count--;
+    pthread_mutex_unlock(&critical_lock);
+}
+
+// Tasks
+// =============================================================================
+
+static void *task_trampoline(void *arg)
+{
+    struct host_task *task = arg;
+    current_task = task;
+    task->stack_overhead = (size_t)(task->stack + task->stack_size - (uint8_t *)__builtin_frame_address(0));
+    pthread_setname_np(pthread_self(), task->name);
+    task->function(task->parameters);
+
+    // Returning from a task function is a bug on the real kernel, so flag it here too
+    fprintf(stderr, "host shim: task %s returned without deleting itself\n", task->name);
+    return NULL;
+}
+
+static void task_init(struct host_task *task, const char *name)
+{
+    snprintf(task->name, sizeof(task->name), "%s", name);
+    pthread_mutex_init(&task->notify_lock, NULL);
+    cond_init(&task->notify_cond);
+}
+
+static struct host_task *task_alloc(const char *name)
+{
+    struct host_task *task = calloc(1, sizeof(struct host_task));
+    if (task == NULL)
+    {
+        return NULL;
+    }
+    task_init(task, name);
+    return task;
+}
+
+// Starts the task's thread on a filled stack of its own
+static BaseType_t task_start(struct host_task *task, TaskFunction_t function, uint32_t stack_depth, void *parameters)
+{
+    task->function = function;
+    task->parameters = parameters;
+    task->stack_depth = stack_depth;
+    task->stack_size = stack_depth < HOST_MIN_TASK_STACK ? HOST_MIN_TASK_STACK : stack_depth;
+    task->stack = mmap(NULL, task->stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (task->stack == MAP_FAILED)
+    {
+        task->stack = NULL;
+        return pdFAIL;
+    }
+    memset(task->stack, HOST_STACK_FILL, task->stack_size);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, task->stack, task->stack_size);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int error = pthread_create(&task->thread, &attr, task_trampoline, task);
+    pthread_attr_destroy(&attr);
+    if (error != 0)
+    {
+        munmap(task->stack, task->stack_size);
+        task->stack = NULL;
+        return pdFAIL;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters, UBaseType_t priority, TaskHandle_t *created_task)
+{
+    (void)priority;
+    struct host_task *task = task_alloc(name);
+    if (task == NULL)
+    {
+        return pdFAIL;
+    }
+
+    // Publish the handle before the task runs, as the kernel does
+    if (created_task != NULL)
+    {
+        *created_task = task;
+    }
+
+    if (task_start(task, function, stack_depth, parameters) != pdPASS)
+    {
+        if (created_task != NULL)
+        {
+            *created_task = NULL;
+        }
+        free(task);
+        return pdFAIL;
+    }
+    return pdPASS;
+}
+
+// The task's state goes in the caller's control block as on the kernel, but the caller's stack
+// is only sized for the esp32, so the thread still runs on a host sized stack
+TaskHandle_t xTaskCreateStatic(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters, UBaseType_t priority, StackType_t *stack_buffer, StaticTask_t *task_buffer)
+{
+    (void)priority;
+    if (stack_buffer == NULL || task_buffer == NULL)
+    {
+        return NULL;
+    }
+    struct host_task *task = (struct host_task *)task_buffer;
+    memset(task, 0, sizeof(*task));
+    task_init(task, name);
+    task->is_static = 1;
+    return (task_start(task, function, stack_depth, parameters) == pdPASS) ? task : NULL;
+}
+
+// Least stack the task has had left, in bytes of the depth it was created with - the host's
+// stack frames aren't the esp32's, so this is a guide to how close a task runs, not a measurement
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    if (task == NULL)
+    {
+        task = current_task;
+    }
+    if (task == NULL || task->stack == NULL)
+    {
+        return 0;
+    }
+
+    size_t untouched = 0;
+    while (untouched < task->stack_size && task->stack[untouched] == HOST_STACK_FILL)
+    {
+        untouched++;
+    }
+    size_t used = task->stack_size - untouched;
+    used = (used > task->stack_overhead) ? used - task->stack_overhead : 0;
+    return (used < task->stack_depth) ? (UBaseType_t)(task->stack_depth - used) : 0;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters, UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id)
+{
+    (void)core_id;
+    return xTaskCreate(function, name, stack_depth, parameters, priority, created_task);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || task == current_task)
+    {
+        pthread_exit(NULL);
+    }
+
+    // Like the kernel, deleting another task does not unwind it - resources it holds leak.
+    // Cancellation takes effect at the next blocking call, which is where firmware tasks sit.
+    pthread_cancel(task->thread);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (ticks == 0)
+    {
+        sched_yield();
+        return;
+    }
+
+    struct timespec deadline = tick_deadline(ticks);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+    {
+    }
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return current_task;
+}
+
+const char *pcTaskGetName(TaskHandle_t task)
+{
+    if (task == NULL)
+    {
+        task = current_task;
+    }
+    return task != NULL ? task->name : "host";
+}
+
+void host_adopt_current_thread(const char *name)
+{
+    if (current_task == NULL)
+    {
+        current_task = task_alloc(name);
+        current_task->thread = pthread_self();
+    }
+}
+
+// Task notifications
+// =============================================================================
+
+// Waits on a condition variable until the deadline for 'ticks' (0 = poll, portMAX_DELAY = forever)
+// Returns 0 on wake, ETIMEDOUT on timeout
+static int timed_wait(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks, const struct timespec *deadline)
+{
+    if (ticks == 0)
+    {
+        return ETIMEDOUT;
+    }
+    if (ticks == portMAX_DELAY)
+    {
+        return pthread_cond_wait(cond, lock);
+    }
+    return pthread_cond_timedwait(cond, lock, deadline);
+}
+
+BaseType_t xTaskGenericNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+    BaseType_t result = pdPASS;
+    pthread_mutex_lock(&task->notify_lock);
+    switch (action)
+    {
+    case eSetBits:
+        task->notify_value |= value;
+        break;
+    case eIncrement:
+        task->notify_value++;
+        break;
+    case eSetValueWithOverwrite:
+        task->notify_value = value;
+        break;
+    case eSetValueWithoutOverwrite:
+        if (task->notify_pending)
+        {
+            result = pdFAIL;
+        }
+        else
+        {
+            task->notify_value = value;
+        }
+        break;
+    case eNoAction:
+    default:
+        break;
+    }
+    task->notify_pending = 1;
+    pthread_cond_broadcast(&task->notify_cond);
+    pthread_mutex_unlock(&task->notify_lock);
+    return result;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    host_adopt_current_thread("host");
+    struct host_task *task = current_task;
+    struct timespec deadline = tick_deadline(ticks_to_wait);
+
+    pthread_mutex_lock(&task->notify_lock);
+    while (task->notify_value == 0)
+    {
+        if (timed_wait(&task->notify_cond, &task->notify_lock, ticks_to_wait, &deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+    uint32_t value = task->notify_value;
+    if (value != 0)
+    {
+        task->notify_value = clear_on_exit ? 0 : value - 1;
+    }
+    task->notify_pending = 0;
+    pthread_mutex_unlock(&task->notify_lock);
+    return value;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t bits_to_clear_on_entry, uint32_t bits_to_clear_on_exit, uint32_t *notification_value, TickType_t ticks_to_wait)
+{
+    host_adopt_current_thread("host");
+    struct host_task *task = current_task;
+    struct timespec deadline = tick_deadline(ticks_to_wait);
+    BaseType_t result = pdTRUE;
+
+    pthread_mutex_lock(&task->notify_lock);
+    if (!task->notify_pending)
+    {
+        task->notify_value &= ~bits_to_clear_on_entry;
+    }
+    while (!task->notify_pending)
+    {
+        if (timed_wait(&task->notify_cond, &task->notify_lock, ticks_to_wait, &deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+    if (notification_value != NULL)
+    {
+        *notification_value = task->notify_value;
+    }
+    if (task->notify_pending)
+    {
+        task->notify_value &= ~bits_to_clear_on_exit;
+        task->notify_pending = 0;
+    }
+    else
+    {
+        result = pdFALSE;
+    }
+    pthread_mutex_unlock(&task->notify_lock);
+    return result;
+}
+
+// Queues
+// =============================================================================
+
+static void queue_init(struct host_queue *queue, UBaseType_t length, UBaseType_t item_size, UBaseType_t initial_count)
+{
+    queue->length = length;
+    queue->item_size = item_size;
+    queue->count = initial_count;
+    pthread_mutex_init(&queue->lock, NULL);
+    cond_init(&queue->not_empty);
+    cond_init(&queue->not_full);
+}
+
+static QueueHandle_t queue_create(UBaseType_t length, UBaseType_t item_size, UBaseType_t initial_count)
+{
+    struct host_queue *queue = calloc(1, sizeof(struct host_queue));
+    if (queue == NULL)
+    {
+        return NULL;
+    }
+    if (item_size > 0)
+    {
+        queue->storage = calloc(length, item_size);
+        if (queue->storage == NULL)
+        {
+            free(queue);
+            return NULL;
+        }
+    }
+    queue_init(queue, length, item_size, initial_count);
+    return queue;
+}
+
+static QueueHandle_t queue_create_static(UBaseType_t length, UBaseType_t item_size, UBaseType_t initial_count, uint8_t *storage, StaticQueue_t *queue_buffer)
+{
+    if (queue_buffer == NULL || (item_size > 0 && storage == NULL))
+    {
+        return NULL;
+    }
+    struct host_queue *queue = (struct host_queue *)queue_buffer;
+    memset(queue, 0, sizeof(*queue));
+    queue->storage = storage;
+    queue->is_static = 1;
+    queue_init(queue, length, item_size, initial_count);
+    return queue;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    if (length == 0)
+    {
+        return NULL;
+    }
+    return queue_create(length, item_size, 0);
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size, uint8_t *storage, StaticQueue_t *queue_buffer)
+{
+    if (length == 0)
+    {
+        return NULL;
+    }
+    return queue_create_static(length, item_size, 0, storage, queue_buffer);
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+    if (!queue->is_static)
+    {
+        free(queue->storage);
+        free(queue);
+    }
+}
+
+static BaseType_t queue_send(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait, uint8_t to_front)
+{
+    struct timespec deadline = tick_deadline(ticks_to_wait);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count >= queue->length)
+    {
+        if (timed_wait(&queue->not_full, &queue->lock, ticks_to_wait, &deadline) == ETIMEDOUT)
+        {
+            queue->full_count++;
+            pthread_mutex_unlock(&queue->lock);
+            return pdFALSE;
+        }
+    }
+
+    if (queue->item_size > 0)
+    {
+        UBaseType_t slot;
+        if (to_front)
+        {
+            queue->head = (queue->head + queue->length - 1) % queue->length;
+            slot = queue->head;
+        }
+        else
+        {
+            slot = (queue->head + queue->count) % queue->length;
+        }
+        memcpy(queue->storage + (size_t)slot * queue->item_size, item, queue->item_size);
+    }
+    queue->count++;
+    if (queue->count > queue->peak)
+    {
+        queue->peak = queue->count;
+    }
+
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+    return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+    return queue_send(queue, item, ticks_to_wait, 0);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+    return queue_send(queue, item, ticks_to_wait, 1);
+}
+
+static BaseType_t queue_receive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait, uint8_t peek)
+{
+    struct timespec deadline = tick_deadline(ticks_to_wait);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0)
+    {
+        if (timed_wait(&queue->not_empty, &queue->lock, ticks_to_wait, &deadline) == ETIMEDOUT)
+        {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFALSE;
+        }
+    }
+
+    if (queue->item_size > 0 && buffer != NULL)
+    {
+        memcpy(buffer, queue->storage + (size_t)queue->head * queue->item_size, queue->item_size);
+    }
+    if (!peek)
+    {
+        if (queue->item_size > 0)
+        {
+            queue->head = (queue->head + 1) % queue->length;
+        }
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait)
+{
+    return queue_receive(queue, buffer, ticks_to_wait, 0);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait)
+{
+    return queue_receive(queue, buffer, ticks_to_wait, 1);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t spaces = queue->length - queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return spaces;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->count = 0;
+    queue->head = 0;
+    pthread_cond_broadcast(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+// Queue registry - kept by the host so the benchmarks can see how full the firmware's queues got
+static QueueHandle_t queue_registry[HOST_QUEUE_REGISTRY_SIZE];
+static atomic_uint queue_registry_count = 0;
+
+void vQueueAddToRegistry(QueueHandle_t queue, const char *name)
+{
+    queue->name = name;
+    unsigned int index = atomic_load(&queue_registry_count);
+    if (index < HOST_QUEUE_REGISTRY_SIZE)
+    {
+        queue_registry[index] = queue;
+        atomic_store(&queue_registry_count, index + 1);
+    }
+}
+
+void host_queue_stats(const char *name, uint32_t *full_count, uint32_t *peak)
+{
+    *full_count = 0;
+    *peak = 0;
+    unsigned int count = atomic_load(&queue_registry_count);
+    for (unsigned int index = 0; index < count; index++)
+    {
+        QueueHandle_t queue = queue_registry[index];
+        if (strcmp(queue->name, name) == 0)
+        {
+            pthread_mutex_lock(&queue->lock);
+            *full_count += queue->full_count;
+            if (queue->peak > *peak)
+            {
+                *peak = queue->peak;
+            }
+            pthread_mutex_unlock(&queue->lock);
+        }
+    }
+}
+
+// Semaphores
+// =============================================================================
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return queue_create(1, 0, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *mutex_buffer)
+{
+    return queue_create_static(1, 0, 1, NULL, mutex_buffer);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return queue_create(1, 0, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    return queue_create(max_count, 0, initial_count);
+}
@@ -0,0 +1,28 @@
+// Host shim: driver/sdmmc_host.h
+
+#ifndef HOST_DRIVER_SDMMC_HOST_H_INCLUDED
+#define HOST_DRIVER_SDMMC_HOST_H_INCLUDED
+
+#include <stdint.h>
+
+#define SDMMC_HOST_FLAG_1BIT (1 << 0)
+#define SDMMC_HOST_FLAG_4BIT (1 << 1)
+#define SDMMC_HOST_FLAG_8BIT (1 << 2)
+#define SDMMC_HOST_SLOT_1 1
+#define SDMMC_FREQ_DEFAULT 20000
+
+typedef struct {
+    uint32_t flags;
+    int slot;
+    int max_freq_khz;
+} sdmmc_host_t;
+
+typedef struct {
+    uint8_t width;
+    uint32_t flags;
+} sdmmc_slot_config_t;
+
+#define SDMMC_HOST_DEFAULT() ((sdmmc_host_t){ .flags = SDMMC_HOST_FLAG_4BIT | SDMMC_HOST_FLAG_1BIT, .slot = SDMMC_HOST_SLOT_1, .max_freq_khz = SDMMC_FREQ_DEFAULT })
+#define SDMMC_SLOT_CONFIG_DEFAULT() ((sdmmc_slot_config_t){ .width = 0, .flags = 0 })
+
+#endif
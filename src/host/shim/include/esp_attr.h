@@ -0,0 +1,9 @@
+// Host shim: esp_attr.h - no IRAM on the host
+
+#ifndef HOST_ESP_ATTR_H_INCLUDED
+#define HOST_ESP_ATTR_H_INCLUDED
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#endif
@@ -0,0 +1,92 @@
+// Host shim: esp_eth.h - a driver that "links up" immediately and reports 127.0.0.1
+
+#ifndef HOST_ESP_ETH_H_INCLUDED
+#define HOST_ESP_ETH_H_INCLUDED
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+
+typedef void *esp_eth_handle_t;
+typedef struct host_eth_mac esp_eth_mac_t;
+typedef struct host_eth_phy esp_eth_phy_t;
+
+extern const esp_event_base_t ETH_EVENT;
+
+typedef enum {
+    ETHERNET_EVENT_START,
+    ETHERNET_EVENT_STOP,
+    ETHERNET_EVENT_CONNECTED,
+    ETHERNET_EVENT_DISCONNECTED
+} eth_event_t;
+
+typedef enum {
+    ETH_CMD_G_MAC_ADDR,
+    ETH_CMD_S_MAC_ADDR,
+    ETH_CMD_G_PHY_ADDR,
+    ETH_CMD_S_PHY_ADDR
+} esp_eth_io_cmd_t;
+
+typedef struct {
+    uint32_t sw_reset_timeout_ms;
+    uint32_t rx_task_stack_size;
+    uint32_t rx_task_prio;
+    uint32_t flags;
+} eth_mac_config_t;
+
+typedef struct {
+    int32_t phy_addr;
+    uint32_t reset_timeout_ms;
+    uint32_t autonego_timeout_ms;
+    int reset_gpio_num;
+} eth_phy_config_t;
+
+typedef enum {
+    EMAC_CLK_DEFAULT,
+    EMAC_CLK_EXT_IN,
+    EMAC_CLK_OUT
+} emac_rmii_clock_mode_t;
+
+typedef enum {
+    EMAC_CLK_IN_GPIO = 0,
+    EMAC_APPL_CLK_OUT_GPIO = 0,
+    EMAC_CLK_OUT_GPIO = 16,
+    EMAC_CLK_OUT_180_GPIO = 17
+} emac_rmii_clock_gpio_t;
+
+typedef union {
+    struct {
+        emac_rmii_clock_mode_t clock_mode;
+        emac_rmii_clock_gpio_t clock_gpio;
+    } rmii;
+} eth_mac_clock_config_t;
+
+typedef struct {
+    int smi_mdc_gpio_num;
+    int smi_mdio_gpio_num;
+    int interface;
+    eth_mac_clock_config_t clock_config;
+    uint32_t dma_burst_len;
+} eth_esp32_emac_config_t;
+
+typedef struct {
+    esp_eth_mac_t *mac;
+    esp_eth_phy_t *phy;
+    uint32_t check_link_period_ms;
+} esp_eth_config_t;
+
+#define ETH_MAC_DEFAULT_CONFIG() ((eth_mac_config_t){ .sw_reset_timeout_ms = 100, .rx_task_stack_size = 2048, .rx_task_prio = 15, .flags = 0 })
+#define ETH_PHY_DEFAULT_CONFIG() ((eth_phy_config_t){ .phy_addr = -1, .reset_timeout_ms = 100, .autonego_timeout_ms = 4000, .reset_gpio_num = 5 })
+#define ETH_ESP32_EMAC_DEFAULT_CONFIG() ((eth_esp32_emac_config_t){ .smi_mdc_gpio_num = 23, .smi_mdio_gpio_num = 18, .interface = 0, \
+        .clock_config = { .rmii = { .clock_mode = EMAC_CLK_DEFAULT, .clock_gpio = EMAC_CLK_IN_GPIO } }, .dma_burst_len = 0 })
+#define ETH_DEFAULT_CONFIG(emac, ephy) ((esp_eth_config_t){ .mac = (emac), .phy = (ephy), .check_link_period_ms = 2000 })
+
+esp_eth_mac_t *esp_eth_mac_new_esp32(const eth_esp32_emac_config_t *esp32_config, const eth_mac_config_t *config);
+esp_eth_phy_t *esp_eth_phy_new_lan87xx(const eth_phy_config_t *config);
+esp_err_t esp_eth_driver_install(const esp_eth_config_t *config, esp_eth_handle_t *out_hdl);
+void *esp_eth_new_netif_glue(esp_eth_handle_t eth_hdl);
+esp_err_t esp_eth_start(esp_eth_handle_t hdl);
+esp_err_t esp_eth_stop(esp_eth_handle_t hdl);
+esp_err_t esp_eth_ioctl(esp_eth_handle_t hdl, esp_eth_io_cmd_t cmd, void *data);
+
+#endif
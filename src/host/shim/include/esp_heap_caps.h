@@ -0,0 +1,16 @@
+// Host shim: esp_heap_caps.h - the host's malloc arena stands in for the esp32's heaps
+
+#ifndef HOST_ESP_HEAP_CAPS_H_INCLUDED
+#define HOST_ESP_HEAP_CAPS_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+size_t heap_caps_get_total_size(uint32_t caps);
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+
+#endif
@@ -0,0 +1,57 @@
+// Host shim: esp_netif.h
+// On the esp32 lwIP's socket headers also carry the TCP socket options; Linux keeps them apart
+
+#ifndef HOST_ESP_NETIF_H_INCLUDED
+#define HOST_ESP_NETIF_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "esp_err.h"
+#include "esp_event.h"
+
+typedef struct {
+    uint32_t addr; // Network byte order
+} esp_ip4_addr_t;
+
+typedef struct {
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+typedef struct esp_netif_obj esp_netif_t;
+
+typedef struct {
+    const void *base;
+} esp_netif_config_t;
+
+typedef struct {
+    esp_netif_t *esp_netif;
+    esp_netif_ip_info_t ip_info;
+    bool ip_changed;
+} ip_event_got_ip_t;
+
+extern const esp_event_base_t IP_EVENT;
+
+typedef enum {
+    IP_EVENT_STA_GOT_IP,
+    IP_EVENT_STA_LOST_IP,
+    IP_EVENT_AP_STAIPASSIGNED,
+    IP_EVENT_GOT_IP6,
+    IP_EVENT_ETH_GOT_IP,
+    IP_EVENT_ETH_LOST_IP
+} ip_event_t;
+
+#define ESP_NETIF_DEFAULT_ETH() ((esp_netif_config_t){ .base = NULL })
+
+#define esp_ip4_addr_get_byte(ipaddr, idx) (((const uint8_t *)(&(ipaddr)->addr))[idx])
+#define IPSTR "%d.%d.%d.%d"
+#define IP2STR(ipaddr) esp_ip4_addr_get_byte(ipaddr, 0), esp_ip4_addr_get_byte(ipaddr, 1), esp_ip4_addr_get_byte(ipaddr, 2), esp_ip4_addr_get_byte(ipaddr, 3)
+
+esp_err_t esp_netif_init(void);
+esp_netif_t *esp_netif_new(const esp_netif_config_t *config);
+esp_err_t esp_netif_attach(esp_netif_t *esp_netif, void *driver_handle);
+
+#endif
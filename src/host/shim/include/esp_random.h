@@ -0,0 +1,10 @@
+// Host shim: esp_random.h
+
+#ifndef HOST_ESP_RANDOM_H_INCLUDED
+#define HOST_ESP_RANDOM_H_INCLUDED
+
+#include <stdint.h>
+
+uint32_t esp_random(void);
+
+#endif
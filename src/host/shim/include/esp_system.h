@@ -0,0 +1,13 @@
+// Host shim: esp_system.h
+
+#ifndef HOST_ESP_SYSTEM_H_INCLUDED
+#define HOST_ESP_SYSTEM_H_INCLUDED
+
+#include <stdint.h>
+#include "esp_err.h"
+
+void esp_restart(void) __attribute__((noreturn));
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+
+#endif
@@ -0,0 +1,18 @@
+// Host shim: esp_vfs_eventfd.h - Linux has eventfd natively, registration is a no-op
+
+#ifndef HOST_ESP_VFS_EVENTFD_H_INCLUDED
+#define HOST_ESP_VFS_EVENTFD_H_INCLUDED
+
+#include <stddef.h>
+#include <sys/eventfd.h>
+#include "esp_err.h"
+
+typedef struct {
+    size_t max_fds;
+} esp_vfs_eventfd_config_t;
+
+#define ESP_VFS_EVENTD_CONFIG_DEFAULT() ((esp_vfs_eventfd_config_t){ .max_fds = 5 })
+
+esp_err_t esp_vfs_eventfd_register(const esp_vfs_eventfd_config_t *config);
+
+#endif
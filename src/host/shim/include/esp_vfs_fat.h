@@ -0,0 +1,23 @@
+// Host shim: esp_vfs_fat.h - "mounting" maps the mount point onto a host directory
+
+#ifndef HOST_ESP_VFS_FAT_H_INCLUDED
+#define HOST_ESP_VFS_FAT_H_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "driver/sdmmc_host.h"
+#include "sdmmc_cmd.h"
+
+typedef struct {
+    bool format_if_mount_failed;
+    int max_files;
+    size_t allocation_unit_size;
+} esp_vfs_fat_sdmmc_mount_config_t;
+
+typedef esp_vfs_fat_sdmmc_mount_config_t esp_vfs_fat_mount_config_t;
+
+esp_err_t esp_vfs_fat_sdmmc_mount(const char *base_path, const sdmmc_host_t *host_config, const void *slot_config, const esp_vfs_fat_mount_config_t *mount_config, sdmmc_card_t **out_card);
+esp_err_t esp_vfs_fat_sdcard_unmount(const char *base_path, sdmmc_card_t *card);
+
+#endif
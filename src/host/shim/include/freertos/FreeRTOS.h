@@ -0,0 +1,129 @@
+// Host shim: FreeRTOS kernel API on top of POSIX threads
+//-----------------------------------
+// Only the subset of the kernel that the firmware uses is provided. Semantics follow the
+// ESP-IDF port closely enough for timing work: stack depths are in bytes, ticks run at
+// CONFIG_FREERTOS_HZ against the monotonic clock, and blocking calls wake on tick boundaries.
+
+#ifndef HOST_FREERTOS_H_INCLUDED
+#define HOST_FREERTOS_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include "sdkconfig.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint8_t StackType_t; // Stack depths are in bytes, as on the esp32 port
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ CONFIG_FREERTOS_HZ
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000U))
+#define configMAX_TASK_NAME_LEN 16
+
+#define portYIELD_FROM_ISR(...) do { } while (0)
+
+// Critical sections - a single process wide lock stands in for the esp32 spinlocks
+typedef struct {
+    uint32_t owner;
+    uint32_t count;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0, 0}
+#define portMUX_INITIALIZE(mux) (*(mux) = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED)
+
+void host_enter_critical(portMUX_TYPE *mux);
+void host_exit_critical(portMUX_TYPE *mux);
+
+#define taskENTER_CRITICAL(mux) host_enter_critical(mux)
+#define taskEXIT_CRITICAL(mux) host_exit_critical(mux)
+#define portENTER_CRITICAL(mux) host_enter_critical(mux)
+#define portEXIT_CRITICAL(mux) host_exit_critical(mux)
+#define taskENTER_CRITICAL_ISR(mux) host_enter_critical(mux)
+#define taskEXIT_CRITICAL_ISR(mux) host_exit_critical(mux)
+
+// Control blocks for statically allocated tasks, queues and semaphores - the host keeps its own
+// state in them, so they are sized for that rather than matching the kernel's
+typedef struct {
+    uint64_t storage[40];
+} StaticTask_t;
+typedef struct {
+    uint64_t storage[32];
+} StaticQueue_t;
+typedef StaticQueue_t StaticSemaphore_t;
+
+// Tasks
+typedef void (*TaskFunction_t)(void *);
+typedef struct host_task *TaskHandle_t;
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters, UBaseType_t priority, TaskHandle_t *created_task);
+TaskHandle_t xTaskCreateStatic(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters, UBaseType_t priority, StackType_t *stack_buffer, StaticTask_t *task_buffer);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters, UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+const char *pcTaskGetName(TaskHandle_t task);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task); // Bytes, as the stack depths
+
+// Direct to task notifications (index 0 only)
+typedef enum {
+    eNoAction = 0,
+    eSetBits,
+    eIncrement,
+    eSetValueWithOverwrite,
+    eSetValueWithoutOverwrite
+} eNotifyAction;
+
+BaseType_t xTaskGenericNotify(TaskHandle_t task, uint32_t value, eNotifyAction action);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+BaseType_t xTaskNotifyWait(uint32_t bits_to_clear_on_entry, uint32_t bits_to_clear_on_exit, uint32_t *notification_value, TickType_t ticks_to_wait);
+
+#define xTaskNotify(task, value, action) xTaskGenericNotify((task), (value), (action))
+#define xTaskNotifyGive(task) xTaskGenericNotify((task), 0, eIncrement)
+#define xTaskNotifyFromISR(task, value, action, woken) xTaskGenericNotify((task), (value), (action))
+#define vTaskNotifyGiveFromISR(task, woken) ((void)(woken), (void)xTaskGenericNotify((task), 0, eIncrement))
+
+// Queues and semaphores (semaphores are queues with zero sized items, as in the kernel)
+typedef struct host_queue *QueueHandle_t;
+typedef QueueHandle_t SemaphoreHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size, uint8_t *storage, StaticQueue_t *queue_buffer);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait);
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait);
+BaseType_t xQueuePeek(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue);
+BaseType_t xQueueReset(QueueHandle_t queue);
+
+// The host keeps a queue registry (configQUEUE_REGISTRY_SIZE is 0 on the box, which makes this a
+// no-op) - see host_queue_stats
+#define HOST_QUEUE_REGISTRY_SIZE 16
+void vQueueAddToRegistry(QueueHandle_t queue, const char *name);
+
+#define xQueueSendToBack(queue, item, ticks) xQueueSend((queue), (item), (ticks))
+#define xQueueSendFromISR(queue, item, woken) xQueueSend((queue), (item), 0)
+#define xQueueReceiveFromISR(queue, buffer, woken) xQueueReceive((queue), (buffer), 0)
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *mutex_buffer);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count);
+
+#define xSemaphoreTake(sem, ticks) xQueueReceive((sem), NULL, (ticks))
+#define xSemaphoreGive(sem) xQueueSend((sem), NULL, 0)
+#define xSemaphoreGiveFromISR(sem, woken) xQueueSend((sem), NULL, 0)
+#define vSemaphoreDelete(sem) vQueueDelete(sem)
+
+#endif
@@ -0,0 +1,2 @@
+// Host shim: see FreeRTOS.h - the whole kernel subset is declared there
+#include "freertos/FreeRTOS.h"
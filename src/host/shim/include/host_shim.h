@@ -0,0 +1,50 @@
+// Host shim: controls for driving the firmware from a Linux process
+//-----------------------------------
+// Used by host_main.c and the benchmarks - never included by the firmware itself
+
+#ifndef HOST_SHIM_H_INCLUDED
+#define HOST_SHIM_H_INCLUDED
+
+#include <stdint.h>
+
+// Monotonic time since process start ("power on"), and the absolute monotonic time of boot
+int64_t host_time_us(void);
+int64_t host_boot_time_us(void);
+
+// Directory standing in for the SD card, NULL for "no card inserted"
+void host_set_sdcard_dir(const char *path);
+
+// Directory holding NVS, so it is kept from one run to the next - NULL (the default) for a
+// blank flash every run
+void host_set_nvs_dir(const char *path);
+
+// Makes the calling (non-task) thread usable with the blocking FreeRTOS calls
+void host_adopt_current_thread(const char *name);
+
+// Runs app_main in a task, as the IDF startup code does
+void host_start_app(void);
+
+// GPIO: drive an input pin (buttons are active low) and observe outputs
+void host_gpio_set_input(int pin, int level);
+int host_gpio_get_output(int pin);
+typedef void (*host_gpio_output_hook_t)(int pin, int level);
+void host_gpio_set_output_hook(host_gpio_output_hook_t hook);
+
+// Queues the firmware registered under a name: sends refused because one was full (summed over
+// every queue with the name, e.g. one per router) and the most any of them has held
+void host_queue_stats(const char *name, uint32_t *full_count, uint32_t *peak);
+
+// Ethernet: simulate cable unplug/replug (link up also hands out an address)
+void host_eth_set_link(int up);
+
+// Stand-ins for how long a box takes to negotiate a link after starting the PHY (and after the
+// cable goes back in), for DHCP to give it an address after that, and to mount the SD card -
+// all 0 (straight away) by default
+void host_set_boot_delays(int64_t link_us, int64_t dhcp_us, int64_t sdcard_mount_us);
+
+// 1 to have esp_eth_start wait for the link and the address before returning, so the rest of
+// boot follows the network rather than overlapping it - the one after another boot that
+// starting the PHY first replaced, for comparison
+void host_set_boot_serial(int serial);
+
+#endif
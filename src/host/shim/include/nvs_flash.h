@@ -0,0 +1,12 @@
+// Host shim: nvs_flash.h
+
+#ifndef HOST_NVS_FLASH_H_INCLUDED
+#define HOST_NVS_FLASH_H_INCLUDED
+
+#include "esp_err.h"
+#include "nvs.h"
+
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
+
+#endif
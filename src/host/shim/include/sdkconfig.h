@@ -0,0 +1,13 @@
+// Host shim: the handful of sdkconfig values the firmware depends on
+// Kept in step with src/sdkconfig so timing on the host matches the esp32 build
+
+#ifndef HOST_SDKCONFIG_H_INCLUDED
+#define HOST_SDKCONFIG_H_INCLUDED
+
+#define CONFIG_FREERTOS_HZ 100
+#define CONFIG_LOG_DEFAULT_LEVEL 3
+#define CONFIG_ESP_MAIN_TASK_STACK_SIZE 3584
+#define CONFIG_LWIP_MAX_SOCKETS 10
+#define CONFIG_VFS_SUPPORT_SELECT 1
+
+#endif
@@ -0,0 +1,15 @@
+// Host shim: sdmmc_cmd.h
+
+#ifndef HOST_SDMMC_CMD_H_INCLUDED
+#define HOST_SDMMC_CMD_H_INCLUDED
+
+#include <stdio.h>
+
+typedef struct {
+    char name[8];
+    const char *host_path;
+} sdmmc_card_t;
+
+void sdmmc_card_print_info(FILE *stream, const sdmmc_card_t *card);
+
+#endif
@@ -0,0 +1,429 @@
+// Videohub emulator
+//-----------------------------------
+// One thread does everything - accepting, reading commands, storms and disconnects - so a slow
+// write holds up everything else it sends, as a router's single control engine does.
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "host_shim.h"
+#include "videohub_protocol.h"
+#include "videohub_emulator.h"
+
+#define SEND_TIMEOUT_MS 2000 // A client that takes nothing for this long is dropped
+#define DUMP_BUFFER_SIZE (EMULATOR_SIZE_MAX * 40 * 4 + 1024)
+
+struct Emulator_Client_Struct {
+    int sock; // -1 for a free slot
+    uint8_t failed; // Write failed - closed once its data has been read
+    struct Videohub_Parser_Struct parser;
+    uint16_t command_count; // Routing lines in the block being read
+    uint8_t command_bad;    // A line in it was out of range
+    uint16_t outputs[EMULATOR_COMMAND_ROUTES_MAX];
+    uint16_t inputs[EMULATOR_COMMAND_ROUTES_MAX];
+};
+
+static int listener = -1;
+static pthread_t thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; // protects:
+static struct Videohub_Emulator_Config_Struct config;
+static struct Videohub_Emulator_Stats_Struct stats;
+
+// Read by other threads
+static _Atomic uint16_t routes[EMULATOR_SIZE_MAX];
+static _Atomic int64_t command_times[EMULATOR_SIZE_MAX];
+
+// Only used by the emulator thread
+static struct Emulator_Client_Struct clients[EMULATOR_CLIENTS_MAX];
+static struct Videohub_Emulator_Config_Struct running; // Copy of config for this pass of the loop
+static unsigned int random_seed = 1;
+static char dump_buffer[DUMP_BUFFER_SIZE];
+static char block_buffer[EMULATOR_COMMAND_ROUTES_MAX * 12 + 64];
+
+static void count(uint32_t *counter, uint32_t amount)
+{
+    pthread_mutex_lock(&lock);
+    *counter += amount;
+    pthread_mutex_unlock(&lock);
+}
+
+// Sends text to a client in the configured pieces - marks the client failed if it can't
+static void client_write(struct Emulator_Client_Struct *client, const char *text, size_t length)
+{
+    size_t sent = 0;
+    while (!client->failed && sent < length)
+    {
+        size_t piece = length - sent;
+        if (running.write_chunk > 0 && piece > running.write_chunk)
+        {
+            piece = running.write_chunk;
+        }
+        if (sent > 0 && running.write_delay_us > 0)
+        {
+            usleep(running.write_delay_us);
+        }
+        ssize_t written = send(client->sock, text + sent, piece, MSG_NOSIGNAL);
+        if (written <= 0)
+        {
+            client->failed = 1;
+            break;
+        }
+        sent += written;
+    }
+    pthread_mutex_lock(&lock);
+    stats.bytes_sent += sent;
+    pthread_mutex_unlock(&lock);
+}
+
+// Sends a block of route changes to every client
+static void broadcast_routes(const uint16_t *outputs, const uint16_t *inputs, uint16_t route_count)
+{
+    size_t length = snprintf(block_buffer, sizeof(block_buffer), "VIDEO OUTPUT ROUTING:\n");
+    for (uint16_t route = 0; route < route_count; route++)
+    {
+        length += snprintf(block_buffer + length, sizeof(block_buffer) - length, "%u %u\n", outputs[route], inputs[route]);
+    }
+    length += snprintf(block_buffer + length, sizeof(block_buffer) - length, "\n");
+
+    for (int index = 0; index < EMULATOR_CLIENTS_MAX; index++)
+    {
+        if (clients[index].sock >= 0)
+        {
+            client_write(&clients[index], block_buffer, length);
+            count(&stats.confirms_sent, route_count);
+        }
+    }
+}
+
+static size_t write_routing_table(char *buffer, size_t size, uint16_t router_size)
+{
+    size_t length = snprintf(buffer, size, "VIDEO OUTPUT ROUTING:\n");
+    for (uint16_t output = 0; output < router_size; output++)
+    {
+        length += snprintf(buffer + length, size - length, "%u %u\n", output, atomic_load(&routes[output]));
+    }
+    length += snprintf(buffer + length, size - length, "\n");
+    return length;
+}
+
+// Everything a Videohub sends a new client, in its order
+static void send_status_dump(struct Emulator_Client_Struct *client)
+{
+    uint16_t size = running.size;
+    size_t length = snprintf(dump_buffer, sizeof(dump_buffer),
+                             "PROTOCOL PREAMBLE:\nVersion: 2.8\n\n"
+                             "VIDEOHUB DEVICE:\nDevice present: true\nModel name: Blackmagic Videohub emulator\nFriendly name: Emulator\n"
+                             "Unique ID: 7C2E0D000001\nVideo inputs: %u\nVideo processing units: 0\nVideo outputs: %u\n"
+                             "Video monitoring outputs: 0\nSerial ports: 0\n\nINPUT LABELS:\n", size, size);
+    for (uint16_t input = 0; input < size; input++)
+    {
+        length += snprintf(dump_buffer + length, sizeof(dump_buffer) - length, "%u Input %u\n", input, input + 1);
+    }
+    length += snprintf(dump_buffer + length, sizeof(dump_buffer) - length, "\nOUTPUT LABELS:\n");
+    for (uint16_t output = 0; output < size; output++)
+    {
+        length += snprintf(dump_buffer + length, sizeof(dump_buffer) - length, "%u Output %u\n", output, output + 1);
+    }
+    length += snprintf(dump_buffer + length, sizeof(dump_buffer) - length, "\nVIDEO OUTPUT LOCKS:\n");
+    for (uint16_t output = 0; output < size; output++)
+    {
+        length += snprintf(dump_buffer + length, sizeof(dump_buffer) - length, "%u U\n", output);
+    }
+    length += snprintf(dump_buffer + length, sizeof(dump_buffer) - length, "\n");
+    length += write_routing_table(dump_buffer + length, sizeof(dump_buffer) - length, size);
+    length += snprintf(dump_buffer + length, sizeof(dump_buffer) - length, "END PRELUDE:\n\n");
+
+    client_write(client, dump_buffer, length);
+    count(&stats.dumps_sent, 1);
+}
+
+// A routing command block has ended - NAK it if any line is out of range (or at random), otherwise
+// ACK it, make the routes and tell every client
+static void handle_routing_command(struct Emulator_Client_Struct *client)
+{
+    if (client->command_count == 0 && !client->command_bad)
+    {
+        // Empty block asks for the routing table
+        client_write(client, "ACK\n\n", 5);
+        size_t length = write_routing_table(dump_buffer, sizeof(dump_buffer), running.size);
+        client_write(client, dump_buffer, length);
+        count(&stats.dumps_sent, 1);
+        return;
+    }
+
+    if (client->command_bad || (running.nak_percent > 0 && (uint32_t)(rand_r(&random_seed) % 100) < running.nak_percent))
+    {
+        client_write(client, "NAK\n\n", 5);
+        count(&stats.commands_naked, 1);
+        return;
+    }
+
+    int64_t now = host_time_us();
+    for (uint16_t route = 0; route < client->command_count; route++)
+    {
+        atomic_store(&routes[client->outputs[route]], client->inputs[route]);
+        atomic_store(&command_times[client->outputs[route]], now);
+    }
+    client_write(client, "ACK\n\n", 5);
+    pthread_mutex_lock(&lock);
+    stats.commands_acked++;
+    stats.routes_commanded += client->command_count;
+    pthread_mutex_unlock(&lock);
+    broadcast_routes(client->outputs, client->inputs, client->command_count);
+}
+
+static void client_event(const struct Videohub_Event_Struct *event, void *context)
+{
+    struct Emulator_Client_Struct *client = context;
+
+    if (event->type == VH_EVT_ROUTE)
+    {
+        if (event->index >= running.size || event->value >= running.size || client->command_count >= EMULATOR_COMMAND_ROUTES_MAX)
+        {
+            client->command_bad = 1;
+            return;
+        }
+        client->outputs[client->command_count] = event->index;
+        client->inputs[client->command_count] = (uint16_t)event->value;
+        client->command_count++;
+    }
+    else if (event->type == VH_EVT_BLOCK_END)
+    {
+        if (event->block == VH_BLOCK_OUTPUT_ROUTING)
+        {
+            handle_routing_command(client);
+        }
+        else
+        {
+            // The parser doesn't name PING: - it is the only other block the firmware sends
+            client_write(client, "ACK\n\n", 5);
+            count(&stats.pings, 1);
+        }
+        client->command_count = 0;
+        client->command_bad = 0;
+    }
+}
+
+static void client_close(struct Emulator_Client_Struct *client)
+{
+    close(client->sock);
+    client->sock = -1;
+}
+
+static void client_accept(void)
+{
+    int sock = accept(listener, NULL, NULL);
+    if (sock < 0)
+    {
+        return;
+    }
+    for (int index = 0; index < EMULATOR_CLIENTS_MAX; index++)
+    {
+        struct Emulator_Client_Struct *client = &clients[index];
+        if (client->sock < 0)
+        {
+            struct timeval timeout = {.tv_sec = SEND_TIMEOUT_MS / 1000, .tv_usec = (SEND_TIMEOUT_MS % 1000) * 1000};
+            setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            client->sock = sock;
+            client->failed = 0;
+            client->command_count = 0;
+            client->command_bad = 0;
+            videohub_parser_init(&client->parser, client_event, client);
+            count(&stats.connections, 1);
+            send_status_dump(client);
+            return;
+        }
+    }
+    close(sock); // No free client slots - as a Videohub that has run out
+}
+
+// Route changes from "other clients"
+static void storm(void)
+{
+    static uint16_t outputs[EMULATOR_COMMAND_ROUTES_MAX];
+    static uint16_t inputs[EMULATOR_COMMAND_ROUTES_MAX];
+    uint16_t output_range = (running.storm_outputs > 0 && running.storm_outputs < running.size) ? running.storm_outputs : running.size;
+    uint16_t route_count = (running.storm_routes < EMULATOR_COMMAND_ROUTES_MAX) ? running.storm_routes : EMULATOR_COMMAND_ROUTES_MAX;
+
+    for (uint16_t route = 0; route < route_count; route++)
+    {
+        outputs[route] = rand_r(&random_seed) % output_range;
+        inputs[route] = rand_r(&random_seed) % running.size;
+        atomic_store(&routes[outputs[route]], inputs[route]);
+    }
+    count(&stats.storm_routes, route_count);
+    broadcast_routes(outputs, inputs, route_count);
+}
+
+static void *emulator_thread(void *arg)
+{
+    (void)arg;
+    int64_t next_storm = 0;
+    int64_t next_disconnect = 0;
+
+    while (1)
+    {
+        pthread_mutex_lock(&lock);
+        running = config;
+        pthread_mutex_unlock(&lock);
+
+        // Storms and disconnects on their own schedules - restarted whenever they are turned on
+        int64_t now = host_time_us();
+        int64_t wait_us = -1;
+        if (running.storm_interval_ms == 0)
+        {
+            next_storm = 0;
+        }
+        else
+        {
+            if (next_storm == 0)
+            {
+                next_storm = now + running.storm_interval_ms * 1000LL;
+            }
+            if (now >= next_storm)
+            {
+                storm();
+                next_storm = (next_storm + running.storm_interval_ms * 1000LL > now) ? next_storm + running.storm_interval_ms * 1000LL
+                                                                                     : now + running.storm_interval_ms * 1000LL;
+            }
+            wait_us = next_storm - now;
+        }
+        if (running.disconnect_ms == 0)
+        {
+            next_disconnect = 0;
+        }
+        else
+        {
+            if (next_disconnect == 0)
+            {
+                next_disconnect = now + running.disconnect_ms * 1000LL;
+            }
+            if (now >= next_disconnect)
+            {
+                for (int index = 0; index < EMULATOR_CLIENTS_MAX; index++)
+                {
+                    if (clients[index].sock >= 0)
+                    {
+                        client_close(&clients[index]);
+                        count(&stats.disconnects, 1);
+                    }
+                }
+                next_disconnect = now + running.disconnect_ms * 1000LL;
+            }
+            if (wait_us < 0 || next_disconnect - now < wait_us)
+            {
+                wait_us = next_disconnect - now;
+            }
+        }
+
+        struct pollfd pfds[EMULATOR_CLIENTS_MAX + 1];
+        pfds[0] = (struct pollfd){.fd = listener, .events = POLLIN};
+        for (int index = 0; index < EMULATOR_CLIENTS_MAX; index++)
+        {
+            pfds[index + 1] = (struct pollfd){.fd = clients[index].sock, .events = POLLIN};
+        }
+        // Wake at least every 100 ms to pick up a new config
+        int timeout_ms = (wait_us < 0 || wait_us > 100000) ? 100 : (int)((wait_us + 999) / 1000);
+        if (poll(pfds, EMULATOR_CLIENTS_MAX + 1, timeout_ms) <= 0)
+        {
+            continue;
+        }
+
+        if (pfds[0].revents & POLLIN)
+        {
+            client_accept();
+        }
+        for (int index = 0; index < EMULATOR_CLIENTS_MAX; index++)
+        {
+            struct Emulator_Client_Struct *client = &clients[index];
+            if (client->sock < 0 || client->sock != pfds[index + 1].fd || !(pfds[index + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                continue;
+            }
+            uint8_t buffer[2048];
+            ssize_t length = recv(client->sock, buffer, sizeof(buffer), 0);
+            if (length <= 0)
+            {
+                client_close(client);
+                continue;
+            }
+            videohub_parser_feed(&client->parser, buffer, length);
+            if (client->failed)
+            {
+                client_close(client);
+            }
+        }
+        for (int index = 0; index < EMULATOR_CLIENTS_MAX; index++)
+        {
+            if (clients[index].sock >= 0 && clients[index].failed)
+            {
+                client_close(&clients[index]); // Couldn't take a broadcast
+            }
+        }
+    }
+    return NULL;
+}
+
+int videohub_emulator_start(int port, const struct Videohub_Emulator_Config_Struct *new_config)
+{
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY), .sin_port = htons(port)};
+    socklen_t address_length = sizeof(address);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, EMULATOR_CLIENTS_MAX) != 0
+        || getsockname(listener, (struct sockaddr *)&address, &address_length) != 0)
+    {
+        perror("videohub emulator");
+        return -1;
+    }
+
+    for (int index = 0; index < EMULATOR_CLIENTS_MAX; index++)
+    {
+        clients[index].sock = -1;
+    }
+    videohub_emulator_configure(new_config);
+    for (uint16_t output = 0; output < EMULATOR_SIZE_MAX; output++)
+    {
+        atomic_store(&routes[output], output % config.size);
+    }
+    pthread_create(&thread, NULL, emulator_thread, NULL);
+    return ntohs(address.sin_port);
+}
+
+void videohub_emulator_configure(const struct Videohub_Emulator_Config_Struct *new_config)
+{
+    pthread_mutex_lock(&lock);
+    config = *new_config;
+    if (config.size == 0 || config.size > EMULATOR_SIZE_MAX)
+    {
+        config.size = EMULATOR_SIZE_MAX;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void videohub_emulator_get_stats(struct Videohub_Emulator_Stats_Struct *copy)
+{
+    pthread_mutex_lock(&lock);
+    *copy = stats;
+    pthread_mutex_unlock(&lock);
+}
+
+uint16_t videohub_emulator_route(uint16_t output)
+{
+    return (output < EMULATOR_SIZE_MAX) ? atomic_load(&routes[output]) : 0;
+}
+
+int64_t videohub_emulator_command_time(uint16_t output)
+{
+    return (output < EMULATOR_SIZE_MAX) ? atomic_load(&command_times[output]) : 0;
+}
@@ -0,0 +1,60 @@
+// Videohub emulator
+//-----------------------------------
+// Stand-in Blackmagic Videohub for loading the firmware's network stack harder than a real router
+// does. Takes clients on a TCP port, sends each the full status dump on connect (preamble, device,
+// labels, locks and routing, up to 288x288), ACKs (or NAKs) their commands, confirms routes to
+// every client as a Videohub does, and can add:
+//   storms      - blocks of route changes from "other clients", sent to every client
+//   slow writes - everything it sends cut into small pieces with a wait between them
+//   disconnects - every client dropped every so often
+// Runs in its own thread - used by videohub_emulator_main.c and load_test.c.
+
+#ifndef VIDEOHUB_EMULATOR_H_INCLUDED
+#define VIDEOHUB_EMULATOR_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EMULATOR_DEFAULT_PORT 9990
+#define EMULATOR_CLIENTS_MAX 8
+#define EMULATOR_SIZE_MAX 288 // Universal Videohub 288
+#define EMULATOR_COMMAND_ROUTES_MAX 1024 // Routing lines read from one command block
+
+struct Videohub_Emulator_Config_Struct {
+    uint16_t size;                // Inputs and outputs
+    uint32_t storm_interval_ms;   // 0 for no storms
+    uint16_t storm_routes;        // Route changes in each storm block
+    uint16_t storm_outputs;       // Storms change outputs below this (0 for all of them)
+    size_t write_chunk;           // Bytes per write, 0 to write everything in one go
+    uint32_t write_delay_us;      // Wait between the pieces
+    uint32_t disconnect_ms;       // 0 never - otherwise every client is dropped this often
+    uint8_t nak_percent;          // Routing commands NAKed at random (without being routed)
+};
+
+struct Videohub_Emulator_Stats_Struct {
+    uint32_t connections;
+    uint32_t disconnects;         // Dropped by the emulator
+    uint32_t dumps_sent;          // Status dumps on connect, and routing tables asked for
+    uint32_t commands_acked;      // Routing commands
+    uint32_t commands_naked;
+    uint32_t pings;
+    uint32_t routes_commanded;    // Routes in ACKed routing commands
+    uint32_t storm_routes;        // Route changes made by storms
+    uint32_t confirms_sent;       // Routing lines sent to clients as changes (not in dumps)
+    uint64_t bytes_sent;
+};
+
+// Starts the emulator on port (0 for any free one) - returns the port, or -1 if it couldn't listen
+int videohub_emulator_start(int port, const struct Videohub_Emulator_Config_Struct *config);
+
+// Changes the storms, writes and disconnects while it runs - the size only applies from the next
+// status dump
+void videohub_emulator_configure(const struct Videohub_Emulator_Config_Struct *config);
+
+void videohub_emulator_get_stats(struct Videohub_Emulator_Stats_Struct *stats);
+
+// Input routed to an output, and when the last routing command for it arrived (host_time_us)
+uint16_t videohub_emulator_route(uint16_t output);
+int64_t videohub_emulator_command_time(uint16_t output);
+
+#endif
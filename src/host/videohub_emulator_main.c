@@ -0,0 +1,102 @@
+// Videohub emulator as a program of its own
+//-----------------------------------
+// Stands in for the router on port 9990, where the host build's sdcard/config.txt points, so
+// boxes_host (or a box on the bench) can be run against storms, a 288x288 router, slow writes
+// and disconnects by hand. Prints what it has done every second until stopped.
+//   --port N             listen on N rather than 9990
+//   --size N             inputs and outputs, up to 288 (default 288)
+//   --storm MS:ROUTES    every MS ms, a block of ROUTES route changes from "other clients"
+//   --storm-outputs N    storms only change the first N outputs
+//   --chunk BYTES:US     write everything in BYTES sized pieces, US us apart
+//   --disconnect MS      drop every client every MS ms
+//   --nak PERCENT        NAK this many routing commands at random
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "host_shim.h"
+#include "videohub_emulator.h"
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [--port N] [--size N] [--storm MS:ROUTES] [--storm-outputs N] [--chunk BYTES:US] [--disconnect MS] [--nak PERCENT]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    int port = EMULATOR_DEFAULT_PORT;
+    struct Videohub_Emulator_Config_Struct config = {.size = EMULATOR_SIZE_MAX};
+
+    for (int i = 1; i < argc; i++)
+    {
+        unsigned int first;
+        unsigned int second;
+        if (i + 1 >= argc)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (strcmp(argv[i - 1], "--port") == 0)
+        {
+            port = atoi(value);
+        }
+        else if (strcmp(argv[i - 1], "--size") == 0)
+        {
+            config.size = atoi(value);
+        }
+        else if (strcmp(argv[i - 1], "--storm") == 0 && sscanf(value, "%u:%u", &first, &second) == 2)
+        {
+            config.storm_interval_ms = first;
+            config.storm_routes = second;
+        }
+        else if (strcmp(argv[i - 1], "--storm-outputs") == 0)
+        {
+            config.storm_outputs = atoi(value);
+        }
+        else if (strcmp(argv[i - 1], "--chunk") == 0 && sscanf(value, "%u:%u", &first, &second) == 2)
+        {
+            config.write_chunk = first;
+            config.write_delay_us = second;
+        }
+        else if (strcmp(argv[i - 1], "--disconnect") == 0)
+        {
+            config.disconnect_ms = atoi(value);
+        }
+        else if (strcmp(argv[i - 1], "--nak") == 0)
+        {
+            config.nak_percent = atoi(value);
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    port = videohub_emulator_start(port, &config);
+    if (port < 0)
+    {
+        return 1;
+    }
+    printf("Videohub emulator on port %d\n", port);
+
+    struct Videohub_Emulator_Stats_Struct last = {0};
+    while (1)
+    {
+        sleep(1);
+        struct Videohub_Emulator_Stats_Struct now;
+        videohub_emulator_get_stats(&now);
+        printf("%"PRIu32" connections, %"PRIu32" dropped, %"PRIu32" dumps | last second: %"PRIu32" commands acked, %"PRIu32" naked, "
+               "%"PRIu32" pings, %"PRIu32" storm routes, %"PRIu32" confirms sent, %"PRIu64" bytes\n",
+               now.connections, now.disconnects, now.dumps_sent, now.commands_acked - last.commands_acked,
+               now.commands_naked - last.commands_naked, now.pings - last.pings, now.storm_routes - last.storm_routes,
+               now.confirms_sent - last.confirms_sent, now.bytes_sent - last.bytes_sent);
+        fflush(stdout);
+        last = now;
+    }
+    return 0;
+}
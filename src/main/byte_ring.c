@@ -0,0 +1,70 @@
+// Single producer, single consumer byte ring
+//-----------------------------------
+
+#include "byte_ring.h"
+
+void byte_ring_init(struct Byte_Ring_Struct *ring, uint8_t *storage, size_t size)
+{
+    ring->buffer = storage;
+    ring->size = size;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+size_t byte_ring_write_span(struct Byte_Ring_Struct *ring, uint8_t **span)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire); // Consumer is done with bytes before tail
+    size_t offset = head & (ring->size - 1);
+
+    size_t free_bytes = ring->size - (head - tail);
+    size_t to_end = ring->size - offset;
+
+    *span = ring->buffer + offset;
+    return (free_bytes < to_end) ? free_bytes : to_end;
+}
+
+void byte_ring_commit(struct Byte_Ring_Struct *ring, size_t length)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + length, memory_order_release); // Publishes the written bytes
+}
+
+size_t byte_ring_read_span(struct Byte_Ring_Struct *ring, const uint8_t **span)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t offset = tail & (ring->size - 1);
+
+    size_t used = head - tail;
+    size_t to_end = ring->size - offset;
+
+    *span = ring->buffer + offset;
+    return (used < to_end) ? used : to_end;
+}
+
+void byte_ring_consume(struct Byte_Ring_Struct *ring, size_t length)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + length, memory_order_release); // Hands the space back to the producer
+}
+
+void byte_ring_consume_to(struct Byte_Ring_Struct *ring, size_t position)
+{
+    // Discard everything up to an absolute position previously read from byte_ring_position()
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if ((position - tail) <= ring->size && position != tail)
+    {
+        atomic_store_explicit(&ring->tail, position, memory_order_release);
+    }
+}
+
+size_t byte_ring_used(struct Byte_Ring_Struct *ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire) - atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+size_t byte_ring_position(struct Byte_Ring_Struct *ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire);
+}
@@ -0,0 +1,35 @@
+// Single producer, single consumer byte ring
+//-----------------------------------
+// The producer writes straight into free space (e.g. recv() into the ring) and the consumer
+// reads in place, so data is never copied in or out. Head and tail are free running counts,
+// so the ring is full at head - tail == size. Size must be a power of two.
+
+#ifndef BYTE_RING_H_INCLUDED
+#define BYTE_RING_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+struct Byte_Ring_Struct {
+    uint8_t *buffer;
+    size_t size;
+    atomic_size_t head; // Total bytes ever written - only the producer moves this
+    atomic_size_t tail; // Total bytes ever consumed - only the consumer moves this
+};
+
+void byte_ring_init(struct Byte_Ring_Struct *ring, uint8_t *storage, size_t size);
+
+// Producer side: contiguous free space at the head, then publish what was written
+size_t byte_ring_write_span(struct Byte_Ring_Struct *ring, uint8_t **span);
+void byte_ring_commit(struct Byte_Ring_Struct *ring, size_t length);
+
+// Consumer side: contiguous unread data at the tail, then release what was used
+size_t byte_ring_read_span(struct Byte_Ring_Struct *ring, const uint8_t **span);
+void byte_ring_consume(struct Byte_Ring_Struct *ring, size_t length);
+void byte_ring_consume_to(struct Byte_Ring_Struct *ring, size_t position);
+
+size_t byte_ring_used(struct Byte_Ring_Struct *ring);
+size_t byte_ring_position(struct Byte_Ring_Struct *ring);
+
+#endif
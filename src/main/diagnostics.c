@@ -0,0 +1,263 @@
+// Diagnostics port
+//-----------------------------------
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "diagnostics.h"
+#include "ethernet.h"
+#include "latency.h"
+#include "trace.h"
+#include "route_share.h"
+#include "route_store.h"
+#include "storage.h"
+#include "ram_budget.h"
+#include "queue_stats.h"
+
+// Logging tag
+static const char *TAG = "diagnostics";
+
+static StackType_t diagnostics_task_stack[DIAG_TASK_STACK];
+static StaticTask_t diagnostics_task_buffer;
+
+static const char *const settings_sources[] = {"defaults", "sd card", "cache"};
+static const char *const settings_checks[] = {"card not checked yet", "card unchanged", "no file on card", "card file has errors",
+                                              "card file changed and in use", "card file changed, restarting"};
+
+static size_t dump_stats(char *output, size_t size)
+{
+    size_t length = 0;
+    for (uint8_t router = 0; router < get_router_count() && length < size; router++)
+    {
+        struct Command_Stats_Struct commands;
+        struct Reconnect_Stats_Struct reconnects;
+        get_command_stats(router, &commands);
+        get_reconnect_stats(router, &reconnects);
+
+        uint32_t answered = commands.acked + commands.naked;
+        length += snprintf(output + length, size - length,
+                           "router %u commands: %"PRIu32" acked, %"PRIu32" naked, %"PRIu32" timed out, %"PRIu32" routes coalesced\n"
+                           "  round trip us: last %"PRIu32", min %"PRIu32", max %"PRIu32", mean %"PRIu32", rolling %"PRIu32" +/- %"PRIu32"\n"
+                           "  pings: %"PRIu32" sent, %"PRIu32" missed, %"PRIu32" reconnects for missing them\n"
+                           "  connection: %"PRIu32" connects, %"PRIu32" failed, %"PRIu32" recoveries\n"
+                           "  last recovery us: to ip %"PRId64", to connect %"PRId64", to confirm %"PRId64"\n",
+                           router + 1, commands.acked, commands.naked, commands.timed_out, get_routes_coalesced(router),
+                           commands.rtt_last_us, commands.rtt_min_us, commands.rtt_max_us,
+                           (answered > 0) ? (uint32_t)(commands.rtt_total_us / answered) : 0,
+                           commands.rtt_rolling_us, commands.rtt_jitter_us,
+                           commands.pings_sent, commands.pings_missed, commands.ping_resets,
+                           reconnects.connects, reconnects.connect_failures, reconnects.recoveries,
+                           reconnects.recovery_to_ip_us, reconnects.recovery_to_connect_us, reconnects.recovery_to_confirm_us);
+    }
+
+    struct Route_Share_Stats_Struct sharing;
+    route_share_get_stats(&sharing);
+    if (length < size)
+    {
+        length += snprintf(output + length, size - length,
+                           "route sharing: %"PRIu32" datagrams sent, %"PRIu32" received, %"PRIu32" tables sent, %"PRIu32" routes learned, %"PRIu32" dropped\n",
+                           sharing.datagrams_sent, sharing.datagrams_received, sharing.tables_sent, sharing.routes_learned, sharing.dropped);
+    }
+
+    struct Route_Store_Stats_Struct store;
+    route_store_get_stats(&store);
+    if (length < size)
+    {
+        length += snprintf(output + length, size - length,
+                           "route store: %"PRIu32" changes, %"PRIu32" flash writes, %u restored at boot, %u since confirmed (%u had changed)\n",
+                           store.changes, store.writes, store.restored, store.reconciled, store.differed);
+    }
+
+    struct Settings_Status_Struct settings;
+    get_settings_status(&settings);
+    if (length < size)
+    {
+        length += snprintf(output + length, size - length, "settings: from %s, %s, %u config errors, loaded in %"PRId64" us, %"PRIu32" reloads\n",
+                           settings_sources[settings.source], settings_checks[settings.check], settings.errors, settings.load_us, settings.reloads);
+    }
+    return length;
+}
+
+// Checks the card now, and answers with what it found
+static int reload_settings(char *output, size_t size)
+{
+    struct Settings_Status_Struct settings;
+    get_settings_status(&settings);
+    uint32_t checks = settings.checks;
+    settings_check_now();
+
+    TickType_t waited = 0;
+    do
+    {
+        vTaskDelay(pdMS_TO_TICKS(DIAG_RELOAD_POLL_MS));
+        waited += pdMS_TO_TICKS(DIAG_RELOAD_POLL_MS);
+        get_settings_status(&settings);
+    } while (settings.checks == checks && waited < pdMS_TO_TICKS(DIAG_RELOAD_TIMEOUT_MS));
+
+    if (settings.checks == checks)
+    {
+        return snprintf(output, size, "settings: card check still running\n");
+    }
+    return snprintf(output, size, "settings: %s, %u config errors\n", settings_checks[settings.check], settings.errors);
+}
+
+// Writes an answer made in one piece
+static void write_text(Diagnostics_Write_Function write, void *context, const char *output, int length, size_t size)
+{
+    if (length > 0)
+    {
+        write(output, ((size_t)length < size) ? (size_t)length : size - 1, context);
+    }
+}
+
+// Decodes everything in the trace ring as it stands - events recorded while this runs are left
+// for next time, so a busy box can't keep it going forever
+static void dump_trace(Diagnostics_Write_Function write, void *context, char *output, size_t size)
+{
+    uint32_t end = trace_position();
+    uint32_t cursor = (end > TRACE_RING_LENGTH) ? end - TRACE_RING_LENGTH : 0;
+    size_t length;
+
+    while ((int32_t)(end - cursor) > 0 && (length = trace_format(&cursor, output, size)) > 0)
+    {
+        if (!write(output, length, context))
+        {
+            return;
+        }
+    }
+}
+
+void diagnostics_command(const char *line, Diagnostics_Write_Function write, void *context)
+{
+    // Static rather than on the task's stack - commands are only run one at a time
+    static char output[DIAG_OUTPUT_SIZE];
+
+    // Ignore the line ending, however it was sent
+    size_t length = strcspn(line, "\r\n");
+
+    if (length == strlen("latency") && strncmp(line, "latency", length) == 0)
+    {
+        write_text(write, context, output, latency_dump(output, sizeof(output)), sizeof(output));
+    }
+    else if (length == strlen("latency reset") && strncmp(line, "latency reset", length) == 0)
+    {
+        latency_reset();
+        write_text(write, context, output, snprintf(output, sizeof(output), "latency histograms cleared\n"), sizeof(output));
+    }
+    else if (length == strlen("stats") && strncmp(line, "stats", length) == 0)
+    {
+        write_text(write, context, output, dump_stats(output, sizeof(output)), sizeof(output));
+    }
+    else if (length == strlen("trace") && strncmp(line, "trace", length) == 0)
+    {
+        dump_trace(write, context, output, sizeof(output));
+    }
+    else if (length == strlen("reload") && strncmp(line, "reload", length) == 0)
+    {
+        write_text(write, context, output, reload_settings(output, sizeof(output)), sizeof(output));
+    }
+    else if (length == strlen("ram") && strncmp(line, "ram", length) == 0)
+    {
+        write_text(write, context, output, ram_budget_dump(output, sizeof(output)), sizeof(output));
+    }
+    else if (length == strlen("queues") && strncmp(line, "queues", length) == 0)
+    {
+        write_text(write, context, output, queue_stats_dump(output, sizeof(output)), sizeof(output));
+    }
+    else if (length > 0)
+    {
+        write_text(write, context, output, snprintf(output, sizeof(output), "commands: latency, latency reset, queues, ram, reload, stats, trace\n"), sizeof(output));
+    }
+}
+
+static int send_text(const char *text, size_t length, void *context)
+{
+    return send(*(int *)context, text, length, 0) >= 0;
+}
+
+// Answers one connection until it is closed - one client at a time is plenty
+static void diagnostics_serve(int sock)
+{
+    static char line[DIAG_LINE_LENGTH];
+    size_t used = 0;
+
+    while (1)
+    {
+        int len = recv(sock, line + used, sizeof(line) - used - 1, 0);
+        if (len <= 0)
+        {
+            return;
+        }
+        used += len;
+        line[used] = '\0';
+
+        char *end;
+        while ((end = strchr(line, '\n')) != NULL)
+        {
+            *end = '\0';
+            diagnostics_command(line, send_text, &sock);
+            used -= (end + 1) - line;
+            memmove(line, end + 1, used + 1);
+        }
+
+        if (used == sizeof(line) - 1)
+        {
+            used = 0; // Too long to be a command - throw it away
+        }
+    }
+}
+
+static void diagnostics_task(void)
+{
+    int listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    int reuse = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(DIAG_TCP_PORT);
+
+    if (listen_sock < 0 || bind(listen_sock, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listen_sock, 1) != 0)
+    {
+        // Not worth rebooting over - the box works the same without it
+        ESP_LOGE(TAG, "Unable to open diagnostics port %d: Error number %d", DIAG_TCP_PORT, errno);
+        if (listen_sock >= 0)
+        {
+            close(listen_sock);
+        }
+        vTaskDelete(NULL);
+        return;
+    }
+    ESP_LOGI(TAG, "Diagnostics listening on port %d", DIAG_TCP_PORT);
+
+    while (1)
+    {
+        int sock = accept(listen_sock, NULL, NULL);
+        if (sock < 0)
+        {
+            ESP_LOGW(TAG, "Diagnostics accept failed: Error number %d", errno);
+            vTaskDelay(100 / portTICK_PERIOD_MS);
+            continue;
+        }
+        diagnostics_serve(sock);
+        shutdown(sock, 0);
+        close(sock);
+    }
+}
+
+void setup_diagnostics(void)
+{
+    // Lowest priority of anything on the box - it must never hold up a route
+    create_static_task((TaskFunction_t)diagnostics_task, "diagnostics_task", DIAG_TASK_STACK, diagnostics_task_stack, &diagnostics_task_buffer, NULL, 1);
+}
@@ -0,0 +1,30 @@
+// Diagnostics port
+//-----------------------------------
+// Plain text command port for reading the box's timing and link figures over the network, e.g.
+//   echo latency | nc <box ip> 9991
+// One command per line, answered with a block of text.
+
+#ifndef DIAGNOSTICS_H_INCLUDED
+#define DIAGNOSTICS_H_INCLUDED
+
+#include <stddef.h>
+
+#define DIAG_TCP_PORT 9991
+#define DIAG_LINE_LENGTH 64
+#define DIAG_OUTPUT_SIZE 2048 // Answers longer than this (the trace) are written in pieces
+#define DIAG_TASK_STACK 4096 // Bytes
+
+// "reload" checks the card for a changed config file straight away, and waits this long to say what it found
+#define DIAG_RELOAD_TIMEOUT_MS 5000
+#define DIAG_RELOAD_POLL_MS 20
+
+// Where an answer goes - returns 0 if it couldn't be written, to stop a long answer early
+typedef int (*Diagnostics_Write_Function)(const char *text, size_t length, void *context);
+
+void setup_diagnostics(void);
+
+// Runs one command line and writes its answer - one at a time, as answers are built in a static buffer
+// Also used directly by the host build
+void diagnostics_command(const char *line, Diagnostics_Write_Function write, void *context);
+
+#endif
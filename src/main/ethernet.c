@@ -4,17 +4,24 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdatomic.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/select.h>
 #include <errno.h>
 #include <netdb.h>      
 #include <arpa/inet.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_netif.h"
 #include "esp_eth.h"
 #include "esp_event.h"
+#include "esp_vfs_eventfd.h"
 #include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
 #include "sdkconfig.h"
 
@@ -22,26 +29,131 @@
 #include "ethernet.h"
 #include "local_io.h"
 #include "pindefs.h"
+#include "byte_ring.h"
+#include "videohub_protocol.h"
+#include "latency.h"
+#include "trace.h"
+#include "ram_budget.h"
+#include "router_state.h"
+#include "queue_stats.h"
 
 // Logging tag
 static const char *TAG = "ethernet";
 
-// Output message queue - added to from logic in main.c
-QueueHandle_t ethernet_message_output_queue; 
-
-// Input message queue - added to here from main TCP loop
-QueueHandle_t ethernet_message_input_queue; 
+// Blocks sent to a router and not yet answered, oldest first - the router answers every block
+// with ACK or NAK, in order, so each answer belongs to the oldest entry
+// Added to by the TCP client, answered by the receive task, timed out by the TCP client
+#define ETH_BLOCK_ROUTING 0
+#define ETH_BLOCK_ROUTE_DUMP 1
+#define ETH_BLOCK_PING 2
+
+static const char *const block_kinds[] = {"routing", "route dump", "ping"};
+
+#define CONFIRM_BITMAP_SIZE ((ROUTER_OUTPUTS_MAX + 7) / 8)
+
+struct In_Flight_Block_Struct {
+    uint32_t sequence;
+    size_t connection;  // recv_resync_position when sent - answers only match their own connection
+    int64_t sent_time;  // esp_timer time (us)
+    uint8_t kind;       // ETH_BLOCK_ above
+    uint8_t salvo;      // 1 if the routing block carries a salvo
+    uint8_t route_count;
+    uint16_t outputs[ETH_OUTPUT_QUEUE_LENGTH];
+    uint16_t inputs[ETH_OUTPUT_QUEUE_LENGTH];
+};
+
+// Everything belonging to one router - its own output queue, TCP client and receive task, so a
+// slow or reconnecting router never holds up another
+struct Router_Connection_Struct {
+    uint8_t index; // Zero based router number
+    uint32_t ip;
+    uint32_t port;
+    char ip_text[INET_ADDRSTRLEN];
+    char output_queue_name[24]; // For the queue statistics
+    char confirms_name[24];
+
+    // Output message queue - added to from logic in main.c
+    QueueHandle_t output_queue;
+    SemaphoreHandle_t output_queue_mutex; // Held while a salvo is queued, and while the queue is drained
+    uint8_t output_queue_storage[ETH_OUTPUT_QUEUE_LENGTH * sizeof(struct Queued_Ethernet_Message_Struct)];
+    StaticQueue_t output_queue_buffer;
+    StaticSemaphore_t output_queue_mutex_buffer;
+
+    // eventfd written whenever a message is added to the output queue, so the TCP client can
+    // block in select() on the socket and the queue at the same time
+    int output_wake_fd;
+
+    // Receive ring - the TCP client recv()s straight into it and the receive task parses it in place
+    uint8_t recv_ring_storage[ETH_TCP_RECV_RING_SIZE];
+    struct Byte_Ring_Struct recv_ring;
+    atomic_bool recv_ring_full; // Set by the client when it is waiting for space
+    atomic_size_t recv_resync_position; // Ring position of the start of the current connection
+    _Atomic int64_t recv_time; // esp_timer time of the latest recv(), stamped on the confirms parsed from it
+
+    portMUX_TYPE in_flight_mux; // protects:
+    struct In_Flight_Block_Struct in_flight[ETH_IN_FLIGHT_MAX];
+    uint8_t in_flight_head;
+    uint8_t in_flight_count;
+    uint32_t in_flight_sequence;
+    struct Command_Stats_Struct command_stats;
+
+    // Routing commands dropped because a later one for the same output was queued behind them
+    uint32_t routes_coalesced;
+
+    // Routing confirms waiting for the main logic - staged by the receive task, taken by
+    // take_route_confirm
+    portMUX_TYPE confirm_mux; // protects:
+    uint16_t confirm_input[ROUTER_OUTPUTS_MAX];
+    int64_t confirm_time[ROUTER_OUTPUTS_MAX]; // recv_time of the latest confirm for the output
+    uint8_t confirm_staged[CONFIRM_BITMAP_SIZE];
+    uint8_t confirm_merged[CONFIRM_BITMAP_SIZE]; // Staged over another for the same output
+    uint16_t confirm_count;
+    uint8_t confirms_posted; // IN_MSG_TYP_ETHERNET is in the input event queue
+    struct Queue_Stats_Struct *confirm_stats;
+
+    // Recovery timing - see Reconnect_Stats_Struct
+    portMUX_TYPE reconnect_mux; // protects:
+    struct Reconnect_Stats_Struct reconnect_stats;
+    int64_t recovery_start_time; // esp_timer time recovery started, -1 when connected
+
+    // TCP client and receive tasks
+    TaskHandle_t client_task_handle;
+    TaskHandle_t recv_task_handle;
+    StackType_t client_task_stack[ETH_CLIENT_TASK_STACK];
+    StackType_t recv_task_stack[ETH_RECV_TASK_STACK];
+    StaticTask_t client_task_buffer;
+    StaticTask_t recv_task_buffer;
+
+    // Only used by the TCP client - building a send
+    char send_buffer[ETH_SEND_BUFFER_SIZE];
+    uint16_t send_outputs[ETH_OUTPUT_QUEUE_LENGTH];
+    uint16_t send_inputs[ETH_OUTPUT_QUEUE_LENGTH];
+    int64_t send_queued_times[ETH_OUTPUT_QUEUE_LENGTH];
+    int64_t last_send_time; // esp_timer time anything last went to the router, for the heartbeat
+    struct In_Flight_Block_Struct timed_out_block;
+
+    // Only used by the receive task
+    struct Videohub_Parser_Struct parser;
+    size_t resync_handled; // Connection being parsed
+    struct In_Flight_Block_Struct answered_block;
+};
+
+static struct Router_Connection_Struct routers[ROUTERS_MAX];
+static uint8_t router_count = 0;
 
 // Input message queue handle pointer - passed in from main module
 static QueueHandle_t *input_event_queue_ptr;
 
-// IP and port of router that we're controlling - set in setup function
-uint32_t router_ip;
-uint32_t router_port;
-char router_ip_text[INET_ADDRSTRLEN]; 
+// Link state, set by the Ethernet event handlers - each TCP client connects while the link is up,
+// and drops its connection itself whenever the generation changes (link lost, or new address)
+static atomic_bool tcp_client_link_up = false;
+static atomic_uint tcp_client_link_generation = 0;
+
+// Missed pings in a row before a router is reconnected - set by the main logic, read by the TCP clients
+static atomic_uint ping_missed_max = ETH_PING_MISSED_MAX;
 
-// Handle of TCP client task
-TaskHandle_t tcp_client_task_handle = NULL;
+// Box's own address in network byte order, 0 while it has none
+static atomic_uint_least32_t ethernet_address = 0;
 
 // Ethernet warning light activate
 
@@ -56,6 +168,584 @@ static void ethernet_warning_off(void)
     // TODO
 }
 
+// Wake a router's TCP client to send newly queued messages
+static void wake_tcp_client(struct Router_Connection_Struct *router)
+{
+    uint64_t increment = 1;
+    if (write(router->output_wake_fd, &increment, sizeof(increment)) < 0)
+    {
+        ESP_LOGW(TAG, "Unable to wake TCP client %u: Error number %d", router->index + 1, errno);
+    }
+}
+
+// Tell the main logic a router connection came up or went down, so it can resync its state
+static void post_connection_event(const struct Router_Connection_Struct *router, uint8_t type)
+{
+    struct Queued_Input_Message_Struct new_message = {0};
+    new_message.type = type;
+    new_message.router = router->index;
+
+    // Waits for room rather than lose it - the main logic never waits on this router's tasks
+    if (queue_send_counted(*input_event_queue_ptr, (void *)&new_message, portMAX_DELAY) != pdTRUE)
+    {
+        ESP_LOGW(TAG, "Sending router connection message failed due to queue full? - %i", new_message.type);
+    }
+}
+
+// Tell the TCP clients the link went up or down - they pick this up as soon as they are woken
+static void set_tcp_client_link(bool up)
+{
+    atomic_store(&tcp_client_link_up, up);
+    atomic_fetch_add(&tcp_client_link_generation, 1);
+    for (uint8_t index = 0; index < router_count; index++)
+    {
+        wake_tcp_client(&routers[index]);
+    }
+}
+
+// Starts timing a recovery, unless one is already being timed
+static void recovery_start(struct Router_Connection_Struct *router)
+{
+    taskENTER_CRITICAL(&router->reconnect_mux);
+    if (router->recovery_start_time < 0)
+    {
+        router->recovery_start_time = esp_timer_get_time();
+        router->reconnect_stats.recovery_to_ip_us = 0;
+        router->reconnect_stats.recovery_to_connect_us = 0;
+    }
+    taskEXIT_CRITICAL(&router->reconnect_mux);
+}
+
+// Records how far into the current recovery a step was reached
+static void recovery_step(struct Router_Connection_Struct *router, int64_t *step_time)
+{
+    taskENTER_CRITICAL(&router->reconnect_mux);
+    if (router->recovery_start_time >= 0)
+    {
+        *step_time = esp_timer_get_time() - router->recovery_start_time;
+    }
+    taskEXIT_CRITICAL(&router->reconnect_mux);
+}
+
+// First routing confirm on a connection - the recovery (if any) is complete
+static void recovery_complete(struct Router_Connection_Struct *router)
+{
+    struct Reconnect_Stats_Struct stats;
+    uint8_t recovered = 0;
+    taskENTER_CRITICAL(&router->reconnect_mux);
+    if (router->recovery_start_time >= 0)
+    {
+        router->reconnect_stats.recovery_to_confirm_us = esp_timer_get_time() - router->recovery_start_time;
+        router->reconnect_stats.recoveries++;
+        router->recovery_start_time = -1;
+        stats = router->reconnect_stats;
+        recovered = 1;
+    }
+    taskEXIT_CRITICAL(&router->reconnect_mux);
+
+    if (recovered)
+    {
+        ESP_LOGI(TAG, "Router %u recovered: IP %lld ms, connected %lld ms, first confirm %lld ms", router->index + 1,
+                 (long long)(stats.recovery_to_ip_us / 1000), (long long)(stats.recovery_to_connect_us / 1000),
+                 (long long)(stats.recovery_to_confirm_us / 1000));
+    }
+}
+
+void get_reconnect_stats(uint8_t router_index, struct Reconnect_Stats_Struct *stats)
+{
+    if (router_index >= router_count)
+    {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    struct Router_Connection_Struct *router = &routers[router_index];
+    taskENTER_CRITICAL(&router->reconnect_mux);
+    *stats = router->reconnect_stats;
+    taskEXIT_CRITICAL(&router->reconnect_mux);
+}
+
+// Tell the main logic how the block carrying a salvo was answered
+static void post_salvo_result(const struct Router_Connection_Struct *router, uint8_t type)
+{
+    struct Queued_Input_Message_Struct new_message = {0};
+    new_message.type = type;
+    new_message.router = router->index;
+
+    if (queue_send_counted(*input_event_queue_ptr, (void *)&new_message, portMAX_DELAY) != pdTRUE)
+    {
+        ESP_LOGW(TAG, "Sending salvo result message failed due to queue full? - %i", new_message.type);
+    }
+}
+
+// Tell the main logic each route in a block that failed, so it can undo anything it showed early
+static void post_failed_routes(const struct Router_Connection_Struct *router, const struct In_Flight_Block_Struct *block)
+{
+    if (block->salvo)
+    {
+        post_salvo_result(router, IN_MSG_TYP_SALVO_FAILED);
+    }
+
+    for (uint8_t route = 0; route < block->route_count; route++)
+    {
+        struct Queued_Input_Message_Struct new_message = {0};
+        new_message.type = IN_MSG_TYP_ROUTE_FAILED;
+        new_message.output = block->outputs[route];
+        new_message.input = block->inputs[route];
+        new_message.router = router->index;
+
+        if (queue_send_counted(*input_event_queue_ptr, (void *)&new_message, portMAX_DELAY) != pdTRUE)
+        {
+            ESP_LOGW(TAG, "Sending route failed message failed due to queue full? - %i,%i", new_message.output, new_message.input);
+        }
+    }
+}
+
+static uint8_t in_flight_space(struct Router_Connection_Struct *router)
+{
+    taskENTER_CRITICAL(&router->in_flight_mux);
+    uint8_t space = ETH_IN_FLIGHT_MAX - router->in_flight_count;
+    taskEXIT_CRITICAL(&router->in_flight_mux);
+    return space;
+}
+
+static void in_flight_clear(struct Router_Connection_Struct *router)
+{
+    taskENTER_CRITICAL(&router->in_flight_mux);
+    router->in_flight_count = 0;
+    taskEXIT_CRITICAL(&router->in_flight_mux);
+}
+
+// Records a block just sent - the caller has checked there is space
+static void in_flight_add(struct Router_Connection_Struct *router, uint8_t kind, uint8_t salvo, uint8_t route_count, const uint16_t *outputs, const uint16_t *inputs)
+{
+    taskENTER_CRITICAL(&router->in_flight_mux);
+    struct In_Flight_Block_Struct *block = &router->in_flight[(router->in_flight_head + router->in_flight_count) % ETH_IN_FLIGHT_MAX];
+    router->in_flight_count++;
+    block->sequence = ++router->in_flight_sequence;
+    block->connection = atomic_load(&router->recv_resync_position);
+    block->sent_time = esp_timer_get_time();
+    block->kind = kind;
+    block->salvo = salvo;
+    block->route_count = route_count;
+    memcpy(block->outputs, outputs, route_count * sizeof(uint16_t));
+    memcpy(block->inputs, inputs, route_count * sizeof(uint16_t));
+    taskEXIT_CRITICAL(&router->in_flight_mux);
+}
+
+// Removes the oldest block if it was sent on the given connection - returns 0 if there wasn't one
+static uint8_t in_flight_take_oldest(struct Router_Connection_Struct *router, size_t connection, struct In_Flight_Block_Struct *block)
+{
+    uint8_t found = 0;
+    taskENTER_CRITICAL(&router->in_flight_mux);
+    if (router->in_flight_count > 0 && router->in_flight[router->in_flight_head].connection == connection)
+    {
+        *block = router->in_flight[router->in_flight_head];
+        router->in_flight_head = (router->in_flight_head + 1) % ETH_IN_FLIGHT_MAX;
+        router->in_flight_count--;
+        found = 1;
+    }
+    taskEXIT_CRITICAL(&router->in_flight_mux);
+    return found;
+}
+
+// Matches an ACK or NAK from the router to the oldest block in flight
+static void in_flight_answer(struct Router_Connection_Struct *router, uint8_t acked)
+{
+    struct In_Flight_Block_Struct *block = &router->answered_block;
+    if (!in_flight_take_oldest(router, router->resync_handled, block))
+    {
+        ESP_LOGW(TAG, "Router %u %s with no command in flight", router->index + 1, acked ? "ACK" : "NAK");
+        return;
+    }
+
+    // Pings stay out of the button press figures and the trace - they would soon fill it
+    uint8_t ping = (block->kind == ETH_BLOCK_PING);
+    uint32_t rtt = (uint32_t)(esp_timer_get_time() - block->sent_time);
+    if (!ping)
+    {
+        latency_record(LAT_STAGE_ROUTER, rtt);
+    }
+    struct Command_Stats_Struct *stats = &router->command_stats;
+    taskENTER_CRITICAL(&router->in_flight_mux);
+    if (acked)
+    {
+        stats->acked++;
+    }
+    else
+    {
+        stats->naked++;
+    }
+    stats->rtt_last_us = rtt;
+    if (stats->rtt_min_us == 0 || rtt < stats->rtt_min_us)
+    {
+        stats->rtt_min_us = rtt;
+    }
+    if (rtt > stats->rtt_max_us)
+    {
+        stats->rtt_max_us = rtt;
+    }
+    stats->rtt_total_us += rtt;
+    if (stats->rtt_rolling_us == 0)
+    {
+        stats->rtt_rolling_us = rtt;
+        stats->rtt_jitter_us = rtt / 2;
+    }
+    else
+    {
+        uint32_t error = (rtt > stats->rtt_rolling_us) ? rtt - stats->rtt_rolling_us : stats->rtt_rolling_us - rtt;
+        stats->rtt_jitter_us = stats->rtt_jitter_us + (int32_t)(error - stats->rtt_jitter_us) / (1 << ETH_RTT_SMOOTHING_SHIFT);
+        stats->rtt_rolling_us = stats->rtt_rolling_us + (int32_t)(rtt - stats->rtt_rolling_us) / (1 << ETH_RTT_SMOOTHING_SHIFT);
+    }
+    if (ping && rtt > ETH_PING_INTERVAL_MS * 1000)
+    {
+        stats->pings_missed++; // Answered, but too late
+    }
+    taskEXIT_CRITICAL(&router->in_flight_mux);
+
+    if (acked)
+    {
+        if (!ping)
+        {
+            trace_record(TRACE_EVT_ACK, block->sequence, rtt, block->kind == ETH_BLOCK_ROUTE_DUMP);
+        }
+        if (block->salvo)
+        {
+            post_salvo_result(router, IN_MSG_TYP_SALVO_ACKED);
+        }
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Router %u command %"PRIu32" (%s) NAK after %"PRIu32" us", router->index + 1, block->sequence,
+                 block_kinds[block->kind], rtt);
+        post_failed_routes(router, block);
+    }
+
+    // A slot has opened up - the client may have stopped draining the queue for lack of one
+    wake_tcp_client(router);
+}
+
+// Fails every block in flight if one has gone unanswered too long, returns 1 if it has
+// Returns 0 otherwise, with the time until the first is due in *wait_us (-1 if nothing in flight)
+// Commands are due after ETH_COMMAND_TIMEOUT_MS, and pings once ping_missed_max intervals
+// have passed - by then that many pings in a row have gone unanswered
+static uint8_t in_flight_check_timeout(struct Router_Connection_Struct *router, int64_t *wait_us)
+{
+    struct In_Flight_Block_Struct *block = &router->timed_out_block;
+    int64_t now = esp_timer_get_time();
+    unsigned int missed_max = atomic_load(&ping_missed_max);
+    *wait_us = -1;
+
+    taskENTER_CRITICAL(&router->in_flight_mux);
+    uint8_t count = router->in_flight_count;
+    int64_t due = INT64_MAX;
+    uint8_t due_kind = ETH_BLOCK_ROUTING;
+    for (uint8_t entry = 0; entry < count; entry++)
+    {
+        const struct In_Flight_Block_Struct *sent = &router->in_flight[(router->in_flight_head + entry) % ETH_IN_FLIGHT_MAX];
+        int64_t timeout_us = (sent->kind == ETH_BLOCK_PING) ? ETH_PING_INTERVAL_MS * missed_max * 1000LL
+                                                            : ETH_COMMAND_TIMEOUT_MS * 1000LL;
+        if (sent->sent_time + timeout_us < due)
+        {
+            due = sent->sent_time + timeout_us;
+            due_kind = sent->kind;
+        }
+    }
+    taskEXIT_CRITICAL(&router->in_flight_mux);
+
+    if (count == 0)
+    {
+        return 0;
+    }
+    if (due > now)
+    {
+        *wait_us = due - now;
+        return 0;
+    }
+
+    if (due_kind == ETH_BLOCK_PING)
+    {
+        ESP_LOGW(TAG, "Router %u missed %u pings in a row", router->index + 1, missed_max);
+        taskENTER_CRITICAL(&router->in_flight_mux);
+        router->command_stats.ping_resets++;
+        taskEXIT_CRITICAL(&router->in_flight_mux);
+    }
+
+    // The router answers in order, so nothing behind the oldest is coming either
+    size_t connection = atomic_load(&router->recv_resync_position);
+    while (in_flight_take_oldest(router, connection, block))
+    {
+        taskENTER_CRITICAL(&router->in_flight_mux);
+        if (block->kind == ETH_BLOCK_PING)
+        {
+            router->command_stats.pings_missed++;
+        }
+        else
+        {
+            router->command_stats.timed_out++;
+        }
+        taskEXIT_CRITICAL(&router->in_flight_mux);
+        if (block->kind != ETH_BLOCK_PING)
+        {
+            ESP_LOGW(TAG, "Router %u command %"PRIu32" (%s) timed out", router->index + 1, block->sequence, block_kinds[block->kind]);
+            post_failed_routes(router, block);
+        }
+    }
+    return 1;
+}
+
+void get_command_stats(uint8_t router_index, struct Command_Stats_Struct *stats)
+{
+    if (router_index >= router_count)
+    {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    struct Router_Connection_Struct *router = &routers[router_index];
+    taskENTER_CRITICAL(&router->in_flight_mux);
+    *stats = router->command_stats;
+    taskEXIT_CRITICAL(&router->in_flight_mux);
+}
+
+uint32_t get_routes_coalesced(uint8_t router_index)
+{
+    return (router_index < router_count) ? routers[router_index].routes_coalesced : 0;
+}
+
+void set_ping_missed_max(uint8_t missed_max)
+{
+    atomic_store(&ping_missed_max, missed_max);
+}
+
+uint8_t take_route_confirm(uint8_t router_index, uint16_t *output, uint16_t *input, int64_t *event_time, uint8_t *merged)
+{
+    if (router_index >= router_count)
+    {
+        return 0;
+    }
+    struct Router_Connection_Struct *router = &routers[router_index];
+    uint8_t taken = 0;
+    taskENTER_CRITICAL(&router->confirm_mux);
+    for (uint16_t byte = 0; byte < CONFIRM_BITMAP_SIZE && !taken; byte++)
+    {
+        if (router->confirm_staged[byte] == 0)
+        {
+            continue;
+        }
+        uint16_t staged = byte * 8;
+        while ((router->confirm_staged[byte] & (1 << (staged % 8))) == 0)
+        {
+            staged++;
+        }
+        router->confirm_staged[byte] &= ~(1 << (staged % 8));
+        *merged = (router->confirm_merged[byte] & (1 << (staged % 8))) != 0;
+        router->confirm_merged[byte] &= ~(1 << (staged % 8));
+        router->confirm_count--;
+        *output = staged;
+        *input = router->confirm_input[staged];
+        *event_time = router->confirm_time[staged];
+        taken = 1;
+    }
+    if (!taken)
+    {
+        router->confirms_posted = 0; // Any staged from here on need a new message
+    }
+    taskEXIT_CRITICAL(&router->confirm_mux);
+    return taken;
+}
+
+uint32_t get_ethernet_address(void)
+{
+    return atomic_load(&ethernet_address);
+}
+
+uint8_t get_router_count(void)
+{
+    return router_count;
+}
+
+// Writes the whole of a block - a send can take only part of it once the socket's buffer is full,
+// and the rest must follow or the router sees half a block. Returns non zero if it couldn't all go
+// within the socket's send timeout, and the connection needs resetting
+static int send_all(int sock, const char *data, size_t length)
+{
+    size_t sent = 0;
+    while (sent < length)
+    {
+        ssize_t written = send(sock, data + sent, length - sent, 0);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return 1;
+        }
+        sent += written;
+    }
+    return 0;
+}
+
+// Sends everything waiting in a router's output queue as one write - a single routing block with
+// one line per output (only the latest input asked for each), then a route dump request if any
+// were queued, so the request (and the dump it brings back) never holds up a route
+// Returns non zero if the send failed and the connection needs resetting
+static int send_queued_messages(struct Router_Connection_Struct *router, int sock)
+{
+    char *buffer = router->send_buffer;
+    uint16_t *outputs = router->send_outputs;
+    uint16_t *inputs = router->send_inputs;
+    int64_t *queued_times = router->send_queued_times;
+
+    // Each pass can send two blocks (routes, then a dump request), each needing an in-flight slot
+    // Without them, messages wait in the queue (and coalesce) until the router answers
+    while ( uxQueueMessagesWaiting(router->output_queue) > 0 && in_flight_space(router) >= 2 )
+    {
+        uint8_t route_count = 0;
+        uint8_t route_dump = 0;
+        uint8_t salvo = 0;
+        uint8_t coalesced = 0;
+        uint8_t message_count = 0;
+
+        // At most a queue's worth at a time, so the buffer can't overflow however fast it is refilled
+        // Salvos are queued under the same mutex, so one is never split between two sends
+        xSemaphoreTake(router->output_queue_mutex, portMAX_DELAY);
+        for (uint8_t message = 0; message < ETH_OUTPUT_QUEUE_LENGTH; message++)
+        {
+            struct Queued_Ethernet_Message_Struct incoming_message;
+            if (xQueueReceive(router->output_queue, &incoming_message, 0) != pdTRUE)
+            {
+                break;
+            }
+            queued_times[message_count++] = incoming_message.queued_time;
+
+            switch (incoming_message.type)
+            {
+            case ETH_MSG_TYP_ROUTING:
+            {
+                uint8_t route = 0;
+                while (route < route_count && outputs[route] != incoming_message.output)
+                {
+                    route++;
+                }
+                if (route < route_count)
+                {
+                    coalesced++; // Superseded before it was sent
+                }
+                else
+                {
+                    route_count++;
+                }
+                outputs[route] = incoming_message.output;
+                inputs[route] = incoming_message.input;
+                salvo |= incoming_message.salvo;
+                break;
+            }
+
+            case ETH_MSG_TYP_ROUTEDUMP:
+                route_dump = 1;
+                break;
+
+            default:
+                ESP_LOGE(TAG, "Ethernet message type not recognised in queue: %d", incoming_message.type);
+                break;
+            }
+        }
+        xSemaphoreGive(router->output_queue_mutex);
+
+        int length = 0;
+        if (route_count > 0)
+        {
+            length += snprintf(buffer + length, ETH_SEND_BUFFER_SIZE - length, "VIDEO OUTPUT ROUTING:\n");
+            for (uint8_t route = 0; route < route_count; route++)
+            {
+                length += snprintf(buffer + length, ETH_SEND_BUFFER_SIZE - length, "%u %u\n", outputs[route], inputs[route]);
+            }
+            length += snprintf(buffer + length, ETH_SEND_BUFFER_SIZE - length, "\n");
+        }
+        if (route_dump != 0)
+        {
+            length += snprintf(buffer + length, ETH_SEND_BUFFER_SIZE - length, "VIDEO OUTPUT ROUTING:\n\n");
+        }
+
+        if (coalesced > 0)
+        {
+            router->routes_coalesced += coalesced;
+            queue_stats_coalesced(queue_stats_find(router->output_queue), coalesced);
+            trace_record(TRACE_EVT_COALESCED, coalesced, router->routes_coalesced, 0);
+        }
+
+        if (length == 0)
+        {
+            continue;
+        }
+
+        if (send_all(sock, buffer, length) != 0)
+        {
+            ESP_LOGE(TAG, "Send to router %u failed: Error number %d", router->index + 1, errno);
+            ethernet_warning_on();
+            return 1;
+        }
+
+        int64_t sent_time = esp_timer_get_time();
+        for (uint8_t message = 0; message < message_count; message++)
+        {
+            latency_record(LAT_STAGE_OUTPUT_QUEUE, sent_time - queued_times[message]);
+        }
+
+        if (route_count > 0)
+        {
+            in_flight_add(router, ETH_BLOCK_ROUTING, salvo, route_count, outputs, inputs);
+        }
+        if (route_dump != 0)
+        {
+            in_flight_add(router, ETH_BLOCK_ROUTE_DUMP, 0, 0, NULL, NULL);
+        }
+        router->last_send_time = sent_time;
+
+        // Data sent
+        trace_record(TRACE_EVT_SENT, length, route_count, route_dump);
+        ESP_LOGD(TAG, "Sent %d bytes to %s:\n%.*s", length, router->ip_text, length, buffer);
+        ethernet_warning_off();
+    }
+
+    return 0;
+}
+
+// Sends a PING: block once nothing has gone to the router for ETH_PING_INTERVAL_MS - the router
+// ACKs it like any other block, which proves it is still answering and times the round trip
+// Gives the time until the next one is due in *wait_us (-1 while waiting for an in-flight slot)
+// Returns non zero if the send failed and the connection needs resetting
+static int send_ping(struct Router_Connection_Struct *router, int sock, int64_t *wait_us)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t due = router->last_send_time + (ETH_PING_INTERVAL_MS * 1000LL);
+    if (due > now)
+    {
+        *wait_us = due - now;
+        return 0;
+    }
+    if (in_flight_space(router) == 0)
+    {
+        *wait_us = -1; // Woken when an answer frees a slot, or failed when the oldest times out
+        return 0;
+    }
+
+    static const char ping[] = "PING:\n\n";
+    if (send_all(sock, ping, sizeof(ping) - 1) != 0)
+    {
+        ESP_LOGE(TAG, "Ping to router %u failed: Error number %d", router->index + 1, errno);
+        ethernet_warning_on();
+        return 1;
+    }
+    in_flight_add(router, ETH_BLOCK_PING, 0, 0, NULL, NULL);
+    router->last_send_time = now;
+    taskENTER_CRITICAL(&router->in_flight_mux);
+    router->command_stats.pings_sent++;
+    taskEXIT_CRITICAL(&router->in_flight_mux);
+    *wait_us = ETH_PING_INTERVAL_MS * 1000LL;
+    return 0;
+}
+
 // Event handler for general Ethernet events 
 static void ethernet_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
 {
@@ -68,14 +758,15 @@ static void ethernet_event_handler(void* arg, esp_event_base_t event_base, int32
         esp_eth_ioctl(ethernet_handle, ETH_CMD_G_MAC_ADDR, mac_address);
         ESP_LOGI(TAG, "Ethernet Link Up");
         ESP_LOGI(TAG, "Ethernet HW Addr %02x:%02x:%02x:%02x:%02x:%02x", mac_address[0], mac_address[1], mac_address[2], mac_address[3], mac_address[4], mac_address[5]);
+        for (uint8_t index = 0; index < router_count; index++)
+        {
+            recovery_start(&routers[index]);
+        }
         break;
     case ETHERNET_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "Ethernet Link Down");
-        if( tcp_client_task_handle != NULL )
-        {
-            vTaskDelete(tcp_client_task_handle);
-            tcp_client_task_handle = NULL;
-        }
+        atomic_store(&ethernet_address, 0);
+        set_tcp_client_link(false); // Clients close their connections and wait for the link
         ethernet_warning_on();
         break;
     case ETHERNET_EVENT_START:
@@ -83,11 +774,8 @@ static void ethernet_event_handler(void* arg, esp_event_base_t event_base, int32
         break;
     case ETHERNET_EVENT_STOP:
         ESP_LOGI(TAG, "Ethernet Stopped");
-        if( tcp_client_task_handle != NULL )
-        {
-            vTaskDelete(tcp_client_task_handle);
-            tcp_client_task_handle = NULL;
-        }
+        atomic_store(&ethernet_address, 0);
+        set_tcp_client_link(false);
         ethernet_warning_on();
         break;
     default:
@@ -95,25 +783,101 @@ static void ethernet_event_handler(void* arg, esp_event_base_t event_base, int32
     }
 }
 
-// Main TCP client loop task 
+// Sleeps until a router's output_wake_fd is written (queued message, link change, ring space) or
+// timeout_us passes (-1 for no timeout)
+static void wait_for_wake(struct Router_Connection_Struct *router, int64_t timeout_us)
+{
+    fd_set read_fds;
+    FD_ZERO(&read_fds);
+    FD_SET(router->output_wake_fd, &read_fds);
+    struct timeval timeout = {.tv_sec = timeout_us / 1000000, .tv_usec = timeout_us % 1000000};
+
+    if (select(router->output_wake_fd + 1, &read_fds, NULL, NULL, (timeout_us < 0) ? NULL : &timeout) > 0)
+    {
+        uint64_t wake_count;
+        read(router->output_wake_fd, &wake_count, sizeof(wake_count));
+    }
+}
+
+// Connects without blocking for the whole TCP connect timeout, so a link change can cut it short
+// Returns 0 when connected, otherwise an error number
+static int connect_to_router(struct Router_Connection_Struct *router, int sock, const struct sockaddr_in *dest_addr, unsigned int generation)
+{
+    int output_wake_fd = router->output_wake_fd;
+    int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+
+    if (connect(sock, (const struct sockaddr *)dest_addr, sizeof(*dest_addr)) != 0)
+    {
+        if (errno != EINPROGRESS)
+        {
+            return errno;
+        }
+
+        int64_t give_up = esp_timer_get_time() + (ETH_CONNECT_TIMEOUT_MS * 1000LL);
+        while (1)
+        {
+            int64_t now = esp_timer_get_time();
+            if (atomic_load(&tcp_client_link_generation) != generation)
+            {
+                return ECONNABORTED;
+            }
+            if (now >= give_up)
+            {
+                return ETIMEDOUT;
+            }
+
+            fd_set read_fds;
+            fd_set write_fds;
+            FD_ZERO(&read_fds);
+            FD_ZERO(&write_fds);
+            FD_SET(output_wake_fd, &read_fds);
+            FD_SET(sock, &write_fds);
+            int max_fd = (sock > output_wake_fd) ? sock : output_wake_fd;
+            struct timeval timeout = {.tv_sec = (give_up - now) / 1000000, .tv_usec = (give_up - now) % 1000000};
+
+            if (select(max_fd + 1, &read_fds, &write_fds, NULL, &timeout) < 0 && errno != EINTR)
+            {
+                return errno;
+            }
+            if (FD_ISSET(output_wake_fd, &read_fds))
+            {
+                uint64_t wake_count;
+                read(output_wake_fd, &wake_count, sizeof(wake_count));
+            }
+            if (FD_ISSET(sock, &write_fds))
+            {
+                int sock_error = 0;
+                socklen_t length = sizeof(sock_error);
+                getsockopt(sock, SOL_SOCKET, SO_ERROR, &sock_error, &length);
+                if (sock_error != 0)
+                {
+                    return sock_error;
+                }
+                break;
+            }
+        }
+    }
+
+    fcntl(sock, F_SETFL, flags);
+    return 0;
+}
+
+// Main TCP client loop task - one per router, passed its Router_Connection_Struct
+// Runs for as long as the firmware does - it never gets deleted, it closes its own connection
+// and waits whenever the link goes down
 
-static void tcp_client_loop(void)
+static void tcp_client_loop(struct Router_Connection_Struct *router)
 {
-    static char rx_buffer[ETH_TCP_TEXT_RECV_BUFFER_SIZE];
-    static char next_message_buffer[ETH_TCP_TEXT_RECV_QUEUE_SIZE];
     int addr_family = 0;
     int ip_protocol = 0;
 
-    int partial_line_buffer_bytes = 0;
-    char partial_line_buffer[ETH_TCP_TEXT_RECV_BUFFER_SIZE];
-    memset(partial_line_buffer, '\0', sizeof(partial_line_buffer));
-
     struct sockaddr_in dest_addr;
     struct in_addr sin_ip;
-    sin_ip.s_addr = htonl(router_ip);
+    sin_ip.s_addr = htonl(router->ip);
     dest_addr.sin_addr = sin_ip;
     dest_addr.sin_family = AF_INET;
-    dest_addr.sin_port = htons(router_port);
+    dest_addr.sin_port = htons(router->port);
     addr_family = AF_INET;
     ip_protocol = IPPROTO_IP;
 
@@ -121,19 +885,53 @@ static void tcp_client_loop(void)
     int keepIdle = ETH_KEEPALIVE_IDLE;
     int keepInterval = ETH_KEEPALIVE_INTERVAL;
     int keepCount = ETH_KEEPALIVE_COUNT;
+    struct timeval send_timeout = {.tv_sec = ETH_SEND_TIMEOUT_MS / 1000, .tv_usec = (ETH_SEND_TIMEOUT_MS % 1000) * 1000};
+
+    inet_ntop(AF_INET, &(dest_addr.sin_addr), router->ip_text, INET_ADDRSTRLEN);
 
-    inet_ntop(AF_INET, &(dest_addr.sin_addr), router_ip_text, INET_ADDRSTRLEN);
+    uint32_t backoff_ms = 0; // Wait before the next connection attempt
 
     while (1) 
     {
-        // Outer connection loop - re(connects) to IP 
+        // Outer connection loop - re(connects) to IP while the link is up
+
+        if (!atomic_load(&tcp_client_link_up))
+        {
+            wait_for_wake(router, -1);
+            backoff_ms = 0; // Link has changed - try straight away when it is back
+            continue;
+        }
+
+        unsigned int generation = atomic_load(&tcp_client_link_generation);
+
+        if (backoff_ms > 0)
+        {
+            // Back off, but give up waiting as soon as the link changes
+            int64_t retry_time = esp_timer_get_time() + (backoff_ms * 1000LL);
+            int64_t now;
+            while (atomic_load(&tcp_client_link_generation) == generation && (now = esp_timer_get_time()) < retry_time)
+            {
+                wait_for_wake(router, retry_time - now);
+            }
+            if (atomic_load(&tcp_client_link_generation) != generation)
+            {
+                backoff_ms = 0;
+                continue;
+            }
+        }
+
+        // Next wait if this attempt fails - doubles each time
+        backoff_ms = (backoff_ms == 0) ? ETH_RECONNECT_MIN_MS : backoff_ms * 2;
+        if (backoff_ms > ETH_RECONNECT_MAX_MS)
+        {
+            backoff_ms = ETH_RECONNECT_MAX_MS;
+        }
 
         int sock =  socket(addr_family, SOCK_STREAM, ip_protocol);
         if (sock < 0) 
         {
             ESP_LOGE(TAG, "Unable to create socket: Error number %d", errno);
             ethernet_warning_on();
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
             continue;
         }
 
@@ -142,144 +940,151 @@ static void tcp_client_loop(void)
         setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &keepIdle, sizeof(int));
         setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &keepInterval, sizeof(int));
         setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &keepCount, sizeof(int));
+        // Never stuck in send() for long, so link changes are always noticed
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
         
-        ESP_LOGI(TAG, "Socket created, connecting to %s:%"PRIu32, router_ip_text, router_port);
+        ESP_LOGI(TAG, "Socket created, connecting to router %u at %s:%"PRIu32, router->index + 1, router->ip_text, router->port);
 
-        int err = connect(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+        int err = connect_to_router(router, sock, &dest_addr, generation);
         if (err != 0) 
         {
-            ESP_LOGE(TAG, "Socket unable to connect: Error number %d", errno);
+            ESP_LOGE(TAG, "Socket unable to connect to router %u: Error number %d", router->index + 1, err);
+            taskENTER_CRITICAL(&router->reconnect_mux);
+            router->reconnect_stats.connect_failures++;
+            taskEXIT_CRITICAL(&router->reconnect_mux);
             ethernet_warning_on();
             shutdown(sock, 0);
             close(sock);
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
             continue;
         }
-        ESP_LOGI(TAG, "Successfully connected");
+        ESP_LOGI(TAG, "Successfully connected to router %u", router->index + 1);
+        taskENTER_CRITICAL(&router->reconnect_mux);
+        router->reconnect_stats.connects++;
+        taskEXIT_CRITICAL(&router->reconnect_mux);
+        recovery_step(router, &router->reconnect_stats.recovery_to_connect_us);
+
+        // Anything left in the receive ring belongs to the old connection - have the parser
+        // drop it and start again from a clean state
+        atomic_store(&router->recv_resync_position, byte_ring_position(&router->recv_ring));
+        xTaskNotifyGive(router->recv_task_handle);
+        in_flight_clear(router); // Nothing sent on the old connection will be answered
+        router->last_send_time = esp_timer_get_time();
+
+        // Ask for the full routing table straight away so the main logic's mirror of it is
+        // complete even if this router doesn't send its status dump on connect
+        post_connection_event(router, IN_MSG_TYP_ROUTER_CONNECTED);
+        request_route_dump(router->index);
 
         while (1) 
         {
             // Inner event loop - executes in here until something about the connection fails
 
-            // Send any messages if in queue
-            uint8_t reset_connection = 0;    
-            while ( uxQueueMessagesWaiting(ethernet_message_output_queue) > 0 )
+            // Send any messages if in queue, then a ping if the router has heard nothing for a while
+            int64_t ping_wait_us;
+            if (send_queued_messages(router, sock) != 0 || send_ping(router, sock, &ping_wait_us) != 0)
             {
-                char buffer[64];
-                struct Queued_Ethernet_Message_Struct incoming_message;
-                if (xQueueReceive(ethernet_message_output_queue, &incoming_message, 0) != pdTRUE)
-                {
-                    ESP_LOGW(TAG, "Unable to retrive Ethernet message from queue");
-                    break;
-                }
-                    
-                switch (incoming_message.type)
+                break; // Need to trigger a connection reset
+            }
+
+            // Sleep until the router sends something or a new message is queued for it
+            // Only the heartbeat runs here while the panel and router are idle
+            // Only wait on the socket while there is room in the receive ring - when it is full
+            // TCP flow control holds the router off until the receive task catches up and wakes us
+            uint8_t *recv_span;
+            size_t recv_space = byte_ring_write_span(&router->recv_ring, &recv_span);
+            if (recv_space == 0)
+            {
+                atomic_store(&router->recv_ring_full, true);
+                recv_space = byte_ring_write_span(&router->recv_ring, &recv_span); // Re-check after publishing the flag
+                if (recv_space > 0)
                 {
-                case ETH_MSG_TYP_ROUTING:
-                    snprintf(buffer, sizeof(buffer), "VIDEO OUTPUT ROUTING:\n%d %d\n\n", incoming_message.output, incoming_message.input);
-                    break;
-                
-                case ETH_MSG_TYP_ROUTEDUMP:
-                    snprintf(buffer, sizeof(buffer), "VIDEO OUTPUT ROUTING:\n\n");
-                    break;
-
-                default:
-                    ESP_LOGE(TAG, "Ethernet message type not recognised in queue: %d", incoming_message.type);
-                    break;
+                    atomic_store(&router->recv_ring_full, false);
                 }
+            }
 
-                if (strlen(buffer) > 0)
-                {           
-                    int err = send(sock, buffer, strlen(buffer), 0);
-
-                    if (err < 0) 
-                    {
-                        ESP_LOGE(TAG, "Send failed: Error number %d", errno);
-                        ethernet_warning_on();
-                        reset_connection = 1;
-                        break; // Need to trigger a connection reset (will break out of outer loop below)
-                    } else {
-                        // Data sent
-                        ESP_LOGI(TAG, "Sent %d bytes to %s:", strlen(buffer), router_ip_text);
-                        ESP_LOGI(TAG, "%s", buffer);
-                        ethernet_warning_off();
-                    }
-                }
-                
+            int output_wake_fd = router->output_wake_fd;
+
+            fd_set read_fds;
+            FD_ZERO(&read_fds);
+            if (recv_space > 0)
+            {
+                FD_SET(sock, &read_fds);
             }
+            FD_SET(output_wake_fd, &read_fds);
+            int max_fd = (sock > output_wake_fd) ? sock : output_wake_fd;
 
-            if (reset_connection != 0)
+            // Wake up in time to fail the oldest command if the router doesn't answer it, and for
+            // the next ping
+            int64_t wait_us;
+            if (in_flight_check_timeout(router, &wait_us))
             {
-                break; 
+                ethernet_warning_on();
+                break; // Router has stopped answering - reset the connection
             }
-  
-             // Receive any messages
-            int len = recv(sock, rx_buffer, sizeof(rx_buffer) - 1, MSG_DONTWAIT);
-            // Did an error occurr during receiving?s
-            if (len < 0) 
+            if (ping_wait_us >= 0 && (wait_us < 0 || ping_wait_us < wait_us))
             {
-                if (errno == EAGAIN)
-                {
-                    // Not an error - just no data to recieve
-                    ESP_LOGV(TAG, "No data to recive in socket loop");
-                } else {
-                    ESP_LOGE(TAG, "Recieve failed: Error number %d", errno);
-                    ethernet_warning_on();
-                    break; // Need to trigger a connection reset
-                }
-            } else {
-                // Data received
-                rx_buffer[len] = '\0'; // Null-terminate whatever we received
-                ESP_LOGI(TAG, "Received %d bytes:", len);
-                ESP_LOGI(TAG, "%s", rx_buffer);
-                int start_point_this_rx = 0;
-
-                // First wipe the buffer where we are assembling the next block to send to tcp_recv_task
-                memset(next_message_buffer, '\0', sizeof(next_message_buffer));
-
-                // Then copy the parts we had left over from the last block/loop into it, if any
-                if (partial_line_buffer_bytes>0) 
-                {
-                    ESP_LOGI(TAG, "Copied in from previous block: %s", partial_line_buffer);
-                    memcpy(next_message_buffer, partial_line_buffer, partial_line_buffer_bytes);
-                    start_point_this_rx = partial_line_buffer_bytes;
-                    partial_line_buffer_bytes = 0;
-                    memset(partial_line_buffer, '\0', sizeof(partial_line_buffer));
-                }
+                wait_us = ping_wait_us;
+            }
+            struct timeval timeout = {.tv_sec = wait_us / 1000000, .tv_usec = wait_us % 1000000};
 
-                // Find the index of the last newline in the incoming rx data
-                int last_newline = 0;
-                for (int i=0; i < len; i++) {
-                    if(rx_buffer[i] == '\n')
-                    {
-                        last_newline = i;
-                    }
-                }
-                // Copy everything after that newline to the partial buffer, if any chars left
-                if (last_newline>0 && (len - last_newline) > 1) 
+            int ready = select(max_fd + 1, &read_fds, NULL, NULL, (wait_us < 0) ? NULL : &timeout);
+            if (ready < 0)
+            {
+                if (errno == EINTR)
                 {
-                    memcpy(partial_line_buffer, (void *) ( rx_buffer + last_newline + 1), (len - last_newline - 1));
-                    partial_line_buffer_bytes = (len - last_newline - 1);
-                    ESP_LOGI(TAG, "Copying to next buffer %d bytes: %s", partial_line_buffer_bytes, partial_line_buffer);
+                    continue;
                 }
+                ESP_LOGE(TAG, "Select failed: Error number %d", errno);
+                ethernet_warning_on();
+                break; // Need to trigger a connection reset
+            }
 
-                // Copy everything before that newline to the next message buffer 
-                memcpy((void *)(next_message_buffer + start_point_this_rx), rx_buffer, (last_newline + 1));
+            if (FD_ISSET(output_wake_fd, &read_fds))
+            {
+                // Clear the wakeup - the queue itself is drained at the top of the loop
+                uint64_t wake_count;
+                read(output_wake_fd, &wake_count, sizeof(wake_count));
+            }
 
-                // Send the next message buffer
-                ethernet_warning_off();
-                if (xQueueSend(ethernet_message_input_queue, (void *)&next_message_buffer, 1) == pdTRUE)
-                {
-                    ESP_LOGI(TAG, "Sending message from recv to process logic");
-                }
-                else
-                {
-                    ESP_LOGW(TAG, "Sending message from recv failed due to queue full?");
-                }
+            if (atomic_load(&tcp_client_link_generation) != generation)
+            {
+                ESP_LOGI(TAG, "Link changed, closing connection");
+                break;
+            }
+
+            if (!FD_ISSET(sock, &read_fds))
+            {
+                continue;
+            }
+
+            // Receive straight into the ring - socket is readable so this won't block
+            int len = recv(sock, recv_span, recv_space, 0);
+            // Did an error occurr during receiving?
+            if (len < 0) 
+            {
+                ESP_LOGE(TAG, "Recieve from router %u failed: Error number %d", router->index + 1, errno);
+                ethernet_warning_on();
+                break; // Need to trigger a connection reset
+            } else if (len == 0) {
+                ESP_LOGE(TAG, "Connection closed by router %u", router->index + 1);
+                ethernet_warning_on();
+                break; // Need to trigger a connection reset
             }
 
-            vTaskDelay(10 / portTICK_PERIOD_MS); // Yield for everything else 
+            // Data received - hand it to the receive task
+            trace_record(TRACE_EVT_RECEIVED, len, router->index + 1, 0);
+            ESP_LOGD(TAG, "Received %d bytes from router %u:\n%.*s", len, router->index + 1, len, (char *)recv_span);
+            atomic_store(&router->recv_time, esp_timer_get_time());
+            byte_ring_commit(&router->recv_ring, len);
+            xTaskNotifyGive(router->recv_task_handle);
+            ethernet_warning_off();
+            backoff_ms = 0; // Router is talking - retry straight away if this connection drops
+        }
 
+        post_connection_event(router, IN_MSG_TYP_ROUTER_DISCONNECTED);
+        if (atomic_load(&tcp_client_link_up))
+        {
+            recovery_start(router); // Lost the router with the link still up
         }
 
         if (sock != -1) 
@@ -289,103 +1094,124 @@ static void tcp_client_loop(void)
             close(sock);
             ethernet_warning_on();
         }
-
-        vTaskDelay(1000 / portTICK_PERIOD_MS); // Prevents hammering
     }
 }
 
-// Task that takes incoming TCP message fragments from router and sticks them together
-// Uses a state machine to filter to the messages we want and ignore all others
-static void tcp_recv_task(void)
+// Stages a routing confirm for the main logic, over any for the same output it hasn't taken yet,
+// and tells it there are some if it hasn't been already
+static void stage_route_confirm(struct Router_Connection_Struct *router, uint16_t output, uint16_t input)
 {
-    uint8_t state = ETH_TCP_RECV_STATE_UNKNOWN; // See header file for state machine definitions
+    if (output >= ROUTER_OUTPUTS_MAX)
+    {
+        ESP_LOGW(TAG, "Route confirm for output %u on router %u, beyond what is mirrored", output + 1, router->index + 1);
+        return;
+    }
 
-    while(1)
-    {   
-        static char incoming_msg[ETH_TCP_TEXT_RECV_BUFFER_SIZE];
-        if (xQueueReceive(ethernet_message_input_queue, &incoming_msg, (TickType_t) portMAX_DELAY) == pdTRUE)
+    taskENTER_CRITICAL(&router->confirm_mux);
+    uint8_t coalesced = (router->confirm_staged[output / 8] & (1 << (output % 8))) != 0;
+    router->confirm_staged[output / 8] |= (1 << (output % 8));
+    router->confirm_merged[output / 8] |= (coalesced << (output % 8));
+    router->confirm_count += !coalesced;
+    router->confirm_input[output] = input;
+    router->confirm_time[output] = atomic_load(&router->recv_time);
+    uint16_t waiting = router->confirm_count;
+    uint8_t post = !router->confirms_posted;
+    router->confirms_posted = 1;
+    taskEXIT_CRITICAL(&router->confirm_mux);
+
+    queue_stats_sent(router->confirm_stats, waiting);
+    if (coalesced)
+    {
+        queue_stats_coalesced(router->confirm_stats, 1);
+    }
+    trace_record(TRACE_EVT_CONFIRM, output, input, router->index + 1);
+
+    if (post)
+    {
+        struct Queued_Input_Message_Struct new_message = {0};
+        new_message.type = IN_MSG_TYP_ETHERNET;
+        new_message.router = router->index;
+        new_message.event_time = atomic_load(&router->recv_time);
+        new_message.queued_time = esp_timer_get_time();
+
+        // Only ever one in the queue for a router, so this rarely waits - and while it does, the
+        // receive ring fills and TCP flow control holds the router off
+        if (queue_send_counted(*input_event_queue_ptr, (void *)&new_message, portMAX_DELAY) != pdTRUE)
         {
-            // Message recieved from queue
-            ESP_LOGI(TAG,"Processing incoming text buffer in TCP logic");
+            ESP_LOGW(TAG, "Sending message from route confirm failed due to queue full?");
+            taskENTER_CRITICAL(&router->confirm_mux);
+            router->confirms_posted = 0; // Left staged - the next confirm tries again
+            taskEXIT_CRITICAL(&router->confirm_mux);
+        }
+    }
+}
 
-            // Go through string to break up lines preserving blank lines
+// Handles each event the protocol parser finds in the router's output
+static void tcp_recv_protocol_event(const struct Videohub_Event_Struct *event, void *context)
+{
+    struct Router_Connection_Struct *router = context;
 
-            uint16_t line_count = 0;
-            char *msg_ptr = incoming_msg;  
+    switch (event->type)
+    {
+    case VH_EVT_ROUTE:
+        recovery_complete(router);
+        stage_route_confirm(router, event->index, event->value);
+        break;
 
-            while (*msg_ptr != '\0') 
-            {
-                if (*msg_ptr == '\n') 
-                {   
-                    *msg_ptr = '\0';  // Replace newline with null terminator to break up strings
-                    line_count++;
-                }
-                msg_ptr++;
-            }
+    case VH_EVT_PREAMBLE_FIELD:
+    case VH_EVT_DEVICE_FIELD:
+        ESP_LOGI(TAG, "Router %u %.*s: %.*s", router->index + 1, event->key_length, event->key, event->text_length, event->text);
+        break;
 
-            line_count++;
-            ESP_LOGI(TAG,"Line count - %u",line_count);
+    case VH_EVT_ACK:
+        in_flight_answer(router, 1);
+        break;
 
-            msg_ptr = incoming_msg;
+    case VH_EVT_NAK:
+        in_flight_answer(router, 0);
+        break;
 
-            for (uint16_t i = 0; i < line_count; i++) 
-            {
-                u_int16_t ptr_length = strlen(msg_ptr); // Need to store the length becase we might insert extra null terminators
+    case VH_EVT_END_PRELUDE:
+        ESP_LOGI(TAG, "Router %u initial status dump complete", router->index + 1);
+        break;
 
-                switch (state)
-                {
-                case ETH_TCP_RECV_STATE_UNKNOWN:
-                    // Don't know what message we're currently getting; wait for blank line 
-                    if (strlen(msg_ptr) == 0)
-                    {
-                        // Blank line, now wait for the start of a block
-                        state = ETH_TCP_RECV_STATE_WAIT;
-                        break;
-                    } 
-                    break;
-                case ETH_TCP_RECV_STATE_WAIT:
-                    // Gone past a newline, waiting for the start of a block
-                    if (strncmp(msg_ptr, "VIDEO OUTPUT ROUTING:", strlen("VIDEO OUTPUT ROUTING:")) == 0)
-                    {
-                        state = ETH_TCP_RECV_STATE_IN_UPDATE;
-                        break;
-                    } 
-                    break;
-                case ETH_TCP_RECV_STATE_IN_UPDATE:
-                    // Gone past the start of a VIDEO OUTPUT ROUTING block
-                    if (strlen(msg_ptr) == 0)
-                    {
-                        // Blank line, now wait for the start of a block
-                        state = ETH_TCP_RECV_STATE_WAIT;
-                        break;
-                    }
-                    // If not blank, should be a pair of numbers, so now split by spaces 
-                    char *spacesplit;
-                    spacesplit = strtok(msg_ptr, " "); 
-                    uint8_t output = (uint8_t) atoi(spacesplit);
-                    spacesplit = strtok(NULL, " "); 
-                    uint8_t input = (uint8_t) atoi(spacesplit);
-                    ESP_LOGI(TAG, "Route confirm received! Output: %u Input %u", output, input);
-
-                    struct Queued_Input_Message_Struct new_message;
-                    new_message.type = IN_MSG_TYP_ETHERNET;
-                    new_message.input = input;
-                    new_message.output = output;
-
-                    if (xQueueSend(*input_event_queue_ptr, (void *)&new_message, 0) == pdTRUE)
-                    {
-                        ESP_LOGI(TAG, "Sending message from route confirm %i,%i,%i", new_message.type, new_message.output, new_message.input);
-                    }
-                    else
-                    {
-                        ESP_LOGW(TAG, "Sending message from route confirm failed due to queue full? - %i,%i,%i", new_message.type, new_message.output, new_message.input);
-                    }
-
-                    break;
-                } 
-
-                msg_ptr = msg_ptr + ptr_length + 1;
-            }
+    default:
+        // Labels and locks aren't used yet
+        break;
+    }
+}
+
+// Task that parses a router's text protocol out of its receive ring - one per router
+// The parser is fed whatever has arrived, however it is split, and reads it in place
+static void tcp_recv_task(struct Router_Connection_Struct *router)
+{
+    videohub_parser_init(&router->parser, tcp_recv_protocol_event, router);
+
+    while(1)
+    {   
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        size_t resync = atomic_load(&router->recv_resync_position);
+        if (resync != router->resync_handled)
+        {
+            // New connection - drop the rest of the old stream
+            byte_ring_consume_to(&router->recv_ring, resync);
+            router->resync_handled = resync;
+            videohub_parser_reset(&router->parser);
+        }
+
+        const uint8_t *span;
+        size_t available;
+        while ((available = byte_ring_read_span(&router->recv_ring, &span)) > 0)
+        {
+            videohub_parser_feed(&router->parser, span, available);
+            byte_ring_consume(&router->recv_ring, available);
+        }
+
+        // Room has been made in the ring - wake the client if it stopped reading for lack of it
+        if (atomic_exchange(&router->recv_ring_full, false))
+        {
+            wake_tcp_client(router);
         }
     }
 }
@@ -403,40 +1229,20 @@ static void got_ip_event_handler(void* arg, esp_event_base_t event_base, int32_t
     ESP_LOGI(TAG, "ETHMASK:" IPSTR, IP2STR(&ip_info->netmask) );
     ESP_LOGI(TAG, "ETHGW:" IPSTR, IP2STR(&ip_info->gw));
     ESP_LOGI(TAG, "~~~~~~~~~~~");
+    atomic_store(&ethernet_address, ip_info->ip.addr);
 
-    if( tcp_client_task_handle != NULL )
+    for (uint8_t index = 0; index < router_count; index++)
     {
-        vTaskDelete(tcp_client_task_handle);
-        tcp_client_task_handle = NULL;
+        recovery_step(&routers[index], &routers[index].reconnect_stats.recovery_to_ip_us);
     }
-
-    xTaskCreate( (TaskFunction_t) tcp_client_loop, "tcp_client_loop", 8192, NULL, 5, &tcp_client_task_handle);
+    set_tcp_client_link(true); // (Re)connects straight away, dropping any connection from an old address
 }
 
-void setup_ethernet(uint32_t ip, uint32_t port, QueueHandle_t* input_queue)
+void start_ethernet(void)
 {
-    router_ip = ip;
-    router_port = port;
-
-    // Set up output event queue
-    ethernet_message_output_queue = xQueueCreate (64, sizeof(struct Queued_Ethernet_Message_Struct)); 
-    if (ethernet_message_output_queue == NULL)
-    {
-        ESP_LOGE(TAG,"Unable to create ethernet output  message queue, rebooting");
-        esp_restart();
-    }
-
-    // Set up input message queue
-    ethernet_message_input_queue = xQueueCreate (ETH_TCP_TEXT_RECV_QUEUE_NUM, ETH_TCP_TEXT_RECV_QUEUE_SIZE * (sizeof(char))); 
-    if (ethernet_message_input_queue == NULL)
-    {
-        ESP_LOGE(TAG,"Unable to create ethernet input message queue, rebooting");
-        esp_restart();
-    }
-    xTaskCreate( (TaskFunction_t) tcp_recv_task, "tcp_recv_task", 8192, NULL, 5, NULL);
-
-    // Set up local pointers to the event queue in the main logic
-    input_event_queue_ptr = input_queue;
+    // Wakeups for the TCP clients when their output queues are added to
+    esp_vfs_eventfd_config_t eventfd_config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_vfs_eventfd_register(&eventfd_config));
 
     // Initialize TCP/IP network interface
     ESP_ERROR_CHECK(esp_netif_init());
@@ -490,50 +1296,160 @@ void setup_ethernet(uint32_t ip, uint32_t port, QueueHandle_t* input_queue)
     ESP_ERROR_CHECK(esp_event_handler_register(ETH_EVENT, ESP_EVENT_ANY_ID, &ethernet_event_handler, NULL));
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_ETH_GOT_IP, &got_ip_event_handler, NULL));
 
-    // Start Ethernet driver state machine
+    // Start Ethernet driver state machine - link negotiation and DHCP carry on in the background
     ESP_ERROR_CHECK(esp_eth_start(ethernet_handle));
+}
 
+void setup_ethernet(const struct Router_Settings_Struct *router_settings, uint8_t count, QueueHandle_t* input_queue)
+{
+    count = (count > ROUTERS_MAX) ? ROUTERS_MAX : count;
+
+    // Set up local pointers to the event queue in the main logic
+    input_event_queue_ptr = input_queue;
+
+    for (uint8_t index = 0; index < count; index++)
+    {
+        struct Router_Connection_Struct *router = &routers[index];
+        router->index = index;
+        router->ip = router_settings[index].ip;
+        router->port = router_settings[index].port;
+        portMUX_INITIALIZE(&router->in_flight_mux);
+        portMUX_INITIALIZE(&router->reconnect_mux);
+        portMUX_INITIALIZE(&router->confirm_mux);
+        router->recovery_start_time = -1;
+
+        // Set up output event queue, and the confirms staged for the main logic
+        snprintf(router->output_queue_name, sizeof(router->output_queue_name), "router %u output", index + 1);
+        snprintf(router->confirms_name, sizeof(router->confirms_name), "router %u confirms", index + 1);
+        router->output_queue = create_static_queue(router->output_queue_name, ETH_OUTPUT_QUEUE_LENGTH, sizeof(struct Queued_Ethernet_Message_Struct),
+                                                   router->output_queue_storage, &router->output_queue_buffer);
+        router->output_queue_mutex = create_static_mutex("ethernet output", &router->output_queue_mutex_buffer);
+        router->confirm_stats = queue_stats_add(router, router->confirms_name, ROUTER_OUTPUTS_MAX);
+
+        router->output_wake_fd = eventfd(0, 0);
+        if (router->output_wake_fd < 0)
+        {
+            ESP_LOGE(TAG,"Unable to create ethernet output eventfd, rebooting");
+            esp_restart();
+        }
+
+        // Set up receive ring
+        byte_ring_init(&router->recv_ring, router->recv_ring_storage, sizeof(router->recv_ring_storage));
+    }
+
+    // The Ethernet event handlers are already running - they only look at routers once they are
+    // all set up
+    router_count = count;
+
+    for (uint8_t index = 0; index < router_count; index++)
+    {
+        // Receive task, and the TCP client - which connects straight away if the box already has
+        // an address, or waits for one
+        struct Router_Connection_Struct *router = &routers[index];
+        char task_name[configMAX_TASK_NAME_LEN];
+        snprintf(task_name, sizeof(task_name), "tcp_recv_%u", index + 1);
+        router->recv_task_handle = create_static_task((TaskFunction_t)tcp_recv_task, task_name, ETH_RECV_TASK_STACK, router->recv_task_stack,
+                                                      &router->recv_task_buffer, router, 5);
+        snprintf(task_name, sizeof(task_name), "tcp_client_%u", index + 1);
+        router->client_task_handle = create_static_task((TaskFunction_t)tcp_client_loop, task_name, ETH_CLIENT_TASK_STACK, router->client_task_stack,
+                                                        &router->client_task_buffer, router, 5);
+    }
 }
 
-void send_video_route(uint8_t input, uint8_t output)
+uint8_t send_video_route(uint8_t router_index, uint16_t input, uint16_t output, int64_t press_time)
 {
+    // Returns 1 if the route was queued for sending
     // Add message to queue for output to switcher
+    if (router_index >= router_count)
+    {
+        ESP_LOGW(TAG, "Route for router %u, which isn't set up", router_index + 1);
+        return 0;
+    }
+    struct Router_Connection_Struct *router = &routers[router_index];
     struct Queued_Ethernet_Message_Struct new_message;
     
     new_message.type = ETH_MSG_TYP_ROUTING;
     new_message.input = input;
     new_message.output = output;
+    new_message.salvo = 0;
+    new_message.press_time = press_time;
+    new_message.queued_time = esp_timer_get_time();
 
-    if (xQueueSend(ethernet_message_output_queue, (void *)&new_message, 0) == pdTRUE)
+    if (queue_send_counted(router->output_queue, (void *)&new_message, 0) == pdTRUE)
     {
-        ESP_LOGI(TAG, "Putting message into ethernet output queue %i,%i,%i", new_message.type, new_message.input, new_message.output);
-        ESP_LOGI(TAG, "%i messages in queue",uxQueueMessagesWaiting(ethernet_message_output_queue));
+        wake_tcp_client(router);
+        trace_record(TRACE_EVT_ROUTE_QUEUED, new_message.input, new_message.output, uxQueueMessagesWaiting(router->output_queue));
+        return 1;
     }
     else
     {
         ESP_LOGW(TAG, "Putting message into ethernet output queue failed due to queue full? - %i,%i,%i", new_message.type, new_message.input, new_message.output);
-        ESP_LOGW(TAG, "%i messages in queue",uxQueueMessagesWaiting(ethernet_message_output_queue));
+        ESP_LOGW(TAG, "%i messages in queue for router %u", uxQueueMessagesWaiting(router->output_queue), router_index + 1);
+        return 0;
     }
+}
 
+uint8_t send_video_salvo(uint8_t router_index, uint16_t input, const uint16_t *outputs, uint8_t output_count, int64_t press_time)
+{
+    // Returns 1 if the whole salvo was queued for sending - nothing is queued if it won't all fit
+    if (router_index >= router_count)
+    {
+        ESP_LOGW(TAG, "Salvo for router %u, which isn't set up", router_index + 1);
+        return 0;
+    }
+    struct Router_Connection_Struct *router = &routers[router_index];
+    struct Queued_Ethernet_Message_Struct new_message;
+
+    new_message.type = ETH_MSG_TYP_ROUTING;
+    new_message.input = input;
+    new_message.salvo = 1;
+    new_message.press_time = press_time;
+    new_message.queued_time = esp_timer_get_time();
+
+    xSemaphoreTake(router->output_queue_mutex, portMAX_DELAY);
+    if (uxQueueSpacesAvailable(router->output_queue) < output_count)
+    {
+        xSemaphoreGive(router->output_queue_mutex);
+        queue_stats_dropped(queue_stats_find(router->output_queue), output_count);
+        ESP_LOGW(TAG, "No room in ethernet output queue for a salvo of %u outputs", output_count);
+        return 0;
+    }
+    for (uint8_t output = 0; output < output_count; output++)
+    {
+        new_message.output = outputs[output];
+        queue_send_counted(router->output_queue, (void *)&new_message, 0);
+    }
+    xSemaphoreGive(router->output_queue_mutex);
 
+    wake_tcp_client(router);
+    trace_record(TRACE_EVT_SALVO_QUEUED, input, output_count, uxQueueMessagesWaiting(router->output_queue));
+    return 1;
 }
 
-void request_route_dump()
+void request_route_dump(uint8_t router_index)
 {
     // Request a full dump of all the video routes as a status update
+    if (router_index >= router_count)
+    {
+        return;
+    }
+    struct Router_Connection_Struct *router = &routers[router_index];
     struct Queued_Ethernet_Message_Struct new_message;
     
     new_message.type = ETH_MSG_TYP_ROUTEDUMP;
+    new_message.salvo = 0;
+    new_message.press_time = 0;
+    new_message.queued_time = esp_timer_get_time();
 
-    if (xQueueSend(ethernet_message_output_queue, (void *)&new_message, 0) == pdTRUE)
+    if (queue_send_counted(router->output_queue, (void *)&new_message, 0) == pdTRUE)
     {
-        ESP_LOGI(TAG, "Putting message into ethernet output queue %i", new_message.type);
-        ESP_LOGI(TAG, "%i messages in queue",uxQueueMessagesWaiting(ethernet_message_output_queue));
+        wake_tcp_client(router);
+        trace_record(TRACE_EVT_DUMP_QUEUED, uxQueueMessagesWaiting(router->output_queue), 0, 0);
     }
     else
     {
         ESP_LOGW(TAG, "Putting message into ethernet output queue failed due to queue full? - %i", new_message.type);
-        ESP_LOGW(TAG, "%i messages in queue",uxQueueMessagesWaiting(ethernet_message_output_queue));
+        ESP_LOGW(TAG, "%i messages in queue for router %u", uxQueueMessagesWaiting(router->output_queue), router_index + 1);
     }
 
 
@@ -1,37 +1,121 @@
-// Ethernet IO to video router
+// Ethernet IO to video routers
 //-----------------------------------
+// Each router set up in the config has its own output queue, TCP client task, receive ring and
+// receive task, so one that is slow to answer or reconnecting never holds up sends to another.
+// Routers are numbered from zero here, as in Settings_Struct.
 
 #ifndef ETHERNET_H_INCLUDED
 #define ETHERNET_H_INCLUDED
 
+#include "storage.h"
+
 // Used for commands in queue to send to switcher
 struct Queued_Ethernet_Message_Struct {
     uint8_t type; // See below defines
-    uint8_t input; // Used for a routing command
-    uint8_t output; // Used for a routing command
+    uint16_t input; // Used for a routing command
+    uint16_t output; // Used for a routing command
+    uint8_t salvo; // 1 if the routing command is part of a salvo - see send_video_salvo
+    int64_t press_time;  // esp_timer time of the button edge behind a routing command, for latency tracing
+    int64_t queued_time; // esp_timer time the message was queued
 };
 
 // Definitions of message type for ethernet messages 
 #define ETH_MSG_TYP_ROUTING 0
 #define ETH_MSG_TYP_ROUTEDUMP 1
 
-// Length and number of text buffers for TCP input
-#define ETH_TCP_TEXT_RECV_BUFFER_SIZE 1024
-#define ETH_TCP_TEXT_RECV_QUEUE_SIZE 2048
-#define ETH_TCP_TEXT_RECV_QUEUE_NUM 16
+// Output queue to the router - everything waiting in it goes out in a single send
+#define ETH_OUTPUT_QUEUE_LENGTH 64
+#define ETH_SEND_BUFFER_SIZE 1024 // Enough for a routing line for every queued message, and a dump request
+
+// A salvo - several outputs switched to one input together - is queued in one go and always sent
+// as part of a single routing block, so the router takes every output at once. Once that block
+// is answered the main logic gets IN_MSG_TYP_SALVO_ACKED or IN_MSG_TYP_SALVO_FAILED
+
+// Blocks sent but not yet answered with ACK/NAK - the queue isn't drained while this many are
+// outstanding, and a block unanswered for ETH_COMMAND_TIMEOUT_MS fails and resets the connection
+#define ETH_IN_FLIGHT_MAX 4
+#define ETH_COMMAND_TIMEOUT_MS 2000
+
+// Heartbeat - once nothing has been sent to a router for ETH_PING_INTERVAL_MS a PING: block goes
+// out, so a router whose protocol engine has stopped answering is found with the panel idle (TCP
+// keepalives only show its network stack is up). A ping is missed once it has gone unanswered for
+// ETH_PING_INTERVAL_MS, and the connection is reset after ping_missed_max missed in a row - set
+// from the config file (see set_ping_missed_max), ETH_PING_MISSED_MAX if it doesn't say
+#define ETH_PING_INTERVAL_MS 1000
+#define ETH_PING_MISSED_MAX 2
+#define ETH_PING_MISSED_LIMIT 10 // Most the config file can ask for
+
+// Rolling round trip - each answer moves the figure 1/2^ETH_RTT_SMOOTHING_SHIFT of the way to its
+// own round trip, as TCP's smoothed RTT does, and the jitter likewise towards how far it was out
+#define ETH_RTT_SMOOTHING_SHIFT 2
+
+// Router command results and round trip times (send to ACK/NAK)
+struct Command_Stats_Struct {
+    uint32_t acked;
+    uint32_t naked;
+    uint32_t timed_out;
+    uint32_t rtt_last_us;
+    uint32_t rtt_min_us;
+    uint32_t rtt_max_us;
+    uint64_t rtt_total_us;    // Over all acked and naked blocks
+    uint32_t rtt_rolling_us;  // Pings and commands alike - see ETH_RTT_SMOOTHING_SHIFT
+    uint32_t rtt_jitter_us;
+    uint32_t pings_sent;
+    uint32_t pings_missed;    // Answered after ETH_PING_INTERVAL_MS, or never
+    uint32_t ping_resets;     // Connections reset for ping_missed_max missed in a row
+};
+
+// Routing confirms waiting for the main logic - the latest for each output, so a status dump or a
+// storm of route changes never fills the input event queue and a confirm is never lost to it.
+// One IN_MSG_TYP_ETHERNET message in the queue stands for all of a router's, until
+// take_route_confirm has had them all
+
+// Receive ring between the socket and the protocol parser - must be a power of two
+// When it fills, TCP flow control holds the router off until the parser catches up
+#define ETH_TCP_RECV_RING_SIZE 4096
 
-// TCP socket kepalives
+// Reconnecting - the first retry after losing the router is immediate, then the wait doubles from
+// MIN to MAX until a connection delivers data again
+#define ETH_RECONNECT_MIN_MS 50
+#define ETH_RECONNECT_MAX_MS 1000
+#define ETH_CONNECT_TIMEOUT_MS 3000
+#define ETH_SEND_TIMEOUT_MS 1000
+
+// How quickly the router came back - times are from the link coming up, or from losing the
+// connection while the link stayed up
+struct Reconnect_Stats_Struct {
+    uint32_t connects;              // TCP connections made
+    uint32_t connect_failures;      // Connection attempts that failed
+    uint32_t recoveries;            // Times routing confirms came back after losing the router
+    int64_t recovery_to_ip_us;      // Last recovery: to IP address (0 if the link stayed up)
+    int64_t recovery_to_connect_us; // Last recovery: to TCP connected
+    int64_t recovery_to_confirm_us; // Last recovery: to the first routing confirm
+};
+
+// Task stacks (bytes) - the send and receive buffers are in the router's static state, not on these
+#define ETH_CLIENT_TASK_STACK 8192
+#define ETH_RECV_TASK_STACK 8192
+
+// TCP socket kepalives - the heartbeat above is what finds a router that has stopped answering
 #define ETH_KEEPALIVE_IDLE 1
 #define ETH_KEEPALIVE_INTERVAL 1
 #define ETH_KEEPALIVE_COUNT 1
 
-// Define state machine for TCP recv task
-#define ETH_TCP_RECV_STATE_UNKNOWN 0 
-#define ETH_TCP_RECV_STATE_WAIT 1 
-#define ETH_TCP_RECV_STATE_IN_UPDATE 2 
-
-void setup_ethernet(uint32_t ip, uint32_t port, QueueHandle_t* input_queue);
-void send_video_route(uint8_t input, uint8_t output);
-void request_route_dump();
+// Powers the PHY and starts the driver, so the link and DHCP come up while the rest of boot
+// carries on - then setup_ethernet starts the router connections once the settings are known
+void start_ethernet(void);
+void setup_ethernet(const struct Router_Settings_Struct *router_settings, uint8_t count, QueueHandle_t* input_queue);
+uint8_t send_video_route(uint8_t router_index, uint16_t input, uint16_t output, int64_t press_time);
+uint8_t send_video_salvo(uint8_t router_index, uint16_t input, const uint16_t *outputs, uint8_t output_count, int64_t press_time);
+void request_route_dump(uint8_t router_index);
+void set_ping_missed_max(uint8_t missed_max); // Taken up by the next ping due - no restart needed
+uint8_t get_router_count(void);
+uint32_t get_ethernet_address(void); // Box's IP address in network byte order, 0 while it has none
+uint32_t get_routes_coalesced(uint8_t router_index);
+// Takes a staged confirm - merged is 1 if others for the output came in after the last one taken,
+// so the router may have had routes in between that the main logic never sees. 0 once there are none left
+uint8_t take_route_confirm(uint8_t router_index, uint16_t *output, uint16_t *input, int64_t *event_time, uint8_t *merged);
+void get_command_stats(uint8_t router_index, struct Command_Stats_Struct *stats);
+void get_reconnect_stats(uint8_t router_index, struct Reconnect_Stats_Struct *stats);
 
 #endif  
\ No newline at end of file
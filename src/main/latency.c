@@ -0,0 +1,109 @@
+// Latency histograms
+//-----------------------------------
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+
+#include "latency.h"
+
+static const char *const stage_names[LAT_STAGE_COUNT] = {
+    "debounce",
+    "input queue",
+    "output queue",
+    "router",
+    "confirm to logic",
+    "press to LED",
+    "press to confirm",
+    "salvo skew",
+};
+
+static portMUX_TYPE latency_mux = portMUX_INITIALIZER_UNLOCKED; // protects:
+static struct Latency_Histogram_Struct histograms[LAT_STAGE_COUNT];
+
+static uint8_t bucket_for(uint32_t value)
+{
+    if (value < 4)
+    {
+        return value;
+    }
+    uint8_t octave = 31 - __builtin_clz(value); // Highest set bit, 2 or more
+    return 4 + ((octave - 2) * 4) + ((value >> (octave - 2)) & 3);
+}
+
+// Largest value that falls in a bucket
+static uint32_t bucket_upper_bound(uint8_t bucket)
+{
+    if (bucket < 4)
+    {
+        return bucket;
+    }
+    uint8_t octave = ((bucket - 4) / 4) + 2;
+    uint32_t sub = (bucket - 4) % 4;
+    uint64_t lower = ((uint64_t)(4 + sub)) << (octave - 2);
+    return (uint32_t)(lower + (1ULL << (octave - 2)) - 1);
+}
+
+void latency_record(uint8_t stage, int64_t microseconds)
+{
+    if (stage >= LAT_STAGE_COUNT || microseconds < 0)
+    {
+        return;
+    }
+    uint32_t value = (microseconds > INT32_MAX) ? INT32_MAX : (uint32_t)microseconds;
+
+    taskENTER_CRITICAL(&latency_mux);
+    struct Latency_Histogram_Struct *histogram = &histograms[stage];
+    histogram->buckets[bucket_for(value)]++;
+    histogram->count++;
+    histogram->total_us += value;
+    if (value > histogram->max_us)
+    {
+        histogram->max_us = value;
+    }
+    taskEXIT_CRITICAL(&latency_mux);
+}
+
+void latency_reset(void)
+{
+    taskENTER_CRITICAL(&latency_mux);
+    memset(histograms, 0, sizeof(histograms));
+    taskEXIT_CRITICAL(&latency_mux);
+}
+
+// Value below which the given share (per thousand) of samples fall - capped at the real maximum
+static uint32_t percentile(const struct Latency_Histogram_Struct *histogram, uint32_t per_thousand)
+{
+    uint64_t target = (((uint64_t)histogram->count * per_thousand) + 999) / 1000;
+    uint64_t seen = 0;
+    for (uint8_t bucket = 0; bucket < LAT_BUCKETS; bucket++)
+    {
+        seen += histogram->buckets[bucket];
+        if (seen >= target && seen > 0)
+        {
+            uint32_t bound = bucket_upper_bound(bucket);
+            return (bound < histogram->max_us) ? bound : histogram->max_us;
+        }
+    }
+    return histogram->max_us;
+}
+
+size_t latency_dump(char *buffer, size_t size)
+{
+    size_t length = snprintf(buffer, size, "%-18s %8s %10s %10s %10s %10s\n", "stage", "count", "p50 us", "p99 us", "max us", "mean us");
+    for (uint8_t stage = 0; stage < LAT_STAGE_COUNT && length < size; stage++)
+    {
+        // Copy out a stage at a time so the formatting isn't done inside the critical section
+        struct Latency_Histogram_Struct copy;
+        taskENTER_CRITICAL(&latency_mux);
+        copy = histograms[stage];
+        taskEXIT_CRITICAL(&latency_mux);
+
+        const struct Latency_Histogram_Struct *histogram = &copy;
+        uint32_t mean = (histogram->count > 0) ? (uint32_t)(histogram->total_us / histogram->count) : 0;
+        length += snprintf(buffer + length, size - length, "%-18s %8"PRIu32" %10"PRIu32" %10"PRIu32" %10"PRIu32" %10"PRIu32"\n",
+                           stage_names[stage], histogram->count, percentile(histogram, 500), percentile(histogram, 990), histogram->max_us, mean);
+    }
+    return (length < size) ? length : size - 1;
+}
@@ -0,0 +1,41 @@
+// Latency histograms
+//-----------------------------------
+// Time taken by each stage of a route press, from the button edge through the router and back
+// to the LEDs. Samples go into log-linear buckets (four per power of two), so p50/p99 come out
+// to within a bucket (at most 25%) at any scale without keeping the samples themselves.
+// Recorded from several tasks - all access is under a critical section.
+
+#ifndef LATENCY_H_INCLUDED
+#define LATENCY_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Stages
+#define LAT_STAGE_DEBOUNCE 0         // First button edge to the press being queued to the main logic
+#define LAT_STAGE_INPUT_QUEUE 1      // Press queued to picked up by the main logic
+#define LAT_STAGE_OUTPUT_QUEUE 2     // Route queued by the main logic to sent on the socket
+#define LAT_STAGE_ROUTER 3           // Block sent to the router's ACK/NAK parsed
+#define LAT_STAGE_CONFIRM_TO_LOGIC 4 // Routing confirm received off the socket to handled by the main logic
+#define LAT_STAGE_PRESS_TO_LED 5     // First button edge to the button LED lit
+#define LAT_STAGE_PRESS_TO_CONFIRM 6 // First button edge to the router's confirm handled
+#define LAT_STAGE_SALVO_SKEW 7       // First to last output confirm of a Show Relay salvo
+#define LAT_STAGE_COUNT 8
+
+// 0-3 us individually, then four buckets per power of two up to 2^31 us
+#define LAT_BUCKETS 124
+
+struct Latency_Histogram_Struct {
+    uint32_t buckets[LAT_BUCKETS];
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t total_us;
+};
+
+void latency_record(uint8_t stage, int64_t microseconds);
+void latency_reset(void);
+
+// Writes a table of count/p50/p99/max/mean per stage, returns its length
+size_t latency_dump(char *buffer, size_t size);
+
+#endif
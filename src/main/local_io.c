@@ -1,6 +1,7 @@
 // Local IO: Buttons, LEDs
 //-----------------------------------
 
+#include <stdatomic.h>
 #include <stdlib.h>
 #include "freertos/FreeRTOS.h"
 #include "driver/gpio.h"
@@ -8,11 +9,19 @@
 #include "driver/i2c.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 
 #include "main.h"
 #include "local_io.h"
 #include "pindefs.h"
 #include "ethernet.h"
+#include "storage.h"
+#include "latency.h"
+#include "trace.h"
+#include "ram_budget.h"
+#include "queue_stats.h"
 
 // Logging tag
 static const char *TAG = "local_io";
@@ -20,19 +29,57 @@ static const char *TAG = "local_io";
 // Input message queue handle pointer - passed in from main module
 static QueueHandle_t *input_event_queue_ptr;
 
+// Whether routing buttons send on press or release - set by the main logic, read by whatever
+// debounces the buttons (word sized, as the state below)
+static atomic_uint route_trigger = ROUTE_TRIGGER_RELEASE;
+
 // Define internal buffers that hold the 'current' state of the IO expanders
+// Other tasks only ever see single words through atomics, so no call here waits on another task
+// and none can time out - word sized as the ESP32 has no lock-free byte atomics
 
-SemaphoreHandle_t output_state_buffer_mutex = NULL; // protects:
-uint8_t output_state_buffer_changed_flag = 0;       // 0 unchanged, 1 changed since last output run therefore outputs need refreshed
-struct Output_Buffer_Struct output_state_buffer;    // Raw state of outputs
+struct Output_Buffer_Struct output_state_buffer;        // Raw state of outputs, written by any task
+static atomic_uint output_state_buffer_changed_flag = 0; // 1 if changed since the outputs were last refreshed
+static atomic_uint output_refresh_running = 0;          // 1 while a task is putting the outputs on the pins
 
-SemaphoreHandle_t input_state_buffer_mutex = NULL; // protects:
+// Only touched by whatever debounces the buttons - the debounce timer, or the poll task
 struct Input_Buffer_Struct input_state_buffer;     // Raw state of inputs
 struct Input_Buffer_Struct input_state_counts;     // Counters for debouncing
 struct Input_Buffer_Struct input_debounced_buffer; // Debounced state
 
-// Button array for loop
-uint8_t button_pin_array[] = {PIN_BUTTON_1, PIN_BUTTON_2, PIN_BUTTON_3, PIN_BUTTON_4, PIN_BUTTON_5, PIN_BUTTON_6};
+// Debounced button panel state for other tasks
+static atomic_uint button_panel_state[PANEL_COUNT];
+
+// Presses waiting for the main logic - staged by whatever debounces the buttons, taken by
+// take_button_press. Only the latest routing press on each panel matters; Show Relay presses
+// toggle, so each is kept
+static portMUX_TYPE staged_press_mux = portMUX_INITIALIZER_UNLOCKED; // protects:
+static struct Queued_Input_Message_Struct staged_routing[PANEL_COUNT];
+static uint8_t staged_routing_set[PANEL_COUNT];
+static struct Queued_Input_Message_Struct staged_show_relay; // The latest
+static uint8_t staged_show_relay_count;
+static uint8_t presses_posted; // IN_MSG_TYP_BUTTONS is in the input event queue
+static struct Queue_Stats_Struct *staged_press_stats;
+
+// Pin tables for loops
+static const uint8_t panel_button_pins[PANEL_COUNT][PANEL_BUTTONS_MAX] = PANEL_BUTTON_PINS;
+static const uint8_t panel_led_pins[PANEL_COUNT][3] = PANEL_LED_PINS;
+
+#if INPUT_INTERRUPT_MODE
+// Button edges wake button_edge_task, which (re)starts the debounce timer - the buttons are read
+// when the timer expires, once they have stopped bouncing
+static TaskHandle_t button_edge_task_handle = NULL;
+static StackType_t button_edge_task_stack[BUTTON_EDGE_TASK_STACK];
+static StaticTask_t button_edge_task_buffer;
+static esp_timer_handle_t button_debounce_timer = NULL;
+
+static portMUX_TYPE button_edge_mux = portMUX_INITIALIZER_UNLOCKED; // protects:
+static int64_t button_first_edge_time = -1; // First edge since the buttons were last read, -1 for none
+#else
+static StackType_t input_poll_task_stack[INPUT_POLL_TASK_STACK];
+static StaticTask_t input_poll_task_buffer;
+static int64_t button_change_start_time[PANEL_COUNT]; // When the raw change being debounced was first seen
+static int64_t show_relay_change_start_time;
+#endif
         
 
 // Main tasks: output refresh and input debouncing
@@ -41,221 +88,406 @@ uint8_t button_pin_array[] = {PIN_BUTTON_1, PIN_BUTTON_2, PIN_BUTTON_3, PIN_BUTT
 static void refresh_outputs(void)
 {
     // Update button LEDs when required
-
-    if (output_state_buffer_mutex == NULL)
+    // Whichever task finds them changed puts them on the pins. If one is already at it, the
+    // other leaves its change for it to pick up on its way out - so neither waits, and no
+    // change is left off the pins
+    do
     {
-        ESP_LOGE(TAG, "Output buffer mutex NULL at at refresh_outputs");
-        return;
-    }
-
-    if (xSemaphoreTake(output_state_buffer_mutex, (TickType_t)10) == pdTRUE)
-    {
-        if (output_state_buffer_changed_flag == 0)
+        if (atomic_exchange(&output_refresh_running, 1) != 0)
         {
-            xSemaphoreGive(output_state_buffer_mutex);
-            ESP_LOGD(TAG, "refresh outputs not required");
             return;
         }
 
-        output_state_buffer_changed_flag = 0;
+        while (atomic_exchange(&output_state_buffer_changed_flag, 0) != 0)
+        {
+            for (uint8_t panel = 0; panel < PANEL_COUNT; panel++)
+            {
+                uint8_t leds = atomic_load(&output_state_buffer.led_panel[panel]);
+                gpio_set_level(panel_led_pins[panel][0], (leds & 1) != 0);
+                gpio_set_level(panel_led_pins[panel][1], (leds & 2) != 0);
+                gpio_set_level(panel_led_pins[panel][2], (leds & 4) != 0);
+            }
+            gpio_set_level(PIN_IR_CONTACTOR, atomic_load(&output_state_buffer.ir_contactor) ? IR_CONTACTOR_ON_LEVEL : !IR_CONTACTOR_ON_LEVEL);
+        }
 
-        gpio_set_level(PIN_LED_A, (output_state_buffer.led_panel & 1) != 0);
-        gpio_set_level(PIN_LED_B, (output_state_buffer.led_panel & 2) != 0);
-        gpio_set_level(PIN_LED_C, (output_state_buffer.led_panel & 4) != 0);
+        atomic_store(&output_refresh_running, 0);
+    } while (atomic_load(&output_state_buffer_changed_flag) != 0);
+}
 
-        xSemaphoreGive(output_state_buffer_mutex);
-        ESP_LOGD(TAG, "Output at refresh outputs:%d", output_state_buffer.led_panel); // TODO - print output
+static void send_button_message(uint8_t panel, uint8_t button, uint8_t message_type, int64_t edge_time)
+{
+    // Send message to main logic for a debounced button
+    struct Queued_Input_Message_Struct new_message = {0};
+    new_message.type = message_type;
+    new_message.panel = panel;
+    new_message.event_time = edge_time;
+    new_message.queued_time = esp_timer_get_time();
+    latency_record(LAT_STAGE_DEBOUNCE, new_message.queued_time - edge_time);
+    if (message_type == IN_MSG_TYP_ROUTING)
+    {
+        new_message.panel_button = button - 1; // Note change from physical button 1-6 to array index 0-5 for reference to settings struct in main logic
     }
-    else
+
+    trace_record(TRACE_EVT_BUTTON, button, panel, new_message.type);
+
+    // Staged rather than queued, so a full queue never holds up the debounce - the timer callback
+    // runs in the esp_timer task, which every other timer waits on
+    uint8_t coalesced = 0;
+    taskENTER_CRITICAL(&staged_press_mux);
+    if (message_type == IN_MSG_TYP_ROUTING)
     {
-        ESP_LOGW(TAG, "Output buffer mutex timeout at refresh_outputs");
-        return;
+        coalesced = staged_routing_set[panel];
+        staged_routing[panel] = new_message;
+        staged_routing_set[panel] = 1;
+    }
+    else if (staged_show_relay_count < UINT8_MAX)
+    {
+        staged_show_relay = new_message;
+        staged_show_relay_count++;
+    }
+    uint32_t waiting = staged_show_relay_count;
+    for (uint8_t staged = 0; staged < PANEL_COUNT; staged++)
+    {
+        waiting += staged_routing_set[staged];
+    }
+    uint8_t post = !presses_posted;
+    presses_posted = 1;
+    taskEXIT_CRITICAL(&staged_press_mux);
+
+    queue_stats_sent(staged_press_stats, waiting);
+    if (coalesced)
+    {
+        queue_stats_coalesced(staged_press_stats, 1);
+    }
+
+    if (post)
+    {
+        struct Queued_Input_Message_Struct wake_message = {0};
+        wake_message.type = IN_MSG_TYP_BUTTONS;
+        wake_message.event_time = edge_time;
+        wake_message.queued_time = new_message.queued_time;
+
+        // Never waits - if the queue is full the press stays staged, and the main logic takes it
+        // after the next message it handles
+        if (queue_send_counted(*input_event_queue_ptr, (void *)&wake_message, 0) != pdTRUE)
+        {
+            ESP_LOGW(TAG, "Sending message from button debounce failed due to queue full? - %i,%i", new_message.type, new_message.panel_button);
+            taskENTER_CRITICAL(&staged_press_mux);
+            presses_posted = 0; // The next press tries again
+            taskEXIT_CRITICAL(&staged_press_mux);
+        }
     }
 }
 
-static void button_debounce(uint8_t *raw_input, uint8_t *state, uint8_t *counter, uint8_t message_type)
+uint8_t take_button_press(struct Queued_Input_Message_Struct *message)
 {
-    if (*raw_input == 0)
+    uint8_t taken = 0;
+    taskENTER_CRITICAL(&staged_press_mux);
+    for (uint8_t panel = 0; panel < PANEL_COUNT && !taken; panel++)
     {
-        *counter = 0;
-        if (*state != 0)
+        if (staged_routing_set[panel])
         {
-            // Button has been pressed and released, send message to main logic
-            struct Queued_Input_Message_Struct new_message;
-            new_message.type = message_type;
-            if (message_type == IN_MSG_TYP_ROUTING)
-            {
-                new_message.panel_button = *state - 1; // Note change from physical button 1-6 to array index 0-5 for reference to settings struct in main logic
-            }
-
-            if (xQueueSend(*input_event_queue_ptr, (void *)&new_message, 0) == pdTRUE)
-            {
-                ESP_LOGI(TAG, "Sending message from button debounce: %i,%i", new_message.type, new_message.panel_button);
-            }
-            else
-            {
-                ESP_LOGW(TAG, "Sending message from button debounce failed due to queue full? - %i,%i", new_message.type, new_message.panel_button);
-            }
-            *state = 0;
+            *message = staged_routing[panel];
+            staged_routing_set[panel] = 0;
+            taken = 1;
         }
     }
-    else
+    if (!taken && staged_show_relay_count > 0)
     {
-        *counter = *counter + 1;
+        *message = staged_show_relay;
+        staged_show_relay_count--;
+        taken = 1;
     }
-
-    if (*counter >= INPUT_DEBOUNCE_LOOP_COUNT)
+    if (!taken)
     {
-        *state = *raw_input;
+        presses_posted = 0; // Any staged from here on need a new message
     }
+    taskEXIT_CRITICAL(&staged_press_mux);
+    return taken;
 }
 
-static void refresh_inputs(void)
+static void button_state_change(uint8_t panel, uint8_t *state, uint8_t new_state, uint8_t message_type, int64_t edge_time)
 {
-    if (input_state_buffer_mutex == NULL)
+    // Debounced button state has changed - send message to main logic if this is the trigger
+    unsigned int trigger = atomic_load(&route_trigger);
+    if (new_state == 0 && trigger == ROUTE_TRIGGER_RELEASE)
     {
-        ESP_LOGE(TAG, "Input buffer mutex NULL at at refresh_inputs");
-        return;
+        // Button has been pressed and released
+        send_button_message(panel, *state, message_type, edge_time);
     }
-
-    if (xSemaphoreTake(input_state_buffer_mutex, (TickType_t)10) == pdTRUE)
+    else if (new_state != 0 && trigger == ROUTE_TRIGGER_PRESS)
     {
-        // Get which button is pressed - note that for simplicity if multiple buttons are pressed
-        // then we just get the higer numbered one 
-        
-        uint8_t temp_button_state = 0;
+        // Press confirmed - don't wait for the button to be let go
+        send_button_message(panel, new_state, message_type, edge_time);
+    }
+    *state = new_state;
+}
+
+static uint8_t read_button_panel(uint8_t panel)
+{
+    // Get which button is pressed - note that for simplicity if multiple buttons are pressed
+    // then we just get the higer numbered one 
+
+    uint8_t temp_button_state = 0;
 
-        for (uint8_t button = 0; button<6; button++)
+    for (uint8_t button = 0; button<PANEL_BUTTONS_MAX; button++)
+    {
+        if (gpio_get_level(panel_button_pins[panel][button]) == 0) // Buttons pulled low when pressed
         {
-            if (gpio_get_level(button_pin_array[button]) == 0) // Buttons pulled low when pressed
-            {
-                temp_button_state = button + 1;
-            }
+            temp_button_state = button + 1;
         }
-        
-        input_state_buffer.button_panel = temp_button_state;
+    }
 
-        // Debounce raw inputs into debounced state for buttons, trigger events if required
-        button_debounce(&input_state_buffer.button_panel, &input_debounced_buffer.button_panel, &input_state_counts.button_panel, IN_MSG_TYP_ROUTING);
+    return temp_button_state;
+}
 
-        xSemaphoreGive(input_state_buffer_mutex);
-        ESP_LOGD(TAG, "Input button state at refresh_inputs:%d",input_debounced_buffer.button_panel);
-    }
-    else
+#if INPUT_INTERRUPT_MODE
+
+static void IRAM_ATTR button_edge_isr(void *arg)
+{
+    // Any edge on any button - hand over to the task, as timers can't be restarted from here
+    taskENTER_CRITICAL_ISR(&button_edge_mux);
+    if (button_first_edge_time < 0)
     {
-        ESP_LOGW(TAG, "Input buffer mutex timeout at refresh_inputs");
-        return;
+        button_first_edge_time = esp_timer_get_time();
     }
+    taskEXIT_CRITICAL_ISR(&button_edge_mux);
+
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    vTaskNotifyGiveFromISR(button_edge_task_handle, &higher_priority_task_woken);
+    portYIELD_FROM_ISR(higher_priority_task_woken);
 }
 
-static void input_poll_task(void)
+static void button_edge_task(void)
 {
     while (1)
     {
-        refresh_inputs();
-        refresh_outputs();
-        vTaskDelay(REFRESH_LOOP_TICKS / portTICK_PERIOD_MS);
+        // Sleeps until a button edge, then restarts the debounce - bounces keep pushing it back
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        esp_timer_stop(button_debounce_timer);
+        esp_timer_start_once(button_debounce_timer, INPUT_DEBOUNCE_US);
     }
 }
 
-static uint8_t buffer_single_read(uint8_t *buffer, char *label)
+static void button_debounce_timer_callback(void *arg)
 {
-    // Generic function for returning a value from the buffer
-    if (input_state_buffer_mutex == NULL)
+    // Buttons have been stable for INPUT_DEBOUNCE_US - take their state
+    taskENTER_CRITICAL(&button_edge_mux);
+    int64_t edge_time = button_first_edge_time;
+    button_first_edge_time = -1;
+    taskEXIT_CRITICAL(&button_edge_mux);
+    if (edge_time < 0)
     {
-        ESP_LOGW(TAG, "Input buffer read mutex NULL at %s", label);
-        return NULL;
+        edge_time = esp_timer_get_time(); // Starting state, no edge
     }
 
-    if (xSemaphoreTake(input_state_buffer_mutex, (TickType_t)10) == pdTRUE)
+    for (uint8_t panel = 0; panel < PANEL_COUNT; panel++)
     {
-        uint8_t value = *buffer;
-        xSemaphoreGive(input_state_buffer_mutex);
-        ESP_LOGD(TAG, "Input buffer read at %s:%i", label, value);
-        return value;
+        input_state_buffer.button_panel[panel] = read_button_panel(panel);
+
+        if (input_debounced_buffer.button_panel[panel] != input_state_buffer.button_panel[panel])
+        {
+            button_state_change(panel, &input_debounced_buffer.button_panel[panel], input_state_buffer.button_panel[panel], IN_MSG_TYP_ROUTING, edge_time);
+            atomic_store(&button_panel_state[panel], input_debounced_buffer.button_panel[panel]);
+        }
     }
-    else
+
+    input_state_buffer.show_relay_button = (gpio_get_level(PIN_SHOW_RELAY_BUTTON) == 0);
+    if (input_debounced_buffer.show_relay_button != input_state_buffer.show_relay_button)
     {
-        ESP_LOGW(TAG, "Input buffer read mutex timeout at %s", label);
-        return NULL;
+        button_state_change(0, &input_debounced_buffer.show_relay_button, input_state_buffer.show_relay_button, IN_MSG_TYP_SHOW_RELAY, edge_time);
     }
+    ESP_LOGD(TAG, "Input button state at debounce timer:%d",input_debounced_buffer.button_panel[0]);
 }
 
-static void buffer_single_write(uint8_t *buffer, uint8_t value, char *label)
+#else
+
+static void button_debounce(uint8_t panel, uint8_t *raw_input, uint8_t *state, uint8_t *counter, int64_t *change_start_time, uint8_t message_type)
 {
-    // Generic function for writing a value to the buffer
-    if (output_state_buffer_mutex == NULL)
+    if (*raw_input == *state)
     {
-        ESP_LOGW(TAG, "Output buffer write mutex NULL at %s", label);
+        *counter = 0; // Bounced back, or nothing changed
         return;
     }
+    if (*counter == 0)
+    {
+        *change_start_time = esp_timer_get_time();
+    }
+    *counter = *counter + 1;
 
-    if (xSemaphoreTake(output_state_buffer_mutex, (TickType_t)10) == pdTRUE)
+    // Presses and releases alike are taken once seen for INPUT_DEBOUNCE_LOOP_COUNT loops, so
+    // bounce after a press can't make a release and a second press
+    if (*counter >= INPUT_DEBOUNCE_LOOP_COUNT)
     {
-        if (*buffer != value)
-        {
-            *buffer = value;
-            output_state_buffer_changed_flag = 1;
-        }
-        xSemaphoreGive(output_state_buffer_mutex);
-        ESP_LOGD(TAG, "Output buffer write at %s:%i", label, value);
-        return;
+        *counter = 0;
+        button_state_change(panel, state, *raw_input, message_type, *change_start_time);
     }
-    else
+}
+
+static void refresh_inputs(void)
+{
+    for (uint8_t panel = 0; panel < PANEL_COUNT; panel++)
     {
-        ESP_LOGW(TAG, "Output buffer write mutex timeout at %s", label);
-        return;
+        input_state_buffer.button_panel[panel] = read_button_panel(panel);
+
+        // Debounce raw inputs into debounced state for buttons, trigger events if required
+        button_debounce(panel, &input_state_buffer.button_panel[panel], &input_debounced_buffer.button_panel[panel], &input_state_counts.button_panel[panel],
+                        &button_change_start_time[panel], IN_MSG_TYP_ROUTING);
+        atomic_store(&button_panel_state[panel], input_debounced_buffer.button_panel[panel]);
+    }
+
+    input_state_buffer.show_relay_button = (gpio_get_level(PIN_SHOW_RELAY_BUTTON) == 0);
+    button_debounce(0, &input_state_buffer.show_relay_button, &input_debounced_buffer.show_relay_button, &input_state_counts.show_relay_button,
+                    &show_relay_change_start_time, IN_MSG_TYP_SHOW_RELAY);
+    ESP_LOGD(TAG, "Input button state at refresh_inputs:%d",input_debounced_buffer.button_panel[0]);
+}
+
+static void input_poll_task(void)
+{
+    while (1)
+    {
+        refresh_inputs();
+        refresh_outputs();
+        vTaskDelay(REFRESH_LOOP_TICKS / portTICK_PERIOD_MS);
+    }
+}
+
+#endif
+
+static void output_write(atomic_uint *output, uint8_t value)
+{
+    // Generic function for writing a value to the output buffer - only a change needs the pins refreshed
+    if (atomic_exchange(output, value) != value)
+    {
+        atomic_store(&output_state_buffer_changed_flag, 1);
     }
 }
 
 // Setup and zero outputs at poweron
 // =============================================================================
 
-void setup_local_io(QueueHandle_t *input_queue)
+void setup_local_io(QueueHandle_t *input_queue, uint8_t trigger)
 {
-    // Set up mutexes for local buffer of IO state
-    output_state_buffer_mutex = xSemaphoreCreateMutex();
-    input_state_buffer_mutex = xSemaphoreCreateMutex();
+    uint64_t button_pin_mask = 0;
+    uint64_t led_pin_mask = 1ULL << PIN_IR_CONTACTOR;
+    for (uint8_t panel = 0; panel < PANEL_COUNT; panel++)
+    {
+        for (uint8_t button = 0; button < PANEL_BUTTONS_MAX; button++)
+        {
+            button_pin_mask |= 1ULL << panel_button_pins[panel][button];
+        }
+        for (uint8_t led = 0; led < 3; led++)
+        {
+            led_pin_mask |= 1ULL << panel_led_pins[panel][led];
+        }
+    }
 
     // Set up input pins
     gpio_config_t i_conf;
+#if INPUT_INTERRUPT_MODE
+    i_conf.intr_type = GPIO_INTR_ANYEDGE;
+#else
     i_conf.intr_type = GPIO_INTR_DISABLE;
+#endif
     i_conf.mode = GPIO_MODE_INPUT;
-    i_conf.pin_bit_mask = (PIN_BUTTON_MASK);
+    i_conf.pin_bit_mask = button_pin_mask;
     i_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
     i_conf.pull_up_en = GPIO_PULLUP_ENABLE;
     gpio_config(&i_conf);
 
+    // Show Relay button is on an input only pin, pulled up on the board
+    i_conf.pin_bit_mask = 1ULL << PIN_SHOW_RELAY_BUTTON;
+    i_conf.pull_up_en = GPIO_PULLUP_DISABLE;
+    gpio_config(&i_conf);
+
     // Set up output pins
     gpio_config_t o_conf;
     o_conf.intr_type = GPIO_INTR_DISABLE;
     o_conf.mode = GPIO_MODE_OUTPUT;
-    o_conf.pin_bit_mask = (PIN_LED_MASK);
+    o_conf.pin_bit_mask = led_pin_mask;
     o_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
     o_conf.pull_up_en = GPIO_PULLUP_DISABLE;
     gpio_config(&o_conf);
 
     // Set up local pointers to the event queue in the main logic
     input_event_queue_ptr = input_queue;
+    atomic_store(&route_trigger, trigger);
+    staged_press_stats = queue_stats_add(staged_routing, "panel presses", PANEL_COUNT + 1);
+
+#if INPUT_INTERRUPT_MODE
+    esp_timer_create_args_t timer_args = {
+        .callback = button_debounce_timer_callback,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "button_debounce",
+        .skip_unhandled_events = false
+    };
+    if (esp_timer_create(&timer_args, &button_debounce_timer) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Unable to create button debounce timer, rebooting");
+        esp_restart();
+    }
+
+    button_edge_task_handle = create_static_task((TaskFunction_t)button_edge_task, "button_edge_task", BUTTON_EDGE_TASK_STACK,
+                                                 button_edge_task_stack, &button_edge_task_buffer, NULL, 10);
+
+    esp_err_t ret = gpio_install_isr_service(0);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) // Already installed is fine
+    {
+        ESP_LOGE(TAG, "Unable to install GPIO ISR service (%s), rebooting", esp_err_to_name(ret));
+        esp_restart();
+    }
+    for (uint8_t panel = 0; panel < PANEL_COUNT; panel++)
+    {
+        for (uint8_t button = 0; button<PANEL_BUTTONS_MAX; button++)
+        {
+            gpio_isr_handler_add(panel_button_pins[panel][button], button_edge_isr, NULL);
+        }
+    }
+    gpio_isr_handler_add(PIN_SHOW_RELAY_BUTTON, button_edge_isr, NULL);
 
-    xTaskCreate((TaskFunction_t)input_poll_task, "input_poll_task", 2048, NULL, 5, NULL);
+    // Take the starting state of the buttons once they have had time to settle
+    esp_timer_start_once(button_debounce_timer, INPUT_DEBOUNCE_US);
+#else
+    create_static_task((TaskFunction_t)input_poll_task, "input_poll_task", INPUT_POLL_TASK_STACK, input_poll_task_stack, &input_poll_task_buffer, NULL, 5);
+#endif
 }
 
 // Main button panels (routing buttons)
 // =============================================================================
 
-uint8_t get_button_panel_state()
+uint8_t get_button_panel_state(uint8_t panel)
 {
     // Returns button panel state
-    char s[17];
-    snprintf(s, 17, "Button panel");
-    return buffer_single_read(&input_debounced_buffer.button_panel, s);
+    if (panel >= PANEL_COUNT)
+    {
+        return 0;
+    }
+    return atomic_load(&button_panel_state[panel]);
 }
 
-void set_button_led_state(uint8_t value)
+void set_button_led_state(uint8_t panel, uint8_t value)
 {
     // Sets the state of the button panel LEDs
-    char s[22];
-    snprintf(s, 22, "Button panel LEDs");
-    buffer_single_write(&output_state_buffer.led_panel, value, s);
+    if (panel >= PANEL_COUNT)
+    {
+        return;
+    }
+    output_write(&output_state_buffer.led_panel[panel], value);
+
+    // Update the LEDs now rather than waiting for the next poll (there isn't one in interrupt mode)
+    refresh_outputs();
+}
+
+void set_ir_contactor_state(uint8_t value)
+{
+    // Sets the IR floodlight contactor - 1 is on
+    output_write(&output_state_buffer.ir_contactor, value);
+    refresh_outputs();
+}
+
+// Settings reloaded - the local IO task reads it afresh for every debounced change
+void set_route_trigger(uint8_t trigger)
+{
+    atomic_store(&route_trigger, trigger);
 }
@@ -4,24 +4,50 @@
 #ifndef LOCAL_IO_H_INCLUDED
 #define LOCAL_IO_H_INCLUDED
 
+#include <stdatomic.h>
+
+#include "pindefs.h"
+#include "main.h"
+
 // Define structures that can be used for state buffers and debouncing of IO
 struct Input_Buffer_Struct
 {
-    uint8_t button_panel; // 0 is unpressed 1-6 pressed
+    uint8_t button_panel[PANEL_COUNT]; // 0 is unpressed 1-6 pressed
+    uint8_t show_relay_button; // 0 is unpressed 1 pressed
 };
 
 struct Output_Buffer_Struct
 {
-    uint8_t led_panel; // 0 is unlit, 1-6 lit
+    atomic_uint led_panel[PANEL_COUNT]; // 0 is unlit, 1-6 lit
+    atomic_uint ir_contactor; // 0 is off (floodlights off), 1 on
 };
 
+// Button input mode - 1 for edge interrupts with a timer debounce (nothing runs while the panel
+// is idle), 0 to poll the buttons every REFRESH_LOOP_TICKS
+#define INPUT_INTERRUPT_MODE 1
+
 // Debounce properties
-#define INPUT_DEBOUNCE_LOOP_COUNT 3
+#define INPUT_DEBOUNCE_LOOP_COUNT 3 // Polled mode: samples a press or release must be seen for
 #define REFRESH_LOOP_TICKS 10
+#define INPUT_DEBOUNCE_US 10000 // Interrupt mode: time buttons must be stable after their last edge
+
+// Task stacks (bytes) - the "ram" diagnostics command shows how much of them is used
+#define BUTTON_EDGE_TASK_STACK 2048
+#define INPUT_POLL_TASK_STACK 2048
+
+void setup_local_io(QueueHandle_t *input_queue, uint8_t route_trigger);
+
+// Debounced presses are staged here and an IN_MSG_TYP_BUTTONS message posted for them, so a full
+// input event queue never holds up the debounce or loses a press. Fills in an IN_MSG_TYP_ROUTING
+// or IN_MSG_TYP_SHOW_RELAY message - returns 0 once there are none left
+uint8_t take_button_press(struct Queued_Input_Message_Struct *message);
+void set_route_trigger(uint8_t route_trigger);
 
-void setup_local_io(QueueHandle_t *input_queue);
+// Panels are numbered from 0 - those without hardware (panel >= PANEL_COUNT) read as unpressed
+// and ignore their LEDs
+uint8_t get_button_panel_state(uint8_t panel);
+void set_button_led_state(uint8_t panel, uint8_t value);
 
-uint8_t get_button_panel_state();
-void set_button_led_state(uint8_t value);
+void set_ir_contactor_state(uint8_t value);
 
 #endif
\ No newline at end of file
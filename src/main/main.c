@@ -7,6 +7,7 @@
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "freertos/queue.h" 
 
@@ -14,17 +15,169 @@
 #include "local_io.h"
 #include "ethernet.h"
 #include "storage.h"
+#include "router_state.h"
+#include "panel_map.h"
+#include "latency.h"
+#include "diagnostics.h"
+#include "trace.h"
+#include "show_relay.h"
+#include "route_share.h"
+#include "route_store.h"
+#include "ram_budget.h"
 
 // Queue handles input to logic from button panels, messages received on ethernet
 // Avoids having to poll inputs from main logic (polling, denbouncing, buffering of buttons etc handled in local_io module)
 QueueHandle_t input_event_queue; 
+static uint8_t input_event_queue_storage[INPUT_EVENT_QUEUE_LENGTH * sizeof(struct Queued_Input_Message_Struct)];
+static StaticQueue_t input_event_queue_buffer;
 
-// Holds the various settings
-// Note that route info is held in 'physical' 1-40 numbering not the 0-39 form - decrements are applied below when commands are sent
-struct Settings_Struct settings;
+static StackType_t input_logic_task_stack[INPUT_LOGIC_TASK_STACK];
+static StaticTask_t input_logic_task_buffer;
+
+// Holds the various settings - the copy taken last from storage (see settings_take), swapped for a
+// reloaded one between messages, so the logic never sees half of a change
+// Note that route info is held in 'physical' 1-288 numbering not the 0-287 form - decrements are applied below when commands are sent
+static const struct Settings_Struct *settings;
 
 static const char *TAG = "main";
 
+// Mirror of each router's crosspoint table - only used from input_logic_task
+static struct Router_State_Struct router_state[ROUTERS_MAX];
+
+// 1 once a router's own confirms are coming in on the current connection - until then the mirror
+// only holds what other boxes have shared (see route_share.h), if anything
+static uint8_t router_live[ROUTERS_MAX];
+
+// Outputs the router itself has confirmed on the current connection - only these are trusted to
+// answer a press locally. A live router's mirror still holds routes shared by other boxes, or
+// restored from before the power went, on every output its status dump hasn't reached yet
+static uint8_t router_confirmed[ROUTERS_MAX][(ROUTER_OUTPUTS_MAX + 7) / 8];
+
+static uint8_t route_confirmed(uint8_t router, uint16_t output)
+{
+    return (router_confirmed[router][output / 8] & (1 << (output % 8))) != 0;
+}
+
+// Reverse index from router crosspoints to panel buttons - see panel_map.h
+static struct Panel_Map_Struct panel_map;
+
+// Input each panel has asked the router to put on its destination and not yet seen confirmed
+// Its button is lit straight away, and put back if the router refuses or doesn't answer
+static uint16_t pending_input[PANELS_MAX];
+static int64_t pending_press_time[PANELS_MAX]; // esp_timer time of the button edge that asked for it
+
+// What a panel's router has on its destination
+static uint16_t panel_route(uint8_t panel)
+{
+    return router_state_get_route(&router_state[settings->panels[panel].router], settings->panels[panel].routing_destination - 1);
+}
+
+// Lights the button for whatever the router has on a panel's destination (none if it isn't one of its sources)
+static void refresh_button_leds(uint8_t panel)
+{
+    uint16_t input = panel_route(panel);
+    if (input == ROUTER_INPUT_UNKNOWN)
+    {
+        return; // Leave the LEDs as they were until the router tells us
+    }
+    set_button_led_state(panel, panel_map_button(&panel_map, panel, input));
+}
+
+// Drops a panel's pending route and goes back to showing what the router is known to have
+static void roll_back_pending(uint8_t panel)
+{
+    pending_input[panel] = ROUTER_INPUT_UNKNOWN;
+    if (panel_route(panel) == ROUTER_INPUT_UNKNOWN)
+    {
+        set_button_led_state(panel, 0); // Don't know - better dark than wrong
+        return;
+    }
+    refresh_button_leds(panel);
+}
+
+// Routing confirm for one of a panel's destinations - merged if others for the output came in
+// since the last one (see take_route_confirm)
+static void handle_panel_confirm(uint8_t panel, uint16_t input, uint8_t merged, int64_t now)
+{
+    if (pending_input[panel] != ROUTER_INPUT_UNKNOWN && pending_input[panel] != input && !merged)
+    {
+        // Older change still coming through - keep showing ours until it lands
+        return;
+    }
+    if (pending_input[panel] != ROUTER_INPUT_UNKNOWN && pending_input[panel] != input)
+    {
+        // Ours may have been among those merged away, and already overtaken - show what the
+        // router has rather than wait for a confirm that won't come
+        pending_input[panel] = ROUTER_INPUT_UNKNOWN;
+        refresh_button_leds(panel);
+        return;
+    }
+    if (pending_input[panel] != ROUTER_INPUT_UNKNOWN)
+    {
+        latency_record(LAT_STAGE_PRESS_TO_CONFIRM, now - pending_press_time[panel]);
+    }
+    pending_input[panel] = ROUTER_INPUT_UNKNOWN;
+    refresh_button_leds(panel);
+}
+
+// Routing confirm from a router - keep the mirror up to date, and update the LEDs of any panels
+// showing that output
+static void handle_route_confirm(uint8_t router, uint16_t output, uint16_t input, int64_t event_time, uint8_t merged)
+{
+    int64_t now = esp_timer_get_time();
+    latency_record(LAT_STAGE_CONFIRM_TO_LOGIC, now - event_time);
+    if (!router_live[router])
+    {
+        router_live[router] = 1;
+        route_share_router_live(router, 1);
+    }
+    router_state_set_route(&router_state[router], output, input);
+    router_confirmed[router][output / 8] |= (1 << (output % 8));
+    route_share_publish(router, output, input);
+    show_relay_confirm(router, output, input, now);
+
+    for (uint8_t panel = panel_map_first(&panel_map, router, output); panel != PANEL_NONE; panel = panel_map_next(&panel_map, panel))
+    {
+        route_store_update(panel, input);
+        handle_panel_confirm(panel, input, merged, now);
+    }
+}
+
+// Takes the settings the card check has published - the panels may have new sources,
+// destinations or routers, but the router connections are the same
+static void reload_settings(void)
+{
+    settings = settings_take();
+    set_route_trigger(settings->route_trigger);
+    set_ping_missed_max(settings->ping_missed_max);
+    panel_map_build(&panel_map, settings);
+    show_relay_reload(settings);
+    route_store_reload(settings);
+
+    for (uint8_t panel = 0; panel < PANELS_MAX; panel++)
+    {
+        // A confirm for a route in flight still updates the mirror, it just isn't waited for
+        pending_input[panel] = ROUTER_INPUT_UNKNOWN;
+        if (panel >= settings->panel_count || settings->panels[panel].routing_destination == 0)
+        {
+            set_button_led_state(panel, 0);
+            continue;
+        }
+        uint16_t input = panel_route(panel);
+        if (input == ROUTER_INPUT_UNKNOWN)
+        {
+            set_button_led_state(panel, 0);
+            continue;
+        }
+        if (route_confirmed(settings->panels[panel].router, settings->panels[panel].routing_destination - 1))
+        {
+            route_store_update(panel, input);
+        }
+        refresh_button_leds(panel);
+    }
+    ESP_LOGI(TAG,"Settings reloaded");
+}
+
 static void input_logic_task(void)
 {
     // Task which responds to button presses on the front panel, ethernet messages
@@ -32,52 +185,167 @@ static void input_logic_task(void)
 
     while(1)
     {   
+        // Each message from the queue is followed by any presses staged in local_io - taken after
+        // every message, so one staged while the queue was full is never left waiting
         struct Queued_Input_Message_Struct incoming_msg;
-        if (xQueueReceive(input_event_queue, &incoming_msg, (TickType_t) portMAX_DELAY) == pdTRUE)
+        uint8_t have_message = (xQueueReceive(input_event_queue, &incoming_msg, (TickType_t) portMAX_DELAY) == pdTRUE);
+        while (have_message)
         {
             // Message recieved from queue
-            ESP_LOGI(TAG,"Processing message in input logic, type:%i",incoming_msg.type);
+            trace_record(TRACE_EVT_LOGIC_MESSAGE, incoming_msg.type, incoming_msg.output, incoming_msg.input);
+            int64_t now = esp_timer_get_time();
 
             switch (incoming_msg.type)
             {
             case IN_MSG_TYP_ROUTING:
+            {
                 // Routing input from button panel - send command to switcher
-                ESP_LOGI(TAG,"Sending video routing message");
-                uint8_t input = settings.routing_sources[incoming_msg.panel_button];
-                uint8_t output = settings.routing_destination;
+                uint8_t panel = incoming_msg.panel;
+                if (panel >= settings->panel_count || incoming_msg.panel_button >= settings->panels[panel].button_count
+                    || settings->panels[panel].routing_destination == 0)
+                {
+                    ESP_LOGW(TAG,"Button %u on panel %u has no route set up", incoming_msg.panel_button + 1, panel + 1);
+                    break;
+                }
+                uint16_t input = settings->panels[panel].routing_sources[incoming_msg.panel_button];
+                uint16_t output = settings->panels[panel].routing_destination;
+                uint8_t router = settings->panels[panel].router;
+                latency_record(LAT_STAGE_INPUT_QUEUE, now - incoming_msg.queued_time);
+                if (input == 0)
+                {
+                    break; // Unused button
+                }
+                if (input == SOURCE_SHOW_RELAY)
+                {
+                    // Relay button - put the Show Relay's camera up, and keep following it
+                    if (!show_relay_configured() || router != settings->show_relay_router)
+                    {
+                        ESP_LOGW(TAG,"Relay button on panel %u but no Show Relay set up on its router", panel + 1);
+                        break;
+                    }
+                    input = show_relay_current_input();
+                }
+                show_relay_follow(panel, settings->panels[panel].routing_sources[incoming_msg.panel_button] == SOURCE_SHOW_RELAY);
 
-                // Decrement in/outs by 1 to go from physical 1-40 numbering to zero index 
-                send_video_route(input - 1, output - 1);
+                // Decrement in/outs by 1 to go from physical 1-288 numbering to zero index 
+                if (pending_input[panel] == ROUTER_INPUT_UNKNOWN && route_confirmed(router, output - 1) && router_state_get_route(&router_state[router], output - 1) == (uint16_t)(input - 1))
+                {
+                    // Router already has this route - answer locally without a round trip
+                    // Only trusted if the router itself has confirmed it (see router_confirmed)
+                    trace_record(TRACE_EVT_ROUTE_LOCAL, input, output, 0);
+                    refresh_button_leds(panel);
+                    latency_record(LAT_STAGE_PRESS_TO_LED, esp_timer_get_time() - incoming_msg.event_time);
+                    break;
+                }
+
+                if (send_video_route(router, input - 1, output - 1, incoming_msg.event_time))
+                {
+                    // Show the press straight away - the confirm or a failure settles it
+                    pending_input[panel] = input - 1;
+                    pending_press_time[panel] = incoming_msg.event_time;
+                    set_button_led_state(panel, incoming_msg.panel_button + 1);
+                    latency_record(LAT_STAGE_PRESS_TO_LED, esp_timer_get_time() - incoming_msg.event_time);
+                }
 
                 break;
+            }
 
             case IN_MSG_TYP_ETHERNET:
-                // Incoming text message on ethenet
-                ESP_LOGI(TAG,"Processing routing confirm message");
-                // Work out if the incoming routing confirm applies to any of our screens
-                u_int8_t found_button = 0;
+            {
+                // Incoming routing confirms from the router - only the latest for each output is
+                // kept until taken here, so take them all
+                uint16_t output;
+                uint16_t input;
+                int64_t event_time;
+                uint8_t merged;
+                while (take_route_confirm(incoming_msg.router, &output, &input, &event_time, &merged))
+                {
+                    handle_route_confirm(incoming_msg.router, output, input, event_time, merged);
+                }
+                break;
+            }
+
+            case IN_MSG_TYP_PEER_ROUTES:
+                // Routes from other boxes - only taken while the router isn't answering us itself,
+                // to light the buttons before (or without) its status dump
+                if (route_share_take(incoming_msg.router, router_live[incoming_msg.router] ? NULL : &router_state[incoming_msg.router]) == 0)
+                {
+                    break;
+                }
+                for (uint8_t panel = 0; panel < settings->panel_count; panel++)
+                {
+                    if (settings->panels[panel].router == incoming_msg.router && pending_input[panel] == ROUTER_INPUT_UNKNOWN)
+                    {
+                        refresh_button_leds(panel);
+                    }
+                }
+                break;
+
+            case IN_MSG_TYP_ROUTE_FAILED:
+                // Router refused a route or didn't answer - undo the LEDs of panels it was pending on
+                for (uint8_t panel = panel_map_first(&panel_map, incoming_msg.router, incoming_msg.output); panel != PANEL_NONE; panel = panel_map_next(&panel_map, panel))
+                {
+                    if (incoming_msg.input == pending_input[panel])
+                    {
+                        ESP_LOGW(TAG,"Route to input %u failed on panel %u, rolling back LEDs", incoming_msg.input + 1, panel + 1);
+                        roll_back_pending(panel);
+                    }
+                }
+                break;
+
+            case IN_MSG_TYP_SHOW_RELAY:
+                // Main/IR button - switch every show relay output in one salvo
+                latency_record(LAT_STAGE_INPUT_QUEUE, now - incoming_msg.queued_time);
+                show_relay_toggle(incoming_msg.event_time);
+                break;
+
+            case IN_MSG_TYP_SALVO_ACKED:
+                show_relay_salvo_acked(incoming_msg.router);
+                break;
+
+            case IN_MSG_TYP_SALVO_FAILED:
+                show_relay_salvo_failed(incoming_msg.router);
+                break;
 
-                if ((incoming_msg.output + 1) == settings.routing_destination)
+            case IN_MSG_TYP_ROUTER_CONNECTED:
+            case IN_MSG_TYP_ROUTER_DISCONNECTED:
+                // Forget everything this router told us - the status dump on connect refills the
+                // mirror, and button presses are always sent until it does. Routes shared by other
+                // boxes are kept until then, as they are being kept up to date
+                ESP_LOGI(TAG,"Router %u %s", incoming_msg.router + 1, (incoming_msg.type == IN_MSG_TYP_ROUTER_CONNECTED) ? "connected" : "disconnected");
+                for (uint8_t panel = 0; panel < settings->panel_count; panel++)
                 {
-                    // It is our screen
-                    for (uint8_t button = 0; button<6; button++)
+                    if (settings->panels[panel].router == incoming_msg.router && pending_input[panel] != ROUTER_INPUT_UNKNOWN)
                     {
-                        if ((incoming_msg.input + 1) == settings.routing_sources[button])
-                        {
-                            // and it's one of our outputs 
-                            found_button = button + 1; // Got to convert back from zero index to physical button, because 0 = no LED lit
-                            break;
-                        } 
+                        // Whatever was in flight is lost with the connection
+                        roll_back_pending(panel);
                     }
-                    set_button_led_state(found_button);  
                 }
+                memset(router_confirmed[incoming_msg.router], 0, sizeof(router_confirmed[incoming_msg.router]));
+                if (router_live[incoming_msg.router])
+                {
+                    router_state_clear(&router_state[incoming_msg.router]);
+                    router_live[incoming_msg.router] = 0;
+                    route_share_router_live(incoming_msg.router, 0);
+                }
+                show_relay_connection_reset(incoming_msg.router);
+                break;
 
+            case IN_MSG_TYP_SETTINGS:
+                // Changed config file - swapped in here, between messages
+                reload_settings();
                 break;
+
+            case IN_MSG_TYP_BUTTONS:
+                // Presses staged - taken below
+                break;
+
             default:
                 ESP_LOGW(TAG,"Input message unknown:%i",incoming_msg.type);
                 break;
             }
-            
+
+            have_message = take_button_press(&incoming_msg);
         }
     }
 
@@ -90,7 +358,10 @@ static void local_test_mode(void)
     {
         // Do some dumb polling of the buttons to light any up that are selected
 
-        set_button_led_state(get_button_panel_state());
+        for (uint8_t panel = 0; panel < PANEL_COUNT; panel++)
+        {
+            set_button_led_state(panel, get_button_panel_state(panel));
+        }
         vTaskDelay(5);
     
     }
@@ -100,29 +371,84 @@ static void local_test_mode(void)
 void app_main(void)
 {   
     // Set up input event queue
-    input_event_queue = xQueueCreate (32, sizeof(struct Queued_Input_Message_Struct)); 
-    if (input_event_queue == NULL)
+    input_event_queue = create_static_queue("input event", INPUT_EVENT_QUEUE_LENGTH, sizeof(struct Queued_Input_Message_Struct),
+                                            input_event_queue_storage, &input_event_queue_buffer);
+
+    // Bring the network up first - the PHY negotiating a link and DHCP take longer than anything
+    // else at boot, so they carry on while the settings are read and the panel is set up
+    start_ethernet();
+
+    // NVS holds the settings cache
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)
     {
-        ESP_LOGE(TAG,"Unable to create input event queue, rebooting");
-        esp_restart();
+        ESP_LOGW(TAG, "NVS partition full or from a newer IDF, erasing");
+        nvs_flash_erase();
+        ret = nvs_flash_init();
+    }
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "NVS init failed (%s), settings won't be cached", esp_err_to_name(ret));
     }
 
-    // Retrive settings from SD card 
-    settings = get_settings();
+    // Retrive settings - from the cache if there is one, otherwise from the SD card
+    get_settings();
+    settings = settings_take();
 
     //Set up local buttons, LEDs, relay outputs and warning lights
-    setup_local_io(&input_event_queue);
+    setup_local_io(&input_event_queue, settings->route_trigger);
+
+    for (uint8_t router = 0; router < ROUTERS_MAX; router++)
+    {
+        router_state_clear(&router_state[router]);
+        router_live[router] = 0;
+    }
+    panel_map_build(&panel_map, settings);
+    show_relay_setup(settings);
+    for (uint8_t panel = 0; panel < PANELS_MAX; panel++)
+    {
+        pending_input[panel] = ROUTER_INPUT_UNKNOWN;
+    }
+    if (settings->panel_count > PANEL_COUNT)
+    {
+        ESP_LOGW(TAG,"Config sets up %u panels, only %u wired to this box", settings->panel_count, PANEL_COUNT);
+    }
+
+    // Light the buttons with the routes from before the power went - they only go in the mirror
+    // of a router that isn't live, so are shown but never trusted, until the router confirms
+    setup_route_store(settings);
+    for (uint8_t panel = 0; panel < settings->panel_count; panel++)
+    {
+        uint16_t input = route_store_restored(panel);
+        if (input != ROUTER_INPUT_UNKNOWN)
+        {
+            router_state_set_route(&router_state[settings->panels[panel].router], settings->panels[panel].routing_destination - 1, input);
+            refresh_button_leds(panel);
+        }
+    }
 
     vTaskDelay(10); // Wait to see if buttons are being held down
     //Check to see if we're heading into 'vegas mode' for testing rather than the proper application
-    if (get_button_panel_state() == 1)
+    if (get_button_panel_state(0) == 1)
     {
         local_test_mode();
         return; 
     }
 
-    // Set up ethernet stack and communication with video router
-    setup_ethernet(settings.router_ip, settings.router_port, &input_event_queue);
+    // Set up communication with the video routers
+    set_ping_missed_max(settings->ping_missed_max);
+    setup_ethernet(settings->routers, settings->router_count, &input_event_queue);
+    if (settings->route_sharing)
+    {
+        setup_route_share(settings, &input_event_queue);
+    }
+
+    create_static_task((TaskFunction_t)input_logic_task, "input_logic_task", INPUT_LOGIC_TASK_STACK, input_logic_task_stack,
+                       &input_logic_task_buffer, NULL, 5);
+
+    // Settings from the cache - see if the card has changed now the box is up
+    settings_check_start(&input_event_queue);
 
-    xTaskCreate( (TaskFunction_t) input_logic_task, "input_logic_task", 2048, NULL, 5, NULL);
+    // Last, so everything a command asks about (or for, as "reload" does) is running
+    setup_diagnostics();
 }
\ No newline at end of file
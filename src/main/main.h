@@ -3,18 +3,37 @@
 #ifndef MAIN_H_INCLUDED
 #define MAIN_H_INCLUDED
 
+#include <stdint.h>
+
 // Used for commands in queue to input logic
 struct Queued_Input_Message_Struct {
     uint8_t type; // See below defines
 
+    uint8_t panel; // Used for a routing command (which panel, zero based)
     uint8_t panel_button; // Used for a routing command (which button within the panel)
 
-    uint8_t input; // Used for an incoming routing confirm
-    uint8_t output; // Used for an incoming routing confirm 
+    uint16_t input; // Used for an incoming routing confirm (zero based, routers go up to 288x288)
+    uint16_t output; // Used for an incoming routing confirm
+    uint8_t router; // Zero based router an incoming confirm, failure or connection change came from
+
+    int64_t event_time;  // esp_timer time of the first button edge, or of the confirm coming off the socket
+    int64_t queued_time; // esp_timer time the message was queued
 };
 
 // Definitions of message type for input messages 
 #define IN_MSG_TYP_ROUTING 0
 #define IN_MSG_TYP_ETHERNET 1
+#define IN_MSG_TYP_ROUTER_CONNECTED 2
+#define IN_MSG_TYP_ROUTER_DISCONNECTED 3
+#define IN_MSG_TYP_ROUTE_FAILED 4 // A route we sent was NAKed or never answered (input/output as for a confirm)
+#define IN_MSG_TYP_SHOW_RELAY 5 // Show Relay Main/IR button
+#define IN_MSG_TYP_SALVO_ACKED 6 // Router ACKed the block carrying a salvo
+#define IN_MSG_TYP_SALVO_FAILED 7 // Router NAKed the block carrying a salvo, or didn't answer
+#define IN_MSG_TYP_PEER_ROUTES 8 // Other boxes have sent routes for a router - see route_share.h
+#define IN_MSG_TYP_SETTINGS 9 // A changed config file has been published - see settings_take
+#define IN_MSG_TYP_BUTTONS 10 // Presses have been staged - see take_button_press
+
+#define INPUT_EVENT_QUEUE_LENGTH 32
+#define INPUT_LOGIC_TASK_STACK 2048 // Bytes - the "ram" diagnostics command shows how much is used
 
 #endif
\ No newline at end of file
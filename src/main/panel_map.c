@@ -0,0 +1,64 @@
+// Panel map
+//-----------------------------------
+
+#include <string.h>
+
+#include "panel_map.h"
+
+static void map_button(struct Panel_Map_Struct *map, uint8_t panel, uint16_t source, uint8_t button)
+{
+    if (source >= 1 && source <= ROUTER_INPUTS_MAX && map->button_for_input[panel][source - 1] == 0)
+    {
+        map->button_for_input[panel][source - 1] = button + 1; // First button wins if a source is repeated
+    }
+}
+
+void panel_map_build(struct Panel_Map_Struct *map, const struct Settings_Struct *settings)
+{
+    memset(map->first_panel, PANEL_NONE, sizeof(map->first_panel));
+    memset(map->next_panel, PANEL_NONE, sizeof(map->next_panel));
+    memset(map->button_for_input, 0, sizeof(map->button_for_input));
+
+    // Last panel first, so panels sharing an output are chained in panel order
+    for (int8_t panel = settings->panel_count - 1; panel >= 0; panel--)
+    {
+        const struct Panel_Settings_Struct *panel_settings = &settings->panels[panel];
+        uint16_t destination = panel_settings->routing_destination;
+        uint8_t router = panel_settings->router;
+        if (destination < 1 || destination > ROUTER_OUTPUTS_MAX || router >= ROUTERS_MAX)
+        {
+            continue; // Panel not used, or pointed at an output the router can't have
+        }
+
+        map->next_panel[panel] = map->first_panel[router][destination - 1];
+        map->first_panel[router][destination - 1] = panel;
+
+        for (uint8_t button = 0; button < panel_settings->button_count; button++)
+        {
+            uint16_t source = panel_settings->routing_sources[button];
+            if (source == SOURCE_SHOW_RELAY)
+            {
+                // Lit for whichever camera the Show Relay is on
+                map_button(map, panel, settings->show_relay_main_source, button);
+                map_button(map, panel, settings->show_relay_ir_source, button);
+                continue;
+            }
+            map_button(map, panel, source, button);
+        }
+    }
+}
+
+uint8_t panel_map_first(const struct Panel_Map_Struct *map, uint8_t router, uint16_t output)
+{
+    return (router < ROUTERS_MAX && output < ROUTER_OUTPUTS_MAX) ? map->first_panel[router][output] : PANEL_NONE;
+}
+
+uint8_t panel_map_next(const struct Panel_Map_Struct *map, uint8_t panel)
+{
+    return map->next_panel[panel];
+}
+
+uint8_t panel_map_button(const struct Panel_Map_Struct *map, uint8_t panel, uint16_t input)
+{
+    return (input < ROUTER_INPUTS_MAX) ? map->button_for_input[panel][input] : 0;
+}
@@ -0,0 +1,33 @@
+// Panel map
+//-----------------------------------
+// Reverse index from the router's crosspoints to the panel buttons that show them, built once
+// from the settings. A routing confirm (router, output, input) finds the panels on that output, and the
+// button each would light, with table lookups rather than a search of every panel and button.
+// Only touched by the main logic task, so needs no locking.
+
+#ifndef PANEL_MAP_H_INCLUDED
+#define PANEL_MAP_H_INCLUDED
+
+#include <stdint.h>
+
+#include "router_state.h"
+#include "storage.h"
+
+#define PANEL_NONE 0xFF
+
+struct Panel_Map_Struct {
+    uint8_t first_panel[ROUTERS_MAX][ROUTER_OUTPUTS_MAX]; // Zero based first panel on each zero based output, PANEL_NONE for none
+    uint8_t next_panel[PANELS_MAX];          // Next panel on the same output, PANEL_NONE at the end
+    uint8_t button_for_input[PANELS_MAX][ROUTER_INPUTS_MAX]; // Button (1 based, 0 for none) selecting each zero based input
+};
+
+void panel_map_build(struct Panel_Map_Struct *map, const struct Settings_Struct *settings);
+
+// Walk the panels on an output with: for (p = panel_map_first(map, r, o); p != PANEL_NONE; p = panel_map_next(map, p))
+uint8_t panel_map_first(const struct Panel_Map_Struct *map, uint8_t router, uint16_t output);
+uint8_t panel_map_next(const struct Panel_Map_Struct *map, uint8_t panel);
+
+// Button (1 based) on a panel that selects a zero based input, 0 if none does
+uint8_t panel_map_button(const struct Panel_Map_Struct *map, uint8_t panel, uint16_t input);
+
+#endif
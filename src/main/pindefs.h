@@ -26,8 +26,22 @@
 #define PIN_BUTTON_5 34
 #define PIN_BUTTON_6 35
 
-#define PIN_BUTTON_MASK (1ULL << PIN_BUTTON_1) | (1ULL << PIN_BUTTON_2) | (1ULL << PIN_BUTTON_3) | (1ULL << PIN_BUTTON_4) | (1ULL << PIN_BUTTON_5) | (1ULL << PIN_BUTTON_6)
-
-#define PIN_LED_MASK (1ULL << PIN_LED_A) | (1ULL << PIN_LED_B) | (1ULL << PIN_LED_C)  
+// Show Relay - not on the current main-board revision, these are the spare header pins
+// GPIO36 is input only with no internal pull-up, so the Main/IR button needs an external one
+// GPIO0 is pulled high at reset to boot from flash, so the contactor driver is active low to keep
+// the floodlights off until the firmware has decided
+#define PIN_SHOW_RELAY_BUTTON 36
+#define PIN_IR_CONTACTOR 0
+#define IR_CONTACTOR_ON_LEVEL 0
+
+// Routing panels wired to the main board, one row per panel - its six buttons, and the three
+// LED lines that light one of them (binary coded button number, 0 for none)
+#define PANEL_COUNT 1
+#define PANEL_BUTTON_PINS { \
+    {PIN_BUTTON_1, PIN_BUTTON_2, PIN_BUTTON_3, PIN_BUTTON_4, PIN_BUTTON_5, PIN_BUTTON_6}, \
+}
+#define PANEL_LED_PINS { \
+    {PIN_LED_A, PIN_LED_B, PIN_LED_C}, \
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,135 @@
+// Queue statistics
+//-----------------------------------
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+
+#include "queue_stats.h"
+
+// Logging tag
+static const char *TAG = "queue_stats";
+
+// Added to as queues are made, read by any task - an entry is filled in before the count takes
+// it in
+static struct Queue_Stats_Struct queue_stats[QUEUE_STATS_MAX];
+static atomic_uint queue_stats_count = 0;
+static portMUX_TYPE queue_stats_mux = portMUX_INITIALIZER_UNLOCKED; // Held while one is added
+
+struct Queue_Stats_Struct *queue_stats_add(const void *queue, const char *name, uint32_t length)
+{
+    struct Queue_Stats_Struct *stats = NULL;
+    taskENTER_CRITICAL(&queue_stats_mux);
+    unsigned int index = atomic_load(&queue_stats_count);
+    if (index < QUEUE_STATS_MAX)
+    {
+        stats = &queue_stats[index];
+        stats->queue = queue;
+        stats->name = name;
+        stats->length = length;
+        atomic_store(&queue_stats_count, index + 1);
+    }
+    taskEXIT_CRITICAL(&queue_stats_mux);
+
+    if (stats == NULL)
+    {
+        ESP_LOGW(TAG, "Queue %s not counted - raise QUEUE_STATS_MAX", name);
+    }
+    return stats;
+}
+
+struct Queue_Stats_Struct *queue_stats_find(const void *queue)
+{
+    unsigned int count = atomic_load(&queue_stats_count);
+    for (unsigned int index = 0; index < count; index++)
+    {
+        if (queue_stats[index].queue == queue)
+        {
+            return &queue_stats[index];
+        }
+    }
+    return NULL;
+}
+
+struct Queue_Stats_Struct *queue_stats_find_name(const char *name)
+{
+    unsigned int count = atomic_load(&queue_stats_count);
+    for (unsigned int index = 0; index < count; index++)
+    {
+        if (strcmp(queue_stats[index].name, name) == 0)
+        {
+            return &queue_stats[index];
+        }
+    }
+    return NULL;
+}
+
+void queue_stats_sent(struct Queue_Stats_Struct *stats, uint32_t waiting)
+{
+    if (stats == NULL)
+    {
+        return;
+    }
+    atomic_fetch_add(&stats->sent, 1);
+    unsigned int peak = atomic_load(&stats->peak);
+    while (waiting > peak && !atomic_compare_exchange_weak(&stats->peak, &peak, waiting))
+    {
+    }
+}
+
+void queue_stats_dropped(struct Queue_Stats_Struct *stats, uint32_t count)
+{
+    if (stats != NULL)
+    {
+        atomic_fetch_add(&stats->dropped, count);
+    }
+}
+
+void queue_stats_coalesced(struct Queue_Stats_Struct *stats, uint32_t count)
+{
+    if (stats != NULL)
+    {
+        atomic_fetch_add(&stats->coalesced, count);
+    }
+}
+
+BaseType_t queue_send_counted(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+    struct Queue_Stats_Struct *stats = queue_stats_find(queue);
+    BaseType_t sent = xQueueSend(queue, item, 0);
+    if (sent != pdTRUE && ticks_to_wait > 0)
+    {
+        if (stats != NULL)
+        {
+            atomic_fetch_add(&stats->waited, 1);
+        }
+        sent = xQueueSend(queue, item, ticks_to_wait);
+    }
+
+    if (sent == pdTRUE)
+    {
+        queue_stats_sent(stats, uxQueueMessagesWaiting(queue));
+    }
+    else
+    {
+        queue_stats_dropped(stats, 1);
+    }
+    return sent;
+}
+
+size_t queue_stats_dump(char *output, size_t size)
+{
+    size_t length = snprintf(output, size, "queue                 sent  dropped coalesced  waited   peak\n");
+    unsigned int count = atomic_load(&queue_stats_count);
+    for (unsigned int index = 0; index < count && length < size; index++)
+    {
+        struct Queue_Stats_Struct *stats = &queue_stats[index];
+        length += snprintf(output + length, size - length, "%-18s %7u %8u %9u %7u %3u/%"PRIu32"\n", stats->name,
+                           atomic_load(&stats->sent), atomic_load(&stats->dropped), atomic_load(&stats->coalesced),
+                           atomic_load(&stats->waited), atomic_load(&stats->peak), stats->length);
+    }
+    return length;
+}
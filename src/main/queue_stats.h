@@ -0,0 +1,52 @@
+// Queue statistics
+//-----------------------------------
+// Counters for every queue between the tasks, shown on the "queues" diagnostics command: messages
+// put in, those turned away because the queue was full, those merged into one already waiting
+// (only the latest mattered), sends that had to wait for room, and the most ever waiting.
+// Every queue made through create_static_queue is counted here - its senders go through
+// queue_send_counted - and stages that aren't FreeRTOS queues (the presses and routing confirms
+// waiting for the main logic) add themselves with queue_stats_add.
+
+#ifndef QUEUE_STATS_H_INCLUDED
+#define QUEUE_STATS_H_INCLUDED
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "storage.h"
+
+// The input event queue, the staged panel presses, and an output queue and confirm stage for each router
+#define QUEUE_STATS_MAX (2 + 2 * ROUTERS_MAX)
+
+struct Queue_Stats_Struct {
+    const void *queue; // Queue handle, or whatever identifies a stage
+    const char *name;  // Must outlive the queue
+    uint32_t length;
+    atomic_uint sent;
+    atomic_uint dropped;
+    atomic_uint coalesced;
+    atomic_uint waited;
+    atomic_uint peak;
+};
+
+// Starts counting for a queue - returns NULL (and nothing is counted) if QUEUE_STATS_MAX are in use
+struct Queue_Stats_Struct *queue_stats_add(const void *queue, const char *name, uint32_t length);
+struct Queue_Stats_Struct *queue_stats_find(const void *queue);
+struct Queue_Stats_Struct *queue_stats_find_name(const char *name);
+
+// Sends to a queue, waiting up to ticks_to_wait for room - counted as waited if it had to, and
+// as dropped if it still didn't fit
+BaseType_t queue_send_counted(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait);
+
+// For stages that aren't FreeRTOS queues, and for merging messages into one already waiting -
+// stats may be NULL
+void queue_stats_sent(struct Queue_Stats_Struct *stats, uint32_t waiting);
+void queue_stats_dropped(struct Queue_Stats_Struct *stats, uint32_t count);
+void queue_stats_coalesced(struct Queue_Stats_Struct *stats, uint32_t count);
+
+// Every queue's counters as text, as much as fits
+size_t queue_stats_dump(char *output, size_t size);
+
+#endif
@@ -0,0 +1,115 @@
+// RAM budget: statically allocated tasks and queues
+//-----------------------------------
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_system.h"
+
+#include "ram_budget.h"
+#include "queue_stats.h"
+
+// Logging tag
+static const char *TAG = "ram_budget";
+
+// Ends of the statically allocated RAM, from the linker script
+extern int _data_start, _data_end, _bss_start, _bss_end;
+
+struct Budget_Task_Struct {
+    TaskHandle_t handle;
+    uint32_t stack_size;
+};
+
+// Added to as tasks are made, read by the diagnostics task - an entry is filled in before the
+// count takes it in
+static struct Budget_Task_Struct tasks[RAM_BUDGET_TASKS_MAX];
+static atomic_uint task_count = 0;
+static atomic_uint queue_count = 0;
+static atomic_uint queue_bytes = 0; // Storage and control blocks, mutexes included
+
+TaskHandle_t create_static_task(TaskFunction_t function, const char *name, uint32_t stack_size, StackType_t *stack, StaticTask_t *task_buffer,
+                                void *parameters, UBaseType_t priority)
+{
+    TaskHandle_t handle = xTaskCreateStatic(function, name, stack_size, parameters, priority, stack, task_buffer);
+    if (handle == NULL)
+    {
+        ESP_LOGE(TAG, "Unable to create task %s, rebooting", name);
+        esp_restart();
+    }
+
+    unsigned int index = atomic_load(&task_count);
+    if (index < RAM_BUDGET_TASKS_MAX)
+    {
+        tasks[index].handle = handle;
+        tasks[index].stack_size = stack_size;
+        atomic_store(&task_count, index + 1);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Task %s left out of the RAM budget - raise RAM_BUDGET_TASKS_MAX", name);
+    }
+    return handle;
+}
+
+QueueHandle_t create_static_queue(const char *name, UBaseType_t length, UBaseType_t item_size, uint8_t *storage, StaticQueue_t *queue_buffer)
+{
+    QueueHandle_t queue = xQueueCreateStatic(length, item_size, storage, queue_buffer);
+    if (queue == NULL)
+    {
+        ESP_LOGE(TAG, "Unable to create %s queue, rebooting", name);
+        esp_restart();
+    }
+    vQueueAddToRegistry(queue, name);
+    queue_stats_add(queue, name, length);
+    atomic_fetch_add(&queue_count, 1);
+    atomic_fetch_add(&queue_bytes, length * item_size + sizeof(StaticQueue_t));
+    return queue;
+}
+
+SemaphoreHandle_t create_static_mutex(const char *name, StaticSemaphore_t *mutex_buffer)
+{
+    SemaphoreHandle_t mutex = xSemaphoreCreateMutexStatic(mutex_buffer);
+    if (mutex == NULL)
+    {
+        ESP_LOGE(TAG, "Unable to create %s mutex, rebooting", name);
+        esp_restart();
+    }
+    atomic_fetch_add(&queue_count, 1);
+    atomic_fetch_add(&queue_bytes, sizeof(StaticSemaphore_t));
+    return mutex;
+}
+
+size_t ram_budget_dump(char *output, size_t size)
+{
+    size_t length = snprintf(output, size, "task              stack   peak  free\n");
+    unsigned int count = atomic_load(&task_count);
+    uint32_t stack_total = 0;
+    for (unsigned int index = 0; index < count && length < size; index++)
+    {
+        uint32_t free_bytes = uxTaskGetStackHighWaterMark(tasks[index].handle);
+        length += snprintf(output + length, size - length, "%-16s %6"PRIu32" %6"PRIu32" %5"PRIu32"\n", pcTaskGetName(tasks[index].handle),
+                           tasks[index].stack_size, tasks[index].stack_size - free_bytes, free_bytes);
+        stack_total += tasks[index].stack_size + sizeof(StaticTask_t);
+    }
+
+    size_t static_bytes = ((char *)&_data_end - (char *)&_data_start) + ((char *)&_bss_end - (char *)&_bss_start);
+    size_t heap_total = heap_caps_get_total_size(MALLOC_CAP_8BIT);
+    size_t heap_free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    if (length < size)
+    {
+        length += snprintf(output + length, size - length,
+                           "tasks: %u, %"PRIu32" bytes with their stacks\nqueues and mutexes: %u, %u bytes\n"
+                           "static ram: %u bytes (.data and .bss, all of the above included)\n"
+                           "heap: %u bytes in use of %u, lowest free %u\ntotal ram in use: %u bytes\n",
+                           count, stack_total, atomic_load(&queue_count), atomic_load(&queue_bytes), (unsigned int)static_bytes,
+                           (unsigned int)(heap_total - heap_free), (unsigned int)heap_total,
+                           (unsigned int)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT), (unsigned int)(static_bytes + heap_total - heap_free));
+    }
+    return length;
+}
@@ -0,0 +1,33 @@
+// RAM budget: statically allocated tasks and queues
+//-----------------------------------
+// Every task, queue and mutex the firmware makes lives in a buffer fixed when the firmware is
+// linked - they are in the .bss figure from `idf.py size` - so nothing is taken from the heap for
+// them once the box is running, and a build that doesn't fit the esp32's SRAM fails to link rather
+// than to boot. They are made through here so the "ram" diagnostics command can list each task's
+// stack against the most of it ever used, along with the box's total RAM use.
+// Stack sizes are in bytes, as for xTaskCreate on the esp32 port, and set next to each task.
+
+#ifndef RAM_BUDGET_H_INCLUDED
+#define RAM_BUDGET_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+// Tasks listed by the report - seven, and two for each router
+#define RAM_BUDGET_TASKS_MAX 16
+
+// Each restarts the box if the object can't be made, as a failed xTaskCreate or xQueueCreate did
+// The name must outlive the object - tasks' names are copied, so can be built on the stack
+TaskHandle_t create_static_task(TaskFunction_t function, const char *name, uint32_t stack_size, StackType_t *stack, StaticTask_t *task_buffer,
+                                void *parameters, UBaseType_t priority);
+QueueHandle_t create_static_queue(const char *name, UBaseType_t length, UBaseType_t item_size, uint8_t *storage, StaticQueue_t *queue_buffer);
+SemaphoreHandle_t create_static_mutex(const char *name, StaticSemaphore_t *mutex_buffer);
+
+// Each task's stack use and the RAM totals as text, as much as fits
+size_t ram_budget_dump(char *output, size_t size);
+
+#endif
@@ -0,0 +1,568 @@
+// Route sharing between boxes
+//-----------------------------------
+
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_vfs_eventfd.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "main.h"
+#include "route_share.h"
+#include "ethernet.h"
+#include "trace.h"
+#include "ram_budget.h"
+#include "queue_stats.h"
+
+// Logging tag
+static const char *TAG = "route_share";
+
+#define OUTPUT_BITMAP_SIZE ((ROUTER_OUTPUTS_MAX + 7) / 8)
+
+// One per router in the config
+struct Shared_Router_Struct {
+    uint32_t ip;
+    uint16_t port;
+
+    // Protected by share_mutex:
+    uint8_t live;                                // Main logic is hearing from the router itself
+    uint16_t table[ROUTER_OUTPUTS_MAX];          // What the router has confirmed, while live
+    uint8_t unsent[OUTPUT_BITMAP_SIZE];          // Outputs changed since the last delta went out
+    uint8_t table_asked;                         // A peer has asked for our table
+    uint8_t request_due;                         // We want peers' tables
+    uint16_t staged[ROUTER_OUTPUTS_MAX];         // Routes from peers waiting for the main logic
+    uint8_t staged_changed[OUTPUT_BITMAP_SIZE];
+    uint8_t staged_posted;                       // IN_MSG_TYP_PEER_ROUTES is in the input queue
+};
+
+static struct Shared_Router_Struct shared_routers[ROUTERS_MAX];
+static uint8_t shared_router_count = 0; // 0 while sharing is off
+static StaticSemaphore_t share_mutex_buffer;
+static SemaphoreHandle_t share_mutex;   // protects the above, and:
+static struct Route_Share_Stats_Struct share_stats;
+
+// Input message queue handle pointer - passed in from main module
+static QueueHandle_t *input_event_queue_ptr;
+
+// Written whenever the sharing task has something to send, or the box's address changes
+static int share_wake_fd = -1;
+
+static StackType_t share_task_stack[ROUTE_SHARE_TASK_STACK];
+static StaticTask_t share_task_buffer;
+
+// Box's address (network byte order) - the group is joined on it, and again whenever it changes
+static atomic_uint_least32_t share_address = 0;
+static atomic_uint share_address_generation = 0;
+
+static uint32_t sender_id;
+
+// Only used by the sharing task
+static struct {
+    uint32_t sender;
+    uint16_t sequence;
+} peers[ROUTE_SHARE_PEERS_MAX];
+static uint8_t peer_count = 0;
+static uint8_t peer_replace = 0;
+static uint16_t send_sequence = 0;
+static uint8_t send_datagram[ROUTE_SHARE_DATAGRAM_SIZE];
+static uint8_t recv_datagram[ROUTE_SHARE_DATAGRAM_SIZE + 1]; // One over, so anything too long is seen to be
+
+static void bit_set(uint8_t *bitmap, uint16_t index)
+{
+    bitmap[index / 8] |= (1 << (index % 8));
+}
+
+static uint8_t bit_take(uint8_t *bitmap, uint16_t index)
+{
+    uint8_t set = (bitmap[index / 8] & (1 << (index % 8))) != 0;
+    bitmap[index / 8] &= ~(1 << (index % 8));
+    return set;
+}
+
+static void put16(uint8_t *to, uint16_t value)
+{
+    to[0] = value >> 8;
+    to[1] = value;
+}
+
+static void put32(uint8_t *to, uint32_t value)
+{
+    put16(to, value >> 16);
+    put16(to + 2, value);
+}
+
+static uint16_t get16(const uint8_t *from)
+{
+    return ((uint16_t)from[0] << 8) | from[1];
+}
+
+static uint32_t get32(const uint8_t *from)
+{
+    return ((uint32_t)get16(from) << 16) | get16(from + 2);
+}
+
+static void wake_share_task(void)
+{
+    uint64_t wake = 1;
+    write(share_wake_fd, &wake, sizeof(wake));
+}
+
+static int8_t find_router(uint32_t ip, uint16_t port)
+{
+    for (uint8_t router = 0; router < shared_router_count; router++)
+    {
+        if (shared_routers[router].ip == ip && shared_routers[router].port == port)
+        {
+            return router;
+        }
+    }
+    return -1;
+}
+
+// 1 if a datagram is newer than the last one taken from its sender
+static uint8_t peer_in_order(uint32_t sender, uint16_t sequence)
+{
+    for (uint8_t peer = 0; peer < peer_count; peer++)
+    {
+        if (peers[peer].sender == sender)
+        {
+            if ((int16_t)(sequence - peers[peer].sequence) <= 0)
+            {
+                return 0;
+            }
+            peers[peer].sequence = sequence;
+            return 1;
+        }
+    }
+
+    // New box (or one that has rebooted, with a new id) - take the place of the oldest if full
+    uint8_t peer = (peer_count < ROUTE_SHARE_PEERS_MAX) ? peer_count++ : peer_replace++ % ROUTE_SHARE_PEERS_MAX;
+    peers[peer].sender = sender;
+    peers[peer].sequence = sequence;
+    return 1;
+}
+
+static void handle_datagram(size_t length)
+{
+    const uint8_t *datagram = recv_datagram;
+    if (length < ROUTE_SHARE_HEADER_SIZE || datagram[0] != 'V' || datagram[1] != 'R' || datagram[2] != ROUTE_SHARE_VERSION)
+    {
+        xSemaphoreTake(share_mutex, portMAX_DELAY);
+        share_stats.dropped++;
+        xSemaphoreGive(share_mutex);
+        return;
+    }
+
+    uint8_t type = datagram[3];
+    uint32_t sender = get32(datagram + 4);
+    uint16_t sequence = get16(datagram + 8);
+    uint16_t count = get16(datagram + 16);
+    if (sender == sender_id)
+    {
+        return; // Our own, looped back
+    }
+    int8_t router = find_router(get32(datagram + 10), get16(datagram + 14));
+    if (router < 0)
+    {
+        return; // About a router this box doesn't use
+    }
+
+    uint8_t valid = (count <= ROUTER_OUTPUTS_MAX && length == ROUTE_SHARE_HEADER_SIZE + (size_t)count * 4 && type <= ROUTE_SHARE_MSG_REQUEST);
+    if (valid && !peer_in_order(sender, sequence))
+    {
+        valid = 0;
+    }
+
+    struct Shared_Router_Struct *shared = &shared_routers[router];
+    uint8_t post = 0;
+
+    xSemaphoreTake(share_mutex, portMAX_DELAY);
+    if (!valid)
+    {
+        share_stats.dropped++;
+    }
+    else
+    {
+        share_stats.datagrams_received++;
+        if (type == ROUTE_SHARE_MSG_REQUEST)
+        {
+            shared->table_asked = shared->live;
+        }
+        else if (!shared->live)
+        {
+            // Only wanted while the router isn't talking to us itself
+            const uint8_t *route = datagram + ROUTE_SHARE_HEADER_SIZE;
+            for (uint16_t index = 0; index < count; index++, route += 4)
+            {
+                uint16_t output = get16(route);
+                uint16_t input = get16(route + 2);
+                if (output < ROUTER_OUTPUTS_MAX && input < ROUTER_INPUTS_MAX)
+                {
+                    shared->staged[output] = input;
+                    bit_set(shared->staged_changed, output);
+                    post = 1;
+                }
+            }
+            post = post && !shared->staged_posted;
+            shared->staged_posted |= post;
+        }
+    }
+    xSemaphoreGive(share_mutex);
+
+    if (valid)
+    {
+        trace_record(TRACE_EVT_SHARE_RECEIVED, type, count, router + 1);
+    }
+
+    if (post)
+    {
+        struct Queued_Input_Message_Struct new_message;
+        new_message.type = IN_MSG_TYP_PEER_ROUTES;
+        new_message.router = router;
+        new_message.input = 0;
+        new_message.output = 0;
+        new_message.event_time = esp_timer_get_time();
+        new_message.queued_time = new_message.event_time;
+
+        if (queue_send_counted(*input_event_queue_ptr, (void *)&new_message, 0) != pdTRUE)
+        {
+            // Left staged - the next datagram for this router tries again
+            ESP_LOGW(TAG, "Sending message for peer routes failed due to queue full?");
+            xSemaphoreTake(share_mutex, portMAX_DELAY);
+            shared->staged_posted = 0;
+            xSemaphoreGive(share_mutex);
+        }
+    }
+}
+
+static void send_routes(int sock, uint8_t type, uint8_t router, uint16_t count)
+{
+    send_datagram[0] = 'V';
+    send_datagram[1] = 'R';
+    send_datagram[2] = ROUTE_SHARE_VERSION;
+    send_datagram[3] = type;
+    put32(send_datagram + 4, sender_id);
+    put16(send_datagram + 8, ++send_sequence);
+    put32(send_datagram + 10, shared_routers[router].ip);
+    put16(send_datagram + 14, shared_routers[router].port);
+    put16(send_datagram + 16, count);
+
+    struct sockaddr_in group;
+    memset(&group, 0, sizeof(group));
+    group.sin_family = AF_INET;
+    group.sin_addr.s_addr = inet_addr(ROUTE_SHARE_GROUP);
+    group.sin_port = htons(ROUTE_SHARE_PORT);
+
+    size_t length = ROUTE_SHARE_HEADER_SIZE + (size_t)count * 4;
+    if (sendto(sock, send_datagram, length, 0, (struct sockaddr *)&group, sizeof(group)) < 0)
+    {
+        ESP_LOGW(TAG, "Route sharing send failed: Error number %d", errno);
+        return;
+    }
+    trace_record(TRACE_EVT_SHARE_SENT, type, count, router + 1);
+
+    xSemaphoreTake(share_mutex, portMAX_DELAY);
+    share_stats.datagrams_sent++;
+    share_stats.tables_sent += (type == ROUTE_SHARE_MSG_TABLE);
+    xSemaphoreGive(share_mutex);
+}
+
+// Sends whatever each router has waiting - a table if a peer asked for one (it carries every
+// change too), otherwise the changes since last time, and our own request
+static void send_due(int sock)
+{
+    for (uint8_t router = 0; router < shared_router_count; router++)
+    {
+        struct Shared_Router_Struct *shared = &shared_routers[router];
+        uint8_t *route = send_datagram + ROUTE_SHARE_HEADER_SIZE;
+        uint16_t count = 0;
+
+        xSemaphoreTake(share_mutex, portMAX_DELAY);
+        uint8_t type = (shared->table_asked && shared->live) ? ROUTE_SHARE_MSG_TABLE : ROUTE_SHARE_MSG_DELTA;
+        for (uint16_t output = 0; output < ROUTER_OUTPUTS_MAX; output++)
+        {
+            uint8_t changed = bit_take(shared->unsent, output);
+            if (changed || (type == ROUTE_SHARE_MSG_TABLE && shared->table[output] != ROUTER_INPUT_UNKNOWN))
+            {
+                put16(route, output);
+                put16(route + 2, shared->table[output]);
+                route += 4;
+                count++;
+            }
+        }
+        uint8_t request = shared->request_due;
+        shared->table_asked = 0;
+        shared->request_due = 0;
+        xSemaphoreGive(share_mutex);
+
+        if (count > 0)
+        {
+            send_routes(sock, type, router, count);
+        }
+        if (request)
+        {
+            send_routes(sock, ROUTE_SHARE_MSG_REQUEST, router, 0);
+        }
+    }
+}
+
+// Joins the group on the box's address - returns the socket, or -1
+static int open_share_socket(uint32_t interface_address)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0)
+    {
+        ESP_LOGE(TAG, "Unable to create route sharing socket: Error number %d", errno);
+        return -1;
+    }
+
+    // Several boxes can share a host when testing on one
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(ROUTE_SHARE_PORT);
+
+    struct ip_mreq membership;
+    membership.imr_multiaddr.s_addr = inet_addr(ROUTE_SHARE_GROUP);
+    membership.imr_interface.s_addr = interface_address;
+    struct in_addr interface = {.s_addr = interface_address};
+
+    if (bind(sock, (struct sockaddr *)&address, sizeof(address)) != 0
+        || setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0
+        || setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &interface, sizeof(interface)) != 0)
+    {
+        ESP_LOGE(TAG, "Unable to join route sharing group: Error number %d", errno);
+        close(sock);
+        return -1;
+    }
+
+    // Looped back as well, for other boxes on the same host - our own are dropped by sender id
+    uint8_t ttl = ROUTE_SHARE_TTL;
+    uint8_t loop = 1;
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    ESP_LOGI(TAG, "Sharing routes on %s:%d", ROUTE_SHARE_GROUP, ROUTE_SHARE_PORT);
+    return sock;
+}
+
+static void route_share_task(void)
+{
+    int sock = -1;
+    unsigned int joined_generation = 0;
+
+    while (1)
+    {
+        unsigned int generation = atomic_load(&share_address_generation);
+        if (generation != joined_generation)
+        {
+            // New address - join on it, and ask about every router we aren't hearing ourselves
+            if (sock >= 0)
+            {
+                close(sock);
+            }
+            joined_generation = generation;
+            sock = open_share_socket(atomic_load(&share_address));
+
+            xSemaphoreTake(share_mutex, portMAX_DELAY);
+            for (uint8_t router = 0; router < shared_router_count; router++)
+            {
+                shared_routers[router].request_due = !shared_routers[router].live;
+            }
+            xSemaphoreGive(share_mutex);
+        }
+
+        if (sock >= 0)
+        {
+            int length;
+            while ((length = recv(sock, recv_datagram, sizeof(recv_datagram), 0)) >= 0)
+            {
+                handle_datagram(length);
+            }
+            send_due(sock);
+        }
+
+        // Sleep until a datagram arrives, the main logic has something to send, or the address changes
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(share_wake_fd, &read_fds);
+        if (sock >= 0)
+        {
+            FD_SET(sock, &read_fds);
+        }
+        int max_fd = (sock > share_wake_fd) ? sock : share_wake_fd;
+
+        if (select(max_fd + 1, &read_fds, NULL, NULL, NULL) > 0 && FD_ISSET(share_wake_fd, &read_fds))
+        {
+            uint64_t wake_count;
+            read(share_wake_fd, &wake_count, sizeof(wake_count));
+        }
+    }
+}
+
+static void share_address_changed(uint32_t address)
+{
+    atomic_store(&share_address, address);
+    atomic_fetch_add(&share_address_generation, 1);
+    wake_share_task();
+}
+
+// Event handler for IP_EVENT_ETH_GOT_IP
+static void share_got_ip_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
+{
+    ip_event_got_ip_t* event = (ip_event_got_ip_t *) event_data;
+    share_address_changed(event->ip_info.ip.addr);
+}
+
+void setup_route_share(const struct Settings_Struct *settings, QueueHandle_t *input_queue)
+{
+    input_event_queue_ptr = input_queue;
+    sender_id = esp_random();
+
+    share_mutex = create_static_mutex("route share", &share_mutex_buffer);
+    share_wake_fd = eventfd(0, 0);
+    if (share_wake_fd < 0)
+    {
+        ESP_LOGE(TAG,"Unable to set up route sharing, rebooting");
+        esp_restart();
+    }
+
+    for (uint8_t router = 0; router < settings->router_count && router < ROUTERS_MAX; router++)
+    {
+        struct Shared_Router_Struct *shared = &shared_routers[router];
+        shared->ip = settings->routers[router].ip;
+        shared->port = settings->routers[router].port;
+        for (uint16_t output = 0; output < ROUTER_OUTPUTS_MAX; output++)
+        {
+            shared->table[output] = ROUTER_INPUT_UNKNOWN;
+        }
+    }
+    shared_router_count = (settings->router_count > ROUTERS_MAX) ? ROUTERS_MAX : settings->router_count;
+
+    // Below the router tasks - a route never waits on a peer
+    create_static_task((TaskFunction_t)route_share_task, "route_share_task", ROUTE_SHARE_TASK_STACK, share_task_stack, &share_task_buffer, NULL, 4);
+
+    // The address may already have come in before we were listening for it
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_ETH_GOT_IP, &share_got_ip_handler, NULL));
+    uint32_t address = get_ethernet_address();
+    if (address != 0)
+    {
+        share_address_changed(address);
+    }
+}
+
+void route_share_publish(uint8_t router, uint16_t output, uint16_t input)
+{
+    if (router >= shared_router_count || output >= ROUTER_OUTPUTS_MAX)
+    {
+        return;
+    }
+    struct Shared_Router_Struct *shared = &shared_routers[router];
+
+    xSemaphoreTake(share_mutex, portMAX_DELAY);
+    uint8_t changed = shared->live && shared->table[output] != input;
+    if (changed)
+    {
+        shared->table[output] = input;
+        bit_set(shared->unsent, output);
+    }
+    xSemaphoreGive(share_mutex);
+
+    if (changed)
+    {
+        wake_share_task();
+    }
+}
+
+void route_share_router_live(uint8_t router, uint8_t live)
+{
+    if (router >= shared_router_count)
+    {
+        return;
+    }
+    struct Shared_Router_Struct *shared = &shared_routers[router];
+    uint8_t wake = 0;
+
+    xSemaphoreTake(share_mutex, portMAX_DELAY);
+    if (live && !shared->live)
+    {
+        // Router's own routes from now on - anything from peers still waiting is stale
+        shared->live = 1;
+        memset(shared->staged_changed, 0, sizeof(shared->staged_changed));
+    }
+    else if (!live && shared->live)
+    {
+        // Our table is no use to anyone now - ask the peers for theirs
+        shared->live = 0;
+        for (uint16_t output = 0; output < ROUTER_OUTPUTS_MAX; output++)
+        {
+            shared->table[output] = ROUTER_INPUT_UNKNOWN;
+        }
+        memset(shared->unsent, 0, sizeof(shared->unsent));
+        shared->table_asked = 0;
+        shared->request_due = 1;
+        wake = 1;
+    }
+    xSemaphoreGive(share_mutex);
+
+    if (wake)
+    {
+        wake_share_task();
+    }
+}
+
+uint16_t route_share_take(uint8_t router, struct Router_State_Struct *state)
+{
+    if (router >= shared_router_count)
+    {
+        return 0;
+    }
+    struct Shared_Router_Struct *shared = &shared_routers[router];
+    uint16_t changed = 0;
+
+    xSemaphoreTake(share_mutex, portMAX_DELAY);
+    for (uint16_t output = 0; output < ROUTER_OUTPUTS_MAX; output++)
+    {
+        if (bit_take(shared->staged_changed, output) && state != NULL && router_state_set_route(state, output, shared->staged[output]))
+        {
+            changed++;
+        }
+    }
+    shared->staged_posted = 0;
+    share_stats.routes_learned += changed;
+    xSemaphoreGive(share_mutex);
+
+    return changed;
+}
+
+void route_share_get_stats(struct Route_Share_Stats_Struct *stats)
+{
+    if (share_mutex == NULL)
+    {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    xSemaphoreTake(share_mutex, portMAX_DELAY);
+    *stats = share_stats;
+    xSemaphoreGive(share_mutex);
+}
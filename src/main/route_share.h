@@ -0,0 +1,67 @@
+// Route sharing between boxes
+//-----------------------------------
+// Every box holds its own session to the router, and a Videohub only takes a few clients. Each
+// box publishes the routing changes its routers confirm as compact binary deltas on a UDP
+// multicast group, and answers a box that asks with its whole table - so a box that has just
+// booted, or can't get a session of its own, lights the right buttons from its peers within
+// milliseconds instead of waiting for a status dump.
+// The router stays the authority: routes from peers are only taken while a box isn't hearing
+// from that router itself, and are never passed on to other boxes. Routers are matched between
+// boxes by IP address and port, so their numbering in each config doesn't matter.
+
+#ifndef ROUTE_SHARE_H_INCLUDED
+#define ROUTE_SHARE_H_INCLUDED
+
+#include <stdint.h>
+
+#include "storage.h"
+#include "router_state.h"
+
+// Administratively scoped group, and a TTL that keeps it on the local network
+#define ROUTE_SHARE_GROUP "239.255.90.90"
+#define ROUTE_SHARE_PORT 9992
+#define ROUTE_SHARE_TTL 1
+
+// Datagrams - all fields big endian
+//   magic "VR", version, type, sender id (4), sequence (2), router IP (4), router port (2),
+//   route count (2), then count pairs of zero based output (2) and input (2)
+// Sender ids are random at each boot, so a box never takes its own datagrams back in
+#define ROUTE_SHARE_VERSION 1
+#define ROUTE_SHARE_MSG_DELTA 0   // Routes the sender's router has just confirmed
+#define ROUTE_SHARE_MSG_TABLE 1   // Every route the sender knows, answering a request
+#define ROUTE_SHARE_MSG_REQUEST 2 // Asking anyone hearing the router for its table (no routes)
+#define ROUTE_SHARE_HEADER_SIZE 18
+#define ROUTE_SHARE_DATAGRAM_SIZE (ROUTE_SHARE_HEADER_SIZE + ROUTER_OUTPUTS_MAX * 4) // A whole table fits one Ethernet frame
+
+// Other boxes whose sequence numbers are tracked, to drop datagrams arriving out of order
+#define ROUTE_SHARE_PEERS_MAX 8
+
+#define ROUTE_SHARE_TASK_STACK 4096 // Bytes - the datagrams themselves are static, not on the stack
+
+struct Route_Share_Stats_Struct {
+    uint32_t datagrams_sent;
+    uint32_t datagrams_received; // From other boxes, about one of our routers
+    uint32_t tables_sent;        // Requests answered
+    uint32_t routes_learned;     // Routes from peers that changed the main logic's mirror
+    uint32_t dropped;            // Malformed, another version, or out of order
+};
+
+// Starts the sharing task - needs the event loop, so call after setup_ethernet
+// The main logic gets IN_MSG_TYP_PEER_ROUTES when routes from peers are waiting for a router
+void setup_route_share(const struct Settings_Struct *settings, QueueHandle_t *input_queue);
+
+// Main logic side - routers are zero based, as in Settings_Struct
+// A routing confirm from the router itself - published to peers if it is a change
+void route_share_publish(uint8_t router, uint16_t output, uint16_t input);
+
+// Whether the main logic is hearing from the router directly - while it is, requests for the
+// router are answered and peer routes ignored; when it stops, peers are asked for their tables
+void route_share_router_live(uint8_t router, uint8_t live);
+
+// Takes the peer routes waiting for a router into the mirror (or throws them away if state is
+// NULL) - returns how many changed it
+uint16_t route_share_take(uint8_t router, struct Router_State_Struct *state);
+
+void route_share_get_stats(struct Route_Share_Stats_Struct *stats);
+
+#endif
@@ -0,0 +1,319 @@
+// Last confirmed routes
+//-----------------------------------
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include "route_store.h"
+#include "router_state.h"
+#include "ram_budget.h"
+
+// Logging tag
+static const char *TAG = "route_store";
+
+// One route per panel, with the router and output it was confirmed on, so it is only ever
+// restored onto the same destination - whatever the config has done to the panels since
+struct Stored_Route_Struct {
+    uint32_t router_ip;
+    uint32_t router_port;
+    uint16_t output; // Zero based
+    uint16_t input;  // Zero based, ROUTER_INPUT_UNKNOWN if the router hasn't confirmed one
+};
+
+// What goes in flash
+struct Route_Store_Blob_Struct {
+    uint16_t version; // ROUTE_STORE_VERSION
+    uint16_t count;
+    struct Stored_Route_Struct routes[PANELS_MAX];
+};
+
+// Only used by the main logic
+static uint16_t restored_input[PANELS_MAX];
+static uint8_t provisional[PANELS_MAX];
+
+static StaticSemaphore_t store_mutex_buffer;
+static SemaphoreHandle_t store_mutex; // Protects:
+static struct Route_Store_Blob_Struct current; // Routes as the router last confirmed them
+static uint8_t dirty = 0;                      // current has changed since it was last written
+static int64_t first_change_time;              // Oldest change not yet written
+static int64_t last_change_time;
+static struct Route_Store_Stats_Struct store_stats;
+
+// Only used by the store task once it is running
+static struct Route_Store_Blob_Struct written; // What flash holds
+static TaskHandle_t store_task_handle;
+static StackType_t store_task_stack[ROUTE_STORE_TASK_STACK];
+static StaticTask_t store_task_buffer;
+
+static uint8_t load_routes(struct Route_Store_Blob_Struct *blob)
+{
+    nvs_handle_t handle;
+    if (nvs_open(ROUTE_STORE_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+    {
+        return 0;
+    }
+    size_t length = sizeof(*blob);
+    esp_err_t ret = nvs_get_blob(handle, ROUTE_STORE_NVS_KEY, blob, &length);
+    nvs_close(handle);
+
+    if (ret == ESP_ERR_NVS_NOT_FOUND)
+    {
+        return 0;
+    }
+    if (ret != ESP_OK || length != sizeof(*blob) || blob->version != ROUTE_STORE_VERSION || blob->count > PANELS_MAX)
+    {
+        ESP_LOGW(TAG, "Stored routes are from another firmware version, ignoring them");
+        return 0;
+    }
+    return 1;
+}
+
+static uint8_t write_routes(const struct Route_Store_Blob_Struct *blob)
+{
+    nvs_handle_t handle;
+    esp_err_t ret = nvs_open(ROUTE_STORE_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (ret == ESP_OK)
+    {
+        ret = nvs_set_blob(handle, ROUTE_STORE_NVS_KEY, blob, sizeof(*blob));
+        if (ret == ESP_OK)
+        {
+            ret = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (ret != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to store routes (%s)", esp_err_to_name(ret));
+        return 0;
+    }
+    return 1;
+}
+
+// Sets up the table for the panels' destinations, with no routes known
+static void set_route_keys(const struct Settings_Struct *settings)
+{
+    memset(&current, 0, sizeof(current));
+    current.version = ROUTE_STORE_VERSION;
+    current.count = PANELS_MAX;
+    for (uint8_t panel = 0; panel < PANELS_MAX; panel++)
+    {
+        struct Stored_Route_Struct *route = &current.routes[panel];
+        const struct Panel_Settings_Struct *panel_settings = &settings->panels[panel];
+        if (panel < settings->panel_count && panel_settings->routing_destination != 0 && panel_settings->router < settings->router_count)
+        {
+            route->router_ip = settings->routers[panel_settings->router].ip;
+            route->router_port = settings->routers[panel_settings->router].port;
+            route->output = panel_settings->routing_destination - 1;
+        }
+        route->input = ROUTER_INPUT_UNKNOWN;
+        restored_input[panel] = ROUTER_INPUT_UNKNOWN;
+        provisional[panel] = 0;
+    }
+}
+
+// Writes the routes once they are due - sleeps until then, or until they next change
+static void route_store_task(void)
+{
+    int64_t last_write_time = -(ROUTE_STORE_WRITE_INTERVAL_MS * 1000LL); // The first write isn't held back
+    TickType_t wait = portMAX_DELAY;
+
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, wait);
+        wait = portMAX_DELAY;
+
+        xSemaphoreTake(store_mutex, portMAX_DELAY);
+        if (!dirty)
+        {
+            xSemaphoreGive(store_mutex);
+            continue;
+        }
+
+        // Quiet for the settle time, or changing for a whole interval - and not written for an interval
+        int64_t now = esp_timer_get_time();
+        int64_t due = last_change_time + ROUTE_STORE_SETTLE_MS * 1000LL;
+        if (due > first_change_time + ROUTE_STORE_WRITE_INTERVAL_MS * 1000LL)
+        {
+            due = first_change_time + ROUTE_STORE_WRITE_INTERVAL_MS * 1000LL;
+        }
+        if (due < last_write_time + ROUTE_STORE_WRITE_INTERVAL_MS * 1000LL)
+        {
+            due = last_write_time + ROUTE_STORE_WRITE_INTERVAL_MS * 1000LL;
+        }
+        if (now < due)
+        {
+            xSemaphoreGive(store_mutex);
+            wait = pdMS_TO_TICKS((due - now + 999) / 1000) + 1;
+            continue;
+        }
+        struct Route_Store_Blob_Struct blob = current;
+        dirty = 0;
+        xSemaphoreGive(store_mutex);
+
+        if (memcmp(&blob, &written, sizeof(blob)) == 0)
+        {
+            continue; // Changed and changed back
+        }
+        last_write_time = now;
+        if (write_routes(&blob))
+        {
+            written = blob;
+            xSemaphoreTake(store_mutex, portMAX_DELAY);
+            store_stats.writes++;
+            xSemaphoreGive(store_mutex);
+        }
+        else
+        {
+            // Still to be written - try again an interval on, with whatever has changed by then
+            xSemaphoreTake(store_mutex, portMAX_DELAY);
+            dirty = 1;
+            xSemaphoreGive(store_mutex);
+            wait = pdMS_TO_TICKS(ROUTE_STORE_WRITE_INTERVAL_MS);
+        }
+    }
+}
+
+void setup_route_store(const struct Settings_Struct *settings)
+{
+    store_mutex = create_static_mutex("route store", &store_mutex_buffer);
+
+    set_route_keys(settings);
+
+    // Whatever flash holds for the same router and destination
+    memset(&written, 0, sizeof(written));
+    struct Route_Store_Blob_Struct stored;
+    if (load_routes(&stored))
+    {
+        written = stored;
+        for (uint8_t panel = 0; panel < PANELS_MAX; panel++)
+        {
+            struct Stored_Route_Struct *route = &current.routes[panel];
+            for (uint8_t index = 0; index < stored.count && route->router_ip != 0; index++)
+            {
+                const struct Stored_Route_Struct *old = &stored.routes[index];
+                if (old->router_ip == route->router_ip && old->router_port == route->router_port && old->output == route->output
+                    && old->input < ROUTER_INPUTS_MAX)
+                {
+                    route->input = old->input;
+                    restored_input[panel] = old->input;
+                    provisional[panel] = 1;
+                    store_stats.restored++;
+                    break;
+                }
+            }
+        }
+        ESP_LOGI(TAG, "Restored routes for %u panels", store_stats.restored);
+    }
+
+    store_task_handle = create_static_task((TaskFunction_t)route_store_task, "route_store_task", ROUTE_STORE_TASK_STACK, store_task_stack,
+                                           &store_task_buffer, NULL, 1);
+}
+
+void route_store_reload(const struct Settings_Struct *settings)
+{
+    xSemaphoreTake(store_mutex, portMAX_DELAY);
+    struct Route_Store_Blob_Struct old = current;
+    uint16_t old_restored[PANELS_MAX];
+    uint8_t old_provisional[PANELS_MAX];
+    memcpy(old_restored, restored_input, sizeof(old_restored));
+    memcpy(old_provisional, provisional, sizeof(old_provisional));
+
+    // Routes move with their destination, whichever panel it is on now
+    set_route_keys(settings);
+    for (uint8_t panel = 0; panel < PANELS_MAX; panel++)
+    {
+        struct Stored_Route_Struct *route = &current.routes[panel];
+        for (uint8_t index = 0; index < PANELS_MAX && route->router_ip != 0; index++)
+        {
+            if (old.routes[index].router_ip == route->router_ip && old.routes[index].router_port == route->router_port
+                && old.routes[index].output == route->output)
+            {
+                route->input = old.routes[index].input;
+                restored_input[panel] = old_restored[index];
+                provisional[panel] = old_provisional[index];
+                break;
+            }
+        }
+    }
+
+    uint8_t changed = (memcmp(&current, &old, sizeof(current)) != 0);
+    if (changed)
+    {
+        int64_t now = esp_timer_get_time();
+        if (!dirty)
+        {
+            first_change_time = now;
+        }
+        last_change_time = now;
+        dirty = 1;
+    }
+    xSemaphoreGive(store_mutex);
+
+    if (changed)
+    {
+        xTaskNotifyGive(store_task_handle);
+    }
+}
+
+uint16_t route_store_restored(uint8_t panel)
+{
+    return (panel < PANELS_MAX) ? restored_input[panel] : ROUTER_INPUT_UNKNOWN;
+}
+
+uint8_t route_store_provisional(uint8_t panel)
+{
+    return (panel < PANELS_MAX) ? provisional[panel] : 0;
+}
+
+void route_store_update(uint8_t panel, uint16_t input)
+{
+    if (panel >= PANELS_MAX || current.routes[panel].router_ip == 0)
+    {
+        return;
+    }
+
+    xSemaphoreTake(store_mutex, portMAX_DELAY);
+    if (provisional[panel])
+    {
+        provisional[panel] = 0;
+        store_stats.reconciled++;
+        if (input != restored_input[panel])
+        {
+            store_stats.differed++;
+        }
+    }
+
+    uint8_t changed = (current.routes[panel].input != input);
+    if (changed)
+    {
+        int64_t now = esp_timer_get_time();
+        current.routes[panel].input = input;
+        store_stats.changes++;
+        if (!dirty)
+        {
+            first_change_time = now;
+        }
+        last_change_time = now;
+        dirty = 1;
+    }
+    xSemaphoreGive(store_mutex);
+
+    if (changed)
+    {
+        xTaskNotifyGive(store_task_handle);
+    }
+}
+
+void route_store_get_stats(struct Route_Store_Stats_Struct *stats)
+{
+    xSemaphoreTake(store_mutex, portMAX_DELAY);
+    *stats = store_stats;
+    xSemaphoreGive(store_mutex);
+}
@@ -0,0 +1,54 @@
+// Last confirmed routes
+//-----------------------------------
+// Keeps the input the router last confirmed on each panel's destination in NVS, so a box coming
+// back from a power cut lights its buttons within milliseconds of booting instead of waiting for
+// the network. Restored routes are provisional: they go into the main logic's mirror of a router
+// that isn't live yet, so they are never trusted to skip a route command, and the router's own
+// state (or routes shared by other boxes) replaces them as soon as it arrives.
+// Flash is written from a low priority task, not per change: once the routes have been quiet for
+// ROUTE_STORE_SETTLE_MS, at most once per ROUTE_STORE_WRITE_INTERVAL_MS however busy the panels
+// are, and only if they differ from what flash already holds.
+
+#ifndef ROUTE_STORE_H_INCLUDED
+#define ROUTE_STORE_H_INCLUDED
+
+#include <stdint.h>
+
+#include "storage.h"
+
+#define ROUTE_STORE_SETTLE_MS 1000
+#define ROUTE_STORE_WRITE_INTERVAL_MS 10000
+#define ROUTE_STORE_TASK_STACK 4096 // Bytes - holds a copy of the routes, and NVS calls need plenty
+
+// Bump the version whenever the stored layout changes
+#define ROUTE_STORE_VERSION 1
+#define ROUTE_STORE_NVS_NAMESPACE "routes"
+#define ROUTE_STORE_NVS_KEY "last"
+
+struct Route_Store_Stats_Struct {
+    uint32_t changes;    // Confirms that changed a stored route
+    uint32_t writes;     // Times the routes were written to flash
+    uint8_t restored;    // Panels lit from flash at boot
+    uint8_t reconciled;  // Of those, panels the router has since confirmed
+    uint8_t differed;    // Of those, panels whose route had changed while the box was off
+};
+
+// Reads the stored routes and starts the writer task - call with NVS initialised
+void setup_route_store(const struct Settings_Struct *settings);
+
+// Settings reloaded - routes follow their destinations to whichever panels now have them - main logic only
+void route_store_reload(const struct Settings_Struct *settings);
+
+// Input stored for a panel's destination (zero based), ROUTER_INPUT_UNKNOWN if there is none or
+// the panel's router or destination has changed since
+uint16_t route_store_restored(uint8_t panel);
+
+// 1 while a panel is showing a restored route the router hasn't confirmed yet
+uint8_t route_store_provisional(uint8_t panel);
+
+// The router confirmed a route on a panel's destination (zero based input) - main logic only
+void route_store_update(uint8_t panel, uint16_t input);
+
+void route_store_get_stats(struct Route_Store_Stats_Struct *stats);
+
+#endif
@@ -0,0 +1,41 @@
+// Router state mirror
+//-----------------------------------
+
+#include "router_state.h"
+
+void router_state_clear(struct Router_State_Struct *state)
+{
+    for (uint16_t output = 0; output < ROUTER_OUTPUTS_MAX; output++)
+    {
+        state->route[output] = ROUTER_INPUT_UNKNOWN;
+    }
+    state->known_routes = 0;
+}
+
+// Records a routing confirm - returns 1 if it changed the table
+uint8_t router_state_set_route(struct Router_State_Struct *state, uint16_t output, uint16_t input)
+{
+    if (output >= ROUTER_OUTPUTS_MAX || input >= ROUTER_INPUTS_MAX)
+    {
+        return 0;
+    }
+    if (state->route[output] == input)
+    {
+        return 0;
+    }
+    if (state->route[output] == ROUTER_INPUT_UNKNOWN)
+    {
+        state->known_routes++;
+    }
+    state->route[output] = input;
+    return 1;
+}
+
+uint16_t router_state_get_route(const struct Router_State_Struct *state, uint16_t output)
+{
+    if (output >= ROUTER_OUTPUTS_MAX)
+    {
+        return ROUTER_INPUT_UNKNOWN;
+    }
+    return state->route[output];
+}
@@ -0,0 +1,28 @@
+// Router state mirror
+//-----------------------------------
+// Copy of the router's whole crosspoint table (output -> input), filled from the status dump
+// sent on every connect and kept current from routing confirms. Only touched by the main logic
+// task, so needs no locking.
+
+#ifndef ROUTER_STATE_H_INCLUDED
+#define ROUTER_STATE_H_INCLUDED
+
+#include <stdint.h>
+
+// Largest router supported (Universal Videohub 288)
+#define ROUTER_OUTPUTS_MAX 288
+#define ROUTER_INPUTS_MAX 288
+
+// Route not known yet (not connected, or dump not received)
+#define ROUTER_INPUT_UNKNOWN 0xFFFF
+
+struct Router_State_Struct {
+    uint16_t route[ROUTER_OUTPUTS_MAX]; // Zero based input for each zero based output
+    uint16_t known_routes; // Number of outputs with a known input
+};
+
+void router_state_clear(struct Router_State_Struct *state);
+uint8_t router_state_set_route(struct Router_State_Struct *state, uint16_t output, uint16_t input);
+uint16_t router_state_get_route(const struct Router_State_Struct *state, uint16_t output);
+
+#endif
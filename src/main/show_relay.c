@@ -0,0 +1,245 @@
+// Show Relay
+//-----------------------------------
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+
+#include "show_relay.h"
+#include "ethernet.h"
+#include "local_io.h"
+#include "latency.h"
+#include "trace.h"
+
+static const char *TAG = "show_relay";
+
+static const struct Settings_Struct *relay_settings;
+
+static uint8_t relay_ir = 0;          // Camera the router has confirmed - 1 for IR, 0 for Main
+static uint8_t relay_switching = 0;   // 1 while a salvo is waiting for its ACK/NAK
+static uint8_t relay_followers = 0;   // Bit per panel showing the relay on its destination
+
+// The last salvo sent, for timing its confirms (zero based)
+static uint16_t salvo_input;
+static uint16_t salvo_outputs[SHOW_RELAY_SALVO_MAX];
+static uint8_t salvo_output_count = 0;
+static uint8_t salvo_confirmed[SHOW_RELAY_SALVO_MAX];
+static uint8_t salvo_confirm_count = 0;
+static int64_t salvo_first_confirm_time;
+
+static uint16_t camera_source(uint8_t ir)
+{
+    return ir ? relay_settings->show_relay_ir_source : relay_settings->show_relay_main_source;
+}
+
+static void add_salvo_output(uint16_t output)
+{
+    for (uint8_t existing = 0; existing < salvo_output_count; existing++)
+    {
+        if (salvo_outputs[existing] == output)
+        {
+            return;
+        }
+    }
+    salvo_outputs[salvo_output_count++] = output;
+}
+
+void show_relay_setup(const struct Settings_Struct *settings)
+{
+    relay_settings = settings;
+    relay_ir = 0;
+    relay_switching = 0;
+    relay_followers = 0;
+    salvo_output_count = 0;
+    set_ir_contactor_state(0);
+}
+
+void show_relay_reload(const struct Settings_Struct *settings)
+{
+    relay_settings = settings;
+
+    // A salvo in flight and the contactor carry on as they were - panels only keep following
+    // if they still have a relay button
+    for (uint8_t panel = 0; panel < PANELS_MAX; panel++)
+    {
+        uint8_t has_relay_button = 0;
+        for (uint8_t button = 0; panel < settings->panel_count && button < settings->panels[panel].button_count; button++)
+        {
+            has_relay_button |= (settings->panels[panel].routing_sources[button] == SOURCE_SHOW_RELAY);
+        }
+        if (!has_relay_button)
+        {
+            relay_followers &= ~(1 << panel);
+        }
+    }
+}
+
+uint8_t show_relay_configured(void)
+{
+    return relay_settings->show_relay_main_source != 0 && relay_settings->show_relay_ir_source != 0;
+}
+
+uint16_t show_relay_current_input(void)
+{
+    return camera_source(relay_switching ? !relay_ir : relay_ir);
+}
+
+void show_relay_follow(uint8_t panel, uint8_t following)
+{
+    if (following)
+    {
+        relay_followers |= (1 << panel);
+    }
+    else
+    {
+        relay_followers &= ~(1 << panel);
+    }
+}
+
+void show_relay_toggle(int64_t press_time)
+{
+    if (!show_relay_configured())
+    {
+        ESP_LOGW(TAG, "Show Relay button pressed but no cameras set up");
+        return;
+    }
+    if (relay_switching)
+    {
+        ESP_LOGW(TAG, "Show Relay still switching, press ignored");
+        return;
+    }
+
+    // Every output goes in one salvo - decrement from physical 1-288 numbering to zero index
+    salvo_input = camera_source(!relay_ir) - 1;
+    salvo_output_count = 0;
+    for (uint8_t output = 0; output < relay_settings->show_relay_output_count; output++)
+    {
+        if (relay_settings->show_relay_outputs[output] != 0)
+        {
+            add_salvo_output(relay_settings->show_relay_outputs[output] - 1);
+        }
+    }
+    for (uint8_t panel = 0; panel < relay_settings->panel_count; panel++)
+    {
+        if ((relay_followers & (1 << panel)) && relay_settings->panels[panel].routing_destination != 0
+            && relay_settings->panels[panel].router == relay_settings->show_relay_router)
+        {
+            add_salvo_output(relay_settings->panels[panel].routing_destination - 1);
+        }
+    }
+    if (salvo_output_count == 0)
+    {
+        ESP_LOGW(TAG, "Show Relay has no outputs set up");
+        return;
+    }
+
+    for (uint8_t output = 0; output < salvo_output_count; output++)
+    {
+        salvo_confirmed[output] = 0;
+    }
+    salvo_confirm_count = 0;
+
+    if (!send_video_salvo(relay_settings->show_relay_router, salvo_input, salvo_outputs, salvo_output_count, press_time))
+    {
+        salvo_output_count = 0;
+        return;
+    }
+    relay_switching = 1;
+    ESP_LOGI(TAG, "Switching Show Relay to %s camera, %u outputs", relay_ir ? "Main" : "IR", salvo_output_count);
+}
+
+void show_relay_salvo_acked(uint8_t router)
+{
+    if (router != relay_settings->show_relay_router || !relay_switching)
+    {
+        return; // Sent before a reconnect - the confirms will bring the contactor into step
+    }
+    relay_switching = 0;
+    relay_ir = !relay_ir;
+
+    // Floodlights follow the router, not the button - on for IR, off for Main
+    set_ir_contactor_state(relay_ir);
+    trace_record(TRACE_EVT_SHOW_RELAY, relay_ir, relay_ir, 0);
+}
+
+void show_relay_salvo_failed(uint8_t router)
+{
+    if (router != relay_settings->show_relay_router)
+    {
+        return;
+    }
+    if (relay_switching)
+    {
+        ESP_LOGW(TAG, "Show Relay switch to %s camera failed, staying on %s", relay_ir ? "Main" : "IR", relay_ir ? "IR" : "Main");
+    }
+    relay_switching = 0;
+    salvo_output_count = 0;
+}
+
+void show_relay_connection_reset(uint8_t router)
+{
+    if (router != relay_settings->show_relay_router)
+    {
+        return;
+    }
+
+    // Whatever was in flight is lost with the connection
+    relay_switching = 0;
+    salvo_output_count = 0;
+}
+
+void show_relay_confirm(uint8_t router, uint16_t output, uint16_t input, int64_t now)
+{
+    if (router != relay_settings->show_relay_router || relay_settings->show_relay_output_count == 0 || !show_relay_configured())
+    {
+        return;
+    }
+
+    // Time from the first to the last output of the salvo landing
+    if (salvo_confirm_count < salvo_output_count && input == salvo_input)
+    {
+        for (uint8_t index = 0; index < salvo_output_count; index++)
+        {
+            if (salvo_outputs[index] == output && !salvo_confirmed[index])
+            {
+                salvo_confirmed[index] = 1;
+                if (salvo_confirm_count++ == 0)
+                {
+                    salvo_first_confirm_time = now;
+                }
+                if (salvo_confirm_count == salvo_output_count)
+                {
+                    latency_record(LAT_STAGE_SALVO_SKEW, now - salvo_first_confirm_time);
+                    ESP_LOGI(TAG, "Show Relay salvo of %u outputs landed, skew %lld us", salvo_output_count, (long long)(now - salvo_first_confirm_time));
+                }
+                break;
+            }
+        }
+    }
+
+    // The first show relay output says which camera the router has - picks the contactor up
+    // at connect, and after anything switched it from elsewhere
+    if (!relay_switching && output == relay_settings->show_relay_outputs[0] - 1)
+    {
+        uint8_t ir;
+        if (input == relay_settings->show_relay_ir_source - 1)
+        {
+            ir = 1;
+        }
+        else if (input == relay_settings->show_relay_main_source - 1)
+        {
+            ir = 0;
+        }
+        else
+        {
+            return;
+        }
+        if (ir != relay_ir)
+        {
+            relay_ir = ir;
+            set_ir_contactor_state(relay_ir);
+            trace_record(TRACE_EVT_SHOW_RELAY, relay_ir, relay_ir, 1);
+        }
+    }
+}
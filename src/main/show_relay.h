@@ -0,0 +1,45 @@
+// Show Relay
+//-----------------------------------
+// Switches the show relay outputs around the building between the Main and IR cameras as one
+// salvo, so every screen changes together, and drives the IR floodlight contactor once the router
+// has ACKed the switch. Panel buttons set up with the 'relay' source follow it too.
+// Only touched by the main logic task, so needs no locking.
+
+#ifndef SHOW_RELAY_H_INCLUDED
+#define SHOW_RELAY_H_INCLUDED
+
+#include <stdint.h>
+
+#include "storage.h"
+
+// Outputs a salvo can carry - the show relay outputs plus a follower on every panel
+#define SHOW_RELAY_SALVO_MAX (SHOW_RELAY_OUTPUTS_MAX + PANELS_MAX)
+
+void show_relay_setup(const struct Settings_Struct *settings);
+
+// Settings reloaded without a restart - takes them on without dropping a switch in progress
+void show_relay_reload(const struct Settings_Struct *settings);
+
+// 1 if the config sets up a Show Relay
+uint8_t show_relay_configured(void);
+
+// Camera the relay is on (or switching to), labeled 1-288
+uint16_t show_relay_current_input(void);
+
+// A panel's relay button has been pressed (following) or another of its buttons (not following)
+void show_relay_follow(uint8_t panel, uint8_t following);
+
+// Main/IR button pressed - sends the salvo for the other camera to the Show Relay's router
+void show_relay_toggle(int64_t press_time);
+
+// Router answered the block carrying the salvo - routers are zero based, and only the Show Relay's
+// own router matters
+void show_relay_salvo_acked(uint8_t router);
+void show_relay_salvo_failed(uint8_t router);
+void show_relay_connection_reset(uint8_t router);
+
+// Routing confirm (zero based output and input) - times the salvo landing and keeps the
+// contactor in step with a switch made elsewhere
+void show_relay_confirm(uint8_t router, uint16_t output, uint16_t input, int64_t now);
+
+#endif
@@ -1,26 +1,73 @@
 // Storage module
 //-----------------------------------
 
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/unistd.h>
 #include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_vfs_fat.h"
+#include "nvs.h"
 #include "driver/sdmmc_host.h"
 #include "sdmmc_cmd.h"
 
+#include "main.h"
 #include "pindefs.h"
 #include "storage.h"
+#include "router_state.h"
+#include "ram_budget.h"
+#include "ethernet.h"
+#include "queue_stats.h"
 
 
 static const char *TAG = "storage";
 sdmmc_card_t *card;
 
+// What NVS holds - the settings as they were after reading a file without errors
+struct Settings_Cache_Struct {
+    uint16_t version;     // SETTINGS_CACHE_VERSION
+    uint16_t size;        // sizeof(struct Settings_Struct)
+    uint64_t source_hash; // Of the config file they were read from
+    struct Settings_Struct settings;
+};
+
+static struct Settings_Cache_Struct settings_cache;
+static struct Settings_Status_Struct settings_status;
+
+// Settings in use - see settings_take. Only the check task writes a copy, and only the one
+// the main logic isn't reading
+static struct Settings_Struct settings_copies[2];
+static atomic_uint_least8_t settings_published = 0; // Copy holding the newest settings
+static atomic_uint_least8_t settings_taken = 0;     // Copy the main logic is reading
+static uint64_t settings_hash;  // Of the file the newest settings came from, 0 for the defaults
+static uint64_t rejected_hash;  // Of the last changed file with errors
+
+static TaskHandle_t settings_check_handle = NULL;
+static StackType_t settings_check_stack[SETTINGS_CHECK_TASK_STACK];
+static StaticTask_t settings_check_buffer;
+static QueueHandle_t *input_event_queue_ptr;
+
+// Whole config file - only one read at a time, at boot or in the card checks after it
+static char config_text[CFG_FILE_SIZE_MAX];
+
+// Outcome of the last mount and file read - the card is checked over and over, so each is only
+// logged when it changes
+static esp_err_t card_result = ESP_ERR_INVALID_STATE;
+static esp_err_t file_result = ESP_ERR_INVALID_STATE;
+static uint8_t card_info_printed = 0;
+
 static esp_err_t init_sd_card(void)
 {
-    ESP_LOGI(TAG, "Initializing SD card - using 1 line SDMMC");
+    ESP_LOGD(TAG, "Initializing SD card - using 1 line SDMMC");
 
     esp_vfs_fat_sdmmc_mount_config_t mount_config = {
         .format_if_mount_failed = false,
@@ -36,20 +83,33 @@ static esp_err_t init_sd_card(void)
     slot_config.width = 1;
 
     esp_err_t ret = esp_vfs_fat_sdmmc_mount(MOUNT_POINT, &host, &slot_config, &mount_config, &card);
+    uint8_t changed = (ret != card_result);
+    card_result = ret;
 
     if (ret != ESP_OK) 
     {
+        if (!changed)
+        {
+            return ESP_FAIL;
+        }
         if (ret == ESP_FAIL) 
         {
             ESP_LOGE(TAG, "Failed to mount filesystem");
         } else {
-            ESP_LOGE(TAG, "Failed to initialize SD card (%s)", esp_err_to_name(ret));
+            ESP_LOGW(TAG, "Failed to initialize SD card (%s) - no card?", esp_err_to_name(ret));
         }
         return ESP_FAIL;
     }
 
-    ESP_LOGI(TAG, "SD card mounted");
-    sdmmc_card_print_info(stdout, card);
+    if (changed)
+    {
+        ESP_LOGI(TAG, "SD card mounted");
+    }
+    if (!card_info_printed)
+    {
+        sdmmc_card_print_info(stdout, card);
+        card_info_printed = 1;
+    }
     return ESP_OK;
 
 }
@@ -67,173 +127,803 @@ static void deinit_sd_card(void)
         }
         return;
     }
-    ESP_LOGI(TAG, "SD card unmounted");
+    ESP_LOGD(TAG, "SD card unmounted");
 }
 
-static esp_err_t read_config_file(const char *path, struct Settings_Struct *settings)
+// Config file parser
+// Lines are "name = value", "//" comments or blank. Anything else is an error, reported with
+// its line and column, and the line is ignored - the rest of the file still counts.
+
+struct Config_Parser_Struct {
+    const char *line_start;
+    uint16_t line;
+    uint16_t errors;
+};
+
+typedef uint8_t (*Config_Value_Function)(struct Config_Parser_Struct *parser, const char **cursor, const char *end, uint8_t index, struct Settings_Struct *settings);
+
+struct Config_Key_Struct {
+    const char *name;
+    uint8_t count; // Numbered copies - "name" or "name_1" is the first, "name_2" the second and so on
+    Config_Value_Function read_value;
+};
+
+static void config_error(struct Config_Parser_Struct *parser, const char *at, const char *format, ...)
 {
-    ESP_LOGI(TAG, "Reading file %s", path);
-    FILE *f = fopen(path, "r");
-    if (f == NULL) {
-        ESP_LOGE(TAG, "Failed to open settings file for reading");
-        return ESP_FAIL;
+    char message[96];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    ESP_LOGE(TAG, "%s line %u column %u: %s", CFG_FILE + 1, parser->line, (unsigned)(at - parser->line_start) + 1, message);
+    parser->errors++;
+}
+
+static void skip_spaces(const char **cursor, const char *end)
+{
+    while (*cursor < end && (**cursor == ' ' || **cursor == '\t' || **cursor == '\r'))
+    {
+        (*cursor)++;
+    }
+}
+
+static uint8_t is_name_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Checks nothing but spaces is left after a value
+static uint8_t config_value_end(struct Config_Parser_Struct *parser, const char **cursor, const char *end)
+{
+    skip_spaces(cursor, end);
+    if (*cursor < end)
+    {
+        config_error(parser, *cursor, "unexpected '%c' after value", **cursor);
+        return 0;
     }
+    return 1;
+}
 
-    char line[MAX_CHAR_SIZE];
+static uint8_t config_number(struct Config_Parser_Struct *parser, const char **cursor, const char *end, uint32_t min, uint32_t max, uint32_t *value)
+{
+    skip_spaces(cursor, end);
+    const char *start = *cursor;
+    uint32_t number = 0;
+    while (*cursor < end && **cursor >= '0' && **cursor <= '9')
+    {
+        if (number <= max)
+        {
+            number = number * 10 + (**cursor - '0'); // Stops growing once out of range, so it can't overflow
+        }
+        (*cursor)++;
+    }
+    if (*cursor == start)
+    {
+        config_error(parser, start, "expected a number");
+        return 0;
+    }
+    if (number < min || number > max)
+    {
+        config_error(parser, start, "%.*s is out of range (%"PRIu32"-%"PRIu32")", (int)(*cursor - start), start, min, max);
+        return 0;
+    }
+    *value = number;
+    return 1;
+}
+
+// Takes a word if it comes next, as a whole word
+static uint8_t config_word(const char **cursor, const char *end, const char *word)
+{
+    size_t length = strlen(word);
+    if ((size_t)(end - *cursor) < length || strncmp(*cursor, word, length) != 0
+        || (*cursor + length < end && is_name_char((*cursor)[length])))
+    {
+        return 0;
+    }
+    *cursor += length;
+    return 1;
+}
 
-    while (fgets(line, sizeof(line), f) != NULL)
+// Comma separated list of up to max numbers from 1 to limit - and "relay" if allowed
+static uint8_t config_list(struct Config_Parser_Struct *parser, const char **cursor, const char *end, uint16_t *values, uint8_t max, uint16_t limit, uint8_t allow_relay, uint8_t *count)
+{
+    uint8_t read = 0;
+    while (1)
     {
-        // Strip newline
-        char *pos = strchr(line, '\n');
-        if (pos) 
+        skip_spaces(cursor, end);
+        if (read == max)
         {
-            *pos = '\0';
+            config_error(parser, *cursor, "more than %u values", max);
+            return 0;
         }
 
-        // Ignore comments and blanks
-        if ((strlen(line)>1 && line[0] == '/' && line[1] == '/') || (line[0] == '\0'))
+        uint32_t value;
+        if (allow_relay && config_word(cursor, end, "relay"))
         {
-            continue;
+            values[read++] = SOURCE_SHOW_RELAY;
+        }
+        else if (config_number(parser, cursor, end, 1, limit, &value))
+        {
+            values[read++] = (uint16_t)value;
+        }
+        else
+        {
+            return 0;
         }
 
-        // Now go through the various variables and settings to parse config file
+        skip_spaces(cursor, end);
+        if (*cursor == end || **cursor != ',')
+        {
+            break;
+        }
+        (*cursor)++;
+    }
+    *count = read;
+    return 1;
+}
 
-        ESP_LOGI(TAG, "Read line from file: '%s'", line);
+// Router numbers are 1 based in the file
+static uint8_t config_router(struct Config_Parser_Struct *parser, const char **cursor, const char *end, uint8_t *router)
+{
+    uint32_t value;
+    if (!config_number(parser, cursor, end, 1, ROUTERS_MAX, &value) || !config_value_end(parser, cursor, end))
+    {
+        return 0;
+    }
+    *router = value - 1;
+    return 1;
+}
 
-        char *equalssplit;
-        equalssplit = strtok(line, "="); // First get the variable name before the equals
+// Reads a word from a pair, such as press or release - the first gives 1, the second 0
+static uint8_t config_choice(struct Config_Parser_Struct *parser, const char **cursor, const char *end, const char *first, const char *second, uint8_t *choice)
+{
+    skip_spaces(cursor, end);
+    const char *start = *cursor;
+    uint8_t value;
+    if (config_word(cursor, end, first))
+    {
+        value = 1;
+    }
+    else if (config_word(cursor, end, second))
+    {
+        value = 0;
+    }
+    else
+    {
+        config_error(parser, start, "expected %s or %s", first, second);
+        return 0;
+    }
+    if (!config_value_end(parser, cursor, end))
+    {
+        return 0;
+    }
+    *choice = value;
+    return 1;
+}
 
+static uint8_t read_routing_sources(struct Config_Parser_Struct *parser, const char **cursor, const char *end, uint8_t index, struct Settings_Struct *settings)
+{
+    uint16_t sources[PANEL_BUTTONS_MAX];
+    uint8_t count;
+    if (!config_list(parser, cursor, end, sources, PANEL_BUTTONS_MAX, ROUTER_INPUTS_MAX, 1, &count) || !config_value_end(parser, cursor, end))
+    {
+        return 0;
+    }
+    memset(settings->panels[index].routing_sources, 0, sizeof(settings->panels[index].routing_sources));
+    memcpy(settings->panels[index].routing_sources, sources, count * sizeof(sources[0]));
+    settings->panels[index].button_count = count;
+    return 1;
+}
 
-        // Go through routing panel sources
-        if (strncmp(equalssplit, "routing_sources", strlen("routing_sources")) == 0)
-        {   
-            equalssplit = strtok(NULL, "="); // Get the post equals sign bits - need to split on commas
+static uint8_t read_routing_destination(struct Config_Parser_Struct *parser, const char **cursor, const char *end, uint8_t index, struct Settings_Struct *settings)
+{
+    uint32_t value;
+    if (!config_number(parser, cursor, end, 1, ROUTER_OUTPUTS_MAX, &value) || !config_value_end(parser, cursor, end))
+    {
+        return 0;
+    }
+    settings->panels[index].routing_destination = value;
+    return 1;
+}
 
-            char *commasplit;
-            commasplit = strtok(equalssplit, ","); // Get the first source
+static uint8_t read_routing_router(struct Config_Parser_Struct *parser, const char **cursor, const char *end, uint8_t index, struct Settings_Struct *settings)
+{
+    return config_router(parser, cursor, end, &settings->panels[index].router);
+}
 
-            for (uint8_t button = 0; button<6; button++)
+static uint8_t read_show_relay_router(struct Config_Parser_Struct *parser, const char **cursor, const char *end, uint8_t index, struct Settings_Struct *settings)
+{
+    return config_router(parser, cursor, end, &settings->show_relay_router);
+}
+
+static uint8_t read_show_relay_camera(struct Config_Parser_Struct *parser, const char **cursor, const char *end, uint16_t *source)
+{
+    uint32_t value;
+    if (!config_number(parser, cursor, end, 1, ROUTER_INPUTS_MAX, &value) || !config_value_end(parser, cursor, end))
+    {
+        return 0;
+    }
+    *source = value;
+    return 1;
+}
+
+static uint8_t read_show_relay_main(struct Config_Parser_Struct *parser, const char **cursor, const char *end, uint8_t index, struct Settings_Struct *settings)
+{
+    return read_show_relay_camera(parser, cursor, end, &settings->show_relay_main_source);
+}
+
+static uint8_t read_show_relay_ir(struct Config_Parser_Struct *parser, const char **cursor, const char *end, uint8_t index, struct Settings_Struct *settings)
+{
+    return read_show_relay_camera(parser, cursor, end, &settings->show_relay_ir_source);
+}
+
+static uint8_t read_show_relay_outputs(struct Config_Parser_Struct *parser, const char **cursor, const char *end, uint8_t index, struct Settings_Struct *settings)
+{
+    uint16_t outputs[SHOW_RELAY_OUTPUTS_MAX];
+    uint8_t count;
+    if (!config_list(parser, cursor, end, outputs, SHOW_RELAY_OUTPUTS_MAX, ROUTER_OUTPUTS_MAX, 0, &count) || !config_value_end(parser, cursor, end))
+    {
+        return 0;
+    }
+    memset(settings->show_relay_outputs, 0, sizeof(settings->show_relay_outputs));
+    memcpy(settings->show_relay_outputs, outputs, count * sizeof(outputs[0]));
+    settings->show_relay_output_count = count;
+    return 1;
+}
+
+static uint8_t read_router_ip(struct Config_Parser_Struct *parser, const char **cursor, const char *end, uint8_t index, struct Settings_Struct *settings)
+{
+    uint32_t ip = 0;
+    for (uint8_t octet = 0; octet < 4; octet++)
+    {
+        uint32_t value;
+        if (octet > 0)
+        {
+            if (*cursor == end || **cursor != '.')
             {
-                if (commasplit == NULL)
-                {
-                    // Check that we haven't run out of numbers due to a formatting error in the config file...
-                    ESP_LOGW(TAG, "Formatting error in routing_sources values");
-                    continue;
-                }
-
-                // TODO: Check for valid return from atoi? 
-                settings->routing_sources[button] = (uint8_t) atoi(commasplit);
-                commasplit = strtok(NULL, ",");
+                config_error(parser, *cursor, "expected '.' in IP address");
+                return 0;
             }
-            ESP_LOGI(TAG,"Read in sources");
-            continue;
+            (*cursor)++;
         }
-        
-        // Go through routing destination
-        if (strncmp(equalssplit, "routing_destination", strlen("routing_destination")) == 0)
-        {   
-            equalssplit = strtok(NULL, "="); // Get the post equals sign bits
+        if (!config_number(parser, cursor, end, 0, 255, &value))
+        {
+            return 0;
+        }
+        ip = (ip << 8) | value;
+    }
+    if (!config_value_end(parser, cursor, end))
+    {
+        return 0;
+    }
+    settings->routers[index].ip = ip;
+    return 1;
+}
 
-            if (equalssplit == NULL)
-            {
-                // Check that we haven't run out of number due to a formatting error in the config file...
-                ESP_LOGW(TAG, "Formatting error in routing_destination value");
-                continue;
-            }
+static uint8_t read_router_port(struct Config_Parser_Struct *parser, const char **cursor, const char *end, uint8_t index, struct Settings_Struct *settings)
+{
+    uint32_t value;
+    if (!config_number(parser, cursor, end, 1, 65535, &value) || !config_value_end(parser, cursor, end))
+    {
+        return 0;
+    }
+    settings->routers[index].port = value;
+    return 1;
+}
 
-            // TODO: Check for valid return from atoi? 
-            settings->routing_destination = (uint8_t) atoi(equalssplit);
+static uint8_t read_route_trigger(struct Config_Parser_Struct *parser, const char **cursor, const char *end, uint8_t index, struct Settings_Struct *settings)
+{
+    uint8_t press;
+    if (!config_choice(parser, cursor, end, "press", "release", &press))
+    {
+        return 0;
+    }
+    settings->route_trigger = press ? ROUTE_TRIGGER_PRESS : ROUTE_TRIGGER_RELEASE;
+    return 1;
+}
 
-            ESP_LOGI(TAG,"Read in destination");
+static uint8_t read_ping_missed_max(struct Config_Parser_Struct *parser, const char **cursor, const char *end, uint8_t index, struct Settings_Struct *settings)
+{
+    uint32_t value;
+    if (!config_number(parser, cursor, end, 1, ETH_PING_MISSED_LIMIT, &value) || !config_value_end(parser, cursor, end))
+    {
+        return 0;
+    }
+    settings->ping_missed_max = value;
+    return 1;
+}
+
+static uint8_t read_route_sharing(struct Config_Parser_Struct *parser, const char **cursor, const char *end, uint8_t index, struct Settings_Struct *settings)
+{
+    return config_choice(parser, cursor, end, "on", "off", &settings->route_sharing);
+}
+
+static const struct Config_Key_Struct config_keys[] = {
+    {"routing_sources", PANELS_MAX, read_routing_sources},
+    {"routing_destination", PANELS_MAX, read_routing_destination},
+    {"routing_router", PANELS_MAX, read_routing_router},
+    {"route_trigger", 1, read_route_trigger},
+    {"route_sharing", 1, read_route_sharing},
+    {"show_relay_router", 1, read_show_relay_router},
+    {"show_relay_main", 1, read_show_relay_main},
+    {"show_relay_ir", 1, read_show_relay_ir},
+    {"show_relay_outputs", 1, read_show_relay_outputs},
+    {"router_ip", ROUTERS_MAX, read_router_ip},
+    {"router_port", ROUTERS_MAX, read_router_port},
+    {"ping_missed_max", 1, read_ping_missed_max},
+};
+
+#define CONFIG_KEY_COUNT (sizeof(config_keys) / sizeof(config_keys[0]))
+#define CONFIG_INDEX_MAX ((PANELS_MAX > ROUTERS_MAX) ? PANELS_MAX : ROUTERS_MAX)
+
+// Finds the setting a name is for - returns 0 (with the error reported) if there isn't one
+static uint8_t config_find_key(struct Config_Parser_Struct *parser, const char *name, size_t name_length, uint8_t *key, uint8_t *index)
+{
+    for (uint8_t candidate = 0; candidate < CONFIG_KEY_COUNT; candidate++)
+    {
+        size_t key_length = strlen(config_keys[candidate].name);
+        if (name_length < key_length || strncmp(name, config_keys[candidate].name, key_length) != 0)
+        {
             continue;
         }
+        if (name_length == key_length)
+        {
+            *key = candidate;
+            *index = 0;
+            return 1;
+        }
 
-        // Router properties
-        if (strncmp(equalssplit, "router_ip", strlen("router_ip")) == 0)
-        {   
-            // IP address
-            equalssplit = strtok(NULL, "="); // Get the post equals sign bits - need to split on points
+        // Numbered copy - "_" then digits only, or it's a different setting that starts the same
+        const char *suffix = name + key_length;
+        const char *suffix_end = name + name_length;
+        if (config_keys[candidate].count == 1 || *suffix != '_' || suffix + 1 == suffix_end)
+        {
+            continue;
+        }
+        uint32_t number = 0;
+        const char *digit = suffix + 1;
+        while (digit < suffix_end && *digit >= '0' && *digit <= '9' && number < 1000)
+        {
+            number = number * 10 + (*digit++ - '0');
+        }
+        if (digit != suffix_end)
+        {
+            continue;
+        }
+        if (number < 1 || number > config_keys[candidate].count)
+        {
+            config_error(parser, suffix + 1, "%s only goes from 1 to %u", config_keys[candidate].name, config_keys[candidate].count);
+            return 0;
+        }
+        *key = candidate;
+        *index = number - 1;
+        return 1;
+    }
+    config_error(parser, name, "unknown setting '%.*s'", (int)name_length, name);
+    return 0;
+}
 
-            char *pointsplit;
-            pointsplit = strtok(equalssplit, "."); // Get the octet
+static void parse_config_line(struct Config_Parser_Struct *parser, const char *cursor, const char *end, uint16_t seen_line[CONFIG_KEY_COUNT][CONFIG_INDEX_MAX], struct Settings_Struct *settings)
+{
+    // Comments and blanks
+    skip_spaces(&cursor, end);
+    if (cursor == end || (end - cursor >= 2 && cursor[0] == '/' && cursor[1] == '/'))
+    {
+        return;
+    }
 
-            uint32_t temp_ip = 0;
+    const char *name = cursor;
+    while (cursor < end && is_name_char(*cursor))
+    {
+        cursor++;
+    }
+    if (cursor == name)
+    {
+        config_error(parser, name, "expected a setting name");
+        return;
+    }
+    size_t name_length = cursor - name;
 
-            for (uint8_t octet = 0; octet<4; octet++)
-            {
-                if (pointsplit == NULL)
-                {
-                    // Check that we haven't run out of numbers due to a formatting error in the config file...
-                    ESP_LOGW(TAG, "Formatting error in router IP address");
-                    continue;
-                }
-
-                // TODO: Check for valid return from atoi? 
-                temp_ip = temp_ip + ((uint32_t) atoi(pointsplit) << ((3-octet)*8));
-                pointsplit = strtok(NULL, ".");
-            }
+    uint8_t key;
+    uint8_t index;
+    if (!config_find_key(parser, name, name_length, &key, &index))
+    {
+        return;
+    }
 
-            settings->router_ip = temp_ip;
-            ESP_LOGI(TAG,"Read in IP address");
-            continue;
+    skip_spaces(&cursor, end);
+    if (cursor == end || *cursor != '=')
+    {
+        config_error(parser, cursor, "expected '=' after %.*s", (int)name_length, name);
+        return;
+    }
+    cursor++;
+    skip_spaces(&cursor, end);
+    if (cursor == end)
+    {
+        config_error(parser, cursor, "no value for %.*s", (int)name_length, name);
+        return;
+    }
+
+    if (seen_line[key][index] != 0)
+    {
+        config_error(parser, name, "%.*s is already set on line %u", (int)name_length, name, seen_line[key][index]);
+        return;
+    }
+    if (config_keys[key].read_value(parser, &cursor, end, index, settings))
+    {
+        seen_line[key][index] = parser->line;
+    }
+}
+
+// Reads the config file in one pass - returns how many errors it has
+static uint16_t parse_config(const char *text, size_t length, struct Settings_Struct *settings)
+{
+    struct Config_Parser_Struct parser = {0};
+    uint16_t seen_line[CONFIG_KEY_COUNT][CONFIG_INDEX_MAX]; // Line each setting was read from, 0 if not yet
+    memset(seen_line, 0, sizeof(seen_line));
+
+    const char *line = text;
+    const char *text_end = text + length;
+    while (line < text_end)
+    {
+        const char *line_end = memchr(line, '\n', text_end - line);
+        if (line_end == NULL)
+        {
+            line_end = text_end;
         }
+        parser.line++;
+        parser.line_start = line;
+        parse_config_line(&parser, line, line_end, seen_line, settings);
+        line = line_end + 1;
+    }
 
-        if (strncmp(equalssplit, "router_port", strlen("router_port")) == 0)
-        {   
-            // Router port
-            equalssplit = strtok(NULL, "="); // Get the post equals sign bits
+    // Panels run up to the last one given a destination
+    settings->panel_count = 0;
+    for (uint8_t panel = 0; panel < PANELS_MAX; panel++)
+    {
+        if (settings->panels[panel].routing_destination != 0)
+        {
+            settings->panel_count = panel + 1;
+        }
+    }
 
-            if (equalssplit == NULL)
+    // Routers run up to the last one given an address - there is always the first
+    settings->router_count = 1;
+    for (uint8_t router = 1; router < ROUTERS_MAX; router++)
+    {
+        if (settings->routers[router].ip != 0)
+        {
+            settings->router_count = router + 1;
+            if (settings->routers[router].port == 0)
             {
-                // Check that we haven't run out of number due to a formatting error in the config file...
-                ESP_LOGW(TAG, "Formatting error in router port");
-                continue;
+                settings->routers[router].port = settings->routers[0].port; // Videohubs all listen on the same port
             }
+        }
+    }
+    for (uint8_t panel = 0; panel < settings->panel_count; panel++)
+    {
+        if (settings->panels[panel].router >= settings->router_count)
+        {
+            ESP_LOGW(TAG, "Panel %d is on router %d, which has no router_ip", panel + 1, settings->panels[panel].router + 1);
+        }
+    }
+    if (settings->show_relay_router >= settings->router_count)
+    {
+        ESP_LOGW(TAG, "Show Relay is on router %d, which has no router_ip", settings->show_relay_router + 1);
+    }
 
-            // TODO: Check for valid return from atoi? 
-            settings->router_port = (uint32_t) atoi(equalssplit);
+    return parser.errors;
+}
 
-            ESP_LOGI(TAG,"Read in router port");
-            continue;
-        }        
+// FNV-1a - only has to tell one version of the file from the next
+static uint64_t config_hash(const char *text, size_t length)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)text[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Reads the whole config file off the card into config_text - mounts and unmounts the card
+static esp_err_t read_config_file(size_t *length)
+{
+    if (init_sd_card() != ESP_OK)
+    {
+        file_result = ESP_ERR_INVALID_STATE; // Logged again once the card is back
+        return ESP_FAIL;
     }
 
+    ESP_LOGD(TAG, "Reading file %s", MOUNT_POINT CFG_FILE);
+    FILE *f = fopen(MOUNT_POINT CFG_FILE, "r");
+    if (f == NULL)
+    {
+        if (file_result != ESP_ERR_NOT_FOUND)
+        {
+            ESP_LOGE(TAG, "Failed to open settings file for reading");
+        }
+        file_result = ESP_ERR_NOT_FOUND;
+        deinit_sd_card();
+        return ESP_FAIL;
+    }
+
+    *length = fread(config_text, 1, sizeof(config_text), f);
+    uint8_t too_long = (*length == sizeof(config_text) && fgetc(f) != EOF);
+    uint8_t failed = ferror(f);
     fclose(f);
+    deinit_sd_card();
 
+    esp_err_t ret = failed ? ESP_FAIL : (too_long ? ESP_ERR_INVALID_SIZE : ESP_OK);
+    uint8_t changed = (ret != file_result);
+    file_result = ret;
+    if (failed)
+    {
+        if (changed)
+        {
+            ESP_LOGE(TAG, "Failed to read settings file");
+        }
+        return ESP_FAIL;
+    }
+    if (too_long && changed)
+    {
+        ESP_LOGE(TAG, "Settings file is over %d bytes, only the start is read", CFG_FILE_SIZE_MAX);
+    }
     return ESP_OK;
 }
 
+static uint8_t load_settings_cache(void)
+{
+    nvs_handle_t handle;
+    if (nvs_open(SETTINGS_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+    {
+        return 0;
+    }
+    size_t length = sizeof(settings_cache);
+    esp_err_t ret = nvs_get_blob(handle, SETTINGS_NVS_KEY, &settings_cache, &length);
+    nvs_close(handle);
 
-struct Settings_Struct get_settings(void)
+    if (ret == ESP_ERR_NVS_NOT_FOUND)
+    {
+        return 0;
+    }
+    if (ret != ESP_OK || length != sizeof(settings_cache) || settings_cache.version != SETTINGS_CACHE_VERSION
+        || settings_cache.size != sizeof(settings_cache.settings))
+    {
+        ESP_LOGW(TAG, "Settings cache is from another firmware version, reading the SD card");
+        return 0;
+    }
+    return 1;
+}
+
+static void save_settings_cache(const struct Settings_Struct *settings, uint64_t source_hash)
 {
-    struct Settings_Struct base_settings;
+    memset(&settings_cache, 0, sizeof(settings_cache)); // Padding too, so the blob is the same for the same settings
+    settings_cache.version = SETTINGS_CACHE_VERSION;
+    settings_cache.size = sizeof(settings_cache.settings);
+    settings_cache.source_hash = source_hash;
+    settings_cache.settings = *settings;
+
+    nvs_handle_t handle;
+    esp_err_t ret = nvs_open(SETTINGS_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (ret == ESP_OK)
+    {
+        ret = nvs_set_blob(handle, SETTINGS_NVS_KEY, &settings_cache, sizeof(settings_cache));
+        if (ret == ESP_OK)
+        {
+            ret = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (ret != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to cache settings (%s)", esp_err_to_name(ret));
+        return;
+    }
+    ESP_LOGI(TAG, "Settings cached");
+}
+
+static void default_settings(struct Settings_Struct *settings)
+{
+    memset(settings, 0, sizeof(*settings));
 
-    // First assign some worst case fallback values in case no settings file loads
-    for (uint8_t button = 0; button<6; button++)
+    // Worst case fallback values in case no settings file loads
+    // One panel - further panels are only set up by the config file
+    for (uint8_t button = 0; button<PANEL_BUTTONS_MAX; button++)
     {
-        base_settings.routing_sources[button] = (button + 1);
+        settings->panels[0].routing_sources[button] = (button + 1);
     }
-    base_settings.routing_destination = 5;
+    settings->panels[0].button_count = PANEL_BUTTONS_MAX;
+    settings->panels[0].routing_destination = 5;
+    settings->panel_count = 1;
 
-    base_settings.router_ip = 3232238377; //192.168.11.41
-    base_settings.router_port = 9990;
+    settings->routers[0].ip = 3232238377; //192.168.11.41
+    settings->routers[0].port = 9990;
+    settings->router_count = 1;
 
-    // Get settings from SD card
-    esp_err_t ret = init_sd_card();
-    if (ret != ESP_OK) 
+    settings->route_trigger = ROUTE_TRIGGER_RELEASE;
+    settings->route_sharing = 0;
+    settings->ping_missed_max = ETH_PING_MISSED_MAX;
+}
+
+// 1 if a file changes anything only a restart can put in use
+static uint8_t settings_need_restart(const struct Settings_Struct *in_use, const struct Settings_Struct *settings)
+{
+    if (settings->router_count != in_use->router_count || settings->route_sharing != in_use->route_sharing)
     {
-        ESP_LOGW(TAG, "SD card init fail - no card?");
-        return base_settings;
+        return 1;
     }
+    for (uint8_t router = 0; router < settings->router_count; router++)
+    {
+        if (settings->routers[router].ip != in_use->routers[router].ip || settings->routers[router].port != in_use->routers[router].port)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
 
-    ret = read_config_file(MOUNT_POINT CFG_FILE, &base_settings);
-    if (ret != ESP_OK) 
+// Reads the card, and puts a changed file without errors in use
+static void check_config_file(void)
+{
+    size_t length;
+    if (read_config_file(&length) != ESP_OK)
+    {
+        if (settings_status.check != SETTINGS_CHECK_NO_FILE)
+        {
+            ESP_LOGI(TAG, "No settings file on the card, keeping the settings in use");
+        }
+        settings_status.check = SETTINGS_CHECK_NO_FILE;
+        return;
+    }
+
+    uint64_t hash = config_hash(config_text, length);
+    if (hash == settings_hash || hash == rejected_hash)
+    {
+        // Seen it before - errors in a file are only logged the first time round
+        if (settings_status.check != SETTINGS_CHECK_UNCHANGED && hash == settings_hash)
+        {
+            ESP_LOGI(TAG, "Settings file unchanged");
+        }
+        settings_status.check = (hash == settings_hash) ? SETTINGS_CHECK_UNCHANGED : SETTINGS_CHECK_ERRORS;
+        return;
+    }
+
+    struct Settings_Struct settings;
+    default_settings(&settings);
+    uint16_t errors = parse_config(config_text, length, &settings);
+    settings_status.errors = errors;
+    if (errors != 0)
+    {
+        ESP_LOGE(TAG, "Settings file has changed but has errors (%u), keeping the settings in use", errors);
+        settings_status.check = SETTINGS_CHECK_ERRORS;
+        rejected_hash = hash;
+        return;
+    }
+
+    // The copy that isn't in use can only be written once the main logic has taken the last
+    // change - if it hasn't yet, the file is seen as changed again next time
+    uint8_t taken = atomic_load(&settings_taken);
+    if (atomic_load(&settings_published) != taken)
+    {
+        return;
+    }
+
+    save_settings_cache(&settings, hash);
+    if (settings_need_restart(&settings_copies[taken], &settings))
+    {
+        ESP_LOGW(TAG, "Settings file changes the routers or route sharing, restarting to use it");
+        settings_status.check = SETTINGS_CHECK_RESTART;
+        esp_restart();
+    }
+
+    settings_copies[!taken] = settings;
+    atomic_store(&settings_published, !taken);
+    settings_hash = hash;
+    settings_status.check = SETTINGS_CHECK_CHANGED;
+    settings_status.reloads++;
+    ESP_LOGW(TAG, "Settings file has changed, using it");
+
+    struct Queued_Input_Message_Struct new_message;
+    memset(&new_message, 0, sizeof(new_message));
+    new_message.type = IN_MSG_TYP_SETTINGS;
+    new_message.event_time = esp_timer_get_time();
+    new_message.queued_time = new_message.event_time;
+    queue_send_counted(*input_event_queue_ptr, (void *)&new_message, portMAX_DELAY); // Nothing else can be published until it's taken
+}
+
+static void settings_check_task(void *arg)
+{
+    // Settings from the card are as new as the file - only the cache needs checking straight away
+    if (settings_status.source != SETTINGS_SOURCE_CACHE)
+    {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SETTINGS_CHECK_INTERVAL_MS));
+    }
+    while (1)
+    {
+        check_config_file();
+        settings_status.checks++;
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SETTINGS_CHECK_INTERVAL_MS));
+    }
+}
+
+const struct Settings_Struct *get_settings(void)
+{
+    int64_t start_time = esp_timer_get_time();
+    struct Settings_Struct *settings = &settings_copies[0];
+    default_settings(settings);
+    memset(&settings_status, 0, sizeof(settings_status));
+    atomic_store(&settings_published, 0);
+    atomic_store(&settings_taken, 0);
+    settings_hash = 0;
+    rejected_hash = 0;
+
+    // Settings from the last good file, without waiting for the card - it's checked in the background
+    if (load_settings_cache())
+    {
+        ESP_LOGI(TAG, "Using cached settings");
+        *settings = settings_cache.settings;
+        settings_hash = settings_cache.source_hash;
+        settings_status.source = SETTINGS_SOURCE_CACHE;
+        settings_status.load_us = esp_timer_get_time() - start_time;
+        return settings;
+    }
+
+    // Get settings from SD card
+    size_t length;
+    if (read_config_file(&length) != ESP_OK)
     {
         ESP_LOGE(TAG, "Settings file read failed, returning fallback values");
-        deinit_sd_card();
-        return base_settings;
+        settings_status.source = SETTINGS_SOURCE_DEFAULTS;
+        settings_status.load_us = esp_timer_get_time() - start_time;
+        return settings;
     }
 
-    deinit_sd_card();
-    return base_settings;
-}
\ No newline at end of file
+    // A file with errors still sets what it can, but isn't cached, so it is read (and its
+    // errors logged) at every boot until it's fixed
+    settings_status.source = SETTINGS_SOURCE_CARD;
+    settings_status.errors = parse_config(config_text, length, settings);
+    settings_hash = config_hash(config_text, length);
+    if (settings_status.errors == 0)
+    {
+        save_settings_cache(settings, settings_hash);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Settings file has errors (%u), those lines are ignored", settings_status.errors);
+    }
+    settings_status.load_us = esp_timer_get_time() - start_time;
+    return settings;
+}
+
+void settings_check_start(QueueHandle_t *input_queue)
+{
+    input_event_queue_ptr = input_queue;
+    if (settings_check_handle == NULL)
+    {
+        settings_check_handle = create_static_task((TaskFunction_t)settings_check_task, "settings_check_task", SETTINGS_CHECK_TASK_STACK,
+                                                   settings_check_stack, &settings_check_buffer, NULL, 1);
+    }
+}
+
+void settings_check_now(void)
+{
+    if (settings_check_handle != NULL)
+    {
+        xTaskNotifyGive(settings_check_handle);
+    }
+}
+
+const struct Settings_Struct *settings_take(void)
+{
+    uint8_t newest = atomic_load(&settings_published);
+    atomic_store(&settings_taken, newest);
+    return &settings_copies[newest];
+}
+
+void get_settings_status(struct Settings_Status_Struct *status)
+{
+    *status = settings_status;
+}
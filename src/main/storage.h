@@ -4,17 +4,109 @@
 #ifndef STORAGE_H_INCLUDED
 #define STORAGE_H_INCLUDED
 
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+// Routing panels - each is a row of buttons choosing the source for one router destination
+#define PANELS_MAX 4 // The SM desk has four screens
+#define PANEL_BUTTONS_MAX 6
+
+// Routers - each gets its own connection, and panels choose which one their destination is on
+#define ROUTERS_MAX 2 // Stage feeds and front-of-house on the larger shows - each costs two task stacks and a receive ring, used or not
+
+// Show Relay - outputs around the building switched together between the Main and IR cameras
+#define SHOW_RELAY_OUTPUTS_MAX 16
+#define SOURCE_SHOW_RELAY 0xFFFF // Panel button source that follows the Show Relay camera
+
+struct Panel_Settings_Struct {
+    uint16_t routing_sources[PANEL_BUTTONS_MAX]; // Sources labeled 1-288 for each button, SOURCE_SHOW_RELAY, or 0 for an unused button
+    uint8_t button_count;
+    uint16_t routing_destination; // Destination labeled 1-288, 0 if the panel isn't used
+    uint8_t router; // Zero based router the destination is on
+};
+
+struct Router_Settings_Struct {
+    uint32_t ip;
+    uint32_t port;
+};
+
 struct Settings_Struct {
-    uint8_t routing_sources[6]; // Sources labeled 1-40 for each button
-    uint8_t routing_destination; // Destination labeled 1-40
-    uint32_t router_ip;
-    uint32_t router_port;
+    struct Panel_Settings_Struct panels[PANELS_MAX];
+    uint8_t panel_count; // Panels 0 to panel_count - 1 are set up in the config
+    struct Router_Settings_Struct routers[ROUTERS_MAX];
+    uint8_t router_count; // Routers 0 to router_count - 1 are set up in the config
+    uint8_t route_trigger; // When a button press sends its route - see below
+    uint8_t route_sharing; // 1 to share routes with other boxes - see route_share.h
+    uint8_t show_relay_router; // Zero based router the Show Relay cameras and outputs are on
+    uint16_t show_relay_main_source; // Main camera, labeled 1-288 - 0 if there is no Show Relay
+    uint16_t show_relay_ir_source;   // IR camera, labeled 1-288
+    uint16_t show_relay_outputs[SHOW_RELAY_OUTPUTS_MAX]; // Destinations labeled 1-288
+    uint8_t show_relay_output_count;
+    uint8_t ping_missed_max; // Missed pings in a row before a router is reconnected - see ethernet.h
 };
 
+// Route trigger - send on release (original behaviour) or as soon as a press is debounced
+#define ROUTE_TRIGGER_RELEASE 0
+#define ROUTE_TRIGGER_PRESS 1
+
 #define MOUNT_POINT "/sdcard"
 #define CFG_FILE "/config.txt"
-#define MAX_CHAR_SIZE 256
+#define CFG_FILE_SIZE_MAX 4096 // Read in one go - the example configs are under 2k
+
+// Settings cache - the last config file read without errors, kept in NVS with a hash of the
+// file, so boot doesn't wait for the SD card. The card is checked once the box is up.
+// Bump the version whenever Settings_Struct or the way the file is read changes
+#define SETTINGS_CACHE_VERSION 3
+#define SETTINGS_NVS_NAMESPACE "settings"
+#define SETTINGS_NVS_KEY "cache"
+
+// The slot has no card detect pin, so the card is read again this often to pick up a changed
+// file or a card put back in - or straight away when asked (diagnostics "reload"). Each check
+// sets the SDMMC host up and tears it down again, so it's kept well apart
+#define SETTINGS_CHECK_INTERVAL_MS 30000
+#define SETTINGS_CHECK_TASK_STACK 4096 // Bytes - the file is read into a static buffer, but FATFS and NVS calls need plenty
+
+// Where the settings in use came from
+#define SETTINGS_SOURCE_DEFAULTS 0 // No card, or no config file on it
+#define SETTINGS_SOURCE_CARD 1
+#define SETTINGS_SOURCE_CACHE 2
+
+// What the last card check found
+#define SETTINGS_CHECK_PENDING 0
+#define SETTINGS_CHECK_UNCHANGED 1
+#define SETTINGS_CHECK_NO_FILE 2  // No card, or no config file - the settings in use are kept
+#define SETTINGS_CHECK_ERRORS 3   // The file has changed but has errors - the settings in use are kept
+#define SETTINGS_CHECK_CHANGED 4  // The file has changed - cached and in use, without a restart
+#define SETTINGS_CHECK_RESTART 5  // The file changes the routers or route sharing - cached and restarting to use it
+
+struct Settings_Status_Struct {
+    uint8_t source;
+    uint8_t check;
+    uint16_t errors;  // Errors in the config file last read
+    int64_t load_us;  // How long get_settings took
+    uint32_t checks;  // Card checks done
+    uint32_t reloads; // Changed files put in use without a restart
+};
+
+// Reads the settings and publishes them - from the cache if there is one, otherwise from the card
+// Call nvs_flash_init first, so the cache can be used
+const struct Settings_Struct *get_settings(void);
+
+// Starts a low priority task checking the card - straight away if the settings came from the
+// cache, then every SETTINGS_CHECK_INTERVAL_MS. A changed file without errors is cached and
+// published, and an IN_MSG_TYP_SETTINGS message tells the main logic to take it. Changes to the
+// routers or route sharing restart the box instead, as the connections are set up from them
+void settings_check_start(QueueHandle_t *input_queue);
+
+// Checks the card now rather than at the next interval
+void settings_check_now(void);
+
+// Main logic only - the newest settings published. There are two copies: the one taken last is
+// never written while it is in use, so it can be read without a lock, and the next change is
+// only published once the main logic has taken the one before
+const struct Settings_Struct *settings_take(void);
 
-struct Settings_Struct get_settings(void);
+void get_settings_status(struct Settings_Status_Struct *status);
 
-#endif  
\ No newline at end of file
+#endif
@@ -0,0 +1,121 @@
+// Trace ring
+//-----------------------------------
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+
+#include "trace.h"
+
+// Only used when the ring is read back - each format takes arg0, arg1 and arg2 in that order
+// and needn't use them all
+static const char *const event_formats[TRACE_EVT_COUNT] = {
+    [TRACE_EVT_BUTTON] = "button %"PRIu32" on panel %"PRIu32" to main logic, message type %"PRIu32,
+    [TRACE_EVT_LOGIC_MESSAGE] = "logic message type %"PRIu32", output %"PRIu32", input %"PRIu32,
+    [TRACE_EVT_ROUTE_LOCAL] = "route input %"PRIu32" to output %"PRIu32" already set, not sent",
+    [TRACE_EVT_ROUTE_QUEUED] = "route input %"PRIu32" to output %"PRIu32" queued, %"PRIu32" in queue",
+    [TRACE_EVT_DUMP_QUEUED] = "route dump request queued, %"PRIu32" in queue",
+    [TRACE_EVT_COALESCED] = "coalesced %"PRIu32" superseded routes, %"PRIu32" total",
+    [TRACE_EVT_SENT] = "sent %"PRIu32" bytes, %"PRIu32" routes, dump request %"PRIu32,
+    [TRACE_EVT_RECEIVED] = "received %"PRIu32" bytes from router %"PRIu32,
+    [TRACE_EVT_CONFIRM] = "route confirm output %"PRIu32" input %"PRIu32" on router %"PRIu32,
+    [TRACE_EVT_ACK] = "command %"PRIu32" ACK after %"PRIu32" us, dump request %"PRIu32,
+    [TRACE_EVT_SALVO_QUEUED] = "salvo of input %"PRIu32" to %"PRIu32" outputs queued, %"PRIu32" in queue",
+    [TRACE_EVT_SHOW_RELAY] = "Show Relay on IR camera %"PRIu32", contactor %"PRIu32", from confirm %"PRIu32,
+    [TRACE_EVT_SHARE_SENT] = "route sharing type %"PRIu32" with %"PRIu32" routes sent for router %"PRIu32,
+    [TRACE_EVT_SHARE_RECEIVED] = "route sharing type %"PRIu32" with %"PRIu32" routes received for router %"PRIu32,
+};
+
+static portMUX_TYPE trace_mux = portMUX_INITIALIZER_UNLOCKED; // protects:
+static struct Trace_Record_Struct trace_ring[TRACE_RING_LENGTH];
+static uint32_t trace_head = 0; // Next record to write, counts up forever
+
+void trace_record(uint16_t event, uint16_t arg0, uint32_t arg1, uint32_t arg2)
+{
+    struct Trace_Record_Struct record = {
+        .time_us = (uint32_t)esp_timer_get_time(),
+        .event = event,
+        .arg0 = arg0,
+        .arg1 = arg1,
+        .arg2 = arg2
+    };
+
+    taskENTER_CRITICAL(&trace_mux);
+    trace_ring[trace_head & (TRACE_RING_LENGTH - 1)] = record;
+    trace_head++;
+    taskEXIT_CRITICAL(&trace_mux);
+}
+
+uint32_t trace_position(void)
+{
+    taskENTER_CRITICAL(&trace_mux);
+    uint32_t position = trace_head;
+    taskEXIT_CRITICAL(&trace_mux);
+    return position;
+}
+
+size_t trace_format(uint32_t *cursor, char *buffer, size_t size)
+{
+    size_t length = 0;
+    char line[128];
+
+    while (1)
+    {
+        struct Trace_Record_Struct record;
+        uint32_t lost = 0;
+
+        taskENTER_CRITICAL(&trace_mux);
+        if (*cursor == trace_head)
+        {
+            taskEXIT_CRITICAL(&trace_mux);
+            break;
+        }
+        if (trace_head - *cursor > TRACE_RING_LENGTH)
+        {
+            // Overwritten while we weren't looking - skip to the oldest still held
+            lost = trace_head - TRACE_RING_LENGTH - *cursor;
+            *cursor = trace_head - TRACE_RING_LENGTH;
+        }
+        record = trace_ring[*cursor & (TRACE_RING_LENGTH - 1)];
+        taskEXIT_CRITICAL(&trace_mux);
+
+        int line_length = 0;
+        if (lost > 0)
+        {
+            line_length = snprintf(line, sizeof(line), "... %"PRIu32" older events overwritten\n", lost);
+        }
+        line_length += snprintf(line + line_length, sizeof(line) - line_length, "%10"PRIu32" ", record.time_us);
+        if (record.event < TRACE_EVT_COUNT)
+        {
+            line_length += snprintf(line + line_length, sizeof(line) - line_length, event_formats[record.event],
+                                    (uint32_t)record.arg0, record.arg1, record.arg2);
+        }
+        else
+        {
+            line_length += snprintf(line + line_length, sizeof(line) - line_length, "event %u: %u %"PRIu32" %"PRIu32,
+                                    record.event, record.arg0, record.arg1, record.arg2);
+        }
+        line_length += snprintf(line + line_length, sizeof(line) - line_length, "\n");
+        if (line_length >= (int)sizeof(line))
+        {
+            line_length = sizeof(line) - 1;
+        }
+
+        if (length + line_length >= size)
+        {
+            *cursor -= lost; // Doesn't fit - it (and any overwritten note) is the first line next time
+            break;
+        }
+        memcpy(buffer + length, line, line_length);
+        length += line_length;
+        (*cursor)++;
+    }
+
+    if (length < size)
+    {
+        buffer[length] = '\0';
+    }
+    return length;
+}
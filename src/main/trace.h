@@ -0,0 +1,53 @@
+// Trace ring
+//-----------------------------------
+// Fixed size binary records of what the firmware is doing, for the hot paths that used to log
+// every packet and queue message as text. Recording an event is a timestamp and a copy into
+// the ring - no formatting and nothing written to the console - so it costs next to nothing and
+// can stay on in production. The records are only turned into text when asked for (see
+// diagnostics.h), in the lowest priority task on the box.
+// The ring keeps the last TRACE_RING_LENGTH events, older ones are overwritten.
+
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Must be a power of two
+#define TRACE_RING_LENGTH 512
+
+// Events - arguments in brackets, see the format table in trace.c
+#define TRACE_EVT_BUTTON 0         // Debounced button being sent to the main logic (button, panel, message type)
+#define TRACE_EVT_LOGIC_MESSAGE 1  // Main logic picked up a message (type, output, input)
+#define TRACE_EVT_ROUTE_LOCAL 2    // Route already on the router, answered without sending (input, output)
+#define TRACE_EVT_ROUTE_QUEUED 3   // Route put in the output queue (input, output, queue depth)
+#define TRACE_EVT_DUMP_QUEUED 4    // Route dump request put in the output queue (queue depth)
+#define TRACE_EVT_COALESCED 5      // Superseded routes dropped from a send (this send, total)
+#define TRACE_EVT_SENT 6           // Block(s) written to the router (bytes, routes, dump request)
+#define TRACE_EVT_RECEIVED 7       // Data received from a router (bytes, router)
+#define TRACE_EVT_CONFIRM 8        // Routing confirm parsed and passed on (output, input, router)
+#define TRACE_EVT_ACK 9            // Router ACKed a block (sequence, round trip us, dump request)
+#define TRACE_EVT_SALVO_QUEUED 10  // Salvo put in the output queue (input, outputs, queue depth)
+#define TRACE_EVT_SHOW_RELAY 11    // Show Relay camera changed (IR, contactor, 1 if taken from a confirm rather than our salvo)
+#define TRACE_EVT_SHARE_SENT 12    // Route sharing datagram sent to other boxes (type, routes, router)
+#define TRACE_EVT_SHARE_RECEIVED 13 // Route sharing datagram taken from another box (type, routes, router)
+#define TRACE_EVT_COUNT 14
+
+struct Trace_Record_Struct {
+    uint32_t time_us; // Low 32 bits of esp_timer time - wraps after 71 minutes
+    uint16_t event;
+    uint16_t arg0;
+    uint32_t arg1;
+    uint32_t arg2;
+};
+
+void trace_record(uint16_t event, uint16_t arg0, uint32_t arg1, uint32_t arg2);
+
+// Index of the next record to be written - the oldest still held is TRACE_RING_LENGTH before it
+uint32_t trace_position(void);
+
+// Turns records from *cursor onwards into text lines, as many as fit, and moves *cursor on
+// Returns the length written, 0 once *cursor has caught up with trace_position()
+size_t trace_format(uint32_t *cursor, char *buffer, size_t size);
+
+#endif
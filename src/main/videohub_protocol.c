@@ -0,0 +1,401 @@
+// Videohub Ethernet protocol parser
+//-----------------------------------
+// Protocol reference: Blackmagic Videohub Developer Information, "Videohub Ethernet Protocol".
+// Status is sent as blocks - a header line, body lines, then a blank line. Indices are zero based.
+
+#include <string.h>
+
+#include "videohub_protocol.h"
+
+// Position within the current line
+#define VH_LINE_START          0  // Nothing read yet on this line
+#define VH_LINE_HEADER         1  // Matching a block header
+#define VH_LINE_NUMBER         2  // First number of a labels/locks/routing line
+#define VH_LINE_NUMBER_2       3  // Second number of a routing line
+#define VH_LINE_NUMBER_2_END   4  // Trailing spaces after the second number
+#define VH_LINE_LOCK           5  // Lock state character
+#define VH_LINE_LABEL          6  // Label text up to end of line
+#define VH_LINE_KEY            7  // Key of a key/value field up to the colon
+#define VH_LINE_VALUE_START    8  // Just after the colon of a key/value field
+#define VH_LINE_VALUE          9  // Value of a key/value field up to end of line
+#define VH_LINE_SKIP           10 // Ignoring the rest of the line
+
+// Block headers, indexed by block type - 1
+static const char *const block_headers[] = {
+    "PROTOCOL PREAMBLE:",
+    "VIDEOHUB DEVICE:",
+    "INPUT LABELS:",
+    "OUTPUT LABELS:",
+    "VIDEO OUTPUT LOCKS:",
+    "VIDEO OUTPUT ROUTING:",
+    "ACK",
+    "NAK",
+    "END PRELUDE:",
+};
+
+#define VH_HEADER_COUNT (sizeof(block_headers) / sizeof(block_headers[0]))
+#define VH_HEADER_ALL ((uint16_t)((1U << VH_HEADER_COUNT) - 1))
+
+static void emit(struct Videohub_Parser_Struct *parser, uint8_t type, uint16_t index, uint32_t value)
+{
+    struct Videohub_Event_Struct event;
+    event.type = type;
+    event.block = parser->block;
+    event.index = index;
+    event.value = value;
+    event.key = parser->key;
+    event.key_length = parser->key_length;
+    event.text = parser->text;
+    event.text_length = parser->text_length;
+    parser->callback(&event, parser->context);
+}
+
+static void malformed(struct Videohub_Parser_Struct *parser)
+{
+    parser->malformed_lines++;
+    parser->line_state = VH_LINE_SKIP;
+}
+
+static void start_line(struct Videohub_Parser_Struct *parser)
+{
+    parser->line_state = VH_LINE_START;
+    parser->number = 0;
+    parser->number_2 = 0;
+    parser->digits = 0;
+    parser->lock_state = 0;
+    parser->key_length = 0;
+    parser->text_length = 0;
+}
+
+static void append_text(struct Videohub_Parser_Struct *parser, const uint8_t *data, size_t length)
+{
+    size_t space = VIDEOHUB_TEXT_MAX - parser->text_length;
+    size_t copy = (length < space) ? length : space;
+    memcpy(parser->text + parser->text_length, data, copy);
+    parser->text_length += copy;
+}
+
+// Adds a digit to a number in progress - returns 0 if it ran past the largest index
+static uint8_t add_digit(struct Videohub_Parser_Struct *parser, uint32_t *number, uint8_t c)
+{
+    *number = (*number * 10) + (c - '0');
+    parser->digits++;
+    return *number <= VIDEOHUB_INDEX_MAX;
+}
+
+// Text runs are gathered up to the newline, so a CRLF line ending leaves a CR behind
+static void trim_carriage_return(struct Videohub_Parser_Struct *parser)
+{
+    if (parser->text_length > 0 && parser->text[parser->text_length - 1] == '\r')
+    {
+        parser->text_length--;
+    }
+}
+
+static uint32_t text_as_number(const struct Videohub_Parser_Struct *parser)
+{
+    uint32_t number = 0;
+    for (uint8_t i = 0; i < parser->text_length; i++)
+    {
+        if (parser->text[i] < '0' || parser->text[i] > '9' || i >= 9)
+        {
+            return 0;
+        }
+        number = (number * 10) + (parser->text[i] - '0');
+    }
+    return number;
+}
+
+// Works out which block a completed header line opened
+static void end_header(struct Videohub_Parser_Struct *parser)
+{
+    parser->block = VH_BLOCK_UNKNOWN;
+    for (uint8_t i = 0; i < VH_HEADER_COUNT; i++)
+    {
+        if ((parser->header_match & (1U << i)) && block_headers[i][parser->header_length] == '\0')
+        {
+            parser->block = i + 1;
+            break;
+        }
+    }
+
+    switch (parser->block)
+    {
+    case VH_BLOCK_ACK:
+        emit(parser, VH_EVT_ACK, 0, 0);
+        break;
+    case VH_BLOCK_NAK:
+        emit(parser, VH_EVT_NAK, 0, 0);
+        break;
+    case VH_BLOCK_END_PRELUDE:
+        emit(parser, VH_EVT_END_PRELUDE, 0, 0);
+        break;
+    default:
+        break;
+    }
+}
+
+// Handles the end of a line according to where in the line the parser got to
+static void end_line(struct Videohub_Parser_Struct *parser)
+{
+    switch (parser->line_state)
+    {
+    case VH_LINE_START:
+        // Blank line - ends the block (extra blank lines between blocks are ignored)
+        if (parser->block != VH_BLOCK_NONE)
+        {
+            emit(parser, VH_EVT_BLOCK_END, 0, 0);
+            parser->block = VH_BLOCK_NONE;
+        }
+        break;
+    case VH_LINE_HEADER:
+        end_header(parser);
+        break;
+    case VH_LINE_NUMBER:
+        // Only a label line may end after its number - the label is empty
+        if (parser->digits > 0 && (parser->block == VH_BLOCK_INPUT_LABELS || parser->block == VH_BLOCK_OUTPUT_LABELS))
+        {
+            emit(parser, (parser->block == VH_BLOCK_INPUT_LABELS) ? VH_EVT_INPUT_LABEL : VH_EVT_OUTPUT_LABEL, parser->number, 0);
+        }
+        else
+        {
+            parser->malformed_lines++;
+        }
+        break;
+    case VH_LINE_NUMBER_2:
+    case VH_LINE_NUMBER_2_END:
+        if (parser->digits > 0)
+        {
+            emit(parser, VH_EVT_ROUTE, parser->number, parser->number_2);
+        }
+        else
+        {
+            parser->malformed_lines++;
+        }
+        break;
+    case VH_LINE_LOCK:
+        if (parser->lock_state != 0)
+        {
+            emit(parser, VH_EVT_OUTPUT_LOCK, parser->number, parser->lock_state);
+        }
+        else
+        {
+            parser->malformed_lines++;
+        }
+        break;
+    case VH_LINE_LABEL:
+        trim_carriage_return(parser);
+        emit(parser, (parser->block == VH_BLOCK_INPUT_LABELS) ? VH_EVT_INPUT_LABEL : VH_EVT_OUTPUT_LABEL, parser->number, 0);
+        break;
+    case VH_LINE_KEY:
+        parser->malformed_lines++; // No colon
+        break;
+    case VH_LINE_VALUE_START:
+    case VH_LINE_VALUE:
+        trim_carriage_return(parser);
+        emit(parser, (parser->block == VH_BLOCK_PREAMBLE) ? VH_EVT_PREAMBLE_FIELD : VH_EVT_DEVICE_FIELD, 0, text_as_number(parser));
+        break;
+    case VH_LINE_SKIP:
+    default:
+        break;
+    }
+
+    start_line(parser);
+}
+
+// First character of a non-blank line - decides how the line is read
+static void begin_line(struct Videohub_Parser_Struct *parser)
+{
+    switch (parser->block)
+    {
+    case VH_BLOCK_NONE:
+        parser->line_state = VH_LINE_HEADER;
+        parser->header_match = VH_HEADER_ALL;
+        parser->header_length = 0;
+        break;
+    case VH_BLOCK_PREAMBLE:
+    case VH_BLOCK_DEVICE:
+        parser->line_state = VH_LINE_KEY;
+        break;
+    case VH_BLOCK_INPUT_LABELS:
+    case VH_BLOCK_OUTPUT_LABELS:
+    case VH_BLOCK_OUTPUT_LOCKS:
+    case VH_BLOCK_OUTPUT_ROUTING:
+        parser->line_state = VH_LINE_NUMBER;
+        break;
+    default:
+        // Blocks we don't read, and stray lines after ACK/NAK
+        parser->line_state = VH_LINE_SKIP;
+        break;
+    }
+}
+
+void videohub_parser_init(struct Videohub_Parser_Struct *parser, videohub_event_callback_t callback, void *context)
+{
+    parser->callback = callback;
+    parser->context = context;
+    parser->malformed_lines = 0;
+    videohub_parser_reset(parser);
+}
+
+void videohub_parser_reset(struct Videohub_Parser_Struct *parser)
+{
+    // Back to the start of a connection - expecting a block header
+    parser->block = VH_BLOCK_NONE;
+    parser->header_match = 0;
+    parser->header_length = 0;
+    start_line(parser);
+}
+
+void videohub_parser_feed(struct Videohub_Parser_Struct *parser, const uint8_t *data, size_t length)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = data + length;
+
+    while (p < end)
+    {
+        // Text runs and skipped lines are handled a run at a time rather than per character
+        if (parser->line_state == VH_LINE_LABEL || parser->line_state == VH_LINE_VALUE || parser->line_state == VH_LINE_SKIP)
+        {
+            const uint8_t *newline = memchr(p, '\n', end - p);
+            const uint8_t *run_end = (newline != NULL) ? newline : end;
+            if (parser->line_state != VH_LINE_SKIP)
+            {
+                append_text(parser, p, run_end - p);
+            }
+            p = run_end;
+            if (newline == NULL)
+            {
+                break;
+            }
+        }
+
+        uint8_t c = *p++;
+
+        if (c == '\n')
+        {
+            end_line(parser);
+            continue;
+        }
+        if (c == '\r')
+        {
+            continue;
+        }
+
+        if (parser->line_state == VH_LINE_START)
+        {
+            begin_line(parser);
+        }
+
+        switch (parser->line_state)
+        {
+        case VH_LINE_HEADER:
+            // Drop every header that doesn't have this character next
+            for (uint8_t i = 0; i < VH_HEADER_COUNT; i++)
+            {
+                if ((parser->header_match & (1U << i)) && block_headers[i][parser->header_length] != (char)c)
+                {
+                    parser->header_match &= ~(1U << i);
+                }
+            }
+            parser->header_length++;
+            if (parser->header_match == 0)
+            {
+                // Not a block we read - skip it all until the blank line
+                parser->block = VH_BLOCK_UNKNOWN;
+                parser->line_state = VH_LINE_SKIP;
+            }
+            break;
+
+        case VH_LINE_NUMBER:
+            if (c >= '0' && c <= '9')
+            {
+                if (!add_digit(parser, &parser->number, c))
+                {
+                    malformed(parser);
+                }
+            }
+            else if (c == ' ' && parser->digits > 0)
+            {
+                parser->digits = 0;
+                if (parser->block == VH_BLOCK_OUTPUT_ROUTING)
+                {
+                    parser->line_state = VH_LINE_NUMBER_2;
+                }
+                else if (parser->block == VH_BLOCK_OUTPUT_LOCKS)
+                {
+                    parser->lock_state = 0;
+                    parser->line_state = VH_LINE_LOCK;
+                }
+                else
+                {
+                    parser->line_state = VH_LINE_LABEL;
+                }
+            }
+            else
+            {
+                malformed(parser);
+            }
+            break;
+
+        case VH_LINE_NUMBER_2:
+            if (c >= '0' && c <= '9')
+            {
+                if (!add_digit(parser, &parser->number_2, c))
+                {
+                    malformed(parser);
+                }
+            }
+            else if (c == ' ' && parser->digits > 0)
+            {
+                parser->line_state = VH_LINE_NUMBER_2_END;
+            }
+            else
+            {
+                malformed(parser);
+            }
+            break;
+
+        case VH_LINE_NUMBER_2_END:
+            if (c != ' ')
+            {
+                malformed(parser);
+            }
+            break;
+
+        case VH_LINE_LOCK:
+            if (parser->lock_state == 0 && c != ' ')
+            {
+                parser->lock_state = c;
+            }
+            else if (c != ' ')
+            {
+                malformed(parser);
+            }
+            break;
+
+        case VH_LINE_KEY:
+            if (c == ':')
+            {
+                parser->line_state = VH_LINE_VALUE_START;
+            }
+            else if (parser->key_length < VIDEOHUB_TEXT_MAX)
+            {
+                parser->key[parser->key_length++] = c;
+            }
+            break;
+
+        case VH_LINE_VALUE_START:
+            // Value text starts after the space that follows the colon
+            parser->line_state = VH_LINE_VALUE;
+            if (c != ' ')
+            {
+                append_text(parser, &c, 1);
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+}
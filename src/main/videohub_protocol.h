@@ -0,0 +1,84 @@
+// Videohub Ethernet protocol parser
+//-----------------------------------
+// Incremental parser for the Blackmagic Videohub text protocol. It is fed bytes as they arrive
+// (split anywhere, even mid-number) and calls back with one typed event per protocol line.
+// No allocation and no line buffering: numbers are accumulated as they are read, and only the
+// text of labels and key/value fields is gathered, into a fixed buffer inside the parser.
+
+#ifndef VIDEOHUB_PROTOCOL_H_INCLUDED
+#define VIDEOHUB_PROTOCOL_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Longest label or key/value text kept - longer text is truncated (the event is still sent)
+#define VIDEOHUB_TEXT_MAX 64
+
+// Largest input/output index accepted - protocol indices are zero based
+#define VIDEOHUB_INDEX_MAX 1023
+
+// Block types (the header line of each block)
+#define VH_BLOCK_NONE 0
+#define VH_BLOCK_PREAMBLE 1      // PROTOCOL PREAMBLE:
+#define VH_BLOCK_DEVICE 2        // VIDEOHUB DEVICE:
+#define VH_BLOCK_INPUT_LABELS 3  // INPUT LABELS:
+#define VH_BLOCK_OUTPUT_LABELS 4 // OUTPUT LABELS:
+#define VH_BLOCK_OUTPUT_LOCKS 5  // VIDEO OUTPUT LOCKS:
+#define VH_BLOCK_OUTPUT_ROUTING 6 // VIDEO OUTPUT ROUTING:
+#define VH_BLOCK_ACK 7           // ACK
+#define VH_BLOCK_NAK 8           // NAK
+#define VH_BLOCK_END_PRELUDE 9   // END PRELUDE: - initial status dump is complete
+#define VH_BLOCK_UNKNOWN 10      // Anything else (serial ports, monitoring outputs etc) - skipped
+
+// Event types
+#define VH_EVT_PREAMBLE_FIELD 0 // key/value text, e.g. "Version" / "2.8"
+#define VH_EVT_DEVICE_FIELD 1   // key/value text, value also as a number when it is one
+#define VH_EVT_INPUT_LABEL 2    // index, text
+#define VH_EVT_OUTPUT_LABEL 3   // index, text
+#define VH_EVT_OUTPUT_LOCK 4    // index = output, value = lock state character (O, U, L)
+#define VH_EVT_ROUTE 5          // index = output, value = input
+#define VH_EVT_ACK 6
+#define VH_EVT_NAK 7
+#define VH_EVT_END_PRELUDE 8
+#define VH_EVT_BLOCK_END 9      // block = the block that just ended
+
+struct Videohub_Event_Struct {
+    uint8_t type;  // See VH_EVT_ defines
+    uint8_t block; // See VH_BLOCK_ defines
+    uint16_t index;
+    uint32_t value;
+    // Key of key/value fields - only valid for the duration of the callback, not terminated
+    const char *key;
+    uint8_t key_length;
+    // Label text, or value text of key/value fields - as above
+    const char *text;
+    uint8_t text_length;
+};
+
+typedef void (*videohub_event_callback_t)(const struct Videohub_Event_Struct *event, void *context);
+
+struct Videohub_Parser_Struct {
+    videohub_event_callback_t callback;
+    void *context;
+
+    uint8_t block;         // Block currently being read
+    uint8_t line_state;    // Position within the current line
+    uint16_t header_match; // Bitmask of block headers still matching the current header line
+    uint8_t header_length; // Header characters matched so far
+    uint32_t number;       // First number on the line
+    uint32_t number_2;     // Second number on the line
+    uint8_t digits;        // Digits read into the number in progress
+    uint8_t lock_state;    // Lock character read on an output locks line
+    uint8_t key_length;    // Key text gathered so far (fields)
+    uint8_t text_length;   // Label or value text gathered so far
+    char key[VIDEOHUB_TEXT_MAX];
+    char text[VIDEOHUB_TEXT_MAX];
+
+    uint32_t malformed_lines; // Body lines that didn't fit their block's format
+};
+
+void videohub_parser_init(struct Videohub_Parser_Struct *parser, videohub_event_callback_t callback, void *context);
+void videohub_parser_reset(struct Videohub_Parser_Struct *parser);
+void videohub_parser_feed(struct Videohub_Parser_Struct *parser, const uint8_t *data, size_t length);
+
+#endif